@@ -35,6 +35,9 @@
 #ifdef HAVE_SYS_SELECT_H
 #include <sys/select.h>
 #endif
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 
 #include <signal.h>
 
@@ -57,8 +60,15 @@
 #include "md5.h"
 #include "pool_stream.h"
 #include "pool_passwd.h"
+#include "pool_admission.h"
 
 static POOL_CONNECTION *do_accept(int unix_fd, int inet_fd, struct timeval *timeout);
+static int receive_admitted_connection(int fd, SockAddr *saddr, int *inet);
+static void init_accept_wait(int unix_fd, int inet_fd);
+static int wait_for_connection(int unix_fd, int inet_fd, struct timeval *timeoutval, int *fd);
+static int watch_listen_fds(bool watch);
+static bool can_accept_session(void);
+static void park_session(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
 static StartupPacket *read_startup_packet(POOL_CONNECTION *cp);
 static POOL_CONNECTION_POOL *connect_backend(StartupPacket *sp, POOL_CONNECTION *frontend);
 static RETSIGTYPE die(int sig);
@@ -88,6 +98,49 @@ static int accepted = 0;
 static int child_inet_fd = 0;
 static int child_unix_fd = 0;
 
+/*
+ * epoll instance used to wait for connection requests when
+ * accept_method is "epoll" or max_sessions_per_child > 1. -1 means
+ * select() is used.
+ */
+static int child_epoll_fd = -1;
+static bool listen_fds_watched = false;	/* true if listen fds are in child_epoll_fd */
+
+/*
+ * Connection to the admission queue process (admission_queue_length >
+ * 0). Used in place of the listen sockets. -1 if not used.
+ */
+static int admission_fd = -1;
+static bool admission_ready_sent = false;	/* waiting for a client from admission queue */
+
+/*
+ * A frontend session parked while the client is idle, so that the
+ * child can serve other sessions (max_sessions_per_child > 1).
+ */
+typedef struct {
+	POOL_CONNECTION *frontend;
+	POOL_SESSION_CONTEXT *session_context;	/* detached session context */
+	int pool_index;		/* connection pool entry held by the session. -1 if
+						 * the backend connections are released and the
+						 * connection pool is detached into backend and info */
+	POOL_CONNECTION_POOL backend;
+	ConnectionInfo *info;
+	time_t parked_time;		/* used for client_idle_limit */
+	char remote_host[NI_MAXHOST];
+	char remote_port[NI_MAXSERV];
+} POOL_PARKED_SESSION;
+
+static int max_sessions = 1;	/* max_sessions_per_child actually in effect */
+static POOL_PARKED_SESSION **parked_sessions;
+static int num_parked_sessions = 0;
+static int num_parked_pools = 0;	/* number of connection pool entries held by parked sessions */
+static POOL_PARKED_SESSION *ready_session;	/* parked session which the client sent data to */
+static bool session_resumed = false;	/* true until the resumed session reads data */
+static int connections_count = 0;	/* used if child_max_connections > 0 */
+
+static POOL_PARKED_SESSION *get_ready_session(bool *idle_limit_reached);
+static POOL_CONNECTION *resume_session(POOL_PARKED_SESSION *session, POOL_CONNECTION_POOL **backend);
+
 extern int myargc;
 extern char **myargv;
 
@@ -109,7 +162,6 @@ void do_child(int unix_fd, int inet_fd)
 	struct timezone tz;
 	struct timeval timeout;
 	static int connected;		/* non 0 if has been accepted connections from frontend */
-	int connections_count = 0;	/* used if child_max_connections > 0 */
 	int found;
 	char psbuf[NI_MAXHOST + 128];
 
@@ -143,6 +195,26 @@ void do_child(int unix_fd, int inet_fd)
 	}
 	child_unix_fd = unix_fd;
 
+	/*
+	 * Connection requests are accepted by the admission queue process
+	 * and passed to us.  Wait for them instead of the listen sockets.
+	 */
+	if (pool_config->admission_queue_length > 0)
+	{
+		admission_fd = pool_admission_connect();
+		if (admission_fd < 0)
+			child_exit(1);
+
+		if (inet_fd)
+			close(inet_fd);
+		close(unix_fd);
+		unix_fd = child_unix_fd = admission_fd;
+		inet_fd = child_inet_fd = 0;
+	}
+
+	/* set up the wait mechanism for incoming connections */
+	init_accept_wait(unix_fd, inet_fd);
+
 	/* Initialize my backend status */
 	pool_initialize_private_backend_status();
 
@@ -181,17 +253,25 @@ void do_child(int unix_fd, int inet_fd)
 	for (;;)
 	{
 		StartupPacket *sp;
+		POOL_STATUS status;
+		POOL_PARKED_SESSION *session;
+		bool idle_limit_reached = false;
 
-		idle = 1;
+		/* we are not idle while any session is parked */
+		idle = (num_parked_sessions == 0);
+		pool_get_my_process_info()->idle = idle;
+		session_resumed = false;
 
 		/* pgpool stop request already sent? */
 		check_stop_request();
 
 		/* Check if restart request is set because of failback event
 		 * happend.  If so, exit myself with exit code 1 to be
-		 * restarted by pgpool parent.
+		 * restarted by pgpool parent.  If any session is parked,
+		 * wait for them to finish (we do not accept new sessions
+		 * meanwhile).
 		 */
-		if (pool_get_my_process_info()->need_to_restart)
+		if (pool_get_my_process_info()->need_to_restart && num_parked_sessions == 0)
 		{
 			pool_log("do_child: failback event found. restart myself.");
 			pool_get_my_process_info()->need_to_restart = 0;
@@ -205,8 +285,19 @@ void do_child(int unix_fd, int inet_fd)
 
 		if (frontend == NULL)	/* connection request from frontend timed out */
 		{
+			/* resume a parked session if the client sent a message */
+			session = get_ready_session(&idle_limit_reached);
+			if (session)
+			{
+				idle = 0;
+				pool_get_my_process_info()->idle = 0;
+				accepted = 1;
+				frontend = resume_session(session, &backend);
+				goto process_query;
+			}
+
 			/* check select() timeout */
-			if (connected && pool_config->child_life_time > 0 &&
+			if (connected && num_parked_sessions == 0 && pool_config->child_life_time > 0 &&
 				timeout.tv_sec == 0 && timeout.tv_usec == 0)
 			{
 				pool_debug("child life %d seconds expired", pool_config->child_life_time);
@@ -224,6 +315,7 @@ void do_child(int unix_fd, int inet_fd)
 
 		/* reset busy flag */
 		idle = 0;
+		pool_get_my_process_info()->idle = 0;
 
 		/* check backend timer is expired */
 		if (backend_timer_expired)
@@ -341,6 +433,10 @@ void do_child(int unix_fd, int inet_fd)
 			}
 		}
 
+		/* look for an idle connection held by the pool manager */
+		if (backend == NULL && pool_config->shared_connection_pool)
+			backend = pool_get_shared_cp(sp);
+
 		if (backend == NULL)
 		{
 			/* create a new connection to backend */
@@ -374,12 +470,22 @@ void do_child(int unix_fd, int inet_fd)
 		/* Mark this connection pool is connected from frontend */
 		pool_coninfo_set_frontend_connected(pool_get_process_context()->proc_id, pool_pool_index());
 
+	process_query:
 		/* query process loop */
 		for (;;)
 		{
-			POOL_STATUS status;
-
-			status = pool_process_query(frontend, backend, 0);
+			if (idle_limit_reached)
+			{
+				pool_log("do_child: parked session forced to terminate due to client_idle_limit (%d) reached",
+						 pool_config->client_idle_limit);
+				pool_send_error_message(frontend, MAJOR(backend),
+										"57000", "connection terminated due to client idle limit reached",
+										"","",  __FILE__, __LINE__);
+				idle_limit_reached = false;
+				status = POOL_END_WITH_FRONTEND_ERROR;
+			}
+			else
+				status = pool_process_query(frontend, backend, 0);
 
 			sp = MASTER_CONNECTION(backend)->sp;
 
@@ -392,10 +498,12 @@ void do_child(int unix_fd, int inet_fd)
 					 * do not cache connection if:
 					 * frontend abnormally exits or
 					 * pool_config->connection_cahe == 0 or
+					 * pool_config->transaction_pooling != 0 or
 					 * database name is template0, template1, postgres or regression
 					 */
 					if (status == POOL_END_WITH_FRONTEND_ERROR ||
 						pool_config->connection_cache == 0 ||
+						pool_config->transaction_pooling ||
 						!strcmp(sp->database, "template0") ||
 						!strcmp(sp->database, "template1") ||
 						!strcmp(sp->database, "postgres") ||
@@ -423,7 +531,8 @@ void do_child(int unix_fd, int inet_fd)
 							pool_send_frontend_exits(backend);
 							pool_discard_cp(sp->user, sp->database, sp->major);
 						}
-						else
+						else if (!pool_config->shared_connection_pool ||
+								 pool_put_shared_cp(backend) < 0)
 							pool_connection_pool_timer(backend);
 					}
 					break;
@@ -441,10 +550,9 @@ void do_child(int unix_fd, int inet_fd)
 					child_exit(1);
 					break;
 
-				/* not implemented yet */
+				/* client is idle. park the session to serve others */
 				case POOL_IDLE:
-					do_accept(unix_fd, inet_fd, &timeout);
-					pool_debug("accept while idle");
+					park_session(frontend, backend);
 					break;
 
 				default:
@@ -455,6 +563,9 @@ void do_child(int unix_fd, int inet_fd)
 				break;
 		}
 
+		if (status == POOL_IDLE)
+			continue;
+
 		/* Destroy session context */
 		pool_session_context_destroy();
 
@@ -473,7 +584,8 @@ void do_child(int unix_fd, int inet_fd)
 
 		/* check if maximum connections count for this child reached */
 		if ( ( pool_config->child_max_connections > 0 ) &&
-			( connections_count >= pool_config->child_max_connections ) )
+			( connections_count >= pool_config->child_max_connections ) &&
+			num_parked_sessions == 0 )
 		{
 			pool_log("child exiting, %d connections reached", pool_config->child_max_connections);
 			send_frontend_exits();
@@ -493,7 +605,6 @@ void do_child(int unix_fd, int inet_fd)
 */
 static POOL_CONNECTION *do_accept(int unix_fd, int inet_fd, struct timeval *timeout)
 {
-    fd_set	readmask;
     int fds;
 	int save_errno;
 
@@ -515,11 +626,6 @@ static POOL_CONNECTION *do_accept(int unix_fd, int inet_fd, struct timeval *time
 	/* Destroy session context for just in case... */
 	pool_session_context_destroy();
 
-	FD_ZERO(&readmask);
-	FD_SET(unix_fd, &readmask);
-	if (inet_fd)
-		FD_SET(inet_fd, &readmask);
-
 	if (timeout->tv_sec == 0 && timeout->tv_usec == 0)
 		timeoutval = NULL;
 	else
@@ -535,7 +641,7 @@ static POOL_CONNECTION *do_accept(int unix_fd, int inet_fd, struct timeval *time
 #endif
 	}
 
-	fds = select(Max(unix_fd, inet_fd)+1, &readmask, NULL, NULL, timeoutval);
+	fds = wait_for_connection(unix_fd, inet_fd, timeoutval, &fd);
 
 	save_errno = errno;
 	/* check backend timer is expired */
@@ -584,26 +690,19 @@ static POOL_CONNECTION *do_accept(int unix_fd, int inet_fd, struct timeval *time
 		if (errno == EAGAIN || errno == EINTR)
 			return NULL;
 
-		pool_error("select() failed. reason %s", strerror(errno));
+		pool_error("%s() failed. reason %s",
+				   child_epoll_fd >= 0 ? "epoll_wait" : "select", strerror(errno));
 		return NULL;
 	}
 
-	/* timeout */
-	if (fds == 0)
+	/* timeout, or a parked session is ready to resume */
+	if (fds == 0 || fd == 0 || ready_session)
 	{
 		return NULL;
 	}
 
-	if (FD_ISSET(unix_fd, &readmask))
-	{
-		fd = unix_fd;
-	}
-
-	if (FD_ISSET(inet_fd, &readmask))
-	{
-		fd = inet_fd;
+	if (inet_fd && fd == inet_fd)
 		inet++;
-	}
 
 	/*
 	 * Note that some SysV systems do not work here. For those
@@ -624,7 +723,10 @@ static POOL_CONNECTION *do_accept(int unix_fd, int inet_fd, struct timeval *time
 		pause();
 	}
 
-	afd = accept(fd, (struct sockaddr *)&saddr.addr, &saddr.salen);
+	if (admission_fd >= 0)
+		afd = receive_admitted_connection(fd, &saddr, &inet);
+	else
+		afd = accept(fd, (struct sockaddr *)&saddr.addr, &saddr.salen);
 
 	save_errno = errno;
 	/* check backend timer is expired */
@@ -819,6 +921,537 @@ static POOL_CONNECTION *do_accept(int unix_fd, int inet_fd, struct timeval *time
 	return cp;
 }
 
+/*
+ * Receive a client accepted by the admission queue process in place
+ * of accept().  The address of the client is stored in saddr, and
+ * *inet is set if it is an INET connection.  Returns -1 with errno
+ * set to EAGAIN if no client has been received.
+ */
+static int receive_admitted_connection(int fd, SockAddr *saddr, int *inet)
+{
+	int afd;
+	int kind;
+
+	kind = pool_admission_receive(fd, &afd);
+	if (kind < 0)
+	{
+		pool_error("receive_admitted_connection: admission queue process has gone");
+		admission_fd = -1;
+		child_exit(1);
+	}
+
+	if (kind != POOL_ADMISSION_ADMIT)
+	{
+		errno = EAGAIN;
+		return -1;
+	}
+	admission_ready_sent = false;
+
+	if (getpeername(afd, (struct sockaddr *)&saddr->addr, &saddr->salen) < 0)
+	{
+		pool_error("receive_admitted_connection: getpeername() failed. reason: %s", strerror(errno));
+		close(afd);
+		errno = EAGAIN;
+		return -1;
+	}
+
+	*inet = saddr->addr.ss_family == AF_INET || saddr->addr.ss_family == AF_INET6;
+	return afd;
+}
+
+/*
+ * Return true if accept_method is "epoll".  The purpose of this
+ * function is to cache the result of strcmp.
+ */
+bool pool_is_epoll_accept(void)
+{
+	static int result = -1;
+
+	if (result == -1)
+	{
+		result = strcmp(pool_config->accept_method, "epoll");
+	}
+	return (result==0)?true:false;
+}
+
+/*
+ * Set up the mechanism used by do_accept() to wait for connection
+ * requests. If accept_method is "epoll", register the listen sockets
+ * to a per child epoll instance with EPOLLEXCLUSIVE so that the
+ * kernel wakes up only one (or a few) of the idle children for each
+ * incoming connection, rather than all of them as select() does
+ * (the "thundering herd").  Falls back to select() if epoll is not
+ * available.
+ *
+ * If max_sessions_per_child > 1, the epoll instance is also used to
+ * wait for parked sessions, so it is created regardless of
+ * accept_method.
+ */
+static void init_accept_wait(int unix_fd, int inet_fd)
+{
+	child_epoll_fd = -1;
+	max_sessions = 1;
+
+	if (!pool_is_epoll_accept() && pool_config->max_sessions_per_child <= 1)
+		return;
+
+#ifdef HAVE_SYS_EPOLL_H
+#ifndef EPOLLEXCLUSIVE
+	if (pool_is_epoll_accept())
+		pool_log("init_accept_wait: epoll with EPOLLEXCLUSIVE is not supported on this platform. falling back to select()");
+	if (pool_config->max_sessions_per_child <= 1)
+		return;
+#endif
+	{
+		int efd;
+
+		efd = epoll_create(pool_config->max_sessions_per_child + 2);
+		if (efd < 0)
+		{
+			pool_error("init_accept_wait: epoll_create() failed. reason: %s. falling back to select()",
+					   strerror(errno));
+			return;
+		}
+
+		child_epoll_fd = efd;
+		if (watch_listen_fds(true) < 0)
+		{
+			pool_error("init_accept_wait: falling back to select()");
+			close(efd);
+			child_epoll_fd = -1;
+			return;
+		}
+		pool_debug("init_accept_wait: waiting for connection requests using epoll");
+	}
+
+	if (pool_config->max_sessions_per_child > 1)
+	{
+		if (pool_config->parallel_mode)
+		{
+			pool_log("init_accept_wait: max_sessions_per_child is ignored in parallel mode");
+			return;
+		}
+
+		parked_sessions = malloc(sizeof(POOL_PARKED_SESSION *) * pool_config->max_sessions_per_child);
+		if (parked_sessions == NULL)
+		{
+			pool_error("init_accept_wait: malloc failed");
+			child_exit(1);
+		}
+		max_sessions = pool_config->max_sessions_per_child;
+
+		/*
+		 * Another child may accept the connection request we are
+		 * woken up for.  Do not block in accept() while sessions are
+		 * parked.  Clients from the admission queue are ours.
+		 */
+		if (admission_fd < 0)
+		{
+			pool_set_nonblock(unix_fd);
+			if (inet_fd)
+				pool_set_nonblock(inet_fd);
+		}
+	}
+#else
+	if (pool_is_epoll_accept())
+		pool_log("init_accept_wait: epoll with EPOLLEXCLUSIVE is not supported on this platform. falling back to select()");
+	if (pool_config->max_sessions_per_child > 1)
+		pool_log("init_accept_wait: epoll is not supported on this platform. max_sessions_per_child is ignored");
+#endif
+}
+
+/*
+ * Add the listen sockets to the epoll instance if watch is true,
+ * otherwise remove them.  Returns 0 on success, -1 on error.
+ */
+static int watch_listen_fds(bool watch)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	struct epoll_event ev;
+	int op = watch ? EPOLL_CTL_ADD : EPOLL_CTL_DEL;
+
+	/* listen sockets are already closed by smart shutdown request */
+	if (listen_fds_watched == watch || exit_request)
+		return 0;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+#ifdef EPOLLEXCLUSIVE
+	if (pool_is_epoll_accept())
+		ev.events |= EPOLLEXCLUSIVE;
+#endif
+
+	/* point to the variables so that they can be told from parked sessions */
+	ev.data.ptr = &child_unix_fd;
+	if (epoll_ctl(child_epoll_fd, op, child_unix_fd, &ev) < 0)
+	{
+		pool_error("watch_listen_fds: epoll_ctl() failed. reason: %s", strerror(errno));
+		return -1;
+	}
+
+	if (child_inet_fd)
+	{
+		ev.data.ptr = &child_inet_fd;
+		if (epoll_ctl(child_epoll_fd, op, child_inet_fd, &ev) < 0)
+		{
+			pool_error("watch_listen_fds: epoll_ctl() failed. reason: %s", strerror(errno));
+			return -1;
+		}
+	}
+	listen_fds_watched = watch;
+#endif
+	return 0;
+}
+
+/*
+ * Wait for a connection request on unix_fd or inet_fd. Returns the
+ * number of ready descriptors, 0 on timeout or -1 on error (errno is
+ * set) just like select(). If a connection request is ready, the
+ * listen socket to accept on is stored in *fd. inet_fd takes
+ * precedence if both of them are ready.
+ *
+ * If sessions are parked, also wait for them.  A parked session whose
+ * client sent data (or whose backend sent an asynchronous message) is
+ * stored in ready_session, and *fd is left untouched.
+ */
+static int wait_for_connection(int unix_fd, int inet_fd, struct timeval *timeoutval, int *fd)
+{
+	fd_set	readmask;
+	int fds;
+
+	/* ask the admission queue process for a client */
+	if (admission_fd >= 0 && !admission_ready_sent && !exit_request && can_accept_session())
+	{
+		if (pool_admission_ready(admission_fd) < 0)
+		{
+			pool_error("wait_for_connection: admission queue process has gone");
+			admission_fd = -1;
+			child_exit(1);
+		}
+		admission_ready_sent = true;
+	}
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (child_epoll_fd >= 0)
+	{
+		struct epoll_event events[16];
+		int msec = -1;
+		int i;
+
+		if (timeoutval)
+			msec = timeoutval->tv_sec * 1000 + (timeoutval->tv_usec + 999) / 1000;
+
+		/* wake up periodically to enforce client_idle_limit on parked sessions */
+		if (num_parked_sessions > 0 && pool_config->client_idle_limit > 0 &&
+			(msec < 0 || msec > 1000))
+			msec = 1000;
+
+		watch_listen_fds(can_accept_session());
+
+		fds = epoll_wait(child_epoll_fd, events, sizeof(events) / sizeof(events[0]), msec);
+
+		for (i = 0; i < fds; i++)
+		{
+			if (events[i].data.ptr == &child_unix_fd ||
+				events[i].data.ptr == &child_inet_fd)
+			{
+				int listen_fd = *(int *)events[i].data.ptr;
+
+				if (*fd == 0 || listen_fd == inet_fd)
+					*fd = listen_fd;
+			}
+			else if (ready_session == NULL)
+				ready_session = events[i].data.ptr;
+		}
+		return fds;
+	}
+#endif
+
+	FD_ZERO(&readmask);
+	FD_SET(unix_fd, &readmask);
+	if (inet_fd)
+		FD_SET(inet_fd, &readmask);
+
+	fds = select(Max(unix_fd, inet_fd)+1, &readmask, NULL, NULL, timeoutval);
+
+	if (fds > 0)
+	{
+		if (FD_ISSET(unix_fd, &readmask))
+			*fd = unix_fd;
+
+		if (inet_fd && FD_ISSET(inet_fd, &readmask))
+			*fd = inet_fd;
+	}
+	return fds;
+}
+
+/*
+ * Return true if we can accept a new session.  The new session and
+ * the parked ones must not exceed max_sessions_per_child.  While any
+ * session is parked, stop accepting if we are going to exit as soon
+ * as the parked sessions end.
+ */
+static bool can_accept_session(void)
+{
+	if (num_parked_sessions == 0)
+		return true;
+
+	if (num_parked_sessions >= max_sessions)
+		return false;
+
+	if (pool_get_my_process_info()->need_to_restart)
+		return false;
+
+	if (pool_config->child_max_connections > 0 &&
+		connections_count + num_parked_sessions >= pool_config->child_max_connections)
+		return false;
+
+	return true;
+}
+
+/*
+ * Return true if the session can be parked while the frontend is
+ * idle so that the child can serve other sessions.  This is called
+ * by the protocol engine right before it waits for the next message
+ * from the frontend, i.e. all the receive buffers are empty.  A
+ * session whose backend connections are not released holds its
+ * connection pool entry while parked, and we leave at least one entry
+ * for other sessions.
+ */
+bool pool_can_park_session(POOL_CONNECTION_POOL *backend)
+{
+	int i;
+
+	if (max_sessions <= 1)
+		return false;
+
+	/* the data which woke up the session has not been read yet */
+	if (session_resumed)
+	{
+		session_resumed = false;
+		return false;
+	}
+
+	if (pool_is_query_in_progress() || pool_is_sync_pending())
+		return false;
+
+	if (!pool_is_backend_released() &&
+		num_parked_pools + 1 >= pool_config->max_pool)
+		return false;
+
+	/*
+	 * The table oids modified in the current transaction, which are
+	 * used to invalidate the query cache at commit, are not per
+	 * session.  Do not park a session in a transaction.
+	 */
+	if (pool_config->memory_cache_enabled)
+	{
+		for (i=0;i<NUM_BACKENDS;i++)
+		{
+			if (VALID_BACKEND(i) && TSTATE(backend, i) != 'I')
+				return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Park the active session.  The session context and the connection
+ * pool are detached so that another session can be served, and the
+ * frontend socket (and the backend sockets if the connection pool
+ * entry is held) are watched to resume the session.
+ */
+static void park_session(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	POOL_PARKED_SESSION *session;
+	struct epoll_event ev;
+	int i;
+
+	session = calloc(1, sizeof(*session));
+	if (session == NULL)
+	{
+		pool_error("park_session: calloc failed");
+		child_exit(1);
+	}
+	session->frontend = frontend;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = session;
+
+	if (epoll_ctl(child_epoll_fd, EPOLL_CTL_ADD, frontend->fd, &ev) < 0)
+	{
+		pool_error("park_session: epoll_ctl() failed. reason: %s", strerror(errno));
+		child_exit(1);
+	}
+
+	if (pool_is_backend_released())
+	{
+		session->info = malloc(sizeof(ConnectionInfo) * NUM_BACKENDS);
+		if (session->info == NULL)
+		{
+			pool_error("park_session: malloc failed");
+			child_exit(1);
+		}
+
+		pool_coninfo_unset_frontend_connected(pool_get_process_context()->proc_id, pool_pool_index());
+		if (pool_detach_cp(&session->backend, session->info) < 0)
+			child_exit(1);
+		session->pool_index = -1;
+	}
+	else
+	{
+		/* notifications etc. may arrive while the session is parked */
+		for (i=0;i<NUM_BACKENDS;i++)
+		{
+			if (!VALID_BACKEND(i))
+				continue;
+
+			if (epoll_ctl(child_epoll_fd, EPOLL_CTL_ADD, CONNECTION(backend, i)->fd, &ev) < 0)
+			{
+				pool_error("park_session: epoll_ctl() failed. reason: %s", strerror(errno));
+				child_exit(1);
+			}
+		}
+		session->pool_index = pool_park_cp();
+		num_parked_pools++;
+	}
+
+	session->session_context = pool_session_context_detach();
+	if (session->session_context == NULL)
+		child_exit(1);
+
+	session->parked_time = time(NULL);
+	strlcpy(session->remote_host, remote_host, sizeof(session->remote_host));
+	strlcpy(session->remote_port, remote_port, sizeof(session->remote_port));
+
+	parked_sessions[num_parked_sessions++] = session;
+
+	/* the connection is counted down by child_exit() as a parked session */
+	accepted = 0;
+
+	pool_debug("park_session: parked session fd: %d. %d sessions are parked",
+			   frontend->fd, num_parked_sessions);
+#endif
+}
+
+/*
+ * Return a parked session to be resumed, if any.  Sessions idle for
+ * more than client_idle_limit are returned with *idle_limit_reached
+ * set.
+ */
+static POOL_PARKED_SESSION *get_ready_session(bool *idle_limit_reached)
+{
+	POOL_PARKED_SESSION *session;
+	time_t now;
+	int i;
+
+	*idle_limit_reached = false;
+
+	if (ready_session)
+	{
+		session = ready_session;
+		ready_session = NULL;
+		return session;
+	}
+
+	if (num_parked_sessions > 0 && pool_config->client_idle_limit > 0)
+	{
+		now = time(NULL);
+		for (i=0;i<num_parked_sessions;i++)
+		{
+			if (now - parked_sessions[i]->parked_time > pool_config->client_idle_limit)
+			{
+				*idle_limit_reached = true;
+				return parked_sessions[i];
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Resume a parked session and make it the active session.  Returns
+ * the frontend and stores the connection pool in *backend.
+ */
+static POOL_CONNECTION *resume_session(POOL_PARKED_SESSION *session, POOL_CONNECTION_POOL **backend)
+{
+	POOL_CONNECTION *frontend = session->frontend;
+	POOL_CONNECTION_POOL *p;
+	StartupPacket *sp;
+	char psbuf[NI_MAXHOST + 128];
+	int i;
+
+	for (i=0;i<num_parked_sessions;i++)
+	{
+		if (parked_sessions[i] == session)
+		{
+			parked_sessions[i] = parked_sessions[--num_parked_sessions];
+			break;
+		}
+	}
+	if (ready_session == session)
+		ready_session = NULL;
+
+#ifdef HAVE_SYS_EPOLL_H
+	epoll_ctl(child_epoll_fd, EPOLL_CTL_DEL, frontend->fd, NULL);
+#endif
+
+	if (session->pool_index >= 0)
+	{
+		p = pool_unpark_cp(session->pool_index);
+		num_parked_pools--;
+
+#ifdef HAVE_SYS_EPOLL_H
+		/* backends may have gone by failover. ignore errors */
+		for (i=0;i<NUM_BACKENDS;i++)
+		{
+			if (CONNECTION_SLOT(p, i) && CONNECTION(p, i)->fd >= 0)
+				epoll_ctl(child_epoll_fd, EPOLL_CTL_DEL, CONNECTION(p, i)->fd, NULL);
+		}
+#endif
+		pool_session_context_attach(session->session_context, p);
+	}
+	else
+	{
+		/*
+		 * We always leave a connection pool entry which is not held
+		 * by parked sessions, so this should not fail.
+		 */
+		p = pool_attach_cp(&session->backend, session->info);
+		if (p == NULL)
+		{
+			pool_error("resume_session: no connection pool entry is available");
+			child_exit(1);
+		}
+		free(session->info);
+
+		pool_session_context_attach(session->session_context, p);
+		pool_coninfo_set_frontend_connected(pool_get_process_context()->proc_id, pool_pool_index());
+	}
+
+	strlcpy(remote_host, session->remote_host, sizeof(remote_host));
+	strlcpy(remote_port, session->remote_port, sizeof(remote_port));
+	snprintf(remote_ps_data, sizeof(remote_ps_data),
+			 remote_port[0] == '\0' ? "%s" : "%s(%s)",
+			 remote_host, remote_port);
+
+	sp = MASTER_CONNECTION(p)->sp;
+	snprintf(psbuf, sizeof(psbuf), "%s %s %s idle",
+			 sp->user, sp->database, remote_ps_data);
+	set_ps_display(psbuf, false);
+
+	pool_debug("resume_session: resumed session fd: %d. %d sessions are parked",
+			   frontend->fd, num_parked_sessions);
+
+	free(session);
+	session_resumed = true;
+	*backend = p;
+	return frontend;
+}
+
 /*
 * Read startup packet
 *
@@ -1152,7 +1785,7 @@ void cancel_request(CancelPacket *sp)
 	pool_debug("Cancel request received");
 
 	/* look for cancel key from shmem info */
-	for (i=0;i<pool_config->num_init_children;i++)
+	for (i=0;i<pool_config->max_children;i++)
 	{
 		for (j=0;j<pool_config->max_pool;j++)
 		{
@@ -1160,11 +1793,17 @@ void cancel_request(CancelPacket *sp)
 			{
 				c = pool_coninfo(i, j, k);
 				pool_debug("con_info: address:%p database:%s user:%s pid:%d key:%d i:%d",
-						   c, c->database, c->user, ntohl(c->pid), ntohl(c->key),i);
+						   c, c->database, c->user, ntohl(c->client_pid), ntohl(c->client_key),i);
 
-				if (c->pid == sp->pid && c->key == sp->key)
+				/*
+				 * The frontend cancels by the pid and key given at
+				 * session start. The cancel request is sent to the
+				 * backends attached now, which may differ with
+				 * transaction_pooling.
+				 */
+				if (c->client_pid == sp->pid && c->client_key == sp->key)
 				{
-					pool_debug("found pid:%d key:%d i:%d",ntohl(c->pid), ntohl(c->key),i);
+					pool_debug("found pid:%d key:%d i:%d",ntohl(c->client_pid), ntohl(c->client_key),i);
 					c = pool_coninfo(i, j, 0);
 					found = true;
 					goto found;
@@ -1290,6 +1929,27 @@ static RETSIGTYPE die(int sig)
 	switch (sig)
 	{
 		case SIGTERM:	/* smart shutdown */
+			/*
+			 * Clients may be on the way from the admission queue.
+			 * Keep the connection until child_exit() withdraws from
+			 * the queue.
+			 */
+			if (admission_fd >= 0)
+				break;
+
+#ifdef HAVE_SYS_EPOLL_H
+			/*
+			 * Other processes keep the listen sockets open, so they
+			 * would stay in the epoll instance after close().
+			 */
+			if (child_epoll_fd >= 0 && listen_fds_watched)
+			{
+				epoll_ctl(child_epoll_fd, EPOLL_CTL_DEL, child_unix_fd, NULL);
+				if (child_inet_fd)
+					epoll_ctl(child_epoll_fd, EPOLL_CTL_DEL, child_inet_fd, NULL);
+				listen_fds_watched = false;
+			}
+#endif
 			/* Refuse further requests by closing listen socket */
 			if (child_inet_fd)
 			{
@@ -1453,9 +2113,21 @@ void child_exit(int code)
 		return;
 	}
 
+	/* return clients on the way to us to the admission queue */
+	if (admission_fd >= 0 && exit_request != SIGINT && exit_request != SIGQUIT)
+	{
+		pool_admission_withdraw(admission_fd);
+		admission_fd = -1;
+	}
+
 	/* count down global connection counter */
 	if (accepted)
 		connection_count_down();
+	while (num_parked_sessions > 0)
+	{
+		connection_count_down();
+		num_parked_sessions--;
+	}
 
 	/* prepare to shutdown connections to system db */
 	if(pool_config->parallel_mode || pool_config->enable_query_cache)
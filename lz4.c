@@ -0,0 +1,255 @@
+/* -*-pgsql-c-*- */
+/*
+ *
+ * $Header$
+ *
+ * pgpool: a language independent connection pool server for PostgreSQL
+ * written by Tatsuo Ishii
+ *
+ * Copyright (c) 2003-2014	PgPool Global Development Group
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that copyright notice and this permission
+ * notice appear in supporting documentation, and that the name of the
+ * author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * lz4.c: compressor and decompressor of the LZ4 block format.
+ *
+ * LZ4 was designed by Yann Collet. This is a small greedy
+ * implementation of its block format, which trades some compression
+ * ratio for simplicity. Its output can be decompressed by any LZ4
+ * block decompressor and vice versa.
+ *
+ * A block is a series of sequences. Each sequence is a token byte
+ * (literal length in the upper 4 bits, match length - 4 in the lower 4
+ * bits), extra literal length bytes, the literals, a 2 byte little
+ * endian match offset and extra match length bytes. Lengths of 15 or
+ * more are continued by bytes added up until a byte other than 255.
+ * The last sequence has literals only.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "lz4.h"
+
+#define MINMATCH		4
+#define MFLIMIT			12		/* the last match must start this far before the end */
+#define LASTLITERALS	5		/* the last bytes are always literals */
+#define MAX_DISTANCE	65535
+#define HASH_LOG		12
+#define SKIP_TRIGGER	6		/* search faster after 2^this misses */
+
+static uint32_t read32(const unsigned char *p);
+static uint32_t hash32(uint32_t v);
+static unsigned char *write_length(unsigned char *op, int len);
+
+/*
+ * Compress "srclen" bytes of src into dst, which has room of "dstlen"
+ * bytes. Returns compressed size, or 0 if dst is too small.
+ */
+int lz4_compress(const char *src, int srclen, char *dst, int dstlen)
+{
+	const unsigned char *base = (const unsigned char *)src;
+	const unsigned char *ip = base;
+	const unsigned char *anchor = base;
+	const unsigned char *iend = base + srclen;
+	const unsigned char *mflimit = iend - MFLIMIT;
+	const unsigned char *matchlimit = iend - LASTLITERALS;
+	unsigned char *op = (unsigned char *)dst;
+	unsigned char *oend = op + dstlen;
+	uint32_t table[1 << HASH_LOG];
+	int litlen;
+
+	if (srclen > MFLIMIT)
+	{
+		unsigned int misses = 0;
+
+		memset(table, 0, sizeof(table));
+		ip++;
+
+		while (ip < mflimit)
+		{
+			const unsigned char *ref;
+			uint32_t h = hash32(read32(ip));
+			int matchlen;
+			unsigned char *token;
+
+			ref = base + table[h];
+			table[h] = ip - base;
+
+			if (ip - ref > MAX_DISTANCE || read32(ref) != read32(ip))
+			{
+				ip += 1 + (misses++ >> SKIP_TRIGGER);
+				continue;
+			}
+			misses = 0;
+
+			/* Extend the match backward and forward */
+			while (ip > anchor && ref > base && ip[-1] == ref[-1])
+			{
+				ip--;
+				ref--;
+			}
+			matchlen = MINMATCH;
+			while (ip + matchlen < matchlimit && ip[matchlen] == ref[matchlen])
+				matchlen++;
+
+			litlen = ip - anchor;
+			if (op + 1 + litlen / 255 + 1 + litlen + 2 + (matchlen - MINMATCH) / 255 + 1 > oend)
+				return 0;
+
+			token = op++;
+			if (litlen >= 15)
+			{
+				*token = 15 << 4;
+				op = write_length(op, litlen - 15);
+			}
+			else
+				*token = litlen << 4;
+			memcpy(op, anchor, litlen);
+			op += litlen;
+
+			*op++ = (ip - ref) & 0xff;
+			*op++ = (ip - ref) >> 8;
+
+			if (matchlen - MINMATCH >= 15)
+			{
+				*token |= 15;
+				op = write_length(op, matchlen - MINMATCH - 15);
+			}
+			else
+				*token |= matchlen - MINMATCH;
+
+			ip += matchlen;
+			anchor = ip;
+		}
+	}
+
+	/* Last literals */
+	litlen = iend - anchor;
+	if (op + 1 + litlen / 255 + 1 + litlen > oend)
+		return 0;
+	if (litlen >= 15)
+	{
+		*op++ = 15 << 4;
+		op = write_length(op, litlen - 15);
+	}
+	else
+		*op++ = litlen << 4;
+	memcpy(op, anchor, litlen);
+	op += litlen;
+
+	return op - (unsigned char *)dst;
+}
+
+/*
+ * Decompress "srclen" bytes of src into dst, which has room of
+ * "dstlen" bytes. Corrupted input never makes this read or write out
+ * of the buffers. Returns decompressed size, or -1 on error.
+ */
+int lz4_decompress(const char *src, int srclen, char *dst, int dstlen)
+{
+	const unsigned char *ip = (const unsigned char *)src;
+	const unsigned char *iend = ip + srclen;
+	unsigned char *op = (unsigned char *)dst;
+	unsigned char *oend = op + dstlen;
+
+	while (ip < iend)
+	{
+		unsigned int token = *ip++;
+		size_t len = token >> 4;
+		size_t offset;
+		unsigned char b;
+
+		if (len == 15)
+		{
+			do
+			{
+				if (ip >= iend)
+					return -1;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+		if (len > (size_t)(iend - ip) || len > (size_t)(oend - op))
+			return -1;
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+
+		/* The last sequence has no match */
+		if (ip >= iend)
+			break;
+
+		if (iend - ip < 2)
+			return -1;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - (unsigned char *)dst))
+			return -1;
+
+		len = token & 15;
+		if (len == 15)
+		{
+			do
+			{
+				if (ip >= iend)
+					return -1;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+		len += MINMATCH;
+		if (len > (size_t)(oend - op))
+			return -1;
+
+		/* The match may overlap the output. Then copy byte by byte */
+		if (offset >= len)
+			memcpy(op, op - offset, len);
+		else
+		{
+			unsigned char *ref = op - offset;
+			size_t i;
+
+			for (i = 0; i < len; i++)
+				op[i] = ref[i];
+		}
+		op += len;
+	}
+
+	return op - (unsigned char *)dst;
+}
+
+static uint32_t read32(const unsigned char *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t hash32(uint32_t v)
+{
+	return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+/*
+ * Write the rest of a length of 15 or more.
+ */
+static unsigned char *write_length(unsigned char *op, int len)
+{
+	while (len >= 255)
+	{
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+	return op;
+}
@@ -0,0 +1,38 @@
+/* -*-pgsql-c-*- */
+/*
+ *
+ * $Header$
+ *
+ * pgpool: a language independent connection pool server for PostgreSQL
+ * written by Tatsuo Ishii
+ *
+ * Copyright (c) 2003-2014	PgPool Global Development Group
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that copyright notice and this permission
+ * notice appear in supporting documentation, and that the name of the
+ * author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * lz4.h: Interface to lz4.c
+ *
+ */
+
+#ifndef LZ4_H
+#define LZ4_H
+
+/*
+ * Upper bound of compressed size of "size" bytes. The compressor never
+ * needs more room than this.
+ */
+#define LZ4_COMPRESS_BOUND(size) ((size) + (size) / 255 + 16)
+
+extern int lz4_compress(const char *src, int srclen, char *dst, int dstlen);
+extern int lz4_decompress(const char *src, int srclen, char *dst, int dstlen);
+
+#endif /* LZ4_H */
@@ -61,6 +61,8 @@
 #include "parser/pool_string.h"
 #include "pool_passwd.h"
 #include "pool_memqcache.h"
+#include "pool_manager.h"
+#include "pool_admission.h"
 #include "watchdog/wd_ext.h"
 
 /*
@@ -103,7 +105,9 @@ static int write_status_file(void);
 static pid_t pcp_fork_a_child(int unix_fd, int inet_fd, char *pcp_conf_file);
 static pid_t fork_a_child(int unix_fd, int inet_fd, int id);
 static pid_t worker_fork_a_child(void);
-static int create_unix_domain_socket(struct sockaddr_un un_addr_tmp);
+static pid_t pool_manager_fork_a_child(void);
+static pid_t admission_fork_a_child(void);
+static int create_unix_domain_socket(struct sockaddr_un un_addr_tmp, mode_t mode);
 static int create_inet_domain_socket(const char *hostname, const int port);
 static void myexit(int code);
 static void failover(void);
@@ -112,6 +116,7 @@ static void wakeup_children(void);
 static void reload_config(void);
 static int pool_pause(struct timeval *timeout);
 static void kill_all_children(int sig);
+static void maintain_spare_children(void);
 static int get_next_master_node(void);
 static pid_t fork_follow_child(int old_master, int new_primary, int old_primary);
 
@@ -137,6 +142,8 @@ static int find_primary_node_repeatedly(void);
 
 static struct sockaddr_un un_addr;		/* unix domain socket path */
 static struct sockaddr_un pcp_un_addr;  /* unix domain socket path for PCP */
+static struct sockaddr_un pool_manager_un_addr;  /* unix domain socket path for pool manager */
+static struct sockaddr_un admission_un_addr;  /* unix domain socket path for admission queue */
 
 ProcessInfo *process_info;	/* Per child info table on shmem */
 
@@ -148,7 +155,7 @@ BACKEND_STATUS private_backend_status[MAX_NUM_BACKENDS];
 /*
  * shmem connection info table
  * this is a three dimension array. i.e.:
- * con_info[pool_config->num_init_children][pool_config->max_pool][MAX_NUM_BACKENDS]
+ * con_info[pool_config->max_children][pool_config->max_pool][MAX_NUM_BACKENDS]
  */
 ConnectionInfo *con_info;
 
@@ -185,6 +192,19 @@ int my_proc_id;
 static BackendStatusRecord backend_rec;	/* Backend status record */
 
 static pid_t worker_pid; /* pid of worker process */
+static pid_t pool_manager_pid; /* pid of pool manager process */
+
+/*
+ * Dynamic scaling of children (max_spare_children > 0). retiring[i]
+ * is non 0 while process_info[i] has been asked to exit and must not
+ * be forked again.
+ */
+static char *retiring;
+static int spawn_rate = 1;	/* # of children forked at once, doubled up to MAX_SPAWN_RATE */
+#define MAX_SPAWN_RATE 32
+static int pool_manager_fd = -1; /* unix domain socket fd for pool manager */
+static pid_t admission_pid; /* pid of admission queue process */
+static int admission_fd = -1; /* unix domain socket fd for admission queue */
 
 BACKEND_STATUS* my_backend_status[MAX_NUM_BACKENDS];		/* Backend status buffer */
 int my_master_node_id;		/* Master node id buffer */
@@ -455,7 +475,7 @@ int main(int argc, char **argv)
 		pool_init_pool_passwd(pool_passwd);
 	}
 
-	if (pool_semaphore_create(MAX_NUM_SEMAPHORES))
+	if (pool_semaphore_create(MAX_NUM_SEMAPHORES + pool_config->memqcache_partitions))
 	{
 		pool_error("Unable to create semaphores. Exiting...");
 		pool_shmem_exit(1);
@@ -486,12 +506,16 @@ int main(int argc, char **argv)
 	snprintf(pcp_un_addr.sun_path, sizeof(pcp_un_addr.sun_path), "%s/.s.PGSQL.%d",
 			 pool_config->pcp_socket_dir,
 			 pool_config->pcp_port);
+	/* set unix domain socket path for pool manager */
+	pool_manager_socket_path(pool_manager_un_addr.sun_path, sizeof(pool_manager_un_addr.sun_path));
+	/* set unix domain socket path for admission queue */
+	pool_admission_socket_path(admission_un_addr.sun_path, sizeof(admission_un_addr.sun_path));
 
 	/* set up signal handlers */
 	pool_signal(SIGPIPE, SIG_IGN);
 
 	/* create unix domain socket */
-	unix_fd = create_unix_domain_socket(un_addr);
+	unix_fd = create_unix_domain_socket(un_addr, 0777);
 
 	/* create inet domain socket if any */
 	if (pool_config->listen_addresses[0])
@@ -517,7 +541,7 @@ int main(int argc, char **argv)
 	}
 	memset(con_info, 0, size);
 
-	size = pool_config->num_init_children * (sizeof(ProcessInfo));
+	size = pool_config->max_children * (sizeof(ProcessInfo));
 	process_info = pool_shared_memory_create(size);
 	if (process_info == NULL)
 	{
@@ -525,11 +549,18 @@ int main(int argc, char **argv)
 		myexit(1);
 	}
 	memset(process_info, 0, size);
-	for (i = 0; i < pool_config->num_init_children; i++)
+	for (i = 0; i < pool_config->max_children; i++)
 	{
 		process_info[i].connection_info = pool_coninfo(i,0,0);
 	}
 
+	retiring = calloc(pool_config->max_children, sizeof(char));
+	if (retiring == NULL)
+	{
+		pool_error("failed to allocate retiring flags");
+		myexit(1);
+	}
+
 	/* create fail over/switch over event area */
 	Req_info = pool_shared_memory_create(sizeof(POOL_REQUEST_INFO));
 	if (Req_info == NULL)
@@ -563,6 +594,34 @@ int main(int argc, char **argv)
 	}
 	*InRecovery = RECOVERY_INIT;
 
+	/*
+	 * Initialize pool manager statistics
+	 */
+	if (pool_config->shared_connection_pool)
+	{
+		pool_manager_stats = pool_shared_memory_create(sizeof(POOL_MANAGER_STATS));
+		if (pool_manager_stats == NULL)
+		{
+			pool_error("failed to allocate pool_manager_stats");
+			myexit(1);
+		}
+		memset((char *)pool_manager_stats, 0, sizeof(POOL_MANAGER_STATS));
+	}
+
+	/*
+	 * Initialize admission queue statistics
+	 */
+	if (pool_config->admission_queue_length > 0)
+	{
+		pool_admission_stats = pool_shared_memory_create(sizeof(POOL_ADMISSION_STATS));
+		if (pool_admission_stats == NULL)
+		{
+			pool_error("failed to allocate pool_admission_stats");
+			myexit(1);
+		}
+		memset((char *)pool_admission_stats, 0, sizeof(POOL_ADMISSION_STATS));
+	}
+
 	/*
 	 * Initialize shared memory cache
 	 */
@@ -579,6 +638,13 @@ int main(int argc, char **argv)
 				myexit(1);
 			}
 
+			if (*pool_config->memqcache_persistent_file &&
+				pool_init_persistent_cache() < 0)
+			{
+				pool_error("pool_init_persistent_cache error");
+				myexit(1);
+			}
+
 			if (pool_init_memory_cache(size) < 0)
 			{
 				pool_error("pool_shared_memory_cache_size error");
@@ -593,34 +659,53 @@ int main(int argc, char **argv)
 			}
 			pool_init_fsmm(size);
 
-			pool_allocate_fsmm_clock_hand();
-
-			pool_discard_oid_maps();
-			pool_log("pool_discard_oid_maps: discarded memqcache oid maps");
+			pool_init_cache_partitions();
 
 			pool_hash_init(pool_config->memqcache_max_num_cache);
+
+			if (pool_init_cache_sketch() < 0)
+			{
+				pool_error("pool_init_cache_sketch failed");
+				myexit(1);
+			}
 		}
 
 #ifdef USE_MEMCACHED
 		else
 		{
+			/*
+			 * Oid maps of caches stored by previous pgpool-II are
+			 * lost. Flush them unless told otherwise.
+			 */
 			if (clear_memcache_oidmaps)
 			{
-				pool_discard_oid_maps();
-				pool_log("pool_discard_oid_maps: discarded memqcache oid maps");
+				pool_debug("skipped flushing memcached");
 			}
 			else
 			{
-				pool_debug("skipped discarding memqcache oid maps");
+				pool_flush_memcached();
+				pool_log("pool_flush_memcached: flushed memcached since oid maps were lost");
 			}
 		}
 #endif
 
+		if (pool_init_oid_maps() < 0)
+		{
+			pool_error("pool_init_oid_maps error");
+			myexit(1);
+		}
+
 		if (pool_init_memqcache_stats() < 0)
 		{
 			pool_error("pool_init_memqcache_stats error");
 			myexit(1);
 		}
+
+		if (pool_init_cache_flights() < 0)
+		{
+			pool_error("pool_init_cache_flights error");
+			myexit(1);
+		}
 	}
 
 	/* start watchdog */
@@ -641,7 +726,21 @@ int main(int argc, char **argv)
 	 */
 	POOL_SETMASK(&BlockSig);
 
-	/* fork the children */
+	/*
+	 * Fork admission queue process. Children connect to it as soon as
+	 * they start.
+	 */
+	if (pool_config->admission_queue_length > 0)
+	{
+		/* only children may receive clients from it */
+		admission_fd = create_unix_domain_socket(admission_un_addr, 0700);
+		admission_pid = admission_fork_a_child();
+	}
+
+	/*
+	 * fork the children. Remaining slots up to max_children are used
+	 * by dynamic scaling of children.
+	 */
 	for (i=0;i<pool_config->num_init_children;i++)
 	{
 		process_info[i].pid = fork_a_child(unix_fd, inet_fd, i);
@@ -668,7 +767,7 @@ int main(int argc, char **argv)
 	pool_log("%s successfully started. version %s (%s)", PACKAGE, VERSION, PGPOOLVERSION);
 
 	/* fork a child for PCP handling */
-	pcp_unix_fd = create_unix_domain_socket(pcp_un_addr);
+	pcp_unix_fd = create_unix_domain_socket(pcp_un_addr, 0777);
     /* maybe change "*" to pool_config->pcp_listen_addresses */
 	pcp_inet_fd = create_inet_domain_socket("*", pool_config->pcp_port);
 	pcp_pid = pcp_fork_a_child(pcp_unix_fd, pcp_inet_fd, pcp_conf_file);
@@ -676,6 +775,14 @@ int main(int argc, char **argv)
 	/* Fork worker process */
 	worker_pid = worker_fork_a_child();
 
+	/* Fork pool manager process */
+	if (pool_config->shared_connection_pool)
+	{
+		/* only children may get authenticated connections from it */
+		pool_manager_fd = create_unix_domain_socket(pool_manager_un_addr, 0700);
+		pool_manager_pid = pool_manager_fork_a_child();
+	}
+
 	retrycnt = 0;		/* reset health check retry counter */
 	sys_retrycnt = 0;	/* reset SystemDB health check retry counter */
 
@@ -837,11 +944,16 @@ int main(int argc, char **argv)
 				int r;
 				struct timeval t = {3, 0};
 
+				/* check idle children every second */
+				if (pool_config->max_spare_children > 0)
+					t.tv_sec = 1;
+
 				POOL_SETMASK(&UnBlockSig);
 				r = pool_pause(&t);
 				POOL_SETMASK(&BlockSig);
 				if (r > 0)
 					break;
+				maintain_spare_children();
 			}
 		}
 	}
@@ -877,8 +989,9 @@ static void usage(void)
 	fprintf(stderr, "  -h, --help          Prints this help\n\n");
 	fprintf(stderr, "Start options:\n");
 	fprintf(stderr, "  -c, --clear         Clears query cache (enable_query_cache must be on)\n");
-	fprintf(stderr, "  -C, --clear-oidmaps Clears query cache oidmaps when memqcache_method is memcached\n");
-	fprintf(stderr, "                      (If shmem, discards whenever pgpool starts.)\n");
+	fprintf(stderr, "  -C, --clear-oidmaps Does not flush memcached at startup when memqcache_method is memcached\n");
+	fprintf(stderr, "                      (If shmem, discards whenever pgpool starts\n");
+	fprintf(stderr, "                      unless memqcache_persistent_file is set.)\n");
 	fprintf(stderr, "  -n, --dont-detach   Don't run in daemon mode, does not detach control tty\n");
 	fprintf(stderr, "  -D, --discard-status Discard pgpool_status file and do not restore previous status\n");
 	fprintf(stderr, "  -d, --debug         Debug mode\n\n");
@@ -1288,6 +1401,72 @@ pid_t worker_fork_a_child()
 	return pid;
 }
 
+/*
+* fork admission queue process
+*/
+static pid_t admission_fork_a_child(void)
+{
+	pid_t pid;
+
+	pid = fork();
+
+	if (pid == 0)
+	{
+		if (pipe_fds[0] > 0)
+		{
+			close(pipe_fds[0]);
+			close(pipe_fds[1]);
+		}
+
+		myargv = save_ps_display_args(myargc, myargv);
+
+		/* call admission queue main */
+		POOL_SETMASK(&UnBlockSig);
+		health_check_timer_expired = 0;
+		reload_config_request = 0;
+		do_admission(unix_fd, inet_fd, admission_fd);
+	}
+	else if (pid == -1)
+	{
+		pool_error("fork() failed. reason: %s", strerror(errno));
+		myexit(1);
+	}
+	return pid;
+}
+
+/*
+* fork pool manager process
+*/
+static pid_t pool_manager_fork_a_child(void)
+{
+	pid_t pid;
+
+	pid = fork();
+
+	if (pid == 0)
+	{
+		if (pipe_fds[0] > 0)
+		{
+			close(pipe_fds[0]);
+			close(pipe_fds[1]);
+		}
+
+		myargv = save_ps_display_args(myargc, myargv);
+
+		/* call pool manager main */
+		POOL_SETMASK(&UnBlockSig);
+		health_check_timer_expired = 0;
+		reload_config_request = 0;
+		do_pool_manager(pool_manager_fd);
+	}
+	else if (pid == -1)
+	{
+		pool_error("fork() failed. reason: %s", strerror(errno));
+		myexit(1);
+	}
+	return pid;
+}
+
 /*
 * create inet domain socket
 */
@@ -1348,7 +1527,7 @@ static int create_inet_domain_socket(const char *hostname, const int port)
 		myexit(1);
 	}
 
-	backlog = pool_config->num_init_children * 2;
+	backlog = pool_config->max_children * 2;
 	if (backlog > PGPOOLMAXLITSENQUEUELENGTH)
 		backlog = PGPOOLMAXLITSENQUEUELENGTH;
 
@@ -1362,9 +1541,9 @@ static int create_inet_domain_socket(const char *hostname, const int port)
 }
 
 /*
-* create UNIX domain socket
+* create UNIX domain socket with the permission mode
 */
-static int create_unix_domain_socket(struct sockaddr_un un_addr_tmp)
+static int create_unix_domain_socket(struct sockaddr_un un_addr_tmp, mode_t mode)
 {
 	struct sockaddr_un addr;
 	int fd;
@@ -1388,7 +1567,7 @@ static int create_unix_domain_socket(struct sockaddr_un un_addr_tmp)
 		myexit(1);
 	}
 
-	if (chmod(un_addr_tmp.sun_path, 0777) == -1)
+	if (chmod(un_addr_tmp.sun_path, mode) == -1)
 	{
 		pool_error("chmod() failed. reason: %s", strerror(errno));
 		myexit(1);
@@ -1419,7 +1598,7 @@ static void myexit(int code)
 	if (process_info != NULL) {
 		POOL_SETMASK(&AuthBlockSig);
 		exiting = 1;
-		for (i = 0; i < pool_config->num_init_children; i++)
+		for (i = 0; i < pool_config->max_children; i++)
 		{
 			pid_t pid = process_info[i].pid;
 			if (pid)
@@ -1428,6 +1607,9 @@ static void myexit(int code)
 			}
 		}
 
+		if (admission_pid)
+			kill(admission_pid, SIGTERM);
+
 		/* wait for all children to exit */
 		while (wait(NULL) > 0)
 			;
@@ -1438,6 +1620,10 @@ static void myexit(int code)
 
 	myunlink(un_addr.sun_path);
 	myunlink(pcp_un_addr.sun_path);
+	if (pool_manager_pid)
+		myunlink(pool_manager_un_addr.sun_path);
+	if (admission_pid)
+		myunlink(admission_un_addr.sun_path);
 	myunlink(pool_config->pid_file_name);
 
 	write_status_file();
@@ -1690,7 +1876,7 @@ static RETSIGTYPE exit_handler(int sig)
 	close(inet_fd);
 	close(unix_fd);
 
-	for (i = 0; i < pool_config->num_init_children; i++)
+	for (i = 0; i < pool_config->max_children; i++)
 	{
 		pid_t pid = process_info[i].pid;
 		if (pid)
@@ -1701,6 +1887,10 @@ static RETSIGTYPE exit_handler(int sig)
 
 	kill(pcp_pid, sig);
 	kill(worker_pid, sig);
+	if (pool_manager_pid)
+		kill(pool_manager_pid, sig);
+	if (admission_pid)
+		kill(admission_pid, sig);
 
 	if (pool_config->use_watchdog)
 	{
@@ -2038,7 +2228,7 @@ static void failover(void)
 			pool_log("Restart all children");
 
 			/* kill all children */
-			for (i = 0; i < pool_config->num_init_children; i++)
+			for (i = 0; i < pool_config->max_children; i++)
 			{
 				pid_t pid = process_info[i].pid;
 				if (pid)
@@ -2185,8 +2375,11 @@ static void failover(void)
 		/* Fork the children if needed */
 		if (need_to_restart_children)
 		{
-			for (i=0;i<pool_config->num_init_children;i++)
+			for (i=0;i<pool_config->max_children;i++)
 			{
+				/* slot not used by dynamic scaling of children */
+				if (process_info[i].pid == 0)
+					continue;
 
 				/*
 				 * Try to kill pgpool child because previous kill signal
@@ -2200,6 +2393,7 @@ static void failover(void)
 				 */
 				kill(process_info[i].pid, SIGQUIT);
 
+				retiring[i] = 0;
 				process_info[i].pid = fork_a_child(unix_fd, inet_fd, i);
 				process_info[i].start_time = time(NULL);
 			}
@@ -2209,7 +2403,7 @@ static void failover(void)
 			/* Set restart request to each child. Children will exit(1)
 			 * whenever they are idle to restart.
 			 */
-			for (i=0;i<pool_config->num_init_children;i++)
+			for (i=0;i<pool_config->max_children;i++)
 			{
 				process_info[i].need_to_restart = 1;
 			}
@@ -2220,6 +2414,12 @@ static void failover(void)
 		 */
 		kill(worker_pid, SIGUSR1);
 
+		/*
+		 * Idle connections held by pool manager are useless now.
+		 */
+		if (pool_manager_pid)
+			kill(pool_manager_pid, SIGUSR1);
+
 		if (reqkind == NODE_UP_REQUEST)
 		{
 			pool_log("failback done. reconnect host %s(%d)",
@@ -2524,6 +2724,37 @@ static void reaper(void)
 			pool_log("fork a new worker child pid %d", worker_pid);
 		}
 
+		/* exiting process was pool manager */
+		else if (pool_manager_pid && pid == pool_manager_pid)
+		{
+			if (WIFSIGNALED(status))
+				pool_log("pool manager %d exits with status %d by signal %d", pid, status, WTERMSIG(status));
+			else
+				pool_log("pool manager %d exits with status %d", pid, status);
+
+			if (status)
+			{
+				pool_manager_pid = pool_manager_fork_a_child();
+				pool_log("fork a new pool manager pid %d", pool_manager_pid);
+			}
+		}
+
+		/* exiting process was admission queue process */
+		else if (admission_pid && pid == admission_pid)
+		{
+			if (WIFSIGNALED(status))
+				pool_log("admission queue process %d exits with status %d by signal %d", pid, status, WTERMSIG(status));
+			else
+				pool_log("admission queue process %d exits with status %d", pid, status);
+
+			/* children connected to it exit and are restarted as well */
+			if (!exiting && status)
+			{
+				admission_pid = admission_fork_a_child();
+				pool_log("fork a new admission queue process pid %d", admission_pid);
+			}
+		}
+
 		/* exiting process was watchdog process */
 		else if (pool_config->use_watchdog && wd_is_watchdog_pid(pid))
 		{
@@ -2542,10 +2773,22 @@ static void reaper(void)
 				pool_debug("child %d exits with status %d", pid, status);
 
 			/* look for exiting child's pid */
-			for (i=0;i<pool_config->num_init_children;i++)
+			for (i=0;i<pool_config->max_children;i++)
 			{
 				if (pid == process_info[i].pid)
 				{
+					/* retired by dynamic scaling. leave the slot empty */
+					if (retiring[i])
+					{
+						retiring[i] = 0;
+						process_info[i].pid = 0;
+						process_info[i].idle = 0;
+						memset(process_info[i].connection_info, 0,
+							   sizeof(ConnectionInfo) * pool_config->max_pool * MAX_NUM_BACKENDS);
+						pool_debug("child %d retired", pid);
+						break;
+					}
+
 					/* if found, fork a new child */
 					if (!switching && !exiting && status)
 					{
@@ -2591,10 +2834,14 @@ pool_get_process_list(int *array_size)
 	int	   *array;
 	int		i;
 
-	*array_size = pool_config->num_init_children;
-	array = calloc(*array_size, sizeof(int));
-	for (i = 0; i < *array_size; i++)
-		array[i] = process_info[i].pid;
+	array = calloc(pool_config->max_children, sizeof(int));
+	*array_size = 0;
+	for (i = 0; i < pool_config->max_children; i++)
+	{
+		/* skip slots not used by dynamic scaling of children */
+		if (process_info[i].pid)
+			array[(*array_size)++] = process_info[i].pid;
+	}
 
 	return array;
 }
@@ -2607,7 +2854,7 @@ pool_get_process_info(pid_t pid)
 {
 	int		i;
 
-	for (i = 0; i < pool_config->num_init_children; i++)
+	for (i = 0; i < pool_config->max_children; i++)
 		if (process_info[i].pid == pid)
 			return &process_info[i];
 
@@ -2676,7 +2923,7 @@ static void kill_all_children(int sig)
 	int i;
 
 	/* kill all children */
-	for (i = 0; i < pool_config->num_init_children; i++)
+	for (i = 0; i < pool_config->max_children; i++)
 	{
 		pid_t pid = process_info[i].pid;
 		if (pid)
@@ -2690,6 +2937,78 @@ static void kill_all_children(int sig)
 		kill(pcp_pid, sig);
 }
 
+/*
+ * Keep the number of idle children between min_spare_children and
+ * max_spare_children. If there are too few idle children, fork new
+ * ones into empty slots, doubling the number forked at once (up to
+ * MAX_SPAWN_RATE) while the shortage continues. If there are too
+ * many, ask one idle child to exit per call. The number of children
+ * never goes beyond max_children nor below num_init_children.
+ */
+static void maintain_spare_children(void)
+{
+	int i;
+	int num_live = 0;
+	int num_idle = 0;
+	int last_idle = -1;
+
+	if (pool_config->max_spare_children <= 0 || switching || exiting)
+		return;
+
+	for (i = 0; i < pool_config->max_children; i++)
+	{
+		if (process_info[i].pid == 0 || retiring[i])
+			continue;
+
+		num_live++;
+		if (process_info[i].idle)
+		{
+			num_idle++;
+			last_idle = i;
+		}
+	}
+
+	if (num_idle < pool_config->min_spare_children && num_live < pool_config->max_children)
+	{
+		int num_fork = pool_config->min_spare_children - num_idle;
+
+		if (num_fork > spawn_rate)
+			num_fork = spawn_rate;
+
+		for (i = 0; i < pool_config->max_children && num_fork > 0; i++)
+		{
+			if (process_info[i].pid)
+				continue;
+
+			/* count as idle until the child reports its state */
+			process_info[i].need_to_restart = 0;
+			process_info[i].idle = 1;
+			process_info[i].pid = fork_a_child(unix_fd, inet_fd, i);
+			process_info[i].start_time = time(NULL);
+			pool_debug("maintain_spare_children: fork a new child pid %d", process_info[i].pid);
+			num_fork--;
+		}
+
+		if (spawn_rate < MAX_SPAWN_RATE)
+			spawn_rate *= 2;
+		return;
+	}
+
+	spawn_rate = 1;
+
+	if (num_idle > pool_config->max_spare_children && num_live > pool_config->num_init_children)
+	{
+		/*
+		 * SIGTERM is smart shutdown. The child exits as soon as it
+		 * finds itself idle, even if it has just accepted a
+		 * connection request.
+		 */
+		retiring[last_idle] = 1;
+		kill(process_info[last_idle].pid, SIGTERM);
+		pool_debug("maintain_spare_children: retire child pid %d", process_info[last_idle].pid);
+	}
+}
+
 /*
  * pause in a period specified by timeout. If any data is coming
  * through pipe_fds[0], that means one of: failover request(SIGUSR1),
@@ -2743,10 +3062,18 @@ void pool_sleep(unsigned int second)
 			timeout.tv_usec += 1000000;
 		}
 
+		/* check idle children every second */
+		if (pool_config->max_spare_children > 0 && timeout.tv_sec >= 1)
+		{
+			timeout.tv_sec = 1;
+			timeout.tv_usec = 0;
+		}
+
 		r = pool_pause(&timeout);
 		POOL_SETMASK(&BlockSig);
 		if (r > 0)
 			CHECK_REQUEST;
+		maintain_spare_children();
 		POOL_SETMASK(&UnBlockSig);
 		gettimeofday(&current_time, NULL);
 	}
@@ -0,0 +1,187 @@
+/* -*-pgsql-c-*- */
+/*
+ *
+ * $Header$
+ *
+ * pgpool: a language independent connection pool server for PostgreSQL
+ * written by Tatsuo Ishii
+ *
+ * Copyright (c) 2003-2014	PgPool Global Development Group
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that copyright notice and this permission
+ * notice appear in supporting documentation, and that the name of the
+ * author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * murmurhash3.c: incremental version of MurmurHash3 x64 128-bit.
+ *
+ * MurmurHash3 was written by Austin Appleby, and placed in the public
+ * domain. This is a fast non-cryptographic hash, which must not be
+ * used where collisions could be forged to cause harm: its users
+ * should verify the hashed data on match.
+ *
+ */
+
+#include <string.h>
+#include "murmurhash3.h"
+
+#define ROTL64(x, r)	(((x) << (r)) | ((x) >> (64 - (r))))
+
+static const uint64_t c1 = 0x87c37b91114253d5ULL;
+static const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+static uint64_t getblock64(const unsigned char *p);
+static uint64_t fmix64(uint64_t k);
+static void murmur3_block(MURMUR3_CTX *ctx, const unsigned char *p);
+
+/*
+ * Read a little endian 64-bit word
+ */
+static uint64_t getblock64(const unsigned char *p)
+{
+	return (uint64_t)p[0] | (uint64_t)p[1] << 8 |
+		(uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+		(uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 |
+		(uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+/*
+ * Finalization mix
+ */
+static uint64_t fmix64(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+/*
+ * Hash a 16 bytes block
+ */
+static void murmur3_block(MURMUR3_CTX *ctx, const unsigned char *p)
+{
+	uint64_t k1 = getblock64(p);
+	uint64_t k2 = getblock64(p + 8);
+
+	k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; ctx->h1 ^= k1;
+
+	ctx->h1 = ROTL64(ctx->h1, 27); ctx->h1 += ctx->h2;
+	ctx->h1 = ctx->h1 * 5 + 0x52dce729;
+
+	k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; ctx->h2 ^= k2;
+
+	ctx->h2 = ROTL64(ctx->h2, 31); ctx->h2 += ctx->h1;
+	ctx->h2 = ctx->h2 * 5 + 0x38495ab5;
+}
+
+void murmur3_init(MURMUR3_CTX *ctx, uint32_t seed)
+{
+	ctx->h1 = seed;
+	ctx->h2 = seed;
+	ctx->tail_len = 0;
+	ctx->total_len = 0;
+}
+
+void murmur3_update(MURMUR3_CTX *ctx, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	ctx->total_len += len;
+
+	/* Complete the pending block first */
+	if (ctx->tail_len > 0)
+	{
+		size_t n = sizeof(ctx->tail) - ctx->tail_len;
+
+		if (n > len)
+			n = len;
+		memcpy(ctx->tail + ctx->tail_len, p, n);
+		ctx->tail_len += n;
+		p += n;
+		len -= n;
+
+		if (ctx->tail_len < sizeof(ctx->tail))
+			return;
+		murmur3_block(ctx, ctx->tail);
+		ctx->tail_len = 0;
+	}
+
+	while (len >= 16)
+	{
+		murmur3_block(ctx, p);
+		p += 16;
+		len -= 16;
+	}
+
+	memcpy(ctx->tail, p, len);
+	ctx->tail_len = len;
+}
+
+/*
+ * Finish hashing and write the 128-bit hash value as 32 hex digits
+ * followed by '\0' to hexsum.
+ */
+void murmur3_final(MURMUR3_CTX *ctx, char *hexsum)
+{
+	static const char hex[] = "0123456789abcdef";
+	const unsigned char *tail = ctx->tail;
+	uint64_t h1 = ctx->h1;
+	uint64_t h2 = ctx->h2;
+	uint64_t k1 = 0;
+	uint64_t k2 = 0;
+	uint64_t h[2];
+	int i;
+
+	switch (ctx->tail_len)
+	{
+		case 15: k2 ^= (uint64_t)tail[14] << 48;
+		case 14: k2 ^= (uint64_t)tail[13] << 40;
+		case 13: k2 ^= (uint64_t)tail[12] << 32;
+		case 12: k2 ^= (uint64_t)tail[11] << 24;
+		case 11: k2 ^= (uint64_t)tail[10] << 16;
+		case 10: k2 ^= (uint64_t)tail[9] << 8;
+		case  9: k2 ^= (uint64_t)tail[8];
+			k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+		case  8: k1 ^= (uint64_t)tail[7] << 56;
+		case  7: k1 ^= (uint64_t)tail[6] << 48;
+		case  6: k1 ^= (uint64_t)tail[5] << 40;
+		case  5: k1 ^= (uint64_t)tail[4] << 32;
+		case  4: k1 ^= (uint64_t)tail[3] << 24;
+		case  3: k1 ^= (uint64_t)tail[2] << 16;
+		case  2: k1 ^= (uint64_t)tail[1] << 8;
+		case  1: k1 ^= (uint64_t)tail[0];
+			k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+	}
+
+	h1 ^= ctx->total_len;
+	h2 ^= ctx->total_len;
+
+	h1 += h2;
+	h2 += h1;
+
+	h1 = fmix64(h1);
+	h2 = fmix64(h2);
+
+	h1 += h2;
+	h2 += h1;
+
+	h[0] = h1;
+	h[1] = h2;
+	for (i = 0; i < 16; i++)
+	{
+		unsigned char b = (unsigned char)(h[i / 8] >> ((i % 8) * 8));
+
+		hexsum[i * 2] = hex[b >> 4];
+		hexsum[i * 2 + 1] = hex[b & 0x0f];
+	}
+	hexsum[MURMUR3_HEXLEN] = '\0';
+}
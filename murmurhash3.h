@@ -0,0 +1,50 @@
+/* -*-pgsql-c-*- */
+/*
+ *
+ * $Header$
+ *
+ * pgpool: a language independent connection pool server for PostgreSQL
+ * written by Tatsuo Ishii
+ *
+ * Copyright (c) 2003-2014	PgPool Global Development Group
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that copyright notice and this permission
+ * notice appear in supporting documentation, and that the name of the
+ * author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * murmurhash3.h: Interface to murmurhash3.c
+ *
+ */
+
+#ifndef MURMURHASH3_H
+#define MURMURHASH3_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MURMUR3_HEXLEN 32		/* length of hex string of a hash value */
+
+/*
+ * State of incremental hashing. Data can be fed in any number of
+ * pieces and the result is the same as hashing them at once.
+ */
+typedef struct {
+	uint64_t h1;
+	uint64_t h2;
+	unsigned char tail[16];		/* data not hashed yet */
+	size_t tail_len;
+	size_t total_len;
+} MURMUR3_CTX;
+
+extern void murmur3_init(MURMUR3_CTX *ctx, uint32_t seed);
+extern void murmur3_update(MURMUR3_CTX *ctx, const void *data, size_t len);
+extern void murmur3_final(MURMUR3_CTX *ctx, char *hexsum);
+
+#endif /* MURMURHASH3_H */
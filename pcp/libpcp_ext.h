@@ -89,6 +89,10 @@ typedef struct {
 							 * might be out of control of
 							 * pgpool-II. So we use "char" here.
 							 */
+	int			client_pid;	/* process id sent to the frontend. differs
+							 * from pid once the backend is reconnected
+							 * by transaction_pooling */
+	int			client_key;	/* cancel key sent to the frontend */
 } ConnectionInfo;
 
 /*
@@ -105,6 +109,9 @@ typedef struct {
 								 * failback a node in streaming
 								 * replication mode.
 								 */
+	char idle;		/* non 0 if waiting for a connection request.
+					 * used for dynamic scaling of children.
+					 */
 } ProcessInfo;
 
 /*
@@ -460,7 +460,7 @@ pcp_do_child(int unix_fd, int inet_fd, char *pcp_conf_file)
 			{
 				int proc_id;
 				int wsize;
-				int num_proc = pool_config->num_init_children;
+				int num_proc = pool_config->max_children;
 				int i;
 
 				proc_id = atoi(buf);
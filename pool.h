@@ -100,6 +100,13 @@ typedef enum {
  */
 #define MAX_STARTUP_PACKET_LENGTH 10000
 
+/*
+ * Upper limit of max_sessions_per_child.  The protocol engine waits
+ * for the session sockets with select(2), so the file descriptors of
+ * all sessions of a child must stay well below FD_SETSIZE.
+ */
+#define MAX_SESSIONS_PER_CHILD	256
+
 
 typedef struct StartupPacket_v2
 {
@@ -138,6 +145,18 @@ typedef struct {
 	char **values;		/* values */
 } ParamStatus;
 
+/*
+ * Data referenced by the write buffer instead of being copied into
+ * it. It is written after the first wbufpo bytes of the write buffer.
+ */
+#define MAX_WRITE_REFS 8
+
+typedef struct {
+	int wbufpo;	/* write buffer offset the data follows */
+	char *buf;	/* data owned by the caller */
+	int len;	/* its length */
+} POOL_WRITE_REF;
+
 /*
  * stream connection structure
  */
@@ -147,6 +166,8 @@ typedef struct {
 	char *wbuf;	/* write buffer for the connection */
 	int wbufsz;	/* write buffer size */
 	int wbufpo;	/* buffer offset */
+	POOL_WRITE_REF wrefs[MAX_WRITE_REFS];	/* data to be written with wbuf */
+	int nwrefs;	/* number of wrefs */
 
 #ifdef USE_SSL
 	SSL_CTX *ssl_ctx; /* SSL connection context */
@@ -158,13 +179,13 @@ typedef struct {
 	int po;		/* pending data offset */
 	int bufsz;	/* pending data buffer size */
 	int len;	/* pending data length */
+	int vpo;	/* offset of data returned by the last pool_read2, or -1.
+				 * data after vpo must not be moved or overwritten */
+	char *hp_old;	/* previous buffer still referenced by pool_read2 data */
 
 	char *sbuf;	/* buffer for pool_read_string */
 	int sbufsz;	/* its size in bytes */
 
-	char *buf2;	/* buffer for pool_read2 */
-	int bufsz2;	/* its size in bytes */
-
 	char *buf3;	/* buffer for pool_push/pop */
 	int bufsz3;	/* its size in bytes */
 
@@ -225,6 +246,7 @@ typedef struct {
 typedef struct {
 	ConnectionInfo *info;		/* connection info on shmem */
     POOL_CONNECTION_POOL_SLOT	*slots[MAX_NUM_BACKENDS];
+	bool parked;	/* true if held by a parked session (see max_sessions_per_child) */
 } POOL_CONNECTION_POOL;
 
 typedef struct {
@@ -342,11 +364,19 @@ extern int my_master_node_id;
 #define NO_LOAD_BALANCE "/*NO LOAD BALANCE*/"
 #define NO_LOAD_BALANCE_COMMENT_SZ (sizeof(NO_LOAD_BALANCE)-1)
 
-#define MAX_NUM_SEMAPHORES		4
+#define MAX_NUM_SEMAPHORES		5
 #define CONN_COUNTER_SEM 0
 #define REQUEST_INFO_SEM 1
-#define SHM_CACHE_SEM	2
-#define QUERY_CACHE_STATS_SEM	3
+#define QUERY_CACHE_STATS_SEM	2
+#define OID_MAP_SEM	3
+#define QUERY_CACHE_FLIGHT_SEM	4
+
+/*
+ * Each partition of the shmem query cache has its own semaphore
+ * following the semaphores above.
+ */
+#define MAX_MEMQCACHE_PARTITIONS	256
+#define SHM_CACHE_PARTITION_SEM(i)	(MAX_NUM_SEMAPHORES + (i))
 #define MAX_REQUEST_QUEUE_SIZE	10
 
 /*
@@ -474,6 +504,7 @@ extern POOL_STATUS pool_process_query(POOL_CONNECTION *frontend,
 
 extern int pool_do_auth(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
 extern int pool_do_reauth(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *cp);
+extern int pool_do_backend_auth(POOL_CONNECTION_POOL_SLOT *cp);
 
 /* SSL functionality */
 extern void pool_ssl_negotiate_serverclient(POOL_CONNECTION *cp);
@@ -609,6 +640,8 @@ extern int wait_connection_closed(void);
 extern void cancel_request(CancelPacket *sp);
 extern void check_stop_request(void);
 extern void pool_initialize_private_backend_status(void);
+extern bool pool_is_epoll_accept(void);
+extern bool pool_can_park_session(POOL_CONNECTION_POOL *backend);
 
 /* pool_process_query.c */
 extern void reset_variables(void);
@@ -650,5 +683,15 @@ extern int connect_unix_domain_socket(int slot, bool retry);
 extern int connect_inet_domain_socket_by_port(char *host, int port, bool retry);
 extern int connect_unix_domain_socket_by_port(int port, char *socket_dir, bool retry);
 extern int pool_pool_index(void);
+extern bool pool_can_release_backend(POOL_CONNECTION_POOL *backend);
+extern bool pool_is_backend_released(void);
+extern void pool_release_backend(POOL_CONNECTION_POOL *backend);
+extern int pool_reacquire_backend(POOL_CONNECTION_POOL *backend);
+extern int pool_park_cp(void);
+extern POOL_CONNECTION_POOL *pool_unpark_cp(int index);
+extern int pool_detach_cp(POOL_CONNECTION_POOL *saved, ConnectionInfo *saved_info);
+extern POOL_CONNECTION_POOL *pool_attach_cp(POOL_CONNECTION_POOL *saved, ConnectionInfo *saved_info);
+extern POOL_CONNECTION_POOL *pool_get_shared_cp(StartupPacket *sp);
+extern int pool_put_shared_cp(POOL_CONNECTION_POOL *backend);
 
 #endif /* POOL_H */
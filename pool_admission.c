@@ -0,0 +1,654 @@
+/* -*-pgsql-c-*- */
+/*
+ * $Header$
+ *
+ * pgpool: a language independent connection pool server for PostgreSQL
+ * written by Tatsuo Ishii
+ *
+ * Copyright (c) 2003-2014	PgPool Global Development Group
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that copyright notice and this permission
+ * notice appear in supporting documentation, and that the name of the
+ * author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * pool_admission.c: admission queue of connection requests
+ *
+ * When admission_queue_length > 0, the admission queue process is the
+ * only process accepting connection requests from clients.  Accepted
+ * clients are queued in arrival order and passed to children waiting
+ * for a client through a UNIX domain socket using SCM_RIGHTS.  If the
+ * queue is full, or a client waits longer than admission_wait_timeout,
+ * the client receives an ErrorResponse instead of waiting in the
+ * kernel listen queue indefinitely.
+ *
+ * A child sends 'R' when it is ready to serve a new client, and
+ * receives 'A' with the client socket.  Before exiting, a child sends
+ * 'W' and returns the clients already sent to it with 'B' until 'W'
+ * is acknowledged, so that no client is lost.
+ *
+ */
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <poll.h>
+
+#include <signal.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "pool.h"
+#include "pool_config.h"
+#include "pool_stream.h"
+#include "pool_manager.h"
+#include "pool_admission.h"
+
+POOL_ADMISSION_STATS *pool_admission_stats;	/* statistics on shmem */
+
+/* upper bounds of the wait time histogram buckets in milliseconds */
+const int pool_admission_wait_bounds[POOL_ADMISSION_WAIT_BUCKETS - 1] = {1, 10, 100, 1000, 10000};
+
+/* max number of clients accepted at once */
+#define MAX_ACCEPT_AT_ONCE 64
+
+/*
+ * Client waiting for a child
+ */
+typedef struct {
+	int fd;
+	struct timeval queued_time;	/* when the client was accepted */
+} POOL_ADMISSION_CLIENT;
+
+/*
+ * Connection from a child
+ */
+typedef struct {
+	int fd;
+	pid_t pid;		/* pid of the child. 0 if unknown */
+	bool ready;		/* waiting for a client */
+	unsigned long ready_seq;	/* when the child became ready */
+} POOL_ADMISSION_CHILD;
+
+/* ring buffer of waiting clients, oldest first */
+static POOL_ADMISSION_CLIENT *queue;
+static int queue_head;
+static int queue_count;
+static int queue_size;
+
+static POOL_ADMISSION_CHILD *children;
+static int num_children;
+static int max_children;
+static unsigned long ready_seq;
+
+static volatile sig_atomic_t admission_exit_request = 0;
+
+static void enqueue_client(int fd, struct timeval *queued_time, bool head);
+static void accept_clients(int listen_fd);
+static void dispatch_clients(void);
+static void expire_clients(void);
+static void handle_child_message(int index);
+static void remove_child(int index);
+static void reject_client(int fd, char *message, char *detail);
+static long long int elapsed_usec(struct timeval *from, struct timeval *to);
+static int recv_admission(int fd, int *client_fd, struct timeval *queued_time);
+static RETSIGTYPE admission_signal_handler(int sig);
+
+/*
+ * Set the path of the UNIX domain socket the admission queue process
+ * listens on
+ */
+void pool_admission_socket_path(char *path, int len)
+{
+	snprintf(path, len, "%s/.s.PGPOOLADM.%d",
+			 pool_config->socket_dir, pool_config->port);
+}
+
+/*
+* admission queue process main loop
+*/
+void do_admission(int unix_fd, int inet_fd, int listen_fd)
+{
+	struct pollfd *pfds;
+	int nfds;
+	int i;
+
+	pool_debug("I am admission queue process %d", getpid());
+
+	/* Identify myself via ps */
+	init_ps_display("", "", "", "");
+	set_ps_display("admission queue", false);
+
+	/* set up signal handlers */
+	signal(SIGALRM, SIG_DFL);
+	signal(SIGTERM, admission_signal_handler);
+	signal(SIGINT, admission_signal_handler);
+	signal(SIGQUIT, admission_signal_handler);
+	signal(SIGHUP, SIG_IGN);
+	signal(SIGCHLD, SIG_IGN);
+	signal(SIGUSR1, SIG_IGN);
+	signal(SIGUSR2, SIG_IGN);
+	signal(SIGPIPE, SIG_IGN);
+
+	/* clients returned by exiting children may exceed the queue length */
+	queue_size = pool_config->admission_queue_length + pool_config->max_children;
+	queue = malloc(sizeof(POOL_ADMISSION_CLIENT) * queue_size);
+
+	/* exiting and new children may be connected at the same time */
+	max_children = pool_config->max_children * 2;
+	children = malloc(sizeof(POOL_ADMISSION_CHILD) * max_children);
+
+	pfds = malloc(sizeof(struct pollfd) * (3 + max_children));
+
+	if (queue == NULL || children == NULL || pfds == NULL)
+	{
+		pool_error("do_admission: malloc failed");
+		exit(1);
+	}
+
+	queue_head = queue_count = num_children = 0;
+	memset((char *)pool_admission_stats, 0, sizeof(POOL_ADMISSION_STATS));
+
+	/* accept as many clients as possible at once */
+	pool_set_nonblock(unix_fd);
+	if (inet_fd)
+		pool_set_nonblock(inet_fd);
+
+	for (;;)
+	{
+		int timeout = -1;
+
+		if (admission_exit_request)
+		{
+			while (queue_count > 0)
+			{
+				close(queue[queue_head].fd);
+				queue_head = (queue_head + 1) % queue_size;
+				queue_count--;
+			}
+			exit(0);
+		}
+
+		dispatch_clients();
+		expire_clients();
+
+		/* wake up when the oldest client times out */
+		if (queue_count > 0 && pool_config->admission_wait_timeout > 0)
+		{
+			struct timeval now;
+			long long int wait;
+
+			gettimeofday(&now, NULL);
+			wait = elapsed_usec(&queue[queue_head].queued_time, &now);
+			timeout = (pool_config->admission_wait_timeout * 1000000LL - wait + 999) / 1000;
+			if (timeout < 0)
+				timeout = 0;
+		}
+
+		nfds = 0;
+		pfds[nfds].fd = listen_fd;
+		pfds[nfds++].events = POLLIN;
+
+		pfds[nfds].fd = unix_fd;
+		pfds[nfds++].events = POLLIN;
+
+		pfds[nfds].fd = inet_fd ? inet_fd : -1;
+		pfds[nfds++].events = POLLIN;
+
+		for (i=0;i<num_children;i++)
+		{
+			pfds[nfds].fd = children[i].fd;
+			pfds[nfds++].events = POLLIN;
+		}
+
+		if (poll(pfds, nfds, timeout) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			pool_error("do_admission: poll() failed. reason: %s", strerror(errno));
+			exit(1);
+		}
+
+		/* children may be removed. check from the last one */
+		for (i=num_children-1;i>=0;i--)
+		{
+			if (pfds[3 + i].revents)
+				handle_child_message(i);
+		}
+
+		if (pfds[0].revents)
+		{
+			int fd = accept(listen_fd, NULL, NULL);
+			pid_t pid;
+
+			if (fd < 0)
+			{
+				if (errno != EINTR && errno != EAGAIN)
+					pool_error("do_admission: accept() failed. reason: %s", strerror(errno));
+			}
+			else if (pool_manager_check_peer(fd, &pid) < 0)
+				close(fd);
+			else if (num_children >= max_children)
+			{
+				pool_error("do_admission: too many connections from children");
+				close(fd);
+			}
+			else
+			{
+				children[num_children].fd = fd;
+				children[num_children].pid = pid;
+				children[num_children].ready = false;
+				num_children++;
+			}
+		}
+
+		if (pfds[1].revents)
+			accept_clients(unix_fd);
+
+		if (inet_fd && pfds[2].revents)
+			accept_clients(inet_fd);
+	}
+}
+
+/*
+ * Accept connection requests from clients and queue them.  If the
+ * queue is full, reject the clients.
+ */
+static void accept_clients(int listen_fd)
+{
+	struct timeval now;
+	int i;
+
+	for (i=0;i<MAX_ACCEPT_AT_ONCE;i++)
+	{
+		int fd = accept(listen_fd, NULL, NULL);
+
+		if (fd < 0)
+		{
+			if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+				pool_error("accept_clients: accept() failed. reason: %s", strerror(errno));
+			return;
+		}
+
+		if (queue_count >= pool_config->admission_queue_length)
+		{
+			pool_admission_stats->num_rejected++;
+			reject_client(fd, "sorry, too many clients already",
+						  "admission queue of pgpool-II is full");
+			continue;
+		}
+
+		gettimeofday(&now, NULL);
+		enqueue_client(fd, &now, false);
+	}
+}
+
+/*
+ * Add a client to the tail of the queue, or to the head if it has
+ * been returned by a child.
+ */
+static void enqueue_client(int fd, struct timeval *queued_time, bool head)
+{
+	POOL_ADMISSION_CLIENT *client;
+
+	if (queue_count >= queue_size)
+	{
+		pool_error("enqueue_client: admission queue overflow");
+		close(fd);
+		return;
+	}
+
+	if (head)
+	{
+		queue_head = (queue_head + queue_size - 1) % queue_size;
+		client = &queue[queue_head];
+	}
+	else
+		client = &queue[(queue_head + queue_count) % queue_size];
+
+	client->fd = fd;
+	client->queued_time = *queued_time;
+	queue_count++;
+
+	pool_admission_stats->queue_length = queue_count;
+	if (queue_count > pool_admission_stats->peak_queue_length)
+		pool_admission_stats->peak_queue_length = queue_count;
+}
+
+/*
+ * Pass queued clients to ready children.  The most recently ready
+ * child is preferred so that the others stay idle and can be retired
+ * by max_spare_children.
+ */
+static void dispatch_clients(void)
+{
+	while (queue_count > 0)
+	{
+		POOL_ADMISSION_CLIENT *client = &queue[queue_head];
+		struct timeval now;
+		long long int wait;
+		int child = -1;
+		int i;
+
+		for (i=0;i<num_children;i++)
+		{
+			if (children[i].ready &&
+				(child < 0 || children[i].ready_seq > children[child].ready_seq))
+				child = i;
+		}
+
+		if (child < 0)
+			return;
+
+		if (pool_manager_send_message(children[child].fd, POOL_ADMISSION_ADMIT,
+									  (char *)&client->queued_time, sizeof(client->queued_time),
+									  &client->fd, 1) < 0)
+		{
+			/* the child has gone. keep the client */
+			remove_child(child);
+			continue;
+		}
+		children[child].ready = false;
+
+		gettimeofday(&now, NULL);
+		wait = elapsed_usec(&client->queued_time, &now);
+
+		for (i=0;i<POOL_ADMISSION_WAIT_BUCKETS-1;i++)
+		{
+			if (wait < pool_admission_wait_bounds[i] * 1000LL)
+				break;
+		}
+		pool_admission_stats->wait_histogram[i]++;
+		pool_admission_stats->num_admitted++;
+		pool_admission_stats->total_wait_usec += wait;
+		if (wait > pool_admission_stats->max_wait_usec)
+			pool_admission_stats->max_wait_usec = wait;
+
+		/* the child owns the client now */
+		close(client->fd);
+		queue_head = (queue_head + 1) % queue_size;
+		queue_count--;
+		pool_admission_stats->queue_length = queue_count;
+	}
+}
+
+/*
+ * Reject clients waiting for more than admission_wait_timeout
+ */
+static void expire_clients(void)
+{
+	struct timeval now;
+
+	if (pool_config->admission_wait_timeout <= 0)
+		return;
+
+	gettimeofday(&now, NULL);
+	while (queue_count > 0 &&
+		   elapsed_usec(&queue[queue_head].queued_time, &now) >=
+		   pool_config->admission_wait_timeout * 1000000LL)
+	{
+		pool_debug("expire_clients: client timed out in admission queue");
+		pool_admission_stats->num_timeouts++;
+		reject_client(queue[queue_head].fd, "sorry, too many clients already",
+					  "timed out while waiting for a pgpool-II child process");
+		queue_head = (queue_head + 1) % queue_size;
+		queue_count--;
+		pool_admission_stats->queue_length = queue_count;
+	}
+}
+
+static void handle_child_message(int index)
+{
+	POOL_MANAGER_HEADER header;
+	int fd = children[index].fd;
+	int fds[MAX_NUM_BACKENDS];
+	char *data;
+	int i;
+
+	if (pool_manager_recv_message(fd, &header, &data, fds) < 0)
+	{
+		/* child exited */
+		remove_child(index);
+		return;
+	}
+
+	switch (header.kind)
+	{
+		case POOL_ADMISSION_READY:
+			/*
+			 * Clients are passed only to our children. The child has
+			 * been registered by the parent before it gets ready.
+			 */
+			if (children[index].pid && pool_get_process_info(children[index].pid) == NULL)
+			{
+				pool_error("handle_child_message: pid %d is not a pgpool child",
+						   (int)children[index].pid);
+				free(data);
+				remove_child(index);
+				return;
+			}
+			children[index].ready = true;
+			children[index].ready_seq = ++ready_seq;
+			break;
+
+		case POOL_ADMISSION_WITHDRAW:
+			children[index].ready = false;
+			pool_manager_send_message(fd, POOL_ADMISSION_WITHDRAW, NULL, 0, NULL, 0);
+			break;
+
+		case POOL_ADMISSION_BOUNCE:
+			if (header.num_fds == 1 && header.len == sizeof(struct timeval))
+			{
+				struct timeval queued_time;
+
+				/* the client is counted again when admitted */
+				memcpy(&queued_time, data, sizeof(queued_time));
+				enqueue_client(fds[0], &queued_time, true);
+				break;
+			}
+			/* fall through */
+
+		default:
+			pool_error("handle_child_message: unknown message kind %c", header.kind);
+			for (i=0;i<header.num_fds;i++)
+				close(fds[i]);
+			break;
+	}
+	free(data);
+}
+
+static void remove_child(int index)
+{
+	close(children[index].fd);
+	children[index] = children[--num_children];
+}
+
+/*
+ * Send an ErrorResponse to a client whose startup packet has not been
+ * read yet, and close the connection.  libpq accepts an error in
+ * place of the response to the startup packet or SSL request.
+ */
+static void reject_client(int fd, char *message, char *detail)
+{
+	char buf[512];
+	char discard[1024];
+	char *p = buf;
+	int len;
+
+	*p++ = 'E';
+	p += sizeof(len);
+	p += snprintf(p, 32, "SFATAL") + 1;
+	p += snprintf(p, 32, "C53300") + 1;
+	p += snprintf(p, 200, "M%s", message) + 1;
+	p += snprintf(p, 200, "D%s", detail) + 1;
+	*p++ = '\0';
+
+	len = htonl(p - buf - 1);
+	memcpy(buf + 1, &len, sizeof(len));
+
+	/*
+	 * Read what the client has sent so far.  Otherwise closing the
+	 * socket would reset the connection before the client reads the
+	 * error.
+	 */
+	pool_set_nonblock(fd);
+	while (read(fd, discard, sizeof(discard)) > 0)
+		;
+
+	if (write(fd, buf, p - buf) < 0)
+		pool_debug("reject_client: write() failed. reason: %s", strerror(errno));
+
+	shutdown(fd, SHUT_WR);
+	close(fd);
+}
+
+static long long int elapsed_usec(struct timeval *from, struct timeval *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000000LL + (to->tv_usec - from->tv_usec);
+}
+
+static RETSIGTYPE admission_signal_handler(int sig)
+{
+	admission_exit_request = 1;
+}
+
+/*
+ * Connect to the admission queue process (child side).  Returns the
+ * socket, or -1 on error.
+ */
+int pool_admission_connect(void)
+{
+	struct sockaddr_un addr;
+	int fd;
+	int i;
+
+	/*
+	 * The admission queue process passes clients only to registered
+	 * children. Wait until the parent has recorded our pid, which
+	 * happens right after fork().
+	 */
+	for (i=0;process_info[my_proc_id].pid != getpid();i++)
+	{
+		if (i >= 10000)
+		{
+			pool_error("pool_admission_connect: pid %d is not registered", getpid());
+			return -1;
+		}
+		usleep(1000);
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+	{
+		pool_error("pool_admission_connect: socket() failed. reason: %s", strerror(errno));
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	pool_admission_socket_path(addr.sun_path, sizeof(addr.sun_path));
+
+	while (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		if (errno == EINTR)
+			continue;
+
+		pool_error("pool_admission_connect: connect() to %s failed. reason: %s",
+				   addr.sun_path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Tell the admission queue process that we are waiting for a client.
+ * Returns 0 on success, -1 on error.
+ */
+int pool_admission_ready(int fd)
+{
+	return pool_manager_send_message(fd, POOL_ADMISSION_READY, NULL, 0, NULL, 0);
+}
+
+/*
+ * Receive a message from the admission queue process. If it is 'A',
+ * the client socket is stored in *client_fd. Returns the message
+ * kind, or -1 on error.
+ */
+int pool_admission_receive(int fd, int *client_fd)
+{
+	struct timeval queued_time;
+
+	return recv_admission(fd, client_fd, &queued_time);
+}
+
+/*
+ * Stop waiting for clients before exiting.  Clients already sent to us
+ * are returned to the head of the queue.
+ */
+void pool_admission_withdraw(int fd)
+{
+	if (pool_manager_send_message(fd, POOL_ADMISSION_WITHDRAW, NULL, 0, NULL, 0) < 0)
+		return;
+
+	for (;;)
+	{
+		struct timeval queued_time;
+		int client_fd;
+		int kind;
+
+		kind = recv_admission(fd, &client_fd, &queued_time);
+		if (kind != POOL_ADMISSION_ADMIT)
+			return;
+
+		pool_manager_send_message(fd, POOL_ADMISSION_BOUNCE,
+								  (char *)&queued_time, sizeof(queued_time), &client_fd, 1);
+		close(client_fd);
+	}
+}
+
+static int recv_admission(int fd, int *client_fd, struct timeval *queued_time)
+{
+	POOL_MANAGER_HEADER header;
+	int fds[MAX_NUM_BACKENDS];
+	char *data;
+	int i;
+
+	if (pool_manager_recv_message(fd, &header, &data, fds) < 0)
+		return -1;
+
+	if (header.kind == POOL_ADMISSION_ADMIT)
+	{
+		if (header.num_fds != 1 || header.len != sizeof(*queued_time))
+		{
+			pool_error("recv_admission: invalid message");
+			for (i=0;i<header.num_fds;i++)
+				close(fds[i]);
+			free(data);
+			return -1;
+		}
+		*client_fd = fds[0];
+		memcpy(queued_time, data, sizeof(*queued_time));
+	}
+	else
+	{
+		for (i=0;i<header.num_fds;i++)
+			close(fds[i]);
+	}
+
+	free(data);
+	return header.kind;
+}
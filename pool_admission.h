@@ -0,0 +1,70 @@
+/* -*-pgsql-c-*- */
+/*
+ *
+ * $Header$
+ *
+ * pgpool: a language independent connection pool server for PostgreSQL
+ * written by Tatsuo Ishii
+ *
+ * Copyright (c) 2003-2014	PgPool Global Development Group
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that copyright notice and this permission
+ * notice appear in supporting documentation, and that the name of the
+ * author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * pool_admission.h: admission queue of connection requests
+ *
+ */
+
+#ifndef POOL_ADMISSION_H
+#define POOL_ADMISSION_H
+
+/*
+ * Message kinds exchanged between children and the admission queue
+ * process. Messages use POOL_MANAGER_HEADER.
+ */
+#define POOL_ADMISSION_READY	'R'		/* child is waiting for a client */
+#define POOL_ADMISSION_WITHDRAW	'W'		/* child stops waiting. acknowledged by 'W' */
+#define POOL_ADMISSION_ADMIT	'A'		/* client socket and its queued time follow */
+#define POOL_ADMISSION_BOUNCE	'B'		/* child returns a client it cannot serve */
+
+/*
+ * Number of wait time histogram buckets. Upper bounds of the buckets
+ * are in pool_admission_wait_bounds (milliseconds). The last bucket
+ * has no upper bound.
+ */
+#define POOL_ADMISSION_WAIT_BUCKETS 6
+
+/*
+ * Statistics of the admission queue on shmem. Updated by the
+ * admission queue process only.
+ */
+typedef struct {
+	int queue_length;			/* number of clients waiting for a child */
+	int peak_queue_length;		/* max of queue_length */
+	long long int num_admitted;	/* number of clients passed to children */
+	long long int num_timeouts;	/* number of clients timed out while waiting */
+	long long int num_rejected;	/* number of clients rejected because the queue was full */
+	long long int total_wait_usec;	/* sum of wait time of admitted clients */
+	long long int max_wait_usec;	/* max wait time of admitted clients */
+	long long int wait_histogram[POOL_ADMISSION_WAIT_BUCKETS];	/* admitted clients by wait time */
+} POOL_ADMISSION_STATS;
+
+extern POOL_ADMISSION_STATS *pool_admission_stats;
+extern const int pool_admission_wait_bounds[POOL_ADMISSION_WAIT_BUCKETS - 1];
+
+extern void pool_admission_socket_path(char *path, int len);
+extern void do_admission(int unix_fd, int inet_fd, int listen_fd);
+extern int pool_admission_connect(void);
+extern int pool_admission_ready(int fd);
+extern int pool_admission_receive(int fd, int *client_fd);
+extern void pool_admission_withdraw(int fd);
+
+#endif /* POOL_ADMISSION_H */
@@ -43,13 +43,17 @@
 #define AUTHFAIL_ERRORCODE "28000"
 
 static POOL_STATUS pool_send_backend_key_data(POOL_CONNECTION *frontend, int pid, int key, int protoMajor);
+static void pool_set_client_key(POOL_CONNECTION_POOL *cp, int pid, int key);
 static int do_clear_text_password(POOL_CONNECTION *backend, POOL_CONNECTION *frontend, int reauth, int protoMajor);
 static void pool_send_auth_fail(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *cp);
 static int do_crypt(POOL_CONNECTION *backend, POOL_CONNECTION *frontend, int reauth, int protoMajor);
 static int do_md5(POOL_CONNECTION *backend, POOL_CONNECTION *frontend, int reauth, int protoMajor);
 static int send_md5auth_request(POOL_CONNECTION *frontend, int protoMajor, char *salt);
 static int read_password_packet(POOL_CONNECTION *frontend, int protoMajor, 	char *password, int *pwdSize);
+static int do_md5_backends(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *cp, int protoMajor);
 static int send_password_packet(POOL_CONNECTION *backend, int protoMajor, char *password);
+static int write_password_packet(POOL_CONNECTION *backend, int protoMajor, char *password);
+static int read_auth_response(POOL_CONNECTION *backend, int protoMajor);
 static int send_auth_ok(POOL_CONNECTION *frontend, int protoMajor);
 
 /*
@@ -212,22 +216,38 @@ from pool_read_message_length and recheck the pg_hba.conf settings.");
 			return -1;
 		}
 
-		for (i=0;i<NUM_BACKENDS;i++)
+		if (NUM_BACKENDS > 1)
 		{
-			if (!VALID_BACKEND(i))
-				continue;
-
 			pool_debug("trying md5 authentication");
 
-			authkind = do_md5(CONNECTION(cp, i), frontend, 0, protoMajor);
+			authkind = do_md5_backends(frontend, cp, protoMajor);
 
 			if (authkind < 0)
 			{
-				pool_debug("do_md5failed in slot %d", i);
+				pool_debug("do_md5_backends failed");
 				pool_send_auth_fail(frontend, cp);
 				return -1;
 			}
 		}
+		else
+		{
+			for (i=0;i<NUM_BACKENDS;i++)
+			{
+				if (!VALID_BACKEND(i))
+					continue;
+
+				pool_debug("trying md5 authentication");
+
+				authkind = do_md5(CONNECTION(cp, i), frontend, 0, protoMajor);
+
+				if (authkind < 0)
+				{
+					pool_debug("do_md5failed in slot %d", i);
+					pool_send_auth_fail(frontend, cp);
+					return -1;
+				}
+			}
+		}
 	}
 
 	else
@@ -380,6 +400,7 @@ from pool_read_message_length and recheck the pg_hba.conf settings.");
 		return -1;
 	}
 
+	pool_set_client_key(cp, pid, key);
 	return pool_send_backend_key_data(frontend, pid, key, protoMajor);
 }
 
@@ -446,9 +467,149 @@ int pool_do_reauth(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *cp)
 		return -1;
 	}
 
+	pool_set_client_key(cp, MASTER_CONNECTION(cp)->pid, MASTER_CONNECTION(cp)->key);
 	return (pool_send_backend_key_data(frontend, MASTER_CONNECTION(cp)->pid, MASTER_CONNECTION(cp)->key, protoMajor) != POOL_CONTINUE);
 }
 
+/*
+ * Authenticate a newly created backend connection without the help of
+ * frontend, using the credentials saved when the session was first
+ * authenticated.  This is used to reconnect released backend
+ * connections in transaction pooling mode.  Messages are read up to
+ * ReadyForQuery and the pid, cancel key and parameter status of the
+ * connection are updated.  Only trust, clear text password and md5
+ * with pool_passwd can be handled.  PROTO_MAJOR_V3 only.
+ * If success return 0 otherwise -1.
+ */
+int pool_do_backend_auth(POOL_CONNECTION_POOL_SLOT *cp)
+{
+	POOL_CONNECTION *backend = cp->con;
+	char kind;
+	int len;
+	int authkind;
+	char salt[4];
+	char encbuf[POOL_PASSWD_LEN+1];
+	char *pool_passwd;
+	char *p;
+
+	for (;;)
+	{
+		if (pool_read(backend, &kind, sizeof(kind)))
+		{
+			pool_error("pool_do_backend_auth: failed to read kind from backend %d", backend->db_node_id);
+			return -1;
+		}
+
+		if (pool_read(backend, &len, sizeof(len)))
+		{
+			pool_error("pool_do_backend_auth: failed to read message length from backend %d", backend->db_node_id);
+			return -1;
+		}
+		len = ntohl(len) - sizeof(len);
+		if (len < 0)
+		{
+			pool_error("pool_do_backend_auth: invalid message length %d for kind %c", len + 4, kind);
+			return -1;
+		}
+
+		switch (kind)
+		{
+			case 'R':	/* Authentication request */
+				if (len < sizeof(authkind) ||
+					pool_read(backend, &authkind, sizeof(authkind)))
+				{
+					pool_error("pool_do_backend_auth: failed to read auth kind");
+					return -1;
+				}
+				authkind = ntohl(authkind);
+
+				if (authkind == 0)
+					break;
+
+				if (authkind != backend->auth_kind)
+				{
+					pool_error("pool_do_backend_auth: auth kind %d differs from the one of the session (%d)",
+							   authkind, backend->auth_kind);
+					return -1;
+				}
+
+				if (authkind == 3)
+				{
+					/* the saved password includes the terminating null */
+					if (send_password_packet(backend, PROTO_MAJOR_V3, backend->password) != 0)
+					{
+						pool_error("pool_do_backend_auth: clear text password authentication failed");
+						return -1;
+					}
+				}
+				else if (authkind == 5 && NUM_BACKENDS > 1)
+				{
+					pool_passwd = pool_get_passwd(cp->sp->user);
+					if (!pool_passwd)
+					{
+						pool_error("pool_do_backend_auth: %s does not exist in pool_passwd", cp->sp->user);
+						return -1;
+					}
+
+					if (pool_read(backend, salt, sizeof(salt)))
+					{
+						pool_error("pool_do_backend_auth: failed to read salt");
+						return -1;
+					}
+
+					pg_md5_encrypt(pool_passwd+strlen("md5"), salt, sizeof(salt), encbuf);
+					if (send_password_packet(backend, PROTO_MAJOR_V3, encbuf) != 0)
+					{
+						pool_error("pool_do_backend_auth: md5 authentication failed");
+						return -1;
+					}
+				}
+				else
+				{
+					pool_error("pool_do_backend_auth: unsupported auth kind: %d", authkind);
+					return -1;
+				}
+				break;
+
+			case 'K':	/* BackendKeyData */
+				if (len != sizeof(cp->pid) + sizeof(cp->key) ||
+					pool_read(backend, &cp->pid, sizeof(cp->pid)) ||
+					pool_read(backend, &cp->key, sizeof(cp->key)))
+				{
+					pool_error("pool_do_backend_auth: failed to read BackendKeyData");
+					return -1;
+				}
+				break;
+
+			case 'S':	/* ParameterStatus */
+				p = pool_read2(backend, len);
+				if (p == NULL)
+					return -1;
+				pool_add_param(&backend->params, p, p + strlen(p) + 1);
+				break;
+
+			case 'N':	/* NoticeResponse */
+				if (len > 0 && pool_read2(backend, len) == NULL)
+					return -1;
+				break;
+
+			case 'E':	/* ErrorResponse */
+				pool_error("pool_do_backend_auth: backend %d returned an error while reconnecting",
+						   backend->db_node_id);
+				return -1;
+
+			case 'Z':	/* ReadyForQuery */
+				if (pool_read(backend, &backend->tstate, sizeof(backend->tstate)))
+					return -1;
+				return 0;
+
+			default:
+				pool_error("pool_do_backend_auth: unknown response \"%c\" while reconnecting", kind);
+				return -1;
+		}
+	}
+}
+
 /*
 * send authentication failure message text to frontend
 */
@@ -505,6 +666,25 @@ static POOL_STATUS pool_send_backend_key_data(POOL_CONNECTION *frontend, int pid
 	return 0;
 }
 
+/*
+ * Remember the pid and cancel key sent to the frontend. cancel_request()
+ * looks up the session by them even after transaction_pooling has
+ * replaced the backend connections.
+ */
+static void pool_set_client_key(POOL_CONNECTION_POOL *cp, int pid, int key)
+{
+	int i;
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (VALID_BACKEND(i))
+		{
+			cp->info[i].client_pid = pid;
+			cp->info[i].client_key = key;
+		}
+	}
+}
+
 /*
  * perform clear text password authentication
  */
@@ -873,49 +1053,12 @@ static int do_md5(POOL_CONNECTION *backend, POOL_CONNECTION *frontend, int reaut
 				return -1;
 			}
 		}
-		kind = 0;
-
-		if (!reauth)
-		{
-			/*
-			 * If ok, authenticate against backends using pool_passwd
-			 */
-			/* Read salt */
-			if (pool_read(backend, salt, sizeof(salt)))
-			{
-				pool_error("do_md5: failed to read salt");
-				return -1;
-			}
-			pool_debug("DB node id: %d salt: %hhx%hhx%hhx%hhx", backend->db_node_id,
-					   salt[0], salt[1], salt[2], salt[3]);
-
-			/* Encrypt password in pool_passwd using the salt */
-			pg_md5_encrypt(pool_passwd+strlen("md5"), salt, sizeof(salt), encbuf);
-
-			/* Send password packet to backend and receive auth response */
-			kind = send_password_packet(backend, protoMajor, encbuf);
-			if (kind < 0)
-			{
-				return -1;
-			}
-		}
-
-		if (!reauth && kind == 0)
-		{
-			if (IS_MASTER_NODE_ID(backend->db_node_id))
-			{
-				/* Send auth ok to frontend */
-				if (send_auth_ok(frontend, protoMajor) < 0)
-				{
-					pool_error("do_md5: send_auth_ok failed");
-					return -1;
-				}
-			}
-
-			/* Save the auth info */
-			backend->auth_kind = 5;
-		}
-		return kind;
+		/*
+		 * Authentication against backends is done by
+		 * do_md5_backends() at connection time.  Only
+		 * re-authentication comes here.
+		 */
+		return 0;
 	}
 
 	/*
@@ -997,6 +1140,100 @@ static int do_md5(POOL_CONNECTION *backend, POOL_CONNECTION *frontend, int reaut
 	return kind;
 }
 
+/*
+ * md5 authentication against multiple backends using pool_passwd.
+ * After checking the password of the frontend, send password packets
+ * to all backends first and then read their responses, so that the
+ * backends authenticate concurrently.
+ */
+static int do_md5_backends(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *cp, int protoMajor)
+{
+	char salt[4];
+	int size;
+	char password[MAX_PASSWORD_SIZE];
+	char encbuf[POOL_PASSWD_LEN+1];
+	char *pool_passwd;
+	int kind;
+	int i;
+
+	/* Read password entry from pool_passwd */
+	pool_passwd = pool_get_passwd(frontend->username);
+	if (!pool_passwd)
+	{
+		pool_debug("do_md5_backends: %s does not exist in pool_passwd", frontend->username);
+		return -1;
+	}
+
+	/* Send md5 auth request to frontend with my own salt */
+	pool_random_salt(salt);
+	if (send_md5auth_request(frontend, protoMajor, salt))
+	{
+		pool_error("do_md5_backends: send_md5auth_request failed");
+		return -1;
+	}
+
+	/* Read password packet */
+	if (read_password_packet(frontend, protoMajor, password, &size))
+	{
+		pool_debug("do_md5_backends: read_password_packet failed");
+		return -1;
+	}
+
+	/* Check the password using my salt + pool_passwd */
+	pg_md5_encrypt(pool_passwd+strlen("md5"), salt, sizeof(salt), encbuf);
+	if (strcmp(password, encbuf))
+	{
+		/* Password does not match */
+		pool_debug("password does not match: frontend:%s pgpool:%s", password, encbuf);
+		return -1;
+	}
+
+	/*
+	 * If ok, authenticate against backends using pool_passwd
+	 */
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (!VALID_BACKEND(i))
+			continue;
+
+		/* Read salt */
+		if (pool_read(CONNECTION(cp, i), salt, sizeof(salt)))
+		{
+			pool_error("do_md5_backends: failed to read salt");
+			return -1;
+		}
+		pool_debug("DB node id: %d salt: %hhx%hhx%hhx%hhx", i,
+				   salt[0], salt[1], salt[2], salt[3]);
+
+		/* Encrypt password in pool_passwd using the salt */
+		pg_md5_encrypt(pool_passwd+strlen("md5"), salt, sizeof(salt), encbuf);
+
+		if (write_password_packet(CONNECTION(cp, i), protoMajor, encbuf) < 0)
+			return -1;
+	}
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (!VALID_BACKEND(i))
+			continue;
+
+		kind = read_auth_response(CONNECTION(cp, i), protoMajor);
+		if (kind != 0)
+			return kind;
+
+		/* Save the auth info */
+		CONNECTION(cp, i)->auth_kind = 5;
+	}
+
+	/* Send auth ok to frontend */
+	if (send_auth_ok(frontend, protoMajor) < 0)
+	{
+		pool_error("do_md5_backends: send_auth_ok failed");
+		return -1;
+	}
+	return 0;
+}
+
 /*
  * Send md5 authentication request packet to frontend
  */
@@ -1089,18 +1326,40 @@ static int read_password_packet(POOL_CONNECTION *frontend, int protoMajor, 	char
  * "password" must be null-terminated.
  */
 static int send_password_packet(POOL_CONNECTION *backend, int protoMajor, char *password)
+{
+	if (write_password_packet(backend, protoMajor, password) < 0)
+		return -1;
+
+	return read_auth_response(backend, protoMajor);
+}
+
+/*
+ * Send password packet to backend without waiting for the response
+ */
+static int write_password_packet(POOL_CONNECTION *backend, int protoMajor, char *password)
 {
 	int size;
-	int len;
-	int kind;
-	char response;
 
-	/* Send password packet to backend */
 	if (protoMajor == PROTO_MAJOR_V3)
 		pool_write(backend, "p", 1);
 	size = htonl(sizeof(size) + strlen(password)+1);
 	pool_write(backend, &size, sizeof(size));
-	pool_write_and_flush(backend, password, strlen(password)+1);
+	if (pool_write_and_flush(backend, password, strlen(password)+1) < 0)
+	{
+		pool_error("write_password_packet: failed to send password packet");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Read authentication response to password packet from backend
+ */
+static int read_auth_response(POOL_CONNECTION *backend, int protoMajor)
+{
+	int len;
+	int kind;
+	char response;
 
 	if (pool_read(backend, &response, sizeof(response)))
 	{
@@ -1697,6 +1697,12 @@ int pool_init_config(void)
 	pool_config->backend_socket_dir = NULL;
 	pool_config->pcp_timeout = 10;
 	pool_config->num_init_children = 32;
+	pool_config->max_children = 0;
+	pool_config->min_spare_children = 0;
+	pool_config->max_spare_children = 0;
+	pool_config->accept_method = "select";
+	pool_config->admission_queue_length = 0;
+	pool_config->admission_wait_timeout = 0;
 	pool_config->max_pool = 4;
 	pool_config->child_life_time = 300;
 	pool_config->client_idle_limit = 0;
@@ -1733,6 +1739,10 @@ int pool_init_config(void)
 	pool_config->delay_threshold = 0;
 	pool_config->log_standby_delay = "none";
 	pool_config->connection_cache = 1;
+	pool_config->transaction_pooling = 0;
+	pool_config->max_sessions_per_child = 1;
+	pool_config->shared_connection_pool = 0;
+	pool_config->use_splice = 0;
 	pool_config->health_check_timeout = 20;
 	pool_config->health_check_period = 0;
 	pool_config->health_check_user = "nobody";
@@ -1818,6 +1828,15 @@ int pool_init_config(void)
     pool_config->memqcache_memcached_port = 11211;
     pool_config->memqcache_total_size = 67108864;
     pool_config->memqcache_max_num_cache = 1000000;
+    pool_config->memqcache_max_num_oidmap = 1000000;
+    pool_config->memqcache_partitions = 16;
+    pool_config->memqcache_eviction_policy = "clock";
+    pool_config->memqcache_compaction_interval = 10;
+    pool_config->memqcache_compress_threshold = 0;
+    pool_config->memqcache_miss_wait_timeout = 0;
+    pool_config->memqcache_expire_grace = 0;
+    pool_config->memqcache_persistent_file = "";
+    pool_config->memqcache_parse_tree_key = 0;
     pool_config->memqcache_expire = 0;
     pool_config->memqcache_auto_cache_invalidation = 1;
     pool_config->memqcache_maxcache = 409600;
@@ -2151,6 +2170,91 @@ int pool_get_config(char *confpath, POOL_CONFIG_CONTEXT context)
 			}
 			pool_config->num_init_children = v;
 		}
+		else if (!strcmp(key, "max_children") && CHECK_CONTEXT(INIT_CONFIG, context))
+		{
+			int v = atoi(yytext);
+
+			if (token != POOL_INTEGER || v < 0)
+			{
+				pool_error("pool_config: %s must be equal or higher than 0 numeric value", key);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->max_children = v;
+		}
+		else if (!strcmp(key, "min_spare_children") && CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context))
+		{
+			int v = atoi(yytext);
+
+			if (token != POOL_INTEGER || v < 0)
+			{
+				pool_error("pool_config: %s must be equal or higher than 0 numeric value", key);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->min_spare_children = v;
+		}
+		else if (!strcmp(key, "max_spare_children") && CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context))
+		{
+			int v = atoi(yytext);
+
+			if (token != POOL_INTEGER || v < 0)
+			{
+				pool_error("pool_config: %s must be equal or higher than 0 numeric value", key);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->max_spare_children = v;
+		}
+		else if (!strcmp(key, "accept_method") && CHECK_CONTEXT(INIT_CONFIG, context))
+		{
+			char *str;
+
+			if (token != POOL_STRING && token != POOL_UNQUOTED_STRING && token != POOL_KEY)
+			{
+				PARSE_ERROR();
+				fclose(fd);
+				return(-1);
+			}
+			str = extract_string(yytext, token);
+			if (str == NULL)
+			{
+				fclose(fd);
+				return(-1);
+			}
+
+			if (strcmp(str, "select") && strcmp(str, "epoll"))
+			{
+				pool_error("pool_config: %s must be either select or epoll", key);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->accept_method = str;
+		}
+		else if (!strcmp(key, "admission_queue_length") && CHECK_CONTEXT(INIT_CONFIG, context))
+		{
+			int v = atoi(yytext);
+
+			if (token != POOL_INTEGER || v < 0)
+			{
+				pool_error("pool_config: %s must be equal or higher than 0 numeric value", key);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->admission_queue_length = v;
+		}
+		else if (!strcmp(key, "admission_wait_timeout") && CHECK_CONTEXT(INIT_CONFIG, context))
+		{
+			int v = atoi(yytext);
+
+			if (token != POOL_INTEGER || v < 0)
+			{
+				pool_error("pool_config: %s must be equal or higher than 0 numeric value", key);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->admission_wait_timeout = v;
+		}
 		else if (!strcmp(key, "child_life_time") &&
 				 CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context))
 		{
@@ -2673,6 +2777,58 @@ int pool_get_config(char *confpath, POOL_CONFIG_CONTEXT context)
 			pool_config->connection_cache = v;
 		}
 
+		else if (!strcmp(key, "transaction_pooling") && CHECK_CONTEXT(INIT_CONFIG, context))
+		{
+			int v = eval_logical(yytext);
+
+			if (v < 0)
+			{
+				pool_error("pool_config: invalid value %s for %s", yytext, key);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->transaction_pooling = v;
+		}
+
+		else if (!strcmp(key, "max_sessions_per_child") && CHECK_CONTEXT(INIT_CONFIG, context))
+		{
+			int v = atoi(yytext);
+
+			if (token != POOL_INTEGER || v < 1 || v > MAX_SESSIONS_PER_CHILD)
+			{
+				pool_error("pool_config: %s must be between 1 and %d", key, MAX_SESSIONS_PER_CHILD);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->max_sessions_per_child = v;
+		}
+
+		else if (!strcmp(key, "shared_connection_pool") && CHECK_CONTEXT(INIT_CONFIG, context))
+		{
+			int v = eval_logical(yytext);
+
+			if (v < 0)
+			{
+				pool_error("pool_config: invalid value %s for %s", yytext, key);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->shared_connection_pool = v;
+		}
+
+		else if (!strcmp(key, "use_splice") && CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context))
+		{
+			int v = eval_logical(yytext);
+
+			if (v < 0)
+			{
+				pool_error("pool_config: invalid value %s for %s", yytext, key);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->use_splice = v;
+		}
+
 		else if (!strcmp(key, "health_check_timeout") &&
 				 CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context))
 		{
@@ -4235,6 +4391,139 @@ int pool_get_config(char *confpath, POOL_CONFIG_CONTEXT context)
             }
             pool_config->memqcache_max_num_cache = v;
         }
+        else if (!strcmp(key, "memqcache_max_num_oidmap") && CHECK_CONTEXT(INIT_CONFIG, context))
+        {
+            int v = atoi(yytext);
+
+            if (token != POOL_INTEGER || v < 1)
+            {
+                pool_error("pool_config: %s must be higher than 0 numeric value", key);
+                fclose(fd);
+                return(-1);
+            }
+            pool_config->memqcache_max_num_oidmap = v;
+        }
+        else if (!strcmp(key, "memqcache_partitions") && CHECK_CONTEXT(INIT_CONFIG, context))
+        {
+            int v = atoi(yytext);
+
+            if (token != POOL_INTEGER || v < 1 || v > MAX_MEMQCACHE_PARTITIONS)
+            {
+                pool_error("pool_config: %s must be between 1 and %d", key, MAX_MEMQCACHE_PARTITIONS);
+                fclose(fd);
+                return(-1);
+            }
+            pool_config->memqcache_partitions = v;
+        }
+        else if (!strcmp(key, "memqcache_eviction_policy") && CHECK_CONTEXT(INIT_CONFIG, context))
+        {
+            char *str;
+
+            if (token != POOL_STRING && token != POOL_UNQUOTED_STRING && token != POOL_KEY)
+            {
+                PARSE_ERROR();
+                fclose(fd);
+                return(-1);
+            }
+            str = extract_string(yytext, token);
+            if (str == NULL)
+            {
+                fclose(fd);
+                return(-1);
+            }
+
+			if (strcmp(str, "block") && strcmp(str, "clock") && strcmp(str, "tinylfu"))
+			{
+				pool_error("memqcache_eviction_policy must be block, clock or tinylfu");
+				fclose(fd);
+				return -1;
+			}
+
+            pool_config->memqcache_eviction_policy = str;
+        }
+        else if (!strcmp(key, "memqcache_compaction_interval") &&
+				 CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context))
+        {
+            int v = atoi(yytext);
+
+            if (token != POOL_INTEGER || v < 0)
+            {
+                pool_error("pool_config: %s must be greater or equal to 0 numeric value", key);
+                fclose(fd);
+                return(-1);
+            }
+            pool_config->memqcache_compaction_interval = v;
+        }
+        else if (!strcmp(key, "memqcache_compress_threshold") &&
+				 CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context))
+        {
+            int v = atoi(yytext);
+
+            if (token != POOL_INTEGER || v < 0)
+            {
+                pool_error("pool_config: %s must be greater or equal to 0 numeric value", key);
+                fclose(fd);
+                return(-1);
+            }
+            pool_config->memqcache_compress_threshold = v;
+        }
+        else if (!strcmp(key, "memqcache_miss_wait_timeout") &&
+				 CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context))
+        {
+            int v = atoi(yytext);
+
+            if (token != POOL_INTEGER || v < 0)
+            {
+                pool_error("pool_config: %s must be greater or equal to 0 numeric value", key);
+                fclose(fd);
+                return(-1);
+            }
+            pool_config->memqcache_miss_wait_timeout = v;
+        }
+        else if (!strcmp(key, "memqcache_expire_grace") &&
+				 CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context))
+        {
+            int v = atoi(yytext);
+
+            if (token != POOL_INTEGER || v < 0)
+            {
+                pool_error("pool_config: %s must be greater or equal to 0 numeric value", key);
+                fclose(fd);
+                return(-1);
+            }
+            pool_config->memqcache_expire_grace = v;
+        }
+        else if (!strcmp(key, "memqcache_persistent_file") && CHECK_CONTEXT(INIT_CONFIG, context))
+        {
+            char *str;
+
+            if (token != POOL_STRING && token != POOL_UNQUOTED_STRING && token != POOL_KEY)
+            {
+                PARSE_ERROR();
+                fclose(fd);
+                return(-1);
+            }
+            str = extract_string(yytext, token);
+            if (str == NULL)
+            {
+                fclose(fd);
+                return(-1);
+            }
+            pool_config->memqcache_persistent_file = str;
+        }
+        else if (!strcmp(key, "memqcache_parse_tree_key") &&
+				 CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context))
+        {
+            int v = eval_logical(yytext);
+
+            if (v < 0)
+            {
+                pool_error("pool_config: invalid value %s for %s", yytext, key);
+                fclose(fd);
+                return(-1);
+            }
+            pool_config->memqcache_parse_tree_key = v;
+        }
         else if (!strcmp(key, "memqcache_expire") && CHECK_CONTEXT(INIT_CONFIG, context))
         {
             int v = atoi(yytext);
@@ -4437,6 +4726,35 @@ int pool_get_config(char *confpath, POOL_CONFIG_CONTEXT context)
 		}
 	}
 
+	/* max_children cannot be less than num_init_children */
+	if (pool_config->max_children < pool_config->num_init_children)
+	{
+		if (pool_config->max_children > 0)
+			pool_log("pool_config: max_children (%d) is less than num_init_children. set to %d",
+					 pool_config->max_children, pool_config->num_init_children);
+		pool_config->max_children = pool_config->num_init_children;
+	}
+
+	if (pool_config->max_spare_children > 0 &&
+		pool_config->max_spare_children < pool_config->min_spare_children)
+	{
+		pool_log("pool_config: max_spare_children (%d) is less than min_spare_children. set to %d",
+				 pool_config->max_spare_children, pool_config->min_spare_children);
+		pool_config->max_spare_children = pool_config->min_spare_children;
+	}
+
+	/* lock partitions are selected by the low bits of hash keys */
+	if (pool_config->memqcache_partitions & (pool_config->memqcache_partitions - 1))
+	{
+		int v = 1;
+
+		while (v * 2 <= pool_config->memqcache_partitions)
+			v *= 2;
+		pool_log("pool_config: memqcache_partitions (%d) is not a power of 2. set to %d",
+				 pool_config->memqcache_partitions, v);
+		pool_config->memqcache_partitions = v;
+	}
+
 	/* initialize system_db_hostname with a default socket path if empty */
 	if (*pool_config->system_db_hostname == '\0')
 	{
@@ -75,6 +75,12 @@ typedef struct {
 	char *pcp_socket_dir;		/* PCP socket directory */
 	int pcp_timeout;			/* PCP timeout for an idle client */
     int	num_init_children;	/* # of children initially pre-forked */
+    int	max_children;	/* max # of children. if 0, same as num_init_children */
+    int	min_spare_children;	/* min # of idle children kept by dynamic scaling */
+    int	max_spare_children;	/* max # of idle children. 0 disables dynamic scaling */
+	char *accept_method;	/* how children wait for connection requests: "select" or "epoll" */
+	int	admission_queue_length;	/* max # of clients waiting for a child. 0 disables admission queue */
+	int	admission_wait_timeout;	/* max seconds a client waits in admission queue. 0 means no timeout */
     int	child_life_time;	/* if idle for this seconds, child exits */
     int	connection_life_time;	/* if idle for this seconds, connection closes */
     int	child_max_connections;	/* if max_connections received, child exits */
@@ -121,6 +127,10 @@ typedef struct {
 										 * to enable the functionality. */
 	char *log_standby_delay;		/* how to log standby lag */
 	int connection_cache;		/* if non 0, cache connection pool */
+	int transaction_pooling;	/* if non 0, release backend connections at the end of each transaction */
+	int max_sessions_per_child;	/* max number of frontend sessions served by a child */
+	int shared_connection_pool;	/* if non 0, share idle backend connections among children */
+	int use_splice;	/* if non 0, forward DataRow messages with splice(2) */
 	int health_check_timeout;	/* health check timeout */
 	int health_check_period;	/* health check period */
 	char *health_check_user;		/* PostgreSQL user name for health check */
@@ -206,10 +216,19 @@ typedef struct {
 
 	int memory_cache_enabled;   /* if true, use the memory cache functionality, false by default */
 	char *memqcache_method;   /* Cache store method. Either 'shmem'(shared memory) or 'memcached'. 'shmem' by default */
-	char *memqcache_memcached_host;   /* Memcached host name. Mandatory if memqcache_method=memcached. */
+	char *memqcache_memcached_host;   /* Comma separated list of memcached host[:port]. Mandatory if memqcache_method=memcached. */
 	int memqcache_memcached_port;   /* Memcached port number. Mandatory if memqcache_method=memcached. */
 	int64 memqcache_total_size;   /* Total memory size in bytes for storing memory cache. Mandatory if memqcache_method=shmem. */
 	int memqcache_max_num_cache;   /* Total number of cache entries. Mandatory if memqcache_method=shmem. */
+	int memqcache_max_num_oidmap;	/* Total number of table oid map entries on shmem */
+	int memqcache_partitions;	/* Number of lock partitions of the shmem cache. Power of 2. */
+	char *memqcache_eviction_policy;	/* Eviction policy of the shmem cache. 'block', 'clock' or 'tinylfu' */
+	int memqcache_compaction_interval;	/* Interval in seconds to pack fragmented cache blocks. 0 disables */
+	int memqcache_compress_threshold;	/* Compress cached results of this size or larger. 0 disables */
+	int memqcache_miss_wait_timeout;	/* Milliseconds to wait for another child running the same query on cache miss. 0 disables */
+	int memqcache_expire_grace;	/* Seconds to keep serving an expired cache while it is refreshed. 0 disables */
+	char *memqcache_persistent_file;	/* File to keep shmem query cache across restarts. '' disables */
+	int memqcache_parse_tree_key;	/* If true, make cache keys from the parse tree of SELECT instead of the query text */
 	int memqcache_expire;   /* Memory cache entry life time specified in seconds. 60 by default. */
 	int memqcache_auto_cache_invalidation; /* If true, invalidation of query cache is triggered by corresponding */
 										   /* DDL/DML/DCL(and memqcache_expire).  If false, it is only triggered */
@@ -46,14 +46,20 @@
 #include "pool_stream.h"
 #include "pool_config.h"
 #include "pool_process_context.h"
+#include "pool_session_context.h"
+#include "pool_manager.h"
 
 static int pool_index;	/* Active pool index */
+static bool backend_released = false;	/* true if backend connections of active pool are released */
 POOL_CONNECTION_POOL *pool_connection_pool;	/* connection pool */
 volatile sig_atomic_t backend_timer_expired = 0; /* flag for connection closed timer is expired */
 volatile sig_atomic_t health_check_timer_expired;		/* non 0 if health check timer expired */
-static POOL_CONNECTION_POOL_SLOT *create_cp(POOL_CONNECTION_POOL_SLOT *cp, int slot);
+static POOL_CONNECTION_POOL_SLOT *create_cp(POOL_CONNECTION_POOL_SLOT *cp, int fd);
 static POOL_CONNECTION_POOL *new_connection(POOL_CONNECTION_POOL *p);
 static int check_socket_status(int fd);
+static POOL_CONNECTION_POOL *get_free_cp(void);
+static int open_inet_domain_socket(char *host, int port, struct sockaddr_in *addr);
+static int connect_backends(int *fds, int *failed_node);
 
 /*
 * initialize connection pools. this should be called once at the startup.
@@ -104,6 +110,13 @@ POOL_CONNECTION_POOL *pool_get_cp(char *user, char *database, int protoMajor, in
 
 	for (i=0;i<pool_config->max_pool;i++)
 	{
+		/* entries held by parked sessions are not available */
+		if (p->parked)
+		{
+			p++;
+			continue;
+		}
+
 		if (MASTER_CONNECTION(p) &&
 			MASTER_CONNECTION(p)->sp &&
 			MASTER_CONNECTION(p)->sp->major == protoMajor &&
@@ -211,6 +224,10 @@ void pool_discard_cp(char *user, char *database, int protoMajor)
 	memset(p, 0, sizeof(POOL_CONNECTION_POOL));
 	p->info = info;
 	memset(p->info, 0, sizeof(ConnectionInfo) * MAX_NUM_BACKENDS);
+
+	/* released connections of the active pool have gone as well */
+	if (p == &pool_connection_pool[pool_index])
+		backend_released = false;
 }
 
 
@@ -218,11 +235,31 @@ void pool_discard_cp(char *user, char *database, int protoMajor)
 * create a connection pool by user and database
 */
 POOL_CONNECTION_POOL *pool_create_cp(void)
+{
+	POOL_CONNECTION_POOL *p;
+	POOL_CONNECTION_POOL *ret;
+
+	p = get_free_cp();
+	if (p == NULL)
+		return NULL;
+
+	ret = new_connection(p);
+	if (ret)
+		pool_index = p - pool_connection_pool;
+	return ret;
+}
+
+/*
+ * Return an empty connection pool entry.  If there's no empty entry,
+ * discard the oldest connection to make one.  Entries held by parked
+ * sessions are never discarded.  Returns NULL if no entry is
+ * available.
+ */
+static POOL_CONNECTION_POOL *get_free_cp(void)
 {
 	int i, freed = 0;
-	time_t closetime;
+	time_t closetime = 0;
 	POOL_CONNECTION_POOL *oldestp;
-	POOL_CONNECTION_POOL *ret;
 	ConnectionInfo *info;
 
 	POOL_CONNECTION_POOL *p = pool_connection_pool;
@@ -236,12 +273,7 @@ POOL_CONNECTION_POOL *pool_create_cp(void)
 	for (i=0;i<pool_config->max_pool;i++)
 	{
 		if (MASTER_CONNECTION(p) == NULL)
-		{
-			ret = new_connection(p);
-			if (ret)
-				pool_index = i;
-			return ret;
-		}
+			return p;
 		p++;
 	}
 
@@ -250,9 +282,8 @@ POOL_CONNECTION_POOL *pool_create_cp(void)
 	/*
 	 * no empty connection slot was found. look for the oldest connection and discard it.
 	 */
-	oldestp = p = pool_connection_pool;
-	closetime = MASTER_CONNECTION(p)->closetime;
-	pool_index = 0;
+	oldestp = NULL;
+	p = pool_connection_pool;
 
 	for (i=0;i<pool_config->max_pool;i++)
 	{
@@ -260,15 +291,21 @@ POOL_CONNECTION_POOL *pool_create_cp(void)
 				   MASTER_CONNECTION(p)->sp->user,
 				   MASTER_CONNECTION(p)->sp->database,
 				   MASTER_CONNECTION(p)->closetime);
-		if (MASTER_CONNECTION(p)->closetime < closetime)
+		if (!p->parked &&
+			(oldestp == NULL || MASTER_CONNECTION(p)->closetime < closetime))
 		{
 			closetime = MASTER_CONNECTION(p)->closetime;
 			oldestp = p;
-			pool_index = i;
 		}
 		p++;
 	}
 
+	if (oldestp == NULL)
+	{
+		pool_error("pool_create_cp: all connection slots are held by parked sessions");
+		return NULL;
+	}
+
 	p = oldestp;
 	pool_send_frontend_exits(p);
 
@@ -297,8 +334,545 @@ POOL_CONNECTION_POOL *pool_create_cp(void)
 	p->info = info;
 	memset(p->info, 0, sizeof(ConnectionInfo) * MAX_NUM_BACKENDS);
 
-	ret = new_connection(p);
-	return ret;
+	return p;
+}
+
+/*
+ * Transaction pooling: return true if the backend connections of the
+ * session can be released now.  The session must be idle outside of a
+ * transaction, must not be in the middle of extended query messages,
+ * must not hold state which lives beyond the transaction, and we must
+ * be able to authenticate new connections without the frontend.
+ */
+bool pool_can_release_backend(POOL_CONNECTION_POOL *backend)
+{
+	int i;
+
+	if (!pool_config->transaction_pooling || backend_released)
+		return false;
+
+	if (MAJOR(backend) != PROTO_MAJOR_V3)
+		return false;
+
+	if (pool_is_query_in_progress() || pool_is_sync_pending() || pool_is_session_pinned())
+		return false;
+
+	/*
+	 * With md5 authentication we can reproduce the password packet
+	 * only if pool_passwd is used (i.e. NUM_BACKENDS > 1).  crypt is
+	 * not supported at all.
+	 */
+	switch (MASTER(backend)->auth_kind)
+	{
+		case 0:
+		case 3:
+			break;
+		case 5:
+			if (NUM_BACKENDS > 1)
+				break;
+			/* fall through */
+		default:
+			return false;
+	}
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (VALID_BACKEND(i) && TSTATE(backend, i) != 'I')
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Transaction pooling: return true if the backend connections of the
+ * active pool are released.
+ */
+bool pool_is_backend_released(void)
+{
+	return backend_released;
+}
+
+/*
+ * Transaction pooling: terminate the backend connections of the
+ * session so that the PostgreSQL connection slots are freed while the
+ * frontend is idle.  POOL_CONNECTION structures are kept because they
+ * hold authentication info, parameter status and transaction state
+ * to be reused by pool_reacquire_backend().
+ */
+void pool_release_backend(POOL_CONNECTION_POOL *backend)
+{
+	POOL_CONNECTION *con;
+	int i;
+
+	pool_debug("pool_release_backend: releasing backend connections");
+
+	pool_send_frontend_exits(backend);
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (!VALID_BACKEND(i))
+			continue;
+
+		con = CONNECTION(backend, i);
+
+		pool_ssl_close(con);
+		con->ssl_active = -1;
+
+		close(con->fd);
+		con->fd = -1;
+		con->len = 0;
+		con->po = 0;
+		con->wbufpo = 0;
+		con->nwrefs = 0;
+		con->no_forward = 0;
+	}
+
+	/*
+	 * The unnamed statement and portal do not survive the
+	 * connection.
+	 */
+	pool_remove_unnamed_sent_messages();
+
+	backend_released = true;
+}
+
+/*
+ * Transaction pooling: reconnect the backend connections released by
+ * pool_release_backend().  Returns 0 on success, -1 on error.
+ */
+int pool_reacquire_backend(POOL_CONNECTION_POOL *backend)
+{
+	POOL_CONNECTION *con;
+	int fds[MAX_NUM_BACKENDS];
+	int failed_node;
+	int i;
+
+	pool_debug("pool_reacquire_backend: reconnecting backend connections");
+
+	if (connect_backends(fds, &failed_node) < 0)
+	{
+		pool_error("pool_reacquire_backend: connect_backends() failed");
+
+		if (failed_node >= 0 && pool_config->fail_over_on_backend_error)
+			notice_backend_error(failed_node);
+		return -1;
+	}
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (VALID_BACKEND(i))
+			CONNECTION(backend, i)->fd = fds[i];
+	}
+
+	/*
+	 * Send startup packets to all backends before authenticating
+	 * against each, so that the backends start up concurrently.
+	 */
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (!VALID_BACKEND(i))
+			continue;
+
+		con = CONNECTION(backend, i);
+
+		pool_ssl_negotiate_clientserver(con);
+
+		if (send_startup_packet(CONNECTION_SLOT(backend, i)) < 0)
+		{
+			pool_error("pool_reacquire_backend: failed to send startup packet to backend %d", i);
+			return -1;
+		}
+	}
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (!VALID_BACKEND(i))
+			continue;
+
+		if (pool_do_backend_auth(CONNECTION_SLOT(backend, i)))
+			return -1;
+
+		backend->info[i].pid = CONNECTION_SLOT(backend, i)->pid;
+		backend->info[i].key = CONNECTION_SLOT(backend, i)->key;
+		backend->info[i].create_time = time(NULL);
+		backend->info[i].counter++;
+	}
+
+	backend_released = false;
+	return 0;
+}
+
+/*
+ * Session multiplexing: mark the connection pool entry of the active
+ * session as held by a parked session so that other sessions neither
+ * reuse nor discard it.  Returns the index of the entry, which is
+ * given back to pool_unpark_cp() when the session is resumed.
+ */
+int pool_park_cp(void)
+{
+	pool_connection_pool[pool_index].parked = true;
+	return pool_index;
+}
+
+/*
+ * Session multiplexing: make the entry held by a parked session the
+ * active connection pool again.
+ */
+POOL_CONNECTION_POOL *pool_unpark_cp(int index)
+{
+	POOL_CONNECTION_POOL *p = &pool_connection_pool[index];
+
+	p->parked = false;
+	pool_index = index;
+	backend_released = false;
+	return p;
+}
+
+/*
+ * Session multiplexing: move the active connection pool, whose
+ * backend connections have been released by pool_release_backend(),
+ * out of the connection pool table into saved and saved_info
+ * (NUM_BACKENDS entries) so that the entry can be used by other
+ * sessions.  Returns 0 on success, -1 on error.
+ */
+int pool_detach_cp(POOL_CONNECTION_POOL *saved, ConnectionInfo *saved_info)
+{
+	POOL_CONNECTION_POOL *p = &pool_connection_pool[pool_index];
+	ConnectionInfo *info;
+
+	if (!backend_released)
+	{
+		pool_error("pool_detach_cp: backend connections are not released");
+		return -1;
+	}
+
+	memcpy(saved, p, sizeof(POOL_CONNECTION_POOL));
+	memcpy(saved_info, p->info, sizeof(ConnectionInfo) * NUM_BACKENDS);
+	saved->info = NULL;
+
+	info = p->info;
+	memset(p, 0, sizeof(POOL_CONNECTION_POOL));
+	p->info = info;
+	memset(p->info, 0, sizeof(ConnectionInfo) * MAX_NUM_BACKENDS);
+
+	backend_released = false;
+	return 0;
+}
+
+/*
+ * Session multiplexing: put a connection pool detached by
+ * pool_detach_cp() back into the connection pool table and make it
+ * the active pool.  Its backend connections are still released and
+ * will be reconnected by pool_reacquire_backend().  Returns NULL if
+ * no entry is available.
+ */
+POOL_CONNECTION_POOL *pool_attach_cp(POOL_CONNECTION_POOL *saved, ConnectionInfo *saved_info)
+{
+	POOL_CONNECTION_POOL *p;
+	ConnectionInfo *info;
+
+	p = get_free_cp();
+	if (p == NULL)
+		return NULL;
+
+	info = p->info;
+	memcpy(p, saved, sizeof(POOL_CONNECTION_POOL));
+	p->info = info;
+	memcpy(p->info, saved_info, sizeof(ConnectionInfo) * NUM_BACKENDS);
+
+	pool_index = p - pool_connection_pool;
+	backend_released = true;
+	return p;
+}
+
+/*
+ * Shared connection pool: ask the pool manager for idle connections
+ * whose startup packet is identical to sp, and make them the active
+ * connection pool.  The startup packet of the slots is left NULL so
+ * that connect_using_existing_connection() sets sp.  Returns NULL if
+ * not found.
+ */
+POOL_CONNECTION_POOL *pool_get_shared_cp(StartupPacket *sp)
+{
+	POOL_CONNECTION_POOL *p;
+	POOL_CONNECTION_POOL_SLOT *s;
+	POOL_MANAGER_SLOT slot;
+	char *data, *reply, *bufp, *name, *value;
+	int reply_len, num_slots, num_valid;
+	int fds[MAX_NUM_BACKENDS];
+	int num_fds;
+	int i, j, n;
+
+	data = malloc(sizeof(int) + sp->len);
+	if (data == NULL)
+	{
+		pool_error("pool_get_shared_cp: malloc failed");
+		return NULL;
+	}
+	memcpy(data, &sp->len, sizeof(int));
+	memcpy(data + sizeof(int), sp->startup_packet, sp->len);
+
+	n = pool_manager_get(data, sizeof(int) + sp->len, &reply, &reply_len, fds, &num_fds);
+	free(data);
+	if (n <= 0)
+		return NULL;
+
+	if (reply_len < sizeof(int) + sp->len + sizeof(int))
+	{
+		pool_error("pool_get_shared_cp: invalid reply from pool manager");
+		for (i=0;i<num_fds;i++)
+			close(fds[i]);
+		free(reply);
+		return NULL;
+	}
+
+	/* the set of backends must not have been changed */
+	bufp = reply + sizeof(int) + sp->len;
+	memcpy(&num_slots, bufp, sizeof(int));
+	bufp += sizeof(int);
+
+	num_valid = 0;
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (VALID_BACKEND(i))
+			num_valid++;
+	}
+
+	p = NULL;
+	if (num_slots != num_fds || num_slots != num_valid)
+	{
+		pool_log("pool_get_shared_cp: backend status changed. discard shared connection");
+	}
+	else if ((p = get_free_cp()) == NULL)
+	{
+		pool_error("pool_get_shared_cp: no connection pool entry available");
+	}
+
+	if (p == NULL)
+	{
+		for (i=0;i<num_fds;i++)
+			close(fds[i]);
+		free(reply);
+		return NULL;
+	}
+
+	for (i=0;i<num_slots;i++)
+	{
+		memcpy(&slot, bufp, sizeof(slot));
+		bufp += sizeof(slot);
+
+		if (slot.node_id < 0 || slot.node_id >= NUM_BACKENDS ||
+			!VALID_BACKEND(slot.node_id) || p->slots[slot.node_id])
+		{
+			pool_log("pool_get_shared_cp: backend status changed. discard shared connection");
+			break;
+		}
+
+		s = malloc(sizeof(POOL_CONNECTION_POOL_SLOT));
+		if (s == NULL)
+		{
+			pool_error("pool_get_shared_cp: malloc failed");
+			break;
+		}
+
+		s->sp = NULL;
+		s->pid = slot.pid;
+		s->key = slot.key;
+		s->closetime = 0;
+		s->con = pool_open(fds[i]);
+		if (s->con == NULL)
+		{
+			free(s);
+			break;
+		}
+		fds[i] = -1;
+		p->slots[slot.node_id] = s;
+
+		s->con->isbackend = 1;
+		s->con->db_node_id = slot.node_id;
+		s->con->tstate = slot.tstate;
+		s->con->auth_kind = slot.auth_kind;
+		s->con->pwd_size = slot.pwd_size;
+		memcpy(s->con->password, slot.password, sizeof(slot.password));
+		memcpy(s->con->salt, slot.salt, sizeof(slot.salt));
+
+		if (pool_init_params(&s->con->params))
+			break;
+
+		for (j=0;j<slot.num_params;j++)
+		{
+			name = bufp;
+			value = name + strlen(name) + 1;
+			bufp = value + strlen(value) + 1;
+			if (pool_add_param(&s->con->params, name, value))
+				break;
+		}
+		if (j < slot.num_params)
+			break;
+
+		/* cancel requests are looked up by the connection info */
+		memcpy(&p->info[slot.node_id], &slot.info, sizeof(ConnectionInfo));
+		p->info[slot.node_id].counter++;
+		p->info[slot.node_id].connected = 0;
+
+		if (check_socket_status(s->con->fd) < 0)
+		{
+			pool_log("pool_get_shared_cp: shared connection closed by backend");
+			break;
+		}
+	}
+
+	free(reply);
+
+	if (i < num_slots)
+	{
+		ConnectionInfo *info;
+
+		for (j=0;j<num_fds;j++)
+		{
+			if (fds[j] >= 0)
+				close(fds[j]);
+		}
+
+		for (j=0;j<NUM_BACKENDS;j++)
+		{
+			if (p->slots[j] == NULL)
+				continue;
+			pool_close(p->slots[j]->con);
+			free(p->slots[j]);
+		}
+
+		info = p->info;
+		memset(p, 0, sizeof(POOL_CONNECTION_POOL));
+		p->info = info;
+		memset(p->info, 0, sizeof(ConnectionInfo) * MAX_NUM_BACKENDS);
+		return NULL;
+	}
+
+	pool_debug("pool_get_shared_cp: got shared connection. user: %s database: %s",
+			   sp->user, sp->database);
+
+	pool_index = p - pool_connection_pool;
+	return p;
+}
+
+/*
+ * Shared connection pool: hand over the idle connections of backend
+ * to the pool manager and remove them from the connection pool.
+ * Returns 0 on success.  Returns -1 if the connections cannot be
+ * shared, in which case they remain in the connection pool.
+ */
+int pool_put_shared_cp(POOL_CONNECTION_POOL *backend)
+{
+	POOL_MANAGER_SLOT slot;
+	StartupPacket *sp = MASTER_CONNECTION(backend)->sp;
+	ConnectionInfo *info;
+	char *data, *bufp, *slotp, *name, *value;
+	int len, num_slots;
+	int fds[MAX_NUM_BACKENDS];
+	int i, j;
+
+	len = sizeof(int) + sp->len + sizeof(int);
+	num_slots = 0;
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (!VALID_BACKEND(i))
+			continue;
+
+		/*
+		 * SSL session state cannot be passed to another process.
+		 * Pending data would be lost.
+		 */
+		if (CONNECTION(backend, i)->ssl_active > 0 ||
+			CONNECTION(backend, i)->len > 0 ||
+			CONNECTION(backend, i)->wbufpo > 0 ||
+			CONNECTION(backend, i)->nwrefs > 0)
+			return -1;
+
+		len += sizeof(POOL_MANAGER_SLOT);
+		for (j=0;pool_get_param(&CONNECTION(backend, i)->params, j, &name, &value) == 0;j++)
+			len += strlen(name) + 1 + strlen(value) + 1;
+
+		fds[num_slots++] = CONNECTION(backend, i)->fd;
+	}
+
+	data = malloc(len);
+	if (data == NULL)
+	{
+		pool_error("pool_put_shared_cp: malloc failed");
+		return -1;
+	}
+
+	bufp = data;
+	memcpy(bufp, &sp->len, sizeof(int));
+	bufp += sizeof(int);
+	memcpy(bufp, sp->startup_packet, sp->len);
+	bufp += sp->len;
+	memcpy(bufp, &num_slots, sizeof(int));
+	bufp += sizeof(int);
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		POOL_CONNECTION *con;
+
+		if (!VALID_BACKEND(i))
+			continue;
+
+		con = CONNECTION(backend, i);
+		memset(&slot, 0, sizeof(slot));
+		slot.node_id = i;
+		slot.pid = CONNECTION_SLOT(backend, i)->pid;
+		slot.key = CONNECTION_SLOT(backend, i)->key;
+		slot.tstate = con->tstate;
+		slot.auth_kind = con->auth_kind;
+		slot.pwd_size = con->pwd_size;
+		memcpy(slot.password, con->password, sizeof(slot.password));
+		memcpy(slot.salt, con->salt, sizeof(slot.salt));
+		memcpy(&slot.info, &backend->info[i], sizeof(ConnectionInfo));
+
+		/* the data may not be aligned. fill in the slot later */
+		slotp = bufp;
+		bufp += sizeof(slot);
+
+		for (j=0;pool_get_param(&con->params, j, &name, &value) == 0;j++)
+		{
+			strcpy(bufp, name);
+			bufp += strlen(name) + 1;
+			strcpy(bufp, value);
+			bufp += strlen(value) + 1;
+		}
+		slot.num_params = j;
+		slot.params_len = bufp - slotp - sizeof(slot);
+		memcpy(slotp, &slot, sizeof(slot));
+	}
+
+	i = pool_manager_put(data, len, fds, num_slots);
+	free(data);
+	if (i < 0)
+		return -1;
+
+	/*
+	 * The pool manager owns the connections now. Just close our
+	 * descriptors without sending Terminate.
+	 */
+	pool_debug("pool_put_shared_cp: handed over connection. user: %s database: %s",
+			   sp->user, sp->database);
+
+	pool_free_startup_packet(sp);
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (!VALID_BACKEND(i))
+			continue;
+		pool_close(CONNECTION(backend, i));
+		free(CONNECTION_SLOT(backend, i));
+	}
+
+	info = backend->info;
+	memset(backend, 0, sizeof(POOL_CONNECTION_POOL));
+	backend->info = info;
+	memset(backend->info, 0, sizeof(ConnectionInfo) * MAX_NUM_BACKENDS);
+	return 0;
 }
 
 /*
@@ -500,29 +1074,21 @@ int connect_unix_domain_socket_by_port(int port, char *socket_dir, bool retry)
 	return fd;
 }
 
-/*
- * Connect to PostgreSQL server by using INET domain socket.
- * If retry is true, retry to call connect() upon receiving EINTR error.
- */
-int connect_inet_domain_socket_by_port(char *host, int port, bool retry)
-{
-	int fd;
-	int len;
-	int on = 1;
-	struct sockaddr_in addr;
-	struct hostent *hp;
-	struct timeval timeout;
-	fd_set rset, wset;
-	int error;
-	socklen_t socklen;
-	int sts;
-
 #define CONNECT_TIMEOUT_MSEC 10000		/* specify select(2) timeout in milliseconds */
 #define CONNECT_TIMEOUT_SEC CONNECT_TIMEOUT_MSEC/1000	/* seconds part */
 /* microseconds part */
 #define CONNECT_TIMEOUT_MICROSEC (CONNECT_TIMEOUT_SEC == 0?CONNECT_TIMEOUT_MSEC*1000:\
 								  CONNECT_TIMEOUT_MSEC*1000 - CONNECT_TIMEOUT_SEC*1000*1000)
 
+/*
+ * Create a non blocking INET domain socket to connect to host:port
+ * and fill in addr.  Returns -1 on error.
+ */
+static int open_inet_domain_socket(char *host, int port, struct sockaddr_in *addr)
+{
+	int fd;
+	int on = 1;
+	struct hostent *hp;
 
 	fd = socket(AF_INET, SOCK_STREAM, 0);
 	if (fd < 0)
@@ -541,11 +1107,10 @@ int connect_inet_domain_socket_by_port(char *host, int port, bool retry)
 		return -1;
 	}
 
-	memset((char *) &addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
+	memset((char *) addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
 
-	addr.sin_port = htons(port);
-	len = sizeof(struct sockaddr_in);
+	addr->sin_port = htons(port);
 
 	hp = gethostbyname(host);
 	if ((hp == NULL) || (hp->h_addrtype != AF_INET))
@@ -554,11 +1119,34 @@ int connect_inet_domain_socket_by_port(char *host, int port, bool retry)
 		close(fd);
 		return -1;
 	}
-	memmove((char *) &(addr.sin_addr),
+	memmove((char *) &(addr->sin_addr),
 			(char *) hp->h_addr,
 			hp->h_length);
 
 	pool_set_nonblock(fd);
+	return fd;
+}
+
+/*
+ * Connect to PostgreSQL server by using INET domain socket.
+ * If retry is true, retry to call connect() upon receiving EINTR error.
+ */
+int connect_inet_domain_socket_by_port(char *host, int port, bool retry)
+{
+	int fd;
+	int len;
+	struct sockaddr_in addr;
+	struct timeval timeout;
+	fd_set rset, wset;
+	int error;
+	socklen_t socklen;
+	int sts;
+
+	fd = open_inet_domain_socket(host, port, &addr);
+	if (fd < 0)
+		return -1;
+
+	len = sizeof(struct sockaddr_in);
 
 	for (;;)
 	{
@@ -693,30 +1281,178 @@ int connect_inet_domain_socket_by_port(char *host, int port, bool retry)
 }
 
 /*
- * create connection pool
+ * Connect to all valid backends at once.  connect(2) over INET domain
+ * sockets is issued to every backend without waiting, and then the
+ * completions are waited for together, so that the time to connect
+ * is that of the slowest backend rather than the sum of all of them.
+ * The descriptors are stored in fds indexed by node id.  Returns -1
+ * on error, in which case *failed_node is set to the node failed (-1
+ * if none in particular) and all descriptors are closed.
  */
-static POOL_CONNECTION_POOL_SLOT *create_cp(POOL_CONNECTION_POOL_SLOT *cp, int slot)
+static int connect_backends(int *fds, int *failed_node)
 {
-	BackendInfo *b = &pool_config->backend_desc->backend_info[slot];
-	int fd;
+	BackendInfo *b;
+	struct sockaddr_in addr;
+	bool in_progress[MAX_NUM_BACKENDS];
+	struct timeval timeout;
+	fd_set wset;
+	int error;
+	socklen_t socklen;
+	int maxfd;
+	int sts;
+	int i;
 
-	if (*b->backend_hostname == '/')
+	*failed_node = -1;
+
+	for (i=0;i<NUM_BACKENDS;i++)
 	{
-		fd = connect_unix_domain_socket(slot, TRUE);
+		fds[i] = -1;
+		in_progress[i] = false;
 	}
-	else
+
+	for (i=0;i<NUM_BACKENDS;i++)
 	{
-		fd = connect_inet_domain_socket(slot, TRUE);
+		if (!VALID_BACKEND(i))
+			continue;
+
+		b = &pool_config->backend_desc->backend_info[i];
+
+		if (*b->backend_hostname == '/')
+		{
+			fds[i] = connect_unix_domain_socket(i, TRUE);
+			if (fds[i] < 0)
+				goto failed;
+			continue;
+		}
+
+		fds[i] = open_inet_domain_socket(b->backend_hostname, b->backend_port, &addr);
+		if (fds[i] < 0)
+			goto failed;
+
+		while (connect(fds[i], (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		{
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+
+			/*
+			 * connect() retried after EINTR returns EALREADY while the
+			 * first attempt is still in progress.
+			 */
+			if (errno == EINPROGRESS || errno == EALREADY)
+			{
+				in_progress[i] = true;
+				break;
+			}
+
+			if (errno == EISCONN)
+				break;
+
+			pool_error("connect_backends: connect() failed: %s", strerror(errno));
+			goto failed;
+		}
 	}
 
-	if (fd < 0)
+	/* wait for connections in progress */
+	for (;;)
+	{
+		if (exit_request)		/* exit request already sent */
+		{
+			pool_log("connect_backends: exit request has been sent");
+			i = -1;
+			goto failed;
+		}
+
+		FD_ZERO(&wset);
+		maxfd = -1;
+		for (i=0;i<NUM_BACKENDS;i++)
+		{
+			if (in_progress[i])
+			{
+				FD_SET(fds[i], &wset);
+				if (fds[i] > maxfd)
+					maxfd = fds[i];
+			}
+		}
+
+		if (maxfd < 0)
+			break;
+
+		timeout.tv_sec = CONNECT_TIMEOUT_SEC;
+		timeout.tv_usec = CONNECT_TIMEOUT_MICROSEC;
+		sts = select(maxfd+1, NULL, &wset, NULL, &timeout);
+
+		if (sts == 0)
+		{
+			pool_log("connect_backends: select() timed out. retrying...");
+			continue;
+		}
+		else if (sts < 0)
+		{
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+
+			pool_error("connect_backends: select() failed: %s", strerror(errno));
+			i = -1;
+			goto failed;
+		}
+
+		for (i=0;i<NUM_BACKENDS;i++)
+		{
+			if (!in_progress[i] || !FD_ISSET(fds[i], &wset))
+				continue;
+
+			error = 0;
+			socklen = sizeof(error);
+			if (getsockopt(fds[i], SOL_SOCKET, SO_ERROR, &error, &socklen) < 0)
+			{
+				pool_error("connect_backends: getsockopt() failed: %s", strerror(errno));
+				goto failed;
+			}
+			if (error != 0)
+			{
+				pool_error("connect_backends: getsockopt() detected error: %s", strerror(error));
+				goto failed;
+			}
+			in_progress[i] = false;
+		}
+	}
+
+	for (i=0;i<NUM_BACKENDS;i++)
 	{
+		if (VALID_BACKEND(i) &&
+			*pool_config->backend_desc->backend_info[i].backend_hostname != '/')
+			pool_unset_nonblock(fds[i]);
+	}
+	return 0;
+
+failed:
+	if (i >= 0)
+	{
+		b = &pool_config->backend_desc->backend_info[i];
 		pool_error("connection to %s(%d) failed", b->backend_hostname, b->backend_port);
-		return NULL;
+		*failed_node = i;
 	}
 
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (fds[i] >= 0)
+		{
+			close(fds[i]);
+			fds[i] = -1;
+		}
+	}
+	return -1;
+}
+
+/*
+ * create connection pool
+ */
+static POOL_CONNECTION_POOL_SLOT *create_cp(POOL_CONNECTION_POOL_SLOT *cp, int fd)
+{
 	cp->sp = NULL;
 	cp->con = pool_open(fd);
+	if (cp->con == NULL)
+		return NULL;
 	cp->closetime = 0;
 	return cp;
 }
@@ -728,8 +1464,32 @@ static POOL_CONNECTION_POOL *new_connection(POOL_CONNECTION_POOL *p)
 {
 	POOL_CONNECTION_POOL_SLOT *s;
 	int active_backend_count = 0;
+	int fds[MAX_NUM_BACKENDS];
+	int failed_node;
 	int i;
 
+	if (connect_backends(fds, &failed_node) < 0)
+	{
+		/* connection failed. mark this backend down */
+		pool_error("new_connection: connect_backends() failed");
+
+		/* If fail_over_on_backend_error is true, do failover.
+		 * Otherwise, just exit this session.
+		 */
+		if (failed_node >= 0)
+		{
+			if (pool_config->fail_over_on_backend_error)
+			{
+				notice_backend_error(failed_node);
+			}
+			else
+			{
+				pool_log("new_connection: do not failover because fail_over_on_backend_error is off");
+			}
+		}
+		child_exit(1);
+	}
+
 	for (i=0;i<NUM_BACKENDS;i++)
 	{
 		pool_debug("new_connection: connecting %d backend", i);
@@ -748,22 +1508,9 @@ static POOL_CONNECTION_POOL *new_connection(POOL_CONNECTION_POOL *p)
 			return NULL;
 		}
 
-		if (create_cp(s, i) == NULL)
+		if (create_cp(s, fds[i]) == NULL)
 		{
-			/* connection failed. mark this backend down */
 			pool_error("new_connection: create_cp() failed");
-
-			/* If fail_over_on_backend_error is true, do failover.
-			 * Otherwise, just exit this session.
-			 */
-			if (pool_config->fail_over_on_backend_error)
-			{
-				notice_backend_error(i);
-			}
-			else
-			{
-				pool_log("new_connection: do not failover because fail_over_on_backend_error is off");
-			}
 			child_exit(1);
 		}
 
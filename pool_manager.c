@@ -0,0 +1,737 @@
+/* -*-pgsql-c-*- */
+/*
+ * $Header$
+ *
+ * pgpool: a language independent connection pool server for PostgreSQL
+ * written by Tatsuo Ishii
+ *
+ * Copyright (c) 2003-2014	PgPool Global Development Group
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that copyright notice and this permission
+ * notice appear in supporting documentation, and that the name of the
+ * author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * pool_manager.c: shared connection pool manager process
+ *
+ * When shared_connection_pool is on, a child hands its idle backend
+ * connections over to the pool manager at the end of a session instead
+ * of caching them in its private connection pool, and asks the pool
+ * manager for an idle connection before connecting to backends.  The
+ * socket descriptors are passed through a UNIX domain socket using
+ * SCM_RIGHTS, along with the state of the connections (startup packet,
+ * cancel key, authentication info and parameter status) needed to
+ * reuse them.  Connections are looked up by the startup packet, which
+ * is what the private connection pool requires as well.
+ *
+ */
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <poll.h>
+
+#include <signal.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pool.h"
+#include "pool_config.h"
+#include "pool_manager.h"
+
+POOL_MANAGER_STATS *pool_manager_stats;	/* statistics on shmem */
+
+/*
+ * Idle connection held by the pool manager
+ */
+typedef struct {
+	char *data;		/* data of 'P' message */
+	int len;
+	int num_fds;
+	int fds[MAX_NUM_BACKENDS];
+	time_t put_time;	/* when the connection was handed over */
+} POOL_MANAGER_ENTRY;
+
+static POOL_MANAGER_ENTRY *entries;	/* ordered by put_time */
+static int num_entries;
+static int max_entries;
+
+static int *clients;	/* connections from children */
+static int num_clients;
+static int max_clients;
+
+static volatile sig_atomic_t manager_exit_request = 0;
+static volatile sig_atomic_t discard_request = 0;
+
+static int manager_fd = -1;	/* connection to the pool manager (child side) */
+
+static int read_all(int fd, char *buf, int len);
+static int connect_pool_manager(void);
+static int request(char kind, char *data, int len, int *fds, int num_fds,
+				   POOL_MANAGER_HEADER *reply, char **reply_data, int *reply_fds);
+static void handle_put(POOL_MANAGER_HEADER *header, char *data, int *fds);
+static void handle_get(int fd, char *data, int len);
+static void discard_entry(int index);
+static void discard_all_entries(void);
+static void expire_entries(void);
+static RETSIGTYPE manager_signal_handler(int sig);
+
+/*
+ * Set the path of the UNIX domain socket the pool manager listens on
+ */
+void pool_manager_socket_path(char *path, int len)
+{
+	snprintf(path, len, "%s/.s.PGPOOLMGR.%d",
+			 pool_config->socket_dir, pool_config->port);
+}
+
+/*
+* pool manager main loop
+*/
+void do_pool_manager(int listen_fd)
+{
+	struct pollfd *pfds;
+	int nfds;
+	int i, j;
+
+	pool_debug("I am pool manager %d", getpid());
+
+	/* Identify myself via ps */
+	init_ps_display("", "", "", "");
+	set_ps_display("pool manager", false);
+
+	/* set up signal handlers */
+	signal(SIGALRM, SIG_DFL);
+	signal(SIGTERM, manager_signal_handler);
+	signal(SIGINT, manager_signal_handler);
+	signal(SIGQUIT, manager_signal_handler);
+	signal(SIGHUP, SIG_IGN);
+	signal(SIGCHLD, SIG_IGN);
+	signal(SIGUSR1, manager_signal_handler);
+	signal(SIGUSR2, SIG_IGN);
+	signal(SIGPIPE, SIG_IGN);
+
+	/*
+	 * Idle connections the children would otherwise cache in their
+	 * private connection pools.
+	 */
+	max_entries = pool_config->max_children * pool_config->max_pool;
+	entries = malloc(sizeof(POOL_MANAGER_ENTRY) * max_entries);
+
+	/* exiting and new children may be connected at the same time */
+	max_clients = pool_config->max_children * 2;
+	clients = malloc(sizeof(int) * max_clients);
+
+	pfds = malloc(sizeof(struct pollfd) * (1 + max_clients + max_entries * MAX_NUM_BACKENDS));
+
+	if (entries == NULL || clients == NULL || pfds == NULL)
+	{
+		pool_error("do_pool_manager: malloc failed");
+		exit(1);
+	}
+
+	num_entries = num_clients = 0;
+	memset((char *)pool_manager_stats, 0, sizeof(POOL_MANAGER_STATS));
+
+	for (;;)
+	{
+		if (manager_exit_request)
+		{
+			discard_all_entries();
+			exit(0);
+		}
+
+		/* failover or failback happened. existing connections are useless */
+		if (discard_request)
+		{
+			pool_log("do_pool_manager: discarding all idle connections");
+			discard_all_entries();
+			discard_request = 0;
+		}
+
+		expire_entries();
+
+		nfds = 0;
+		pfds[nfds].fd = listen_fd;
+		pfds[nfds++].events = POLLIN;
+
+		for (i=0;i<num_clients;i++)
+		{
+			pfds[nfds].fd = clients[i];
+			pfds[nfds++].events = POLLIN;
+		}
+
+		/*
+		 * Idle connections must not receive anything. If they do,
+		 * the backend has gone or reported an error.
+		 */
+		for (i=0;i<num_entries;i++)
+		{
+			for (j=0;j<entries[i].num_fds;j++)
+			{
+				pfds[nfds].fd = entries[i].fds[j];
+				pfds[nfds++].events = POLLIN;
+			}
+		}
+
+		if (poll(pfds, nfds, pool_config->connection_life_time > 0 ? 1000 : -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			pool_error("do_pool_manager: poll() failed. reason: %s", strerror(errno));
+			exit(1);
+		}
+
+		/* check idle connections first since entries may move below */
+		nfds = 1 + num_clients;
+		for (i=0;i<num_entries;i++)
+		{
+			int num_fds = entries[i].num_fds;
+
+			for (j=0;j<num_fds;j++)
+			{
+				if (pfds[nfds + j].revents)
+					break;
+			}
+
+			if (j < num_fds)
+			{
+				pool_debug("do_pool_manager: idle connection closed by backend");
+				discard_entry(i);
+
+				/* the following entries have been shifted. check them next time */
+				break;
+			}
+			nfds += num_fds;
+		}
+
+		for (i=num_clients;i>0;i--)
+		{
+			POOL_MANAGER_HEADER header;
+			int fds[MAX_NUM_BACKENDS];
+			char *data;
+			int fd = pfds[i].fd;
+
+			if (!pfds[i].revents)
+				continue;
+
+			if (pool_manager_recv_message(fd, &header, &data, fds) < 0)
+			{
+				/* child exited */
+				close(fd);
+				for (j=0;j<num_clients;j++)
+				{
+					if (clients[j] == fd)
+					{
+						clients[j] = clients[--num_clients];
+						break;
+					}
+				}
+				continue;
+			}
+
+			switch (header.kind)
+			{
+				case POOL_MANAGER_PUT:
+					handle_put(&header, data, fds);
+					break;
+
+				case POOL_MANAGER_GET:
+					handle_get(fd, data, header.len);
+					free(data);
+					break;
+
+				default:
+					pool_error("do_pool_manager: unknown message kind %c", header.kind);
+					for (j=0;j<header.num_fds;j++)
+						close(fds[j]);
+					free(data);
+					break;
+			}
+		}
+
+		if (pfds[0].revents)
+		{
+			int fd = accept(listen_fd, NULL, NULL);
+
+			if (fd < 0)
+			{
+				if (errno != EINTR && errno != EAGAIN)
+					pool_error("do_pool_manager: accept() failed. reason: %s", strerror(errno));
+			}
+			else if (pool_manager_check_peer(fd, NULL) < 0)
+				close(fd);
+			else if (num_clients >= max_clients)
+			{
+				pool_error("do_pool_manager: too many connections from children");
+				close(fd);
+			}
+			else
+				clients[num_clients++] = fd;
+		}
+	}
+}
+
+/*
+ * Keep an idle connection handed over by a child. If there are too
+ * many idle connections, discard the oldest one.
+ */
+static void handle_put(POOL_MANAGER_HEADER *header, char *data, int *fds)
+{
+	POOL_MANAGER_ENTRY *entry;
+
+	if (num_entries >= max_entries)
+		discard_entry(0);
+
+	entry = &entries[num_entries++];
+	entry->data = data;
+	entry->len = header->len;
+	entry->num_fds = header->num_fds;
+	memcpy(entry->fds, fds, sizeof(int) * header->num_fds);
+	entry->put_time = time(NULL);
+
+	pool_manager_stats->num_puts++;
+	pool_manager_stats->num_idle_connections = num_entries;
+}
+
+/*
+ * Look for an idle connection whose startup packet is identical to
+ * the requested one and pass it to the child.  The most recently used
+ * connection is preferred so that old ones expire.
+ */
+static void handle_get(int fd, char *data, int len)
+{
+	POOL_MANAGER_ENTRY *entry;
+	int i, j;
+
+	for (i=num_entries-1;i>=0;i--)
+	{
+		entry = &entries[i];
+
+		if (entry->len >= len && memcmp(entry->data, data, len) == 0)
+			break;
+	}
+
+	if (i < 0)
+	{
+		pool_manager_stats->num_misses++;
+		pool_manager_send_message(fd, POOL_MANAGER_MISS, NULL, 0, NULL, 0);
+		return;
+	}
+
+	pool_manager_stats->num_hits++;
+
+	if (pool_manager_send_message(fd, POOL_MANAGER_HIT, entry->data, entry->len, entry->fds, entry->num_fds) < 0)
+	{
+		/* the child has gone. keep the connection */
+		return;
+	}
+
+	/* the child owns the connection now */
+	for (j=0;j<entry->num_fds;j++)
+		close(entry->fds[j]);
+	free(entry->data);
+
+	memmove(&entries[i], &entries[i+1], sizeof(POOL_MANAGER_ENTRY) * (num_entries - i - 1));
+	num_entries--;
+	pool_manager_stats->num_idle_connections = num_entries;
+}
+
+/*
+ * Terminate an idle connection and forget it
+ */
+static void discard_entry(int index)
+{
+	POOL_MANAGER_ENTRY *entry = &entries[index];
+	int major;
+	int j;
+
+	/* the startup packet begins with the protocol version */
+	memcpy(&major, entry->data + sizeof(int), sizeof(int));
+	major = ntohl(major) >> 16;
+
+	for (j=0;j<entry->num_fds;j++)
+	{
+		if (major == PROTO_MAJOR_V3)
+		{
+			char buf[5];
+			int len = htonl(4);
+
+			buf[0] = 'X';
+			memcpy(buf + 1, &len, sizeof(len));
+			if (write(entry->fds[j], buf, sizeof(buf)) < 0)
+				pool_debug("discard_entry: write() failed. reason: %s", strerror(errno));
+		}
+		else
+		{
+			if (write(entry->fds[j], "X", 1) < 0)
+				pool_debug("discard_entry: write() failed. reason: %s", strerror(errno));
+		}
+		close(entry->fds[j]);
+	}
+	free(entry->data);
+
+	memmove(&entries[index], &entries[index+1], sizeof(POOL_MANAGER_ENTRY) * (num_entries - index - 1));
+	num_entries--;
+
+	pool_manager_stats->num_discards++;
+	pool_manager_stats->num_idle_connections = num_entries;
+}
+
+static void discard_all_entries(void)
+{
+	while (num_entries > 0)
+		discard_entry(num_entries - 1);
+}
+
+/*
+ * Discard connections idle for more than connection_life_time
+ */
+static void expire_entries(void)
+{
+	time_t now;
+
+	if (pool_config->connection_life_time <= 0)
+		return;
+
+	now = time(NULL);
+	while (num_entries > 0 &&
+		   now - entries[0].put_time >= pool_config->connection_life_time)
+	{
+		pool_debug("expire_entries: discard idle connection");
+		discard_entry(0);
+	}
+}
+
+static RETSIGTYPE manager_signal_handler(int sig)
+{
+	int save_errno = errno;
+
+	switch (sig)
+	{
+		case SIGTERM:
+		case SIGINT:
+		case SIGQUIT:
+			manager_exit_request = 1;
+			break;
+
+		case SIGUSR1:
+			discard_request = 1;
+			break;
+
+		default:
+			break;
+	}
+
+	errno = save_errno;
+}
+
+/*
+ * Hand over an idle connection to the pool manager. The descriptors
+ * can be closed by the caller on success.  Returns 0 on success, -1
+ * on error.
+ */
+int pool_manager_put(char *data, int len, int *fds, int num_fds)
+{
+	return request(POOL_MANAGER_PUT, data, len, fds, num_fds, NULL, NULL, NULL);
+}
+
+/*
+ * Ask the pool manager for an idle connection. On success, the data
+ * of the connection is stored in *reply (malloced) and the
+ * descriptors are stored in fds.  Returns 1 if a connection is found,
+ * 0 if not found and -1 on error.
+ */
+int pool_manager_get(char *data, int len, char **reply, int *reply_len, int *fds, int *num_fds)
+{
+	POOL_MANAGER_HEADER header;
+
+	if (request(POOL_MANAGER_GET, data, len, NULL, 0, &header, reply, fds) < 0)
+		return -1;
+
+	if (header.kind == POOL_MANAGER_MISS)
+	{
+		free(*reply);
+		return 0;
+	}
+
+	if (header.kind != POOL_MANAGER_HIT)
+	{
+		pool_error("pool_manager_get: unknown reply kind %c", header.kind);
+		free(*reply);
+		return -1;
+	}
+
+	*reply_len = header.len;
+	*num_fds = header.num_fds;
+	return 1;
+}
+
+/*
+ * Send a message to the pool manager and receive its reply if reply
+ * is not NULL.  If the pool manager has been restarted, reconnect
+ * once.
+ */
+static int request(char kind, char *data, int len, int *fds, int num_fds,
+				   POOL_MANAGER_HEADER *reply, char **reply_data, int *reply_fds)
+{
+	int retry;
+
+	for (retry=0;retry<2;retry++)
+	{
+		if (manager_fd < 0 && connect_pool_manager() < 0)
+			return -1;
+
+		if (pool_manager_send_message(manager_fd, kind, data, len, fds, num_fds) == 0 &&
+			(reply == NULL || pool_manager_recv_message(manager_fd, reply, reply_data, reply_fds) == 0))
+			return 0;
+
+		close(manager_fd);
+		manager_fd = -1;
+	}
+
+	pool_error("request: failed to communicate with pool manager");
+	return -1;
+}
+
+static int connect_pool_manager(void)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+	{
+		pool_error("connect_pool_manager: socket() failed. reason: %s", strerror(errno));
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	pool_manager_socket_path(addr.sun_path, sizeof(addr.sun_path));
+
+	while (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		if (errno == EINTR)
+			continue;
+
+		pool_error("connect_pool_manager: connect() to %s failed. reason: %s",
+				   addr.sun_path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	manager_fd = fd;
+	return 0;
+}
+
+/*
+ * Send a message with descriptors.  Also used by the admission queue.
+ * Returns 0 on success, -1 on error.
+ */
+int pool_manager_send_message(int fd, char kind, char *data, int len, int *fds, int num_fds)
+{
+	POOL_MANAGER_HEADER header;
+	struct msghdr msg;
+	struct iovec iov[2];
+	struct cmsghdr *cmsg;
+	char cmsgbuf[CMSG_SPACE(sizeof(int) * MAX_NUM_BACKENDS)];
+	int total, sent;
+
+	memset(&header, 0, sizeof(header));
+	header.kind = kind;
+	header.num_fds = num_fds;
+	header.len = len;
+
+	iov[0].iov_base = &header;
+	iov[0].iov_len = sizeof(header);
+	iov[1].iov_base = data;
+	iov[1].iov_len = len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = len > 0 ? 2 : 1;
+
+	if (num_fds > 0)
+	{
+		msg.msg_control = cmsgbuf;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * num_fds);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * num_fds);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * num_fds);
+	}
+
+	while ((sent = sendmsg(fd, &msg, 0)) < 0)
+	{
+		if (errno == EINTR)
+			continue;
+		pool_error("pool_manager_send_message: sendmsg() failed. reason: %s", strerror(errno));
+		return -1;
+	}
+
+	/* send the rest if the socket buffer was short */
+	total = sizeof(header) + len;
+	while (sent < total)
+	{
+		int n;
+
+		if (sent < sizeof(header))
+			n = write(fd, (char *)&header + sent, sizeof(header) - sent);
+		else
+			n = write(fd, data + sent - sizeof(header), total - sent);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			pool_error("pool_manager_send_message: write() failed. reason: %s", strerror(errno));
+			return -1;
+		}
+		sent += n;
+	}
+	return 0;
+}
+
+/*
+ * Receive a message. The data is stored in *data (malloced) and the
+ * descriptors in fds.  Returns 0 on success, -1 on error or EOF.
+ */
+int pool_manager_recv_message(int fd, POOL_MANAGER_HEADER *header, char **data, int *fds)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char cmsgbuf[CMSG_SPACE(sizeof(int) * MAX_NUM_BACKENDS)];
+	int n;
+
+	iov.iov_base = header;
+	iov.iov_len = sizeof(*header);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf;
+	msg.msg_controllen = sizeof(cmsgbuf);
+
+	while ((n = recvmsg(fd, &msg, 0)) < 0)
+	{
+		if (errno == EINTR)
+			continue;
+		pool_error("pool_manager_recv_message: recvmsg() failed. reason: %s", strerror(errno));
+		return -1;
+	}
+
+	if (n == 0)
+		return -1;
+
+	if (n < sizeof(*header) &&
+		read_all(fd, (char *)header + n, sizeof(*header) - n) < 0)
+		return -1;
+
+	if (header->num_fds < 0 || header->num_fds > MAX_NUM_BACKENDS || header->len < 0)
+	{
+		pool_error("pool_manager_recv_message: invalid message");
+		return -1;
+	}
+
+	if (header->num_fds > 0)
+	{
+		cmsg = CMSG_FIRSTHDR(&msg);
+		if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+			cmsg->cmsg_type != SCM_RIGHTS ||
+			cmsg->cmsg_len != CMSG_LEN(sizeof(int) * header->num_fds))
+		{
+			pool_error("pool_manager_recv_message: descriptors were not received");
+			return -1;
+		}
+		memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * header->num_fds);
+	}
+
+	*data = malloc(header->len + 1);
+	if (*data == NULL)
+	{
+		pool_error("pool_manager_recv_message: malloc failed");
+		return -1;
+	}
+
+	if (read_all(fd, *data, header->len) < 0)
+	{
+		free(*data);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Check that the peer of a connection accepted on the pool manager or
+ * admission queue socket runs as the same user as pgpool-II.  These
+ * sockets pass authenticated connections around, so nobody else may
+ * use them.  The pid of the peer is returned to *pid if pid is not
+ * NULL (0 if unknown).  Returns 0 if the peer is allowed, -1 if not.
+ */
+int pool_manager_check_peer(int fd, pid_t *pid)
+{
+#ifdef SO_PEERCRED
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+	{
+		pool_error("pool_manager_check_peer: getsockopt(SO_PEERCRED) failed. reason: %s", strerror(errno));
+		return -1;
+	}
+
+	if (cred.uid != geteuid())
+	{
+		pool_error("pool_manager_check_peer: connection from pid %d uid %d rejected",
+				   (int)cred.pid, (int)cred.uid);
+		return -1;
+	}
+
+	if (pid)
+		*pid = cred.pid;
+#else
+	/* rely on the permission of the socket */
+	if (pid)
+		*pid = 0;
+#endif
+	return 0;
+}
+
+static int read_all(int fd, char *buf, int len)
+{
+	int n;
+
+	while (len > 0)
+	{
+		n = read(fd, buf, len);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			pool_error("read_all: read() failed. reason: %s", strerror(errno));
+			return -1;
+		}
+		if (n == 0)
+			return -1;
+
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
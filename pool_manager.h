@@ -0,0 +1,91 @@
+/* -*-pgsql-c-*- */
+/*
+ *
+ * $Header$
+ *
+ * pgpool: a language independent connection pool server for PostgreSQL
+ * written by Tatsuo Ishii
+ *
+ * Copyright (c) 2003-2014	PgPool Global Development Group
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that copyright notice and this permission
+ * notice appear in supporting documentation, and that the name of the
+ * author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * pool_manager.h: shared connection pool manager
+ *
+ */
+
+#ifndef POOL_MANAGER_H
+#define POOL_MANAGER_H
+
+/*
+ * Message kinds exchanged between children and the pool manager
+ */
+#define POOL_MANAGER_GET	'G'		/* child asks for an idle connection */
+#define POOL_MANAGER_PUT	'P'		/* child hands over an idle connection */
+#define POOL_MANAGER_HIT	'H'		/* reply to 'G'. connection follows */
+#define POOL_MANAGER_MISS	'M'		/* reply to 'G'. no connection found */
+
+/*
+ * Message header. Followed by len bytes of data. Socket descriptors
+ * are passed by SCM_RIGHTS along with the header.
+ */
+typedef struct {
+	char kind;
+	int num_fds;	/* number of descriptors passed */
+	int len;		/* length of data following the header */
+} POOL_MANAGER_HEADER;
+
+/*
+ * Data of 'G' is the startup packet length (int) followed by the
+ * startup packet.  Data of 'P' and 'H' is the same followed by the
+ * number of backends (int) and a POOL_MANAGER_SLOT for each backend,
+ * each of which is followed by the parameter status as
+ * "name\0value\0" pairs.  The descriptors are passed in the order of
+ * the slots.
+ */
+typedef struct {
+	int node_id;	/* DB node id */
+	int pid;		/* backend pid */
+	int key;		/* cancel key */
+	char tstate;	/* transaction state */
+	int auth_kind;	/* remembered authentication info */
+	int pwd_size;
+	char password[MAX_PASSWORD_SIZE];
+	char salt[4];
+	ConnectionInfo info;	/* copy of the connection info on shmem */
+	int num_params;	/* number of parameter status */
+	int params_len;	/* length of parameter status data following */
+} POOL_MANAGER_SLOT;
+
+/*
+ * Statistics of the pool manager on shmem. Updated by the pool
+ * manager only.
+ */
+typedef struct {
+	int num_idle_connections;	/* number of connections the pool manager holds */
+	long long int num_hits;		/* number of requests found a connection */
+	long long int num_misses;	/* number of requests found no connection */
+	long long int num_puts;		/* number of connections handed over */
+	long long int num_discards;	/* number of connections closed by the pool manager */
+} POOL_MANAGER_STATS;
+
+extern POOL_MANAGER_STATS *pool_manager_stats;
+
+extern void pool_manager_socket_path(char *path, int len);
+extern void do_pool_manager(int listen_fd);
+extern int pool_manager_put(char *data, int len, int *fds, int num_fds);
+extern int pool_manager_get(char *data, int len, char **reply, int *reply_len, int *fds, int *num_fds);
+extern int pool_manager_send_message(int fd, char kind, char *data, int len, int *fds, int num_fds);
+extern int pool_manager_recv_message(int fd, POOL_MANAGER_HEADER *header, char **data, int *fds);
+extern int pool_manager_check_peer(int fd, pid_t *pid);
+
+#endif /* POOL_MANAGER_H */
@@ -33,16 +33,21 @@
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <ctype.h>
 #include <arpa/inet.h>
 #include <dirent.h>
+#include <sys/mman.h>
 
 #ifdef USE_MEMCACHED
 #include <libmemcached/memcached.h>
 #endif
 
 #include "md5.h"
+#include "murmurhash3.h"
+#include "lz4.h"
 #include "pool_config.h"
+#include "pool_ipc.h"
 #include "pool_stream.h"
 #include "pool_proto_modules.h"
 #include "pool_memqcache.h"
@@ -57,46 +62,82 @@
 memcached_st *memc;
 #endif
 
-static char* encode_key(const char *s, char *buf, POOL_CONNECTION_POOL *backend);
+/* Query cache stats on shmem. See pool_init_memqcache_stats */
+static POOL_QUERY_CACHE_STATS *stats;
+
+/*
+ * Persistent shmem cache. See POOL_PERSISTENT_CACHE_HEADER.
+ */
+static char *persistent_cache;	/* mapped memqcache_persistent_file */
+static size_t persistent_cache_used;	/* bytes already allocated */
+static bool persistent_cache_restored;	/* true if the contents are valid */
+
+static void pool_make_query_key(POOL_QUERY_KEY *key, const char *query, POOL_CONNECTION_POOL *backend);
+static void encode_key(POOL_QUERY_KEY *key, char *buf);
+static void pool_copy_query_key(POOL_QUERY_KEY *key, char *dest);
+static bool pool_query_key_equal(POOL_QUERY_KEY *key, const char *stored, size_t len);
 #ifdef DEBUG
 static void dump_cache_data(const char *data, size_t len);
 #endif
-static int pool_commit_cache(POOL_CONNECTION_POOL *backend, char *query, char *data, size_t datalen, int num_oids, int *oids);
+static int pool_commit_cache(POOL_CONNECTION_POOL *backend, char *query, POOL_INTERNAL_BUFFER *buffer, int num_oids, int *oids);
 static int pool_fetch_cache(POOL_CONNECTION_POOL *backend, const char *query, char **buf, size_t *len);
+static int pool_fetch_cache_by_key(POOL_QUERY_KEY *key, char *tmpkey, const char *query, char **buf, size_t *len, bool *stale);
+static volatile POOL_CACHE_FLIGHT *pool_find_cache_flight(POOL_QUERY_HASH *query_hash, bool lead, long timeout, unsigned int *generation);
+static bool pool_wait_cache_flight(POOL_QUERY_HASH *query_hash, bool lead);
+static bool pool_cache_expired(time_t timestamp, bool grace);
+static int pool_fetch_shmem_cache(POOL_QUERY_HASH *query_hash, POOL_QUERY_KEY *key, char **buf, size_t *len, bool *stale);
+static int pool_read_item_optimistic(POOL_QUERY_HASH *query_hash, POOL_QUERY_KEY *key, int partition, char **buf, size_t *len, bool *stale);
+static char *pool_compress_cache_data(char *data, size_t len, size_t *compressed_len);
+static char *pool_decompress_cache_data(const char *data, size_t len, size_t *raw_len);
+static long long int elapsed_usec(struct timeval *start);
 static int send_cached_messages(POOL_CONNECTION *frontend, const char *qcache, int qcachelen);
+static int send_cached_portal_messages(POOL_CONNECTION *frontend, const char *qcache, size_t qcachelen, size_t *pos, int max_rows);
+static POOL_STATUS send_cached_ready_for_query(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
 static void send_message(POOL_CONNECTION *conn, char kind, int len, const char *data);
 #ifdef USE_MEMCACHED
 static int delete_cache_on_memcached(const char *key);
 #endif
 static int pool_get_dml_table_oid(int **oid);
-static int pool_get_dropdb_table_oids(int **oids, int dboid);
 static void pool_discard_dml_table_oid(void);
-static void pool_invalidate_query_cache(int num_table_oids, int *table_oid, bool unlink, int dboid);
+static void pool_invalidate_query_cache(int num_table_oids, int *table_oid, int dboid);
+static void pool_invalidate_query_cache_by_db(int dboid);
 static int pool_get_database_oid(void);
-static void pool_add_table_oid_map(POOL_CACHEKEY *cachkey, int num_table_oids, int *table_oids);
+static void pool_add_table_oid_map(POOL_QUERY_HASH *query_hash, int num_table_oids, int *table_oids);
+static void pool_oid_map_reset(void);
+static int pool_oid_map_find_table(int dboid, int table_oid, int **linkp);
+static void pool_oid_map_detach_table(int table, int *link, POOL_QUERY_HASH **keys, int *num_keys, int *keys_size);
+static int pool_oid_map_evict(POOL_QUERY_HASH **keys, int *num_keys, int *keys_size, bool need_entries);
+static void pool_delete_cache_by_keys(POOL_QUERY_HASH *keys, int num_keys);
 static void pool_reset_memqcache_buffer(void);
-static POOL_CACHEID *pool_add_item_shmem_cache(POOL_QUERY_HASH *query_hash, char *data, int size);
+static POOL_CACHEID *pool_add_item_shmem_cache(POOL_QUERY_HASH *query_hash, POOL_QUERY_KEY *key, char *data, POOL_INTERNAL_BUFFER *buffer, int size, bool *rejected);
 static POOL_CACHEID *pool_find_item_on_shmem_cache(POOL_QUERY_HASH *query_hash);
-static char *pool_get_item_shmem_cache(POOL_QUERY_HASH *query_hash, int *size, int *sts);
+static char *pool_get_item_shmem_cache(POOL_QUERY_HASH *query_hash, POOL_QUERY_KEY *key, int *size, int *sts, bool *stale);
 static POOL_QUERY_CACHE_ARRAY * pool_add_query_cache_array(POOL_QUERY_CACHE_ARRAY *cache_array, POOL_TEMP_QUERY_CACHE *cache);
 static void pool_add_temp_query_cache(POOL_TEMP_QUERY_CACHE *temp_cache, char kind, char *data, int data_len);
 static void pool_add_oids_temp_query_cache(POOL_TEMP_QUERY_CACHE *temp_cache, int num_oids, int *oids);
 static POOL_INTERNAL_BUFFER *pool_create_buffer(void);
 static void pool_discard_buffer(POOL_INTERNAL_BUFFER *buffer);
-static void pool_add_buffer(POOL_INTERNAL_BUFFER *buffer, void *data, size_t len);
+static void pool_reset_buffer(POOL_INTERNAL_BUFFER *buffer);
+static int pool_add_buffer(POOL_INTERNAL_BUFFER *buffer, void *data, size_t len);
+static void pool_copy_buffer(POOL_INTERNAL_BUFFER *buffer, char *dest);
 static void *pool_get_buffer(POOL_INTERNAL_BUFFER *buffer, size_t *len);
-static char *pool_get_buffer_pointer(POOL_INTERNAL_BUFFER *buffer);
-static char *pool_get_current_cache_buffer(size_t *len);
 static size_t pool_get_buffer_length(POOL_INTERNAL_BUFFER *buffer);
 static void pool_check_and_discard_cache_buffer(int num_oids, int *oids);
 
+static void *pool_cache_shared_memory_create(size_t size);
+static size_t pool_persistent_cache_size(void);
+static void pool_persistent_cache_fingerprint(char *fingerprint);
+static void pool_close_persistent_cache(int code, Datum arg);
+static int pool_cache_num_partitions(void);
+static long pool_hash_num_buckets(int nelements, int num_partitions, int *max_entries);
+static uint32 pool_sketch_width(int max_entries);
 static void pool_set_memqcache_blocks(int num_blocks);
 static int pool_get_memqcache_blocks(void);
 static void *pool_memory_cache_address(void);
 static void pool_reset_fsmm(size_t size);
 static void *pool_fsmm_address(void);
 static void pool_update_fsmm(POOL_CACHE_BLOCKID blockid, size_t free_space);
-static POOL_CACHE_BLOCKID pool_get_block(size_t free_space);
+static POOL_CACHE_BLOCKID pool_get_block(size_t free_space, int partition, POOL_QUERY_HASH **admission, bool *rejected);
 static POOL_CACHE_ITEM_HEADER *pool_cache_item_header(POOL_CACHEID *cacheid);
 static int pool_init_cache_block(POOL_CACHE_BLOCKID blockid);
 #if NOT_USED
@@ -105,18 +146,27 @@ static void pool_wipe_out_cache_block(POOL_CACHE_BLOCKID blockid);
 static int pool_delete_item_shmem_cache(POOL_CACHEID *cacheid);
 static char *block_address(int blockid);
 static POOL_CACHE_ITEM_POINTER *item_pointer(char *block, int i);
+static size_t max_items_per_block(void);
+static unsigned char *item_refcount(POOL_CACHE_BLOCKID blockid, int itemid);
+static void pool_count_item_hit(POOL_CACHE_BLOCKID blockid, int itemid);
 static POOL_CACHE_ITEM_HEADER *item_header(char *block, int i);
-static POOL_CACHE_BLOCKID pool_reuse_block(void);
+static POOL_CACHE_BLOCKID pool_reuse_block(int partition);
+static POOL_CACHE_BLOCKID pool_evict_items(int partition, size_t request_size, POOL_QUERY_HASH **admission, bool *rejected);
+static int pool_pack_cache_block(POOL_CACHE_BLOCKID blockid);
+static size_t pool_deleted_bytes(char *block);
+static void pool_sketch_increment(POOL_QUERY_HASH *key);
+static int pool_sketch_estimate(POOL_QUERY_HASH *key);
+static unsigned char *pool_sketch_rows(POOL_QUERY_HASH *key, uint32 *h1, uint32 *h2);
+static int query_hash_partition(POOL_QUERY_HASH *key);
 #ifdef SHMEMCACHE_DEBUG
 static void dump_shmem_cache(POOL_CACHE_BLOCKID blockid);
 #endif
 
-static int pool_hash_reset(int nelements);
-static int pool_hash_insert(POOL_QUERY_HASH *key, POOL_CACHEID *cacheid, bool update);
+static int pool_hash_reset(void);
+static int pool_hash_insert(POOL_QUERY_HASH *key, POOL_CACHEID *cacheid);
+static int pool_hash_update(POOL_QUERY_HASH *key, POOL_CACHEID *old, POOL_CACHEID *new);
 static uint32 create_hash_key(POOL_QUERY_HASH *key);
-static volatile POOL_HASH_ELEMENT *get_new_hash_element(void);
-static void put_back_hash_element(volatile POOL_HASH_ELEMENT *element);
-static bool is_free_hash_element(void);
+static bool is_free_hash_element(int partition);
 static char *get_relation_without_alias(RangeVar *relation);
 
 /*
@@ -127,8 +177,12 @@ int memcached_connect (void)
 	char *memqcache_memcached_host;
 	int memqcache_memcached_port;
 #ifdef USE_MEMCACHED
-	memcached_server_st *servers;
+	memcached_server_st *servers = NULL;
 	memcached_return rc;
+	char *hosts;
+	char *host;
+	char *saveptr;
+	int num_servers = 0;
 
 	/* Already connected? */
 	if (memc)
@@ -145,10 +199,72 @@ int memcached_connect (void)
 
 #ifdef USE_MEMCACHED
 	memc = memcached_create(NULL);
-	servers = memcached_server_list_append(NULL,
-										   memqcache_memcached_host,
-										   memqcache_memcached_port,
-										   &rc);
+
+	/*
+	 * memqcache_memcached_host is a comma separated list of host[:port].
+	 * memqcache_memcached_port is used for the hosts without a port.
+	 */
+	hosts = strdup(memqcache_memcached_host);
+	if (hosts == NULL)
+	{
+		pool_error("memcached_connect: strdup failed");
+		memcached_free(memc);
+		memc = NULL;
+		return -1;
+	}
+
+	for (host = strtok_r(hosts, ",", &saveptr); host; host = strtok_r(NULL, ",", &saveptr))
+	{
+		char *p;
+		int port = memqcache_memcached_port;
+
+		while (isspace((unsigned char)*host))
+			host++;
+		p = host + strlen(host);
+		while (p > host && isspace((unsigned char)p[-1]))
+			*--p = '\0';
+		if (*host == '\0')
+			continue;
+
+		/* An IPv6 address has more than one colon. It cannot have a port. */
+		p = strchr(host, ':');
+		if (p && p == strrchr(host, ':'))
+		{
+			*p = '\0';
+			port = atoi(p + 1);
+		}
+
+		pool_debug("memcached_connect: server %d: %s:%d", num_servers, host, port);
+		servers = memcached_server_list_append(servers, host, port, &rc);
+		if (rc != MEMCACHED_SUCCESS)
+		{
+			pool_error("memcached_connect: server_list_append %s:%d %s", host, port, memcached_strerror(memc, rc));
+			free(hosts);
+			memcached_server_list_free(servers);
+			memcached_free(memc);
+			memc = NULL;
+			return -1;
+		}
+		num_servers++;
+	}
+	free(hosts);
+
+	if (num_servers == 0)
+	{
+		pool_error("memcached_connect: no server in memqcache_memcached_host");
+		memcached_free(memc);
+		memc = NULL;
+		return -1;
+	}
+
+	/*
+	 * Distribute the keys over the servers with consistent hashing
+	 * (ketama) so that adding or removing a server moves only the keys
+	 * of that server.
+	 */
+	rc = memcached_behavior_set(memc, MEMCACHED_BEHAVIOR_KETAMA, 1);
+	if (rc != MEMCACHED_SUCCESS)
+		pool_error("memcached_connect: behavior_set %s", memcached_strerror(memc, rc));
 
 	rc = memcached_server_push(memc, servers);
 	if (rc != MEMCACHED_SUCCESS)
@@ -176,11 +292,37 @@ void memcached_disconnect (void)
 		return;
 	}
 	memcached_free(memc);
+	memc = NULL;
 #else
 	pool_error("memcached_disconnect: memcached support is not enabled");
 #endif
 }
 
+/*
+ * Flush all caches on memcached. Called at pgpool-II startup since
+ * oid maps, which are needed to invalidate them, have been lost.
+ */
+void pool_flush_memcached(void)
+{
+#ifdef USE_MEMCACHED
+	memcached_return rc;
+
+	if (memcached_connect() < 0)
+	{
+		memc = NULL;
+		return;
+	}
+
+	rc = memcached_flush(memc, 0);
+	if (rc != MEMCACHED_SUCCESS)
+		pool_error("pool_flush_memcached: %s", memcached_strerror(memc, rc));
+
+	memcached_disconnect();
+#else
+	pool_error("pool_flush_memcached: memcached support is not enabled");
+#endif
+}
+
 /*
  * Register buffer data for query cache on memory cache
  */
@@ -197,21 +339,24 @@ void memqcache_register(char kind,
 }
 
 /*
- * Commit SELECT results to cache storage.
+ * Commit SELECT results in buffer to cache storage. The data is copied
+ * from the chunks of the buffer straight into the cache storage.
  */
-static int pool_commit_cache(POOL_CONNECTION_POOL *backend, char *query, char *data, size_t datalen, int num_oids, int *oids)
+static int pool_commit_cache(POOL_CONNECTION_POOL *backend, char *query, POOL_INTERNAL_BUFFER *buffer, int num_oids, int *oids)
 {
 #ifdef USE_MEMCACHED
 	memcached_return rc;
 #endif
-	POOL_CACHEKEY cachekey;
+	POOL_QUERY_HASH query_hash;
+	POOL_QUERY_KEY key;
 	char tmpkey[MAX_KEY];
 	time_t memqcache_expire;
+	char *data = NULL;		/* compressed data. if NULL, use buffer */
+	size_t datalen;
 
-	/*
-	 * get_buflen() will return -1 if query result exceeds memqcache_maxcache
-	 */
-	if (datalen == -1)
+	/* Nothing was captured */
+	datalen = pool_get_buffer_length(buffer);
+	if (datalen == 0)
 	{
 		return -1;
 	}
@@ -224,36 +369,95 @@ static int pool_commit_cache(POOL_CONNECTION_POOL *backend, char *query, char *d
 
 	pool_debug("pool_commit_cache: Query=%s", query);
 #ifdef DEBUG
-	dump_cache_data(data, datalen);
+	{
+		char *p;
+		size_t len;
+
+		p = pool_get_buffer(buffer, &len);
+		dump_cache_data(p, len);
+		free(p);
+	}
 #endif
 
-	/* encode md5key for memcached */
-	encode_key(query, tmpkey, backend);
+	/*
+	 * Compress large results. Only then the data needs to be made
+	 * contiguous.
+	 */
+	if (pool_config->memqcache_compress_threshold > 0 &&
+		datalen >= (size_t)pool_config->memqcache_compress_threshold)
+	{
+		char *flat;
+		char *compressed;
+		size_t compressed_len;
+
+		flat = pool_get_buffer(buffer, &datalen);
+		if (flat == NULL)
+			return -1;
+
+		compressed = pool_compress_cache_data(flat, datalen, &compressed_len);
+		free(flat);
+		if (compressed)
+		{
+			data = compressed;
+			datalen = compressed_len;
+		}
+	}
+
+	/* hash the query key */
+	pool_make_query_key(&key, query, backend);
+	encode_key(&key, tmpkey);
 	pool_debug("pool_commit_cache: search key ==%s==", tmpkey);
-	memcpy(cachekey.hashkey, tmpkey, 32);
+	memcpy(query_hash.query_hash, tmpkey, sizeof(query_hash.query_hash));
 
 	memqcache_expire = pool_config->memqcache_expire;
 	pool_debug("pool_commit_cache : memqcache_expire = %ld", memqcache_expire);
 
+	/* Keep the item on memcached while it is served as a stale item */
+	if (memqcache_expire > 0)
+		memqcache_expire += pool_config->memqcache_expire_grace;
+
 	if (pool_is_shmem_cache())
 	{
 		POOL_CACHEID *cacheid;
-		POOL_QUERY_HASH query_hash;
+		int partition;
+		bool rejected;
 
-		memcpy(query_hash.query_hash, tmpkey, sizeof(query_hash.query_hash));
+		partition = query_hash_partition(&query_hash);
+
+		pool_shmem_lock_partition(partition);
 
 		cacheid = pool_hash_search(&query_hash);
 
+		/*
+		 * Replace the item if it has expired, which happens when this
+		 * child refreshes a stale item in memqcache_expire_grace.
+		 */
+		if (cacheid != NULL &&
+			pool_cache_expired(pool_cache_item_header(cacheid)->timestamp, false))
+		{
+			pool_debug("pool_commit_cache: replacing the expired item");
+			pool_delete_item_shmem_cache(cacheid);
+			cacheid = NULL;
+		}
+
 		if (cacheid != NULL)
 		{
+			pool_shmem_unlock_partition(partition);
 			pool_debug("pool_commit_cache: the item already exists");
 			return 0;
 		}
 		else
 		{
-			cacheid = pool_add_item_shmem_cache(&query_hash, data, datalen);
-			if (cacheid == NULL)
+			cacheid = pool_add_item_shmem_cache(&query_hash, &key, data, buffer, datalen, &rejected);
+			if (cacheid == NULL && rejected)
+			{
+				pool_shmem_unlock_partition(partition);
+				pool_debug("pool_commit_cache: the item was not admitted");
+				return 0;
+			}
+			else if (cacheid == NULL)
 			{
+				pool_shmem_unlock_partition(partition);
 				pool_error("pool_commit_cache: pool_add_item_shmem_cache failed");
 				return -1;
 			}
@@ -262,16 +466,43 @@ static int pool_commit_cache(POOL_CONNECTION_POOL *backend, char *query, char *d
 				pool_debug("pool_commit_cache: blockid: %d itemid: %d",
 						   cacheid->blockid, cacheid->itemid);
 			}
-			cachekey.cacheid.blockid = cacheid->blockid;
-			cachekey.cacheid.itemid = cacheid->itemid;
 		}
+
+		/*
+		 * The oid map is written after releasing the lock. An
+		 * invalidation running in between does not see the new item,
+		 * which is the same as the invalidation running before this.
+		 */
+		pool_shmem_unlock_partition(partition);
 	}
 
 #ifdef USE_MEMCACHED
 	else
 	{
+		/* Store the query key and the creation time followed by the data */
+		char *value;
+		size_t value_len;
+		unsigned int key_length = key.length;
+		time_t timestamp = time(NULL);
+
+		value_len = sizeof(key_length) + key.length + sizeof(timestamp) + datalen;
+		value = malloc(value_len);
+		if (value == NULL)
+		{
+			pool_error("pool_commit_cache: malloc failed");
+			return -1;
+		}
+		memcpy(value, &key_length, sizeof(key_length));
+		pool_copy_query_key(&key, value + sizeof(key_length));
+		memcpy(value + sizeof(key_length) + key.length, &timestamp, sizeof(timestamp));
+		if (data)
+			memcpy(value + sizeof(key_length) + key.length + sizeof(timestamp), data, datalen);
+		else
+			pool_copy_buffer(buffer, value + sizeof(key_length) + key.length + sizeof(timestamp));
+
 		rc = memcached_set(memc, tmpkey, 32,
-						   data, datalen, (time_t)memqcache_expire, 0);
+						   value, value_len, (time_t)memqcache_expire, 0);
+		free(value);
 		if (rc != MEMCACHED_SUCCESS)
 		{
 			pool_error("pool_commit_cache: memcached_set error %s", memcached_strerror(memc, rc));
@@ -282,9 +513,9 @@ static int pool_commit_cache(POOL_CONNECTION_POOL *backend, char *query, char *d
 #endif
 
 	/*
-	 * Register cache id to oid map
+	 * Register cache key to oid map
 	 */
-	pool_add_table_oid_map(&cachekey, num_oids, oids);
+	pool_add_table_oid_map(&query_hash, num_oids, oids);
 
 	return 0;
 }
@@ -295,34 +526,96 @@ static int pool_commit_cache(POOL_CONNECTION_POOL *backend, char *query, char *d
  */
 static int pool_fetch_cache(POOL_CONNECTION_POOL *backend, const char *query, char **buf, size_t *len)
 {
-	char *ptr;
 	char tmpkey[MAX_KEY];
+	POOL_QUERY_KEY key;
+	POOL_QUERY_HASH query_hash;
+	bool stale;
 	int sts;
-	char *p;
 
 	if (strlen(query) <= 0)
 	{
 		return -1;
 	}
 
-	/* encode md5key for memcached */
-	encode_key(query, tmpkey, backend);
+	/* hash the query key */
+	pool_make_query_key(&key, query, backend);
+	encode_key(&key, tmpkey);
 	pool_debug("pool_fetch_cache: search key ==%s==", tmpkey);
 
+	sts = pool_fetch_cache_by_key(&key, tmpkey, query, buf, len, &stale);
+	memcpy(query_hash.query_hash, tmpkey, sizeof(query_hash.query_hash));
+
+	/*
+	 * A stale item in memqcache_expire_grace is served while one child
+	 * runs the query again to refresh it. Become the one if no other
+	 * child is running it and the result can be cached.
+	 */
+	if (sts == 0 && stale)
+	{
+		unsigned int generation;
+
+		if (MASTER(backend)->tstate == 'I' &&
+			pool_find_cache_flight(&query_hash, true,
+								   pool_config->memqcache_expire_grace * 1000000L,
+								   &generation) == NULL)
+		{
+			pool_debug("pool_fetch_cache: refreshing stale cache");
+			__sync_add_and_fetch(&stats->num_stale_refreshes, 1);
+			free(*buf);
+			return 1;
+		}
+		__sync_add_and_fetch(&stats->num_stale_hits, 1);
+	}
+
+	/*
+	 * If another child is running the same query, wait for it to
+	 * cache the result rather than running the query too. Otherwise
+	 * become the one running it, unless in an explicit transaction
+	 * in which the result is not cached until commit.
+	 */
+	if (sts == 1 && pool_config->memqcache_miss_wait_timeout > 0 &&
+		pool_wait_cache_flight(&query_hash, MASTER(backend)->tstate == 'I'))
+	{
+		sts = pool_fetch_cache_by_key(&key, tmpkey, query, buf, len, &stale);
+		if (sts == 0)
+			__sync_add_and_fetch(&stats->num_coalesced_misses, 1);
+	}
+
+	return sts;
+}
+
+/*
+ * Fetch from memory cache by the query key and its hash.
+ * *stale is set to true if the item is in memqcache_expire_grace.
+ * 0: fetch success, 1: not found -1: error
+ */
+static int pool_fetch_cache_by_key(POOL_QUERY_KEY *key, char *tmpkey, const char *query, char **buf, size_t *len, bool *stale)
+{
+	char *ptr;
+	int sts;
+	char *p;
+
 	if (pool_is_shmem_cache())
 	{
 		POOL_QUERY_HASH query_hash;
-		int mylen;
 
 		memcpy(query_hash.query_hash, tmpkey, sizeof(query_hash.query_hash));
 
-		ptr = pool_get_item_shmem_cache(&query_hash, &mylen, &sts);
-		if (ptr == NULL)
+		/* the item is copied to malloc'ed memory in this case */
+		sts = pool_fetch_shmem_cache(&query_hash, key, &p, len, stale);
+		if (sts != 0)
 		{
-			pool_debug("pool_fetch_cache: cache not found on shmem");
-			return 1;
+			if (sts == 1)
+				pool_debug("pool_fetch_cache: cache not found on shmem");
+			return sts;
 		}
-		*len = mylen;
+
+		pool_debug("pool_fetch_cache: query=%s len:%zd", query, *len);
+#ifdef DEBUG
+		dump_cache_data(p, *len);
+#endif
+		*buf = p;
+		return 0;
 	}
 #ifdef USE_MEMCACHED
 	else
@@ -360,17 +653,37 @@ static int pool_fetch_cache(POOL_CONNECTION_POOL *backend, const char *query, ch
 	}
 #endif
 
-	p = malloc(*len);
-	if (!p)
+	/* Verify the query key and the creation time stored before the data */
 	{
-		pool_error("pool_fetch_cache: malloc failed");
-		return -1;
-	}
+		unsigned int key_length;
+		time_t timestamp;
 
-	memcpy(p, ptr, *len);
+		if (*len < sizeof(key_length) + sizeof(timestamp))
+		{
+			free(ptr);
+			return 1;
+		}
+		memcpy(&key_length, ptr, sizeof(key_length));
+		if (key_length > *len - sizeof(key_length) - sizeof(timestamp) ||
+			!pool_query_key_equal(key, ptr + sizeof(key_length), key_length))
+		{
+			pool_debug("pool_fetch_cache: hash collision: query:%s key:%s", query, tmpkey);
+			free(ptr);
+			return 1;
+		}
+		memcpy(&timestamp, ptr + sizeof(key_length) + key_length, sizeof(timestamp));
+		*stale = pool_cache_expired(timestamp, false);
+		*len -= sizeof(key_length) + key_length + sizeof(timestamp);
 
-	if (!pool_is_shmem_cache())
-	{
+		p = malloc(*len > 0 ? *len : 1);
+		if (!p)
+		{
+			free(ptr);
+			pool_error("pool_fetch_cache: malloc failed");
+			return -1;
+		}
+
+		memcpy(p, ptr + sizeof(key_length) + key_length + sizeof(timestamp), *len);
 		free(ptr);
 	}
 
@@ -385,166 +698,591 @@ static int pool_fetch_cache(POOL_CONNECTION_POOL *backend, const char *query, ch
 }
 
 /*
- * encode key.
- * create cache key as md5(username + query string + database name)
+ * Fetch an item from shmem cache and copy it to malloc'ed memory.
+ * Cache hits are read without the partition lock. If the optimistic
+ * read keeps failing because of concurrent writers, or the item needs
+ * to be deleted because it expired, the partition lock is taken.
+ * *stale is set to true if the item is in memqcache_expire_grace.
+ * 0: fetch success, 1: not found -1: error
  */
-static char* encode_key(const char *s, char *buf, POOL_CONNECTION_POOL *backend)
+static int pool_fetch_shmem_cache(POOL_QUERY_HASH *query_hash, POOL_QUERY_KEY *key, char **buf, size_t *len, bool *stale)
 {
-	char* strkey;
-	int u_length;
-	int d_length;
-	int q_length;
-	int length;
+	int partition = query_hash_partition(query_hash);
+	char *ptr;
+	char *p;
+	int mylen;
+	int sts;
 
-	u_length = strlen(backend->info->user);
-	pool_debug("encode_key: username %s", backend->info->user);
+	pool_sketch_increment(query_hash);
 
-	d_length = strlen(backend->info->database);
-	pool_debug("encode_key: database_name %s", backend->info->database);
+	sts = pool_read_item_optimistic(query_hash, key, partition, buf, len, stale);
+	if (sts >= 0)
+		return sts;
 
-	q_length = strlen(s);
-	pool_debug("encode_key: query %s", s);
+	pool_shmem_lock_partition(partition);
 
-	length = u_length + d_length + q_length + 1;
+	ptr = pool_get_item_shmem_cache(query_hash, key, &mylen, &sts, stale);
+	if (ptr == NULL)
+	{
+		pool_shmem_unlock_partition(partition);
+		return sts;
+	}
 
-	strkey = (char*)malloc(sizeof(char) * length);
-	if (!strkey)
+	p = malloc(mylen);
+	if (!p)
 	{
-		pool_error("encode_key: malloc failed");
-		return NULL;
+		pool_shmem_unlock_partition(partition);
+		pool_error("pool_fetch_shmem_cache: malloc failed");
+		return -1;
 	}
+	memcpy(p, ptr, mylen);
 
-	snprintf(strkey, length, "%s%s%s", backend->info->user, s, backend->info->database);
+	pool_shmem_unlock_partition(partition);
 
-	pool_md5_hash(strkey, strlen(strkey), buf);
-	pool_debug("encode_key: `%s' -> `%s'", strkey, buf);
-	free(strkey);
-	return buf;
+	*buf = p;
+	*len = mylen;
+	return 0;
 }
 
-#ifdef DEBUG
 /*
- * dump cache data
+ * Compress cache data if memqcache_compress_threshold is enabled and
+ * the data is large enough. Returns compressed data in static memory
+ * which is overwritten by the next call, or NULL if the data should
+ * be stored as it is.
  */
-static void dump_cache_data(const char *data, size_t len)
+static char *pool_compress_cache_data(char *data, size_t len, size_t *compressed_len)
 {
-	int i;
-	int plen;
-	
-
-	fprintf(stderr,"shmem: len = %zd\n", len);
+	static char *buffer;
+	static size_t buffer_size;
+	struct timeval start;
+	int32 rawlen;
+	size_t bound;
+	int clen;
+
+	if (pool_config->memqcache_compress_threshold <= 0 ||
+		len < (size_t)pool_config->memqcache_compress_threshold ||
+		len <= POOL_CACHE_COMPRESSED_HEADER_SIZE + 1)
+		return NULL;
 
-	while (len > 0)
+	bound = POOL_CACHE_COMPRESSED_HEADER_SIZE + LZ4_COMPRESS_BOUND(len);
+	if (bound > buffer_size)
 	{
-		fprintf(stderr,"shmem: kind:%c\n", *data++);
-		len--;
-		memmove(&plen, data, 4);
-		len -= 4;
-		data += 4;
-		plen = ntohl(plen);
-		fprintf(stderr,"shmem: len:%d\n", plen);
-		plen -= 4;
+		char *p = realloc(buffer, bound);
 
-		fprintf(stderr, "shmem: ");
-		for (i=0;i<plen;i++)
+		if (p == NULL)
 		{
-			fprintf(stderr, "%02x ", (unsigned char)(*data++));
-			len--;
+			pool_error("pool_compress_cache_data: realloc failed");
+			return NULL;
 		}
-		fprintf(stderr, "\n");
+		buffer = p;
+		buffer_size = bound;
+	}
+
+	gettimeofday(&start, NULL);
+	/* Compressed size must be less than the original */
+	clen = lz4_compress(data, len,
+						buffer + POOL_CACHE_COMPRESSED_HEADER_SIZE,
+						len - POOL_CACHE_COMPRESSED_HEADER_SIZE - 1);
+	__sync_add_and_fetch(&stats->compress_usec, elapsed_usec(&start));
+
+	if (clen <= 0)
+	{
+		pool_debug("pool_compress_cache_data: %zd bytes not compressed", len);
+		return NULL;
 	}
+
+	buffer[0] = POOL_CACHE_COMPRESSED;
+	rawlen = htonl(len);
+	memcpy(buffer + 1, &rawlen, sizeof(rawlen));
+	*compressed_len = POOL_CACHE_COMPRESSED_HEADER_SIZE + clen;
+
+	__sync_add_and_fetch(&stats->num_compressed_items, 1);
+	__sync_add_and_fetch(&stats->compress_raw_bytes, len);
+	__sync_add_and_fetch(&stats->compress_stored_bytes, *compressed_len);
+
+	pool_debug("pool_compress_cache_data: %zd bytes compressed to %zd bytes", len, *compressed_len);
+	return buffer;
 }
-#endif
 
 /*
- * send cached messages
+ * Decompress cache data made by pool_compress_cache_data. Returns
+ * malloc'ed data, or NULL on error.
  */
-static int send_cached_messages(POOL_CONNECTION *frontend, const char *qcache, int qcachelen)
+static char *pool_decompress_cache_data(const char *data, size_t len, size_t *raw_len)
 {
-	int msg = 0;
-	int i = 0;
-	int is_prepared_stmt = 0;
-	int len;
-	const char *p;
+	struct timeval start;
+	int32 rawlen;
+	char *p;
 
-	while (i < qcachelen)
+	if (len < POOL_CACHE_COMPRESSED_HEADER_SIZE)
 	{
-		char tmpkind;
-		int tmplen;
-
-		tmpkind = qcache[i];
-		i++;
-
-		memcpy(&tmplen, qcache+i, sizeof(tmplen));
-		i += sizeof(tmplen);
-		len = ntohl(tmplen);
-		p = qcache + i;
-		i += len - sizeof(tmplen);
-
-		/* No need to cache PARSE and BIND responses */
-		if (tmpkind == '1' || tmpkind == '2')
-		{
-			is_prepared_stmt = 1;
-			continue;
-		}
+		pool_error("pool_decompress_cache_data: invalid length %zd", len);
+		return NULL;
+	}
 
-		/*
-		 * In the prepared statement execution, there is no need to send
-		 * 'T' response to the frontend.
-		 */
-		if (is_prepared_stmt && tmpkind == 'T')
-		{
-			continue;
-		}
+	memcpy(&rawlen, data + 1, sizeof(rawlen));
+	rawlen = ntohl(rawlen);
+	if (rawlen <= 0)
+	{
+		pool_error("pool_decompress_cache_data: invalid uncompressed length %d", rawlen);
+		return NULL;
+	}
 
-		/* send message to frontend */
-		pool_debug("send_cached_messages: %c len: %d", tmpkind, len);
-		send_message(frontend, tmpkind, len, p);
+	p = malloc(rawlen);
+	if (p == NULL)
+	{
+		pool_error("pool_decompress_cache_data: malloc failed");
+		return NULL;
+	}
 
-		msg++;
+	gettimeofday(&start, NULL);
+	if (lz4_decompress(data + POOL_CACHE_COMPRESSED_HEADER_SIZE,
+					   len - POOL_CACHE_COMPRESSED_HEADER_SIZE, p, rawlen) != rawlen)
+	{
+		pool_error("pool_decompress_cache_data: corrupted data");
+		free(p);
+		return NULL;
 	}
+	__sync_add_and_fetch(&stats->decompress_usec, elapsed_usec(&start));
 
-	return msg;
+	*raw_len = rawlen;
+	return p;
 }
 
 /*
- * send message to frontend
+ * Returns microseconds elapsed since start.
  */
-static void send_message(POOL_CONNECTION *conn, char kind, int len, const char *data)
+static long long int elapsed_usec(struct timeval *start)
 {
-	pool_debug("send_message: kind=%c, len=%d, data=%p", kind, len, data);
+	struct timeval now;
 
-	pool_write(conn, &kind, 1);
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000000LL + (now.tv_usec - start->tv_usec);
+}
 
-	len = htonl(len);
-	pool_write(conn, &len, sizeof(len));
+/*
+ * In-flight queries of children. See POOL_CACHE_FLIGHT.
+ */
+static POOL_CACHE_FLIGHT *cache_flights;
 
-	len = ntohl(len);
-	pool_write(conn, (void *)data, len-sizeof(len));
+/*
+ * Allocate in-flight query slots of children on shmem.
+ */
+int pool_init_cache_flights(void)
+{
+	size_t size = sizeof(POOL_CACHE_FLIGHT) * pool_config->max_children;
+
+	cache_flights = pool_shared_memory_create(size);
+	if (cache_flights == NULL)
+	{
+		pool_error("pool_init_cache_flights: failed to allocate shared memory. request size: %zd", size);
+		return -1;
+	}
+	memset(cache_flights, 0, size);
+	return 0;
 }
 
-#ifdef USE_MEMCACHED
 /*
- * delete query cache on memcached
+ * Find another child running the query, ignoring children which
+ * started it more than "timeout" microseconds ago. If no child is
+ * running it and "lead" is true, record that this child runs it.
+ * Returns the slot of the other child and sets its generation to
+ * *generation, or NULL if not found.
  */
-static int delete_cache_on_memcached(const char *key)
+static volatile POOL_CACHE_FLIGHT *pool_find_cache_flight(POOL_QUERY_HASH *query_hash, bool lead, long timeout, unsigned int *generation)
 {
+	volatile POOL_CACHE_FLIGHT *leader = NULL;
+	struct timeval start;
+	int i;
 
-	memcached_return rc;
+	/* Without the slots, behave as if no other child is running it */
+	if (cache_flights == NULL)
+		return NULL;
 
-	pool_debug("delete_cache_on_memcached: key: %s", key);
+	gettimeofday(&start, NULL);
 
+	pool_semaphore_lock(QUERY_CACHE_FLIGHT_SEM);
 
-	/* delete cache data on memcached. key is md5 hash query */
-    rc= memcached_delete(memc, key, 32, (time_t)0);
+	for (i=0;i<pool_config->max_children;i++)
+	{
+		volatile POOL_CACHE_FLIGHT *f = &cache_flights[i];
 
-	/* delete cache data on memcached is failed */
-    if (rc != MEMCACHED_SUCCESS && rc != MEMCACHED_BUFFERED)
-    {
-        pool_error ("delete_cache_on_memcached: %s\n", memcached_strerror(memc, rc));
-        return 0;
-    }
-    return 1;
+		if (i == my_proc_id || !(f->generation & 1))
+			continue;
+
+		/* Ignore queries of children which have gone without ending them */
+		if ((start.tv_sec - f->start.tv_sec) * 1000000L +
+			(start.tv_usec - f->start.tv_usec) > timeout)
+			continue;
+
+		if (!memcmp((char *)f->query_hash.query_hash, query_hash->query_hash, sizeof(POOL_QUERY_HASH)))
+		{
+			leader = f;
+			*generation = f->generation;
+			break;
+		}
+	}
+
+	if (leader == NULL && lead)
+	{
+		POOL_CACHE_FLIGHT *mine = &cache_flights[my_proc_id];
+
+		if (mine->generation & 1)
+			mine->generation++;
+		memcpy(&mine->query_hash, query_hash, sizeof(POOL_QUERY_HASH));
+		mine->start = start;
+		mine->generation++;
+	}
+
+	pool_semaphore_unlock(QUERY_CACHE_FLIGHT_SEM);
+
+	return leader;
+}
+
+/*
+ * Called on a cache miss. If another child is running the query,
+ * wait until it ends the query (pool_end_cache_flight) or
+ * memqcache_miss_wait_timeout passes. If no child is running it and
+ * "lead" is true, record that this child runs it.
+ * Returns true if the other child ended the query, so the result may
+ * be cached now.
+ */
+static bool pool_wait_cache_flight(POOL_QUERY_HASH *query_hash, bool lead)
+{
+	long timeout = pool_config->memqcache_miss_wait_timeout * 1000L;
+	volatile POOL_CACHE_FLIGHT *leader;
+	unsigned int generation = 0;
+	struct timeval start;
+	struct timeval now;
+
+	if (cache_flights == NULL)
+		return false;
+
+	gettimeofday(&start, NULL);
+
+	leader = pool_find_cache_flight(query_hash, lead, timeout, &generation);
+	if (leader == NULL)
+		return false;
+
+	pool_debug("pool_wait_cache_flight: waiting for another child running the query");
+
+	while (leader->generation == generation)
+	{
+		gettimeofday(&now, NULL);
+		if ((now.tv_sec - start.tv_sec) * 1000000L + (now.tv_usec - start.tv_usec) >= timeout)
+		{
+			pool_debug("pool_wait_cache_flight: timed out");
+			__sync_add_and_fetch(&stats->num_coalesce_timeouts, 1);
+			return false;
+		}
+		usleep(POOL_CACHE_FLIGHT_POLL_USEC);
+	}
+	pool_memory_barrier();
+
+	return true;
+}
+
+/*
+ * Returns true if the cache item created at "timestamp" has expired.
+ * If "grace" is true, memqcache_expire_grace is added to
+ * memqcache_expire, i.e. stale items are not regarded as expired.
+ */
+static bool pool_cache_expired(time_t timestamp, bool grace)
+{
+	time_t expire = pool_config->memqcache_expire;
+
+	if (expire <= 0)
+		return false;
+
+	if (grace)
+		expire += pool_config->memqcache_expire_grace;
+
+	return time(NULL) > timestamp + expire;
+}
+
+/*
+ * Tell children waiting in pool_wait_cache_flight that this child
+ * has finished running the query, and the result is cached if
+ * possible.
+ */
+void pool_end_cache_flight(void)
+{
+	POOL_CACHE_FLIGHT *mine;
+
+	if (cache_flights == NULL)
+		return;
+
+	mine = &cache_flights[my_proc_id];
+	if (mine->generation & 1)
+	{
+		pool_memory_barrier();
+		mine->generation++;
+	}
+}
+
+/*
+ * Make query key from user name, database name and query string.
+ * The strings are referred to, not copied.
+ */
+static void pool_make_query_key(POOL_QUERY_KEY *key, const char *query, POOL_CONNECTION_POOL *backend)
+{
+	int i;
+
+	key->parts[0] = backend->info->user;
+	key->parts[1] = backend->info->database;
+	key->parts[2] = query;
+
+	key->length = 0;
+	for (i=0;i<POOL_QUERY_KEY_PARTS;i++)
+	{
+		key->lens[i] = strlen(key->parts[i]) + 1;
+		key->length += key->lens[i];
+	}
+}
+
+/*
+ * encode key.
+ * create cache key as hash of username, database name and query
+ * string. Since the hash is not cryptographic, the key itself is
+ * stored with the cache and compared on a hit.
+ */
+static void encode_key(POOL_QUERY_KEY *key, char *buf)
+{
+	MURMUR3_CTX ctx;
+	int i;
+
+	murmur3_init(&ctx, 0);
+	for (i=0;i<POOL_QUERY_KEY_PARTS;i++)
+		murmur3_update(&ctx, key->parts[i], key->lens[i]);
+	murmur3_final(&ctx, buf);
+
+	pool_debug("encode_key: user:%s database:%s query:%s -> `%s'",
+			   key->parts[0], key->parts[1], key->parts[2], buf);
+}
+
+/*
+ * Copy query key to dest, which must have key->length bytes.
+ */
+static void pool_copy_query_key(POOL_QUERY_KEY *key, char *dest)
+{
+	int i;
+
+	for (i=0;i<POOL_QUERY_KEY_PARTS;i++)
+	{
+		memcpy(dest, key->parts[i], key->lens[i]);
+		dest += key->lens[i];
+	}
+}
+
+/*
+ * Return true if the stored key is same as the query key.
+ */
+static bool pool_query_key_equal(POOL_QUERY_KEY *key, const char *stored, size_t len)
+{
+	int i;
+
+	if (len != key->length)
+		return false;
+
+	for (i=0;i<POOL_QUERY_KEY_PARTS;i++)
+	{
+		if (memcmp(stored, key->parts[i], key->lens[i]) != 0)
+			return false;
+		stored += key->lens[i];
+	}
+	return true;
+}
+
+#ifdef DEBUG
+/*
+ * dump cache data
+ */
+static void dump_cache_data(const char *data, size_t len)
+{
+	int i;
+	int plen;
+	
+
+	fprintf(stderr,"shmem: len = %zd\n", len);
+
+	if (len > 0 && *data == POOL_CACHE_COMPRESSED)
+	{
+		fprintf(stderr,"shmem: compressed\n");
+		return;
+	}
+
+	while (len > 0)
+	{
+		fprintf(stderr,"shmem: kind:%c\n", *data++);
+		len--;
+		memmove(&plen, data, 4);
+		len -= 4;
+		data += 4;
+		plen = ntohl(plen);
+		fprintf(stderr,"shmem: len:%d\n", plen);
+		plen -= 4;
+
+		fprintf(stderr, "shmem: ");
+		for (i=0;i<plen;i++)
+		{
+			fprintf(stderr, "%02x ", (unsigned char)(*data++));
+			len--;
+		}
+		fprintf(stderr, "\n");
+	}
+}
+#endif
+
+/*
+ * send cached messages. Compressed data is decompressed here.
+ * Returns number of messages sent, or -1 if the data could not be
+ * decompressed. Nothing is sent in that case.
+ */
+static int send_cached_messages(POOL_CONNECTION *frontend, const char *qcache, int qcachelen)
+{
+	int msg;
+	size_t pos = 0;
+	char *raw = NULL;
+
+	if (qcachelen > 0 && qcache[0] == POOL_CACHE_COMPRESSED)
+	{
+		size_t rawlen;
+
+		raw = pool_decompress_cache_data(qcache, qcachelen, &rawlen);
+		if (raw == NULL)
+			return -1;
+		qcache = raw;
+		qcachelen = rawlen;
+	}
+
+	msg = send_cached_portal_messages(frontend, qcache, qcachelen, &pos, 0);
+
+	free(raw);
+	return msg;
+}
+
+/*
+ * Send uncompressed cached messages from offset *pos. If max_rows is
+ * not 0, stop before the (max_rows+1)th DataRow and send PortalSuspended
+ * instead, as the backend does for Execute with a row limit. *pos is
+ * set to the offset of the first message not sent, or qcachelen if all
+ * have been sent. Returns number of messages sent.
+ */
+static int send_cached_portal_messages(POOL_CONNECTION *frontend, const char *qcache, size_t qcachelen, size_t *pos, int max_rows)
+{
+	int msg = 0;
+	int rows = 0;
+	int is_prepared_stmt = 0;
+	bool resumed = *pos > 0;
+	size_t i = *pos;
+	int len;
+	const char *p;
+
+	while (i < qcachelen)
+	{
+		char tmpkind;
+		int tmplen;
+		size_t next;
+
+		tmpkind = qcache[i];
+		memcpy(&tmplen, qcache+i+1, sizeof(tmplen));
+		len = ntohl(tmplen);
+		p = qcache + i + 1 + sizeof(tmplen);
+		next = i + 1 + len;
+
+		/* No need to cache PARSE and BIND responses */
+		if (tmpkind == '1' || tmpkind == '2')
+		{
+			is_prepared_stmt = 1;
+			i = next;
+			continue;
+		}
+
+		/*
+		 * In the prepared statement execution, there is no need to send
+		 * 'T' response to the frontend.
+		 */
+		if (is_prepared_stmt && tmpkind == 'T')
+		{
+			i = next;
+			continue;
+		}
+
+		if (tmpkind == 'D' && max_rows > 0 && rows == max_rows)
+		{
+			pool_debug("send_cached_portal_messages: portal suspended after %d rows", rows);
+			send_message(frontend, 's', sizeof(int), "");
+			*pos = i;
+			return msg + 1;
+		}
+
+		/*
+		 * CommandComplete after a suspended portal reports the number
+		 * of rows sent by the last Execute.
+		 */
+		if (tmpkind == 'C' && resumed && strncmp(p, "SELECT ", 7) == 0)
+		{
+			char tag[64];
+
+			snprintf(tag, sizeof(tag), "SELECT %d", rows);
+			pool_debug("send_cached_portal_messages: C len: %zd", sizeof(int) + strlen(tag) + 1);
+			send_message(frontend, 'C', sizeof(int) + strlen(tag) + 1, tag);
+		}
+		else
+		{
+			/* send message to frontend */
+			pool_debug("send_cached_messages: %c len: %d", tmpkind, len);
+			send_message(frontend, tmpkind, len, p);
+		}
+
+		if (tmpkind == 'D')
+			rows++;
+		msg++;
+		i = next;
+	}
+
+	*pos = qcachelen;
+	return msg;
+}
+
+/*
+ * send message to frontend
+ */
+static void send_message(POOL_CONNECTION *conn, char kind, int len, const char *data)
+{
+	pool_debug("send_message: kind=%c, len=%d, data=%p", kind, len, data);
+
+	pool_write(conn, &kind, 1);
+
+	len = htonl(len);
+	pool_write(conn, &len, sizeof(len));
+
+	len = ntohl(len);
+	pool_write(conn, (void *)data, len-sizeof(len));
+}
+
+#ifdef USE_MEMCACHED
+/*
+ * delete query cache on memcached
+ */
+static int delete_cache_on_memcached(const char *key)
+{
+
+	memcached_return rc;
+
+	pool_debug("delete_cache_on_memcached: key: %s", key);
+
+
+	/* delete cache data on memcached. key is md5 hash query */
+    rc= memcached_delete(memc, key, 32, (time_t)0);
+
+	/* delete cache data on memcached is failed */
+    if (rc != MEMCACHED_SUCCESS && rc != MEMCACHED_BUFFERED)
+    {
+        pool_error ("delete_cache_on_memcached: %s\n", memcached_strerror(memc, rc));
+        return 0;
+    }
+    return 1;
 
 }
 #endif
@@ -568,9 +1306,7 @@ POOL_STATUS pool_fetch_from_memory_cache(POOL_CONNECTION *frontend,
 	*foundp = false;
 
 	POOL_SETMASK2(&BlockSig, &oldmask);
-	pool_shmem_lock();
 	sts = pool_fetch_cache(backend, contents, &qcache, &qcachelen);
-	pool_shmem_unlock();
 	POOL_SETMASK(&oldmask);
 
 	if (sts == 0)
@@ -578,49 +1314,16 @@ POOL_STATUS pool_fetch_from_memory_cache(POOL_CONNECTION *frontend,
 		/*
 		 * Cache found. send each messages to frontend
 		 */
-		send_cached_messages(frontend, qcache, qcachelen);
-		free(qcache);
-
-		/*
-		 * If we are doing extended query, wait and discard Sync
-		 * message from frontend. This is necessary to prevent
-		 * receiving Sync message after Sending Ready for query.
-		 */
-		if (pool_is_doing_extended_query_message())
+		if (send_cached_messages(frontend, qcache, qcachelen) < 0)
 		{
-			char kind;
-			int32 len;
-
-			if (pool_flush(frontend))
-				return POOL_END;
-			if (pool_read(frontend, &kind, 1))
-				return POOL_END;
-			pool_debug("pool_fetch_from_memory_cache: expecting sync: %c", kind);
-			if (pool_read(frontend, &len, sizeof(len)))
-				return POOL_END;
+			/* Behave as if cache not found */
+			free(qcache);
+			return POOL_CONTINUE;
 		}
+		free(qcache);
 
-		/*
-		 * send a "READY FOR QUERY"
-		 */
-		if (MAJOR(backend) == PROTO_MAJOR_V3)
-		{
-			signed char state;
-
-			/*
-			 * We keep previous transaction state.
-			 */
-			state = MASTER(backend)->tstate;
-			send_message(frontend, 'Z', 5, (char *)&state);
-		}
-		else
-		{
-			pool_write(frontend, "Z", 1);
-		}
-		if (pool_flush(frontend))
-		{
+		if (send_cached_ready_for_query(frontend, backend) != POOL_CONTINUE)
 			return POOL_END;
-		}
 
 		*foundp = true;
 
@@ -641,6 +1344,136 @@ POOL_STATUS pool_fetch_from_memory_cache(POOL_CONNECTION *frontend,
 	return POOL_CONTINUE;
 }
 
+/*
+ * Fetch the result of a portal from memory cache, honoring the row
+ * limit of Execute. If max_rows is not 0 and more rows remain,
+ * PortalSuspended is sent, and the rest of the cache is kept in
+ * "replay" of the portal and sent by the following Executes without
+ * looking up the cache again.
+ */
+POOL_STATUS pool_fetch_portal_from_memory_cache(POOL_CONNECTION *frontend,
+												POOL_CONNECTION_POOL *backend,
+												char *contents, POOL_CACHE_REPLAY *replay,
+												int max_rows, bool *foundp)
+{
+	bool resumed = true;
+#ifdef HAVE_SIGPROCMASK
+	sigset_t oldmask;
+#else
+	int	oldmask;
+#endif
+
+	*foundp = false;
+
+	if (replay->data == NULL)
+	{
+		char *qcache;
+		size_t qcachelen;
+		int sts;
+
+		POOL_SETMASK2(&BlockSig, &oldmask);
+		sts = pool_fetch_cache(backend, contents, &qcache, &qcachelen);
+		POOL_SETMASK(&oldmask);
+
+		if (sts == -1)
+		{
+			pool_error("pool_fetch_portal_from_memory_cache: pool_fetch_cache() failed. %s", contents);
+			return POOL_END;
+		}
+		else if (sts != 0)
+		{
+			/* Cache not found */
+			return POOL_CONTINUE;
+		}
+
+		if (qcachelen > 0 && qcache[0] == POOL_CACHE_COMPRESSED)
+		{
+			char *raw;
+			size_t rawlen;
+
+			raw = pool_decompress_cache_data(qcache, qcachelen, &rawlen);
+			free(qcache);
+			if (raw == NULL)
+			{
+				/* Behave as if cache not found */
+				return POOL_CONTINUE;
+			}
+			qcache = raw;
+			qcachelen = rawlen;
+		}
+
+		replay->data = qcache;
+		replay->len = qcachelen;
+		replay->pos = 0;
+		resumed = false;
+	}
+
+	send_cached_portal_messages(frontend, replay->data, replay->len,
+								&replay->pos, max_rows);
+
+	if (replay->pos >= replay->len)
+	{
+		free(replay->data);
+		replay->data = NULL;
+	}
+
+	if (send_cached_ready_for_query(frontend, backend) != POOL_CONTINUE)
+		return POOL_END;
+
+	*foundp = true;
+
+	if (!resumed && pool_config->log_per_node_statement)
+		pool_log("query result fetched from cache. statement: %s", contents);
+
+	pool_debug("pool_fetch_portal_from_memory_cache: %s the portal from the query cache, %s",
+			   replay->data ? "suspended" : "completed", contents);
+
+	return POOL_CONTINUE;
+}
+
+/*
+ * Finish a response made from the query cache. If we are doing
+ * extended query, wait and discard Sync message from frontend. This is
+ * necessary to prevent receiving Sync message after Sending Ready for
+ * query. Then send a "READY FOR QUERY".
+ */
+static POOL_STATUS send_cached_ready_for_query(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
+{
+	if (pool_is_doing_extended_query_message())
+	{
+		char kind;
+		int32 len;
+
+		if (pool_flush(frontend))
+			return POOL_END;
+		if (pool_read(frontend, &kind, 1))
+			return POOL_END;
+		pool_debug("send_cached_ready_for_query: expecting sync: %c", kind);
+		if (pool_read(frontend, &len, sizeof(len)))
+			return POOL_END;
+	}
+
+	if (MAJOR(backend) == PROTO_MAJOR_V3)
+	{
+		signed char state;
+
+		/*
+		 * We keep previous transaction state.
+		 */
+		state = MASTER(backend)->tstate;
+		send_message(frontend, 'Z', 5, (char *)&state);
+	}
+	else
+	{
+		pool_write(frontend, "Z", 1);
+	}
+	if (pool_flush(frontend))
+	{
+		return POOL_END;
+	}
+	return POOL_CONTINUE;
+}
+
 /*
  * Simple and rough(thus unreliable) check if the query is likely
  * SELECT. Just check if the query starts with SELECT or WITH. This
@@ -719,6 +1552,29 @@ bool pool_is_likely_select(char *query)
 	return false;
 }
 
+/*
+ * Return the text to make the query cache key of "query" from. If
+ * memqcache_parse_tree_key is on and "node" is a SELECT, it is the
+ * parse tree deparsed by nodeToString(), so that queries differing
+ * only in white spaces, keyword case or comments share the cache.
+ * Constants are kept in the text. The result is allocated in the
+ * current memory context.
+ */
+char *pool_query_cache_key_text(char *query, Node *node)
+{
+	char *text;
+
+	if (!pool_config->memqcache_parse_tree_key || node == NULL || !IsA(node, SelectStmt))
+		return query;
+
+	text = nodeToString(node);
+	if (text == NULL || *text == '\0')
+		return query;
+
+	pool_debug("pool_query_cache_key_text: %s -> %s", query, text);
+	return text;
+}
+
 /*
  * Return true if SELECT can be cached.  "node" is the parse tree for
  * the query and "query" is the query string.
@@ -1078,77 +1934,324 @@ static int pool_get_dml_table_oid(int **oid)
 	return oidbufp;
 }
 
-static int pool_get_dropdb_table_oids(int **oids, int dboid)
+/* Discard oid internal buffer */
+static void pool_discard_dml_table_oid(void)
+{
+	oidbufp = 0;
+}
+
+/*
+ * Management modules for oid map.  When caching SELECT results, we
+ * record which tables they use in the oid map on shared memory, which
+ * has following structure.
+ *
+ * hash bucket -+- table(database_oid, table_oid) -+- entry(query hash)
+ *              |                                  |
+ *              |                                  +- entry(query hash)...
+ *              |
+ *              +- table(database_oid, table_oid) -+- ...
+ *
+ * A table is found by hashing its database oid and table oid. Each
+ * table has a list of entries, each of which holds the key of a cache
+ * entry using the table. If the SELECT uses multiple tables, an entry
+ * is added to each of them. When INSERT/UPDATE/DELETE is executed,
+ * corresponding caches must be deleted(cache invalidation) (when DROP
+ * TABLE, ALTER TABLE is executed, the caches must be deleted as
+ * well). When database is dropped, all caches belonging to the
+ * database must be deleted.
+ *
+ * Tables and entries are taken from fixed size arrays. If either of
+ * them runs out, caches of a victim table are invalidated to make
+ * room. The oid map is protected by OID_MAP_SEM. Keys are copied out
+ * of the map so that caches are deleted after releasing OID_MAP_SEM.
+ * Cache partition locks may be acquired while holding OID_MAP_SEM, but
+ * never the other way around.
+ */
+static POOL_OID_MAP_HEADER *oid_map;
+static int *oid_map_buckets;
+static POOL_OID_MAP_TABLE *oid_map_tables;
+static POOL_OID_MAP_ENTRY *oid_map_entries;
+
+/*
+ * Return number of tables of the oid map
+ */
+static int pool_oid_map_num_tables(void)
+{
+	int n = pool_config->memqcache_max_num_oidmap / 8;
+
+	return n < 64 ? 64 : n;
+}
+
+/*
+ * Return number of hash buckets of the oid map (power of 2)
+ */
+static int pool_oid_map_num_buckets(void)
+{
+	int n = 1;
+
+	while (n < pool_oid_map_num_tables())
+		n <<= 1;
+	return n;
+}
+
+/*
+ * Return shared memory size of the oid map
+ */
+size_t pool_oid_map_size(void)
+{
+	return sizeof(POOL_OID_MAP_HEADER) +
+		sizeof(int) * pool_oid_map_num_buckets() +
+		sizeof(POOL_OID_MAP_TABLE) * pool_oid_map_num_tables() +
+		sizeof(POOL_OID_MAP_ENTRY) * pool_config->memqcache_max_num_oidmap;
+}
+
+/*
+ * Allocate and initialize the oid map on shared memory.
+ * Used by both of shmem and memcached.
+ */
+int pool_init_oid_maps(void)
 {
-	int *rtn = 0;
-	int oids_size = 0;
-	int *tmp;
+	size_t size = pool_oid_map_size();
+	char *p;
 
-	int num_oids = 0;
-	DIR *dir;
-	struct dirent *dp;
-	char path[1024];
+	p = pool_cache_shared_memory_create(size);
+	if (p == NULL)
+	{
+		pool_error("pool_init_oid_maps: failed to allocate shared memory for oid map. request size: %zd", size);
+		return -1;
+	}
 
-	snprintf(path, sizeof(path), "%s/%d", pool_config->memqcache_oiddir, dboid);
-	if ((dir = opendir(path)) == NULL)
+	oid_map = (POOL_OID_MAP_HEADER *)p;
+	p += sizeof(POOL_OID_MAP_HEADER);
+	oid_map_buckets = (int *)p;
+	p += sizeof(int) * pool_oid_map_num_buckets();
+	oid_map_tables = (POOL_OID_MAP_TABLE *)p;
+	p += sizeof(POOL_OID_MAP_TABLE) * pool_oid_map_num_tables();
+	oid_map_entries = (POOL_OID_MAP_ENTRY *)p;
+
+	/* Links to caches restored from memqcache_persistent_file are kept */
+	if (!persistent_cache_restored)
 	{
-		pool_debug("pool_get_dropdb_table_oids: Failed to open dir: %s", path);
-		return 0;
+		oid_map->num_buckets = pool_oid_map_num_buckets();
+		oid_map->num_tables = pool_oid_map_num_tables();
+		oid_map->num_entries = pool_config->memqcache_max_num_oidmap;
+		oid_map->num_overflows = 0;
+		pool_oid_map_reset();
 	}
 
-	while ((dp = readdir(dir)) != NULL)
+	pool_log("pool_init_oid_maps: %d tables and %d entries (%zd bytes)",
+			 oid_map->num_tables, oid_map->num_entries, size);
+	return 0;
+}
+
+/*
+ * Make all tables and entries free. Caller must hold OID_MAP_SEM if
+ * necessary.
+ */
+static void pool_oid_map_reset(void)
+{
+	int i;
+
+	for (i=0;i<oid_map->num_buckets;i++)
+		oid_map_buckets[i] = POOL_OID_MAP_NONE;
+
+	for (i=0;i<oid_map->num_tables;i++)
 	{
-		if (strcmp(dp->d_name, ".") == 0 || strcmp(dp->d_name, "..") == 0)
-			continue;
+		oid_map_tables[i].table_oid = 0;
+		oid_map_tables[i].head = POOL_OID_MAP_NONE;
+		oid_map_tables[i].num_entries = 0;
+		oid_map_tables[i].next = i + 1 < oid_map->num_tables ? i + 1 : POOL_OID_MAP_NONE;
+	}
+	oid_map->free_table = 0;
 
-		if (num_oids >= oids_size)
-		{
-			oids_size += POOL_OIDBUF_SIZE;
-			tmp = realloc(rtn, sizeof(int) * oids_size);
-			if (tmp == NULL)
-			{
-				closedir(dir);
-				return 0;
-			}
-			rtn = tmp;
-		}
+	for (i=0;i<oid_map->num_entries;i++)
+		oid_map_entries[i].next = i + 1 < oid_map->num_entries ? i + 1 : POOL_OID_MAP_NONE;
+	oid_map->free_entry = 0;
+
+	oid_map->used_entries = 0;
+	oid_map->victim = 0;
+}
+
+/*
+ * Look for a table in the oid map. If linkp is not NULL, the address
+ * of the link pointing to the table is set to it.
+ * Returns the table or POOL_OID_MAP_NONE. Caller must hold OID_MAP_SEM.
+ */
+static int pool_oid_map_find_table(int dboid, int table_oid, int **linkp)
+{
+	uint32 h;
+	int *link;
+	int t;
+
+	/* Mix database oid and table oid */
+	h = (uint32)dboid * 0x9e3779b1 ^ (uint32)table_oid;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	link = &oid_map_buckets[h & (oid_map->num_buckets - 1)];
 
-		rtn[num_oids] = atol(dp->d_name);
-		num_oids++;
+	for (t = *link; t != POOL_OID_MAP_NONE; t = *link)
+	{
+		if (oid_map_tables[t].dboid == dboid && oid_map_tables[t].table_oid == table_oid)
+			break;
+		link = &oid_map_tables[t].next;
 	}
 
-	closedir(dir);
-	*oids = rtn;
+	if (linkp)
+		*linkp = link;
+	return t;
+}
 
-	return num_oids;
+/*
+ * Remove a table and all of its entries from the oid map. Keys of the
+ * entries are appended to *keys, which is realloc'ed as needed.
+ * link is the link pointing to the table. Caller must hold OID_MAP_SEM.
+ * If memory allocation fails, the caches are deleted right here.
+ */
+static void pool_oid_map_detach_table(int table, int *link, POOL_QUERY_HASH **keys, int *num_keys, int *keys_size)
+{
+	POOL_OID_MAP_TABLE *t = &oid_map_tables[table];
+	bool copy = true;
+	int e;
+
+	if (*num_keys + t->num_entries > *keys_size)
+	{
+		int newsize = *num_keys + t->num_entries;
+		POOL_QUERY_HASH *p;
+
+		p = realloc(*keys, sizeof(POOL_QUERY_HASH) * newsize);
+		if (p == NULL)
+		{
+			pool_error("pool_oid_map_detach_table: realloc failed");
+			copy = false;
+		}
+		else
+		{
+			*keys = p;
+			*keys_size = newsize;
+		}
+	}
+
+	while ((e = t->head) != POOL_OID_MAP_NONE)
+	{
+		if (copy)
+			memcpy(&(*keys)[(*num_keys)++], &oid_map_entries[e].query_hash, sizeof(POOL_QUERY_HASH));
+		else
+			pool_delete_cache_by_keys(&oid_map_entries[e].query_hash, 1);
+		t->head = oid_map_entries[e].next;
+		oid_map_entries[e].next = oid_map->free_entry;
+		oid_map->free_entry = e;
+		oid_map->used_entries--;
+	}
+
+	*link = t->next;
+	t->table_oid = 0;
+	t->num_entries = 0;
+	t->next = oid_map->free_table;
+	oid_map->free_table = table;
 }
 
-/* Discard oid internal buffer */
-static void pool_discard_dml_table_oid(void)
+/*
+ * Make room in the oid map by removing a victim table. If
+ * need_entries is true, only tables having entries are chosen. Keys
+ * of the removed entries are appended to *keys, and the caller must
+ * delete those caches. Caller must hold OID_MAP_SEM.
+ * Returns 0 on success, -1 if no table could be removed.
+ */
+static int pool_oid_map_evict(POOL_QUERY_HASH **keys, int *num_keys, int *keys_size, bool need_entries)
 {
-	oidbufp = 0;
+	int i;
+
+	for (i=0;i<oid_map->num_tables;i++)
+	{
+		POOL_OID_MAP_TABLE *t;
+		int victim;
+		int *link;
+
+		victim = oid_map->victim;
+		oid_map->victim = (victim + 1) % oid_map->num_tables;
+
+		t = &oid_map_tables[victim];
+		if (t->table_oid == 0 || (need_entries && t->num_entries == 0))
+			continue;
+
+		pool_debug("pool_oid_map_evict: invalidate caches of table %d in database %d (%d entries)",
+				   t->table_oid, t->dboid, t->num_entries);
+
+		pool_oid_map_find_table(t->dboid, t->table_oid, &link);
+		oid_map->num_overflows++;
+		pool_oid_map_detach_table(victim, link, keys, num_keys, keys_size);
+		return 0;
+	}
+	return -1;
 }
 
 /*
- * Management modules for oid map.  When caching SELECT results, we
- * record table oids to file, which has following structure.
- *
- * memqcache_oiddir -+- database_oid -+-table_oid_file1
- *                                    |
- *                                    +-table_oid_file2
- *                                    |
- *                                    +-table_oid_file3...
- *
- * table_oid_file's name is table oid, which was used by the SELECT
- * statement. The file has 1 or more cacheid(s). When SELECT result is
- * cached, the file is created and cache id is appended. Later SELECT
- * using same table oid will add to the same file. If the SELECT uses
- * multiple tables, multiple table_oid_file will be created. When
- * INSERT/UPDATE/DELETE is executed, corresponding caches must be
- * deleted(cache invalidation) (when DROP TABLE, ALTER TABLE is
- * executed, the caches must be deleted as well). When database is
- * dropped, all caches belonging to the database must be deleted.
+ * Delete caches specified by keys.
  */
+static void pool_delete_cache_by_keys(POOL_QUERY_HASH *keys, int num_keys)
+{
+	int i;
+#ifdef USE_MEMCACHED
+	memcached_return rc;
+	bool pipeline = !pool_is_shmem_cache() && num_keys > 1;
+
+	/*
+	 * Send the deletes to memcached without waiting for each reply, and
+	 * flush them at the end. Invalidating many keys then costs one round
+	 * trip per server instead of one per key.
+	 */
+	if (pipeline)
+	{
+		memcached_behavior_set(memc, MEMCACHED_BEHAVIOR_NOREPLY, 1);
+		memcached_behavior_set(memc, MEMCACHED_BEHAVIOR_BUFFER_REQUESTS, 1);
+	}
+#endif
+
+	for (i=0;i<num_keys;i++)
+	{
+		if (pool_is_shmem_cache())
+		{
+			int partition = query_hash_partition(&keys[i]);
+			POOL_CACHEID *c;
+			POOL_CACHEID cacheid;
+
+			pool_shmem_lock_partition(partition);
+			c = pool_hash_search(&keys[i]);
+			if (c)
+			{
+				cacheid = *c;
+				pool_debug("pool_delete_cache_by_keys: deleting cacheid:%d itemid:%d",
+						   cacheid.blockid, cacheid.itemid);
+				pool_delete_item_shmem_cache(&cacheid);
+			}
+			pool_shmem_unlock_partition(partition);
+		}
+#ifdef USE_MEMCACHED
+		else
+		{
+			char delbuf[33];
+
+			memcpy(delbuf, keys[i].query_hash, 32);
+			delbuf[32] = 0;
+			pool_debug("pool_delete_cache_by_keys: deleting %s", delbuf);
+			delete_cache_on_memcached(delbuf);
+		}
+#endif
+	}
+
+#ifdef USE_MEMCACHED
+	if (pipeline)
+	{
+		pool_debug("pool_delete_cache_by_keys: flushing %d deletes", num_keys);
+		rc = memcached_flush_buffers(memc);
+		if (rc != MEMCACHED_SUCCESS)
+			pool_error("pool_delete_cache_by_keys: memcached_flush_buffers %s", memcached_strerror(memc, rc));
+		memcached_behavior_set(memc, MEMCACHED_BEHAVIOR_BUFFER_REQUESTS, 0);
+		memcached_behavior_set(memc, MEMCACHED_BEHAVIOR_NOREPLY, 0);
+	}
+#endif
+}
 
 /*
  * Get oid of current database
@@ -1224,218 +2327,129 @@ int pool_get_database_oid_from_dbname(char *dbname)
 	return dboid;
 }
 
-/*
- * Add cache id(shmem case) or hash key(memcached case) to table oid
- * map file.  Caller must hold shmem lock before calling this function
- * to avoid file extension conflict among different pgpool child
- * process.
- * As of pgpool-II 3.2, pool_handle_query_cache is responsible for that.
- * (pool_handle_query_cache -> pool_commit_cache -> pool_add_table_oid_map)
- */
-static void pool_add_table_oid_map(POOL_CACHEKEY *cachekey, int num_table_oids, int *table_oids)
-{
-	char *dir;
-	int dboid;
-	char path[1024];
-	int i;
-	int len;
-
-	/*
-	 * Create memqcache_oiddir
-	 */
-	dir = pool_config->memqcache_oiddir;
-
-	if (mkdir(dir, S_IREAD|S_IWRITE|S_IEXEC) == -1)
-	{
-		if (errno != EEXIST)
-		{
-			pool_error("pool_add_table_oid_map: failed to create %s. Reason:%s", dir, strerror(errno));
-			return;
-		}
-	}
+/*
+ * Add cache key to oid map entries of the tables used by the cache.
+ * If the oid map is full, caches of victim tables are invalidated to
+ * make room, which may include the cache just registered.
+ */
+static void pool_add_table_oid_map(POOL_QUERY_HASH *query_hash, int num_table_oids, int *table_oids)
+{
+	POOL_QUERY_HASH *keys = NULL;
+	int num_keys = 0;
+	int keys_size = 0;
+	int dboid;
+	int i;
 
-	/*
-	 * Create memqcache_oiddir/database_oid
-	 */
 	dboid = pool_get_database_oid();
 
 	pool_debug("pool_add_table_oid_map: dboid %d", dboid);
 	if (dboid <= 0)
 	{
 		pool_error("pool_add_table_oid_map: could not get database oid");
+		pool_delete_cache_by_keys(query_hash, 1);
 		return;
 	}
 
-	snprintf(path, sizeof(path), "%s/%d", dir, dboid);
-	if (mkdir(path, S_IREAD|S_IWRITE|S_IEXEC) == -1)
-	{
-		if (errno != EEXIST)
-		{
-			pool_error("pool_add_table_oid_map: failed to create %s. reason:%s", path, strerror(errno));
-			return;
-		}
-	}
-
-	if (pool_is_shmem_cache())
-	{
-		len = sizeof(cachekey->cacheid);
-	}
-	else
-	{
-		len = sizeof(cachekey->hashkey);
-	}
+	pool_semaphore_lock(OID_MAP_SEM);
 
 	for (i=0;i<num_table_oids;i++)
 	{
-		int fd;
-		int oid = table_oids[i];
-		int sts;
-		struct flock fl;
+		POOL_OID_MAP_TABLE *t;
+		int table;
+		int e;
 
-		/*
-		 * Create or open each memqcache_oiddir/database_oid/table_oid
-		 */
-		snprintf(path, sizeof(path), "%s/%d/%d", dir, dboid, oid);
-		if ((fd = open(path, O_CREAT|O_RDWR, S_IRUSR|S_IWUSR)) == -1)
+		table = pool_oid_map_find_table(dboid, table_oids[i], NULL);
+		if (table == POOL_OID_MAP_NONE)
 		{
-			pool_error("pool_add_table_oid_map: failed to create or open %s. reason:%s",
-					   path, strerror(errno));
-			return;
-		}
+			int *link;
 
-		fl.l_type   = F_WRLCK;
-		fl.l_whence = SEEK_SET;
-		fl.l_start  = 0;        	/* Offset from l_whence         */
-		fl.l_len    = 0;        	/* length, 0 = to EOF           */
+			if (oid_map->free_table == POOL_OID_MAP_NONE &&
+				pool_oid_map_evict(&keys, &num_keys, &keys_size, false) < 0)
+			{
+				pool_error("pool_add_table_oid_map: no free table in oid map");
+				break;
+			}
 
-		sts = fcntl(fd, F_SETLKW, &fl);
-		if (sts == -1)
-		{
-			pool_error("pool_add_table_oid_map: failed to lock %s. reason:%s",
-					   path, strerror(errno));
-			close(fd);
-			return;
+			/* Link a new table to the hash bucket */
+			pool_oid_map_find_table(dboid, table_oids[i], &link);
+			table = oid_map->free_table;
+			t = &oid_map_tables[table];
+			oid_map->free_table = t->next;
+			t->dboid = dboid;
+			t->table_oid = table_oids[i];
+			t->head = POOL_OID_MAP_NONE;
+			t->num_entries = 0;
+			t->next = POOL_OID_MAP_NONE;
+			*link = table;
 		}
+		t = &oid_map_tables[table];
 
 		/*
-		 * Below was ifdef-out because of a performance reason.
-		 * Looking for duplicate cache entries in a file needed
-		 * unacceptably high cost. So we gave up this and decided not
-		 * to care about duplicate entries in the file.
+		 * The same query is often registered again after its cache
+		 * was evicted. Skip if it is the latest entry.
 		 */
-#ifdef NOT_USED
-		for (;;)
+		if (t->head != POOL_OID_MAP_NONE &&
+			memcmp(&oid_map_entries[t->head].query_hash, query_hash, sizeof(POOL_QUERY_HASH)) == 0)
+			continue;
+
+		if (oid_map->free_entry == POOL_OID_MAP_NONE)
 		{
-			sts = read(fd, (char *)&buf, len);
-			if (sts == -1)
-			{
-				pool_error("pool_add_table_oid_map: failed to read %s. reason:%s",
-						   path, strerror(errno));
-				close(fd);
-				return;
-			}
-			else if (sts == len)
-			{
-				if (memcmp(cachekey, &buf, len) == 0)
-				{
-					/* Same key found. Skip this */
-					close(fd);
-					return;
-				}
-				continue;
-			}
-			/*
-			 * Must be EOF
-			 */
-			if (sts != 0)
+			if (pool_oid_map_evict(&keys, &num_keys, &keys_size, true) < 0)
 			{
-				pool_error("pool_add_table_oid_map: invalid read length %d for %s", sts, path);
-				close(fd);
-				return;
+				pool_error("pool_add_table_oid_map: no free entry in oid map");
+				break;
 			}
-			break;
+			/* The table may have been the victim */
+			i--;
+			continue;
 		}
-#endif
 
-		if (lseek(fd, 0, SEEK_END) == -1)
-		{
-			pool_error("pool_add_table_oid_map: failed to lseek %s. reason:%s",
-					   path, strerror(errno));
-			close(fd);
-			return;
-		}
+		e = oid_map->free_entry;
+		oid_map->free_entry = oid_map_entries[e].next;
+		memcpy(&oid_map_entries[e].query_hash, query_hash, sizeof(POOL_QUERY_HASH));
+		oid_map_entries[e].next = t->head;
+		t->head = e;
+		t->num_entries++;
+		oid_map->used_entries++;
+	}
 
-		/*
-		 * Write cache_id or cache key at the end of file
-		 */
-		sts = write(fd, (char *)cachekey, len);
-		if (sts == -1 || sts != len)
-		{
-			pool_error("pool_add_table_oid_map: failed to write %s. reason:%s",
-					   path, strerror(errno));
-			close(fd);
-			return;
-		}
-		close(fd);
+	pool_semaphore_unlock(OID_MAP_SEM);
+
+	/*
+	 * The cache could not be registered to some tables. Do not keep it
+	 * since it would not be invalidated.
+	 */
+	if (i < num_table_oids)
+		pool_delete_cache_by_keys(query_hash, 1);
+
+	if (keys)
+	{
+		pool_delete_cache_by_keys(keys, num_keys);
+		free(keys);
 	}
 }
 
 /*
- * Discard all oid maps at pgpool-II startup.
- * This is necessary for shmem case.
+ * Discard all oid maps at pgpool-II startup or when the whole cache is
+ * cleared.
  */
 void pool_discard_oid_maps(void)
 {
-	char command[1024];
-
-	snprintf(command, sizeof(command), "/bin/rm -fr %s/[0-9]*",
-			 pool_config->memqcache_oiddir);
-	system(command);
-}
-
-void pool_discard_oid_maps_by_db(int dboid)
-{
-	char command[1024];
-
-	if (pool_is_shmem_cache())
-	{
-		snprintf(command, sizeof(command), "/bin/rm -fr %s/%d/",
-				 pool_config->memqcache_oiddir, dboid);
-		system(command);
-		pool_debug("command: %s", command);
-	}
+	pool_semaphore_lock(OID_MAP_SEM);
+	pool_oid_map_reset();
+	pool_semaphore_unlock(OID_MAP_SEM);
 }
 
 /*
- * Reading cache id(shmem case) or hash key(memcached case) from table
- * oid map file according to table_oids and discard cache entries.  If
- * unlink is true, the file will be unlinked after successful cache
- * removal.
+ * Discard cache entries registered to oid maps of the tables.
  */
-static void pool_invalidate_query_cache(int num_table_oids, int *table_oid, bool unlinkp, int dboid)
+static void pool_invalidate_query_cache(int num_table_oids, int *table_oid, int dboid)
 {
-	char *dir;
-	char path[1024];
+	POOL_QUERY_HASH *keys = NULL;
+	int num_keys = 0;
+	int keys_size = 0;
 	int i;
-	int len;
-	POOL_CACHEKEY buf;
-
-	/*
-	 * Create memqcache_oiddir
-	 */
-	dir = pool_config->memqcache_oiddir;
-	if (mkdir(dir, S_IREAD|S_IWRITE|S_IEXEC) == -1)
-	{
-		if (errno != EEXIST)
-		{
-			pool_error("pool_invalidate_query_cache: failed to create %s", dir);
-			return;
-		}
-	}
 
-	/*
-	 * Create memqcache_oiddir/database_oid
-	 */
 	if (dboid == 0) {
 		dboid = pool_get_database_oid();
 
@@ -1447,115 +2461,70 @@ static void pool_invalidate_query_cache(int num_table_oids, int *table_oid, bool
 		}
 	}
 
-	snprintf(path, sizeof(path), "%s/%d", dir, dboid);
-	if (mkdir(path, S_IREAD|S_IWRITE|S_IEXEC) == -1)
-	{
-		if (errno != EEXIST)
-		{
-			pool_error("pool_invalidate_query_cache: failed to create %s. reason:%s", path, strerror(errno));
-			return;
-		}
-	}
-
-	if (pool_is_shmem_cache())
-	{
-		len = sizeof(buf.cacheid);
-	}
-	else
-	{
-		len = sizeof(buf.hashkey);
-	}
+	pool_semaphore_lock(OID_MAP_SEM);
 
 	for (i=0;i<num_table_oids;i++)
 	{
-		int fd;
-		int oid = table_oid[i];
-		int sts;
-		struct flock fl;
+		int table;
+		int *link;
 
-		/*
-		 * Open each memqcache_oiddir/database_oid/table_oid
-		 */
-		snprintf(path, sizeof(path), "%s/%d/%d", dir, dboid, oid);
-		if ((fd = open(path, O_RDONLY)) == -1)
+		table = pool_oid_map_find_table(dboid, table_oid[i], &link);
+		if (table == POOL_OID_MAP_NONE)
 		{
 			/* This may be normal. It is possible that no SELECT has
 			 * been issued since the table has been created or since
 			 * pgpool-II started up.
 			 */
-			pool_debug("pool_invalidate_query_cache: failed to open %s. reason:%s",
-					   path, strerror(errno));
+			pool_debug("pool_invalidate_query_cache: no oid map for table %d", table_oid[i]);
 			continue;
 		}
+		pool_oid_map_detach_table(table, link, &keys, &num_keys, &keys_size);
+	}
 
-		fl.l_type   = F_RDLCK;
-		fl.l_whence = SEEK_SET;
-		fl.l_start  = 0;        	/* Offset from l_whence         */
-		fl.l_len    = 0;        	/* length, 0 = to EOF           */
-
-		sts = fcntl(fd, F_SETLKW, &fl);
-		if (sts == -1)
-		{
-			pool_error("pool_invalidate_query_cache: failed to lock %s. reason:%s",
-					   path, strerror(errno));
-			close(fd);
-			return;
-		}
-		for (;;)
-		{
-			sts = read(fd, (char *)&buf, len);
-			if (sts == -1)
-			{
-				pool_error("pool_invalidate_query_cache: failed to read %s. reason:%s",
-						   path, strerror(errno));
-				close(fd);
-				return;
-			}
-			else if (sts == len)
-			{
-				if (pool_is_shmem_cache())
-				{
-					pool_debug("pool_invalidate_query_cache: deleting cacheid:%d itemid:%d",
-							   buf.cacheid.blockid, buf.cacheid.itemid);
-					pool_delete_item_shmem_cache(&buf.cacheid);
-				}
-#ifdef USE_MEMCACHED
-				else
-				{
-					char delbuf[33];
-
-					memcpy(delbuf, buf.hashkey, 32);
-					delbuf[32] = 0;
-					pool_debug("pool_invalidate_query_cache: deleting %s", delbuf);
-					delete_cache_on_memcached(delbuf);
-				}
-#endif
-				continue;
-			}
-
-			/*
-			 * Must be EOF
-			 */
-			if (sts != 0)
-			{
-				pool_error("pool_invalidate_query_cache: invalid read length %d for %s", sts, path);
-				close(fd);
-				return;
-			}
-			break;
-		}
+	pool_semaphore_unlock(OID_MAP_SEM);
 
-		if (unlinkp)
-		{
-			unlink(path);
-		}
-		close(fd);
+	if (keys)
+	{
+		pool_delete_cache_by_keys(keys, num_keys);
+		free(keys);
 	}
 #ifdef SHMEMCACHE_DEBUG
 	dump_shmem_cache(0);
 #endif
 }
 
+/*
+ * Discard all cache entries registered to oid maps of the database.
+ */
+static void pool_invalidate_query_cache_by_db(int dboid)
+{
+	POOL_QUERY_HASH *keys = NULL;
+	int num_keys = 0;
+	int keys_size = 0;
+	int i;
+
+	pool_semaphore_lock(OID_MAP_SEM);
+
+	for (i=0;i<oid_map->num_tables;i++)
+	{
+		int *link;
+
+		if (oid_map_tables[i].table_oid == 0 || oid_map_tables[i].dboid != dboid)
+			continue;
+
+		pool_oid_map_find_table(dboid, oid_map_tables[i].table_oid, &link);
+		pool_oid_map_detach_table(i, link, &keys, &num_keys, &keys_size);
+	}
+
+	pool_semaphore_unlock(OID_MAP_SEM);
+
+	if (keys)
+	{
+		pool_delete_cache_by_keys(keys, num_keys);
+		free(keys);
+	}
+}
+
 /*
  * Reset SELECT data buffers
  */
@@ -1670,15 +2639,35 @@ size_t pool_shared_memory_cache_size(void)
  * only once from pgpool main process at the process staring up time.
  */
 static void *shmem;
+
+/*
+ * Hit counters of items, max_items_per_block() per block. They are
+ * kept apart from the cache blocks so that the lock-free reader
+ * (pool_read_item_optimistic) never writes into item data. Not kept
+ * in memqcache_persistent_file.
+ */
+static unsigned char *item_refcounts;
+
 int pool_init_memory_cache(size_t size)
 {
+	size_t refcounts_size;
+
 	pool_debug("pool_init_memory_cache: request size:%zd", size);
-	shmem = pool_shared_memory_create(size);
+	shmem = pool_cache_shared_memory_create(size);
 	if (shmem == NULL)
 	{
 		pool_error("pool_init_memory_cache: failed to allocate shared memory cache. request size: %zd", size);
 		return -1;
 	}
+
+	refcounts_size = pool_get_memqcache_blocks() * max_items_per_block();
+	item_refcounts = pool_shared_memory_create(refcounts_size);
+	if (item_refcounts == NULL)
+	{
+		pool_error("pool_init_memory_cache: failed to allocate item hit counters. request size: %zd", refcounts_size);
+		return -1;
+	}
+	memset(item_refcounts, 0, refcounts_size);
 	return 0;
 }
 
@@ -1704,11 +2693,13 @@ pool_clear_memory_cache(void)
 	size = pool_shared_memory_fsmm_size();
 	pool_reset_fsmm(size);
 
-	pool_discard_oid_maps();
-
-	pool_hash_reset(pool_config->memqcache_max_num_cache);
+	pool_hash_reset();
 
 	pool_shmem_unlock();
+
+	/* OID_MAP_SEM must not be acquired while holding partition locks */
+	pool_discard_oid_maps();
+
 	POOL_SETMASK(&oldmask);
 }
 
@@ -1752,57 +2743,342 @@ size_t pool_shared_memory_fsmm_size(void)
 {
 	size_t size;
 
-	size = pool_get_memqcache_blocks() * sizeof(char);
-	return size;
-}
+	size = pool_get_memqcache_blocks() * sizeof(char);
+	return size;
+}
+
+/*
+ * Acquire and initialize shared memory cache for FSMM. This should be
+ * called after pool_shared_memory_cache_size only once from pgpool
+ * main process at the process staring up time.
+ */
+static void *fsmm;
+int pool_init_fsmm(size_t size)
+{
+	int maxblock = 	pool_get_memqcache_blocks();
+	int encode_value;
+
+	fsmm = pool_cache_shared_memory_create(size);
+	if (fsmm == NULL)
+	{
+		pool_error("pool_init_fsmm: failed to allocate shared memory cache. request size: %zd", size);
+		return -1;
+	}
+
+	if (persistent_cache_restored)
+		return 0;
+
+	encode_value = POOL_MAX_FREE_SPACE/POOL_FSMM_RATIO;
+	memset(fsmm, encode_value, maxblock);
+	return 0;
+}
+
+/*
+ * Return shared memory fsmm address
+ */
+static void *pool_fsmm_address(void)
+{
+	return fsmm;
+}
+
+/*
+ * Partitions of shared query cache.
+ */
+static int memqcache_num_partitions = 1;
+static POOL_CACHE_PARTITION *cache_partitions;
+static int eviction_policy = POOL_EVICT_BLOCK;
+
+/*
+ * Decide number of partitions. Each partition needs at least one
+ * cache block and one hash element. Should be called after
+ * pool_shared_memory_cache_size.
+ */
+static int pool_cache_num_partitions(void)
+{
+	int n = pool_config->memqcache_partitions;
+
+	while (n > 1 && (n > pool_get_memqcache_blocks() ||
+					 n > pool_config->memqcache_max_num_cache))
+		n >>= 1;
+
+	return n;
+}
+
+/*
+ * Allocate partitions on shmem. Should be called after
+ * pool_shared_memory_cache_size and before pool_hash_init.
+ */
+void pool_init_cache_partitions(void)
+{
+	int n = pool_cache_num_partitions();
+	int i;
+
+	if (n != pool_config->memqcache_partitions)
+		pool_log("pool_init_cache_partitions: number of partitions is lowered to %d", n);
+
+	memqcache_num_partitions = n;
+
+	if (!strcmp(pool_config->memqcache_eviction_policy, "clock"))
+		eviction_policy = POOL_EVICT_CLOCK;
+	else if (!strcmp(pool_config->memqcache_eviction_policy, "tinylfu"))
+		eviction_policy = POOL_EVICT_TINYLFU;
+	else
+		eviction_policy = POOL_EVICT_BLOCK;
+
+	cache_partitions = pool_cache_shared_memory_create(sizeof(POOL_CACHE_PARTITION) * n);
+	if (cache_partitions == NULL)
+	{
+		pool_error("pool_init_cache_partitions: failed to allocate shared memory for partitions");
+		return;
+	}
+
+	if (persistent_cache_restored)
+		return;
+
+	for (i=0;i<n;i++)
+	{
+		cache_partitions[i].num_entries = 0;
+		cache_partitions[i].num_deleted = 0;
+		cache_partitions[i].clock_hand = i;
+		cache_partitions[i].clock_item = 0;
+		cache_partitions[i].sketch_samples = 0;
+		cache_partitions[i].version = 0;
+	}
+}
+
+/*
+ * Return the partition which the query hash belongs to.
+ */
+static int query_hash_partition(POOL_QUERY_HASH *key)
+{
+	return create_hash_key(key) & (memqcache_num_partitions - 1);
+}
+
+/*
+ * Map memqcache_persistent_file, and check whether the cache in it
+ * can be restored. Following allocations of the shmem cache are made
+ * from the file. Should be called after pool_shared_memory_cache_size
+ * and before pool_init_memory_cache.
+ */
+int pool_init_persistent_cache(void)
+{
+	char *path = pool_config->memqcache_persistent_file;
+	POOL_PERSISTENT_CACHE_HEADER *header;
+	char fingerprint[MURMUR3_HEXLEN+1];
+	char *reason = NULL;
+	unsigned int generation = 0;
+	struct stat st;
+	size_t size;
+	int fd;
+
+	size = pool_persistent_cache_size();
+	pool_persistent_cache_fingerprint(fingerprint);
+
+	fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	if (fd < 0)
+	{
+		pool_error("pool_init_persistent_cache: could not open \"%s\": %s", path, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0)
+	{
+		pool_error("pool_init_persistent_cache: could not stat \"%s\": %s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if (st.st_size == 0)
+		reason = "it is a new file";
+	else if (st.st_size < sizeof(*header))
+		reason = "it is not a query cache file of this version";
+	else
+	{
+		header = mmap(NULL, sizeof(*header), PROT_READ, MAP_SHARED, fd, 0);
+		if (header == MAP_FAILED)
+		{
+			pool_error("pool_init_persistent_cache: could not map \"%s\": %s", path, strerror(errno));
+			close(fd);
+			return -1;
+		}
+
+		if (memcmp(header->magic, POOL_PERSISTENT_CACHE_MAGIC, sizeof(header->magic)) ||
+			header->version != POOL_PERSISTENT_CACHE_VERSION)
+			reason = "it is not a query cache file of this version";
+		else
+		{
+			generation = header->generation;
+			if (header->size != size || st.st_size != size)
+				reason = "its size does not match the configuration";
+			else if (strcmp(header->fingerprint, fingerprint))
+				reason = "the configuration has been changed";
+			else if (header->generation != header->shutdown_generation)
+				reason = "pgpool-II did not shut down cleanly";
+		}
+
+		munmap(header, sizeof(*header));
+	}
 
-/*
- * Acquire and initialize shared memory cache for FSMM. This should be
- * called after pool_shared_memory_cache_size only once from pgpool
- * main process at the process staring up time.
- */
-static void *fsmm;
-int pool_init_fsmm(size_t size)
-{
-	int maxblock = 	pool_get_memqcache_blocks();
-	int encode_value;
+	/* Zero fill the file to start with an empty cache */
+	if (reason && (ftruncate(fd, 0) < 0 || ftruncate(fd, size) < 0))
+	{
+		pool_error("pool_init_persistent_cache: could not truncate \"%s\": %s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
 
-	fsmm = pool_shared_memory_create(size);
-	if (fsmm == NULL)
+	persistent_cache = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (persistent_cache == MAP_FAILED)
 	{
-		pool_error("pool_init_fsmm: failed to allocate shared memory cache. request size: %zd", size);
+		pool_error("pool_init_persistent_cache: could not map \"%s\": %s", path, strerror(errno));
+		persistent_cache = NULL;
 		return -1;
 	}
 
-	encode_value = POOL_MAX_FREE_SPACE/POOL_FSMM_RATIO;
-	memset(fsmm, encode_value, maxblock);
+	header = (POOL_PERSISTENT_CACHE_HEADER *)persistent_cache;
+	if (reason)
+	{
+		pool_log("pool_init_persistent_cache: starting with empty query cache since %s", reason);
+		memcpy(header->magic, POOL_PERSISTENT_CACHE_MAGIC, sizeof(header->magic));
+		header->version = POOL_PERSISTENT_CACHE_VERSION;
+		header->size = size;
+		strcpy(header->fingerprint, fingerprint);
+		header->generation = generation;
+		header->shutdown_generation = generation;
+	}
+	persistent_cache_restored = (reason == NULL);
+
+	/* Record that the file is in use before it is modified */
+	header->generation++;
+	if (msync(header, sizeof(*header), MS_SYNC) < 0)
+		pool_error("pool_init_persistent_cache: could not sync \"%s\": %s", path, strerror(errno));
+
+	persistent_cache_used = POOL_PERSISTENT_CACHE_ALIGN(sizeof(*header));
+	on_shmem_exit(pool_close_persistent_cache, 0);
+
+	pool_log("pool_init_persistent_cache: %s \"%s\" (%zd bytes, generation %u)",
+			 persistent_cache_restored ? "restored query cache from" : "mapped",
+			 path, size, header->generation);
 	return 0;
 }
 
 /*
- * Return shared memory fsmm address
+ * Calculate the size of memqcache_persistent_file. This must agree
+ * with the allocations by pool_cache_shared_memory_create.
  */
-static void *pool_fsmm_address(void)
+static size_t pool_persistent_cache_size(void)
 {
-	return fsmm;
+	int num_partitions = pool_cache_num_partitions();
+	int max_entries;
+	long nbuckets;
+	size_t size;
+
+	nbuckets = pool_hash_num_buckets(pool_config->memqcache_max_num_cache, num_partitions, &max_entries);
+
+	size = POOL_PERSISTENT_CACHE_ALIGN(sizeof(POOL_PERSISTENT_CACHE_HEADER));
+	size += POOL_PERSISTENT_CACHE_ALIGN((size_t)pool_config->memqcache_cache_block_size * pool_get_memqcache_blocks());
+	size += POOL_PERSISTENT_CACHE_ALIGN(pool_shared_memory_fsmm_size());
+	size += POOL_PERSISTENT_CACHE_ALIGN(sizeof(POOL_CACHE_PARTITION) * num_partitions);
+	size += POOL_PERSISTENT_CACHE_ALIGN(sizeof(POOL_HASH_HEADER));
+	size += POOL_PERSISTENT_CACHE_ALIGN(sizeof(POOL_HASH_BUCKET) * nbuckets * num_partitions);
+	if (!strcmp(pool_config->memqcache_eviction_policy, "tinylfu"))
+		size += POOL_PERSISTENT_CACHE_ALIGN((size_t)pool_sketch_width(max_entries) *
+											POOL_SKETCH_DEPTH * num_partitions);
+	size += POOL_PERSISTENT_CACHE_ALIGN(pool_oid_map_size());
+	return size;
 }
 
 /*
- * Clock algorithm shared query cache management modules.
+ * Make the fingerprint of the configuration which the contents of
+ * memqcache_persistent_file depend on. Caches are not valid for other
+ * backends either.
  */
+static void pool_persistent_cache_fingerprint(char *fingerprint)
+{
+	MURMUR3_CTX ctx;
+	char buf[1024];
+	int i;
+
+	snprintf(buf, sizeof(buf), "%d %ld %d %d %d %d %s %zd %zd %zd %zd",
+			 POOL_PERSISTENT_CACHE_VERSION,
+			 pool_config->memqcache_total_size,
+			 pool_config->memqcache_cache_block_size,
+			 pool_config->memqcache_max_num_cache,
+			 pool_config->memqcache_partitions,
+			 pool_config->memqcache_max_num_oidmap,
+			 pool_config->memqcache_eviction_policy,
+			 sizeof(POOL_CACHE_BLOCK_HEADER),
+			 sizeof(POOL_CACHE_ITEM_HEADER),
+			 sizeof(POOL_HASH_BUCKET),
+			 sizeof(POOL_OID_MAP_ENTRY));
+
+	murmur3_init(&ctx, 0);
+	murmur3_update(&ctx, buf, strlen(buf));
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		snprintf(buf, sizeof(buf), " %s:%d", BACKEND_INFO(i).backend_hostname,
+				 BACKEND_INFO(i).backend_port);
+		murmur3_update(&ctx, buf, strlen(buf));
+	}
+	murmur3_final(&ctx, fingerprint);
+}
 
 /*
- * Clock hand pointing to next victim block
+ * Write back memqcache_persistent_file and mark it as cleanly shut
+ * down. Called at exit of pgpool main process, after children exit.
  */
-static int *pool_fsmm_clock_hand;
+static void pool_close_persistent_cache(int code, Datum arg)
+{
+	POOL_PERSISTENT_CACHE_HEADER *header = (POOL_PERSISTENT_CACHE_HEADER *)persistent_cache;
+	int i;
+
+	if (persistent_cache == NULL)
+		return;
+
+	/* A partition left odd version may be in the middle of modification */
+	for (i=0;i<memqcache_num_partitions;i++)
+	{
+		if (cache_partitions[i].version & 1)
+		{
+			pool_log("pool_close_persistent_cache: partition %d may be inconsistent. query cache will be discarded at next startup", i);
+			break;
+		}
+	}
+
+	if (msync(persistent_cache, header->size, MS_SYNC) < 0)
+		pool_error("pool_close_persistent_cache: msync failed: %s", strerror(errno));
+	else if (i == memqcache_num_partitions)
+	{
+		header->shutdown_generation = header->generation;
+		msync(header, sizeof(*header), MS_SYNC);
+	}
+
+	munmap(persistent_cache, header->size);
+	persistent_cache = NULL;
+}
 
 /*
- * Allocate and initialize clock hand on shmem
+ * Allocate shared memory for the shmem cache, from
+ * memqcache_persistent_file if it is used.
  */
-void pool_allocate_fsmm_clock_hand(void)
+static void *pool_cache_shared_memory_create(size_t size)
 {
-	pool_fsmm_clock_hand = pool_shared_memory_create(sizeof(*pool_fsmm_clock_hand));
-	*pool_fsmm_clock_hand = 0;
+	POOL_PERSISTENT_CACHE_HEADER *header = (POOL_PERSISTENT_CACHE_HEADER *)persistent_cache;
+	char *p;
+
+	if (persistent_cache == NULL)
+		return pool_shared_memory_create(size);
+
+	if (persistent_cache_used + size > header->size)
+	{
+		pool_error("pool_cache_shared_memory_create: memqcache_persistent_file is too small. request size: %zd", size);
+		return NULL;
+	}
+
+	p = persistent_cache + persistent_cache_used;
+	persistent_cache_used += POOL_PERSISTENT_CACHE_ALIGN(size);
+	return p;
 }
 
 /*
@@ -1812,29 +3088,37 @@ static void
 pool_reset_fsmm(size_t size)
 {
 	int encode_value;
+	int i;
 
 	encode_value = POOL_MAX_FREE_SPACE/POOL_FSMM_RATIO;
 	memset(fsmm, encode_value, size);
 
-	*pool_fsmm_clock_hand = 0;
+	for (i=0;i<memqcache_num_partitions;i++)
+	{
+		cache_partitions[i].clock_hand = i;
+		cache_partitions[i].clock_item = 0;
+	}
 }
 
 /*
- * Find victim block using clock algorithm and make it free.
+ * Find victim block in the partition using clock algorithm and make
+ * it free.
  * Returns new free block id.
  */
-static POOL_CACHE_BLOCKID pool_reuse_block(void)
+static POOL_CACHE_BLOCKID pool_reuse_block(int partition)
 {
 	int maxblock = pool_get_memqcache_blocks();
-	char *block = block_address(*pool_fsmm_clock_hand);
+	POOL_CACHE_BLOCKID *clock_hand = &cache_partitions[partition].clock_hand;
+	char *block = block_address(*clock_hand);
 	POOL_CACHE_BLOCK_HEADER *bh = (POOL_CACHE_BLOCK_HEADER *)block;
 	POOL_CACHE_BLOCKID reused_block;
 	POOL_CACHE_ITEM_POINTER *cip;
 	char *p;
 	int i;
+	int num_evicted = 0;
 
 	bh->flags = 0;
-	reused_block = *pool_fsmm_clock_hand;
+	reused_block = *clock_hand;
 	p = block_address(reused_block);
 
 	for (i=0;i<bh->num_items;i++)
@@ -1843,17 +3127,26 @@ static POOL_CACHE_BLOCKID pool_reuse_block(void)
 
 		if (!(POOL_ITEM_DELETED & cip->flags))
 		{
-			pool_hash_delete(&cip->query_hash);
+			POOL_CACHEID cid;
+
+			cid.blockid = reused_block;
+			cid.itemid = i;
+			pool_hash_delete(&cip->query_hash, &cid);
 			pool_debug("pool_reuse_block: blockid: %d item: %d", reused_block, i);
+			num_evicted++;
 		}
 	}
 
+	__sync_add_and_fetch(&stats->num_reused_blocks, 1);
+	__sync_add_and_fetch(&stats->num_evicted_items, num_evicted);
+
 	pool_init_cache_block(reused_block);
 	pool_update_fsmm(reused_block, POOL_MAX_FREE_SPACE);
 
-	(*pool_fsmm_clock_hand)++;
-	if (*pool_fsmm_clock_hand >= maxblock)
-		*pool_fsmm_clock_hand = 0;
+	*clock_hand += memqcache_num_partitions;
+	if (*clock_hand >= maxblock)
+		*clock_hand = partition;
+	cache_partitions[partition].clock_item = 0;
 
 	pool_log("pool_reuse_block: blockid: %d", reused_block);
 
@@ -1861,9 +3154,287 @@ static POOL_CACHE_BLOCKID pool_reuse_block(void)
 }
 
 /*
- * Get block id which has enough space
+ * Make room for "request_size" bytes in the partition by evicting
+ * items (clock and tinylfu policies), and return the block which has
+ * the room. Items are visited by the clock hand of the partition. An
+ * item hit since the last visit survives with its refcount
+ * decremented, otherwise it is evicted. Since evicted items may be in
+ * the middle of the block, the block is packed afterwards. If
+ * "request_size" is 0, just evict one item.
+ *
+ * If *admission is not NULL (tinylfu), the new item of the query hash
+ * is admitted only if it is used at least as often as the first
+ * victim, and *admission is reset to NULL once it is admitted. If not
+ * admitted, *rejected is set to true and -1 is returned.
+ */
+static POOL_CACHE_BLOCKID pool_evict_items(int partition, size_t request_size, POOL_QUERY_HASH **admission, bool *rejected)
+{
+	POOL_CACHE_PARTITION *part = &cache_partitions[partition];
+	int maxblock = pool_get_memqcache_blocks();
+	int nblocks = (maxblock - partition + memqcache_num_partitions - 1) / memqcache_num_partitions;
+	int num_evicted = 0;
+	int visits;
+
+	/*
+	 * Every visit decrements refcount, so every item can be evicted
+	 * after visiting all blocks POOL_ITEM_MAX_REFCOUNT + 1 times.
+	 */
+	for (visits = 0; visits <= nblocks * (POOL_ITEM_MAX_REFCOUNT + 1); visits++)
+	{
+		POOL_CACHE_BLOCKID blockid = part->clock_hand;
+		char *p = block_address(blockid);
+		POOL_CACHE_BLOCK_HEADER *bh = (POOL_CACHE_BLOCK_HEADER *)p;
+		size_t room;
+		int i;
+
+		pool_init_cache_block(blockid);
+		room = bh->free_bytes + pool_deleted_bytes(p);
+
+		for (i = part->clock_item; i < bh->num_items; i++)
+		{
+			POOL_CACHE_ITEM_POINTER *cip = item_pointer(p, i);
+			POOL_CACHEID cid;
+
+			if (request_size == 0 ? num_evicted > 0 : room >= request_size)
+				break;
+
+			if (cip->flags & POOL_ITEM_DELETED)
+				continue;
+
+			if (*item_refcount(blockid, i) > 0)
+			{
+				/* readers may count up concurrently */
+				__sync_fetch_and_sub(item_refcount(blockid, i), 1);
+				continue;
+			}
+
+			if (*admission)
+			{
+				if (pool_sketch_estimate(*admission) < pool_sketch_estimate(&cip->query_hash))
+				{
+					pool_debug("pool_evict_items: new item is used less often than victim block:%d item:%d",
+							   blockid, i);
+					part->clock_item = i;
+					*rejected = true;
+					__sync_add_and_fetch(&stats->num_rejected_items, 1);
+					return -1;
+				}
+				*admission = NULL;
+			}
+
+			room += item_header(p, i)->total_length + sizeof(POOL_CACHE_ITEM_POINTER);
+			cid.blockid = blockid;
+			cid.itemid = i;
+			pool_delete_item_shmem_cache(&cid);
+			num_evicted++;
+		}
+		part->clock_item = i;
+
+		if (request_size == 0 ? num_evicted > 0 : room >= request_size)
+		{
+			__sync_add_and_fetch(&stats->num_evicted_items, num_evicted);
+			if (request_size == 0)
+				return blockid;
+
+			/* Item ids change by packing. Go on with the next block next time */
+			pool_pack_cache_block(blockid);
+			part->clock_hand += memqcache_num_partitions;
+			if (part->clock_hand >= maxblock)
+				part->clock_hand = partition;
+			part->clock_item = 0;
+
+			if (bh->free_bytes >= request_size)
+				return blockid;
+			continue;
+		}
+
+		part->clock_hand += memqcache_num_partitions;
+		if (part->clock_hand >= maxblock)
+			part->clock_hand = partition;
+		part->clock_item = 0;
+	}
+
+	__sync_add_and_fetch(&stats->num_evicted_items, num_evicted);
+
+	/* Should not happen unless packing failed. Give up a whole block */
+	pool_debug("pool_evict_items: could not make room of %zd bytes", request_size);
+	return pool_reuse_block(partition);
+}
+
+/*
+ * Total size of deleted items in the block.
+ */
+static size_t pool_deleted_bytes(char *block)
+{
+	POOL_CACHE_BLOCK_HEADER *bh = (POOL_CACHE_BLOCK_HEADER *)block;
+	size_t size = 0;
+	int i;
+
+	for (i=0;i<bh->num_items;i++)
+	{
+		if (item_pointer(block, i)->flags & POOL_ITEM_DELETED)
+			size += item_header(block, i)->total_length + sizeof(POOL_CACHE_ITEM_POINTER);
+	}
+	return size;
+}
+
+/*
+ * Move live items of the block to the bottom of the block so that
+ * space of deleted items becomes contiguous free space. Item ids of
+ * moved items are updated in the hash table.
+ * Returns 0 on success, -1 on error.
+ */
+static int pool_pack_cache_block(POOL_CACHE_BLOCKID blockid)
+{
+	char *p = block_address(blockid);
+	POOL_CACHE_BLOCK_HEADER *bh = (POOL_CACHE_BLOCK_HEADER *)p;
+	size_t block_size = pool_config->memqcache_cache_block_size;
+	char *work_buffer;
+	char *dci;
+	int index;
+	int i;
+
+	if (pool_deleted_bytes(p) == 0)
+		return 0;
+
+	work_buffer = calloc(1, block_size);
+	if (!work_buffer)
+	{
+		pool_error("pool_pack_cache_block: calloc failed");
+		return -1;
+	}
+
+	dci = work_buffer + block_size;
+	index = 0;
+
+	for (i=0;i<bh->num_items;i++)
+	{
+		POOL_CACHE_ITEM_POINTER *cip = item_pointer(p, i);
+		POOL_CACHE_ITEM_POINTER *dcip;
+		POOL_CACHEID old_cid;
+		POOL_CACHEID cid;
+		int total_length;
+
+		if (POOL_ITEM_DELETED & cip->flags)		/* Deleted item? */
+			continue;
+
+		/* Copy item body */
+		total_length = item_header(p, i)->total_length;
+		dci -= total_length;
+		memcpy(dci, p + cip->offset, total_length);
+
+		/* Copy item pointer */
+		dcip = item_pointer(work_buffer, index);
+		memcpy(dcip, cip, sizeof(POOL_CACHE_ITEM_POINTER));
+		dcip->offset = dci - work_buffer;
+		*item_refcount(blockid, index) = *item_refcount(blockid, i);
+
+		/* Update hash index */
+		old_cid.blockid = blockid;
+		old_cid.itemid = i;
+		cid.blockid = blockid;
+		cid.itemid = index;
+		if (i != index)
+			pool_hash_update(&cip->query_hash, &old_cid, &cid);
+
+		index++;
+	}
+
+	if (index == 0)
+	{
+		/* All items deleted */
+		bh->flags = 0;
+		pool_init_cache_block(blockid);
+	}
+	else
+	{
+		/* Copy back the packed block except block header */
+		memcpy(p + sizeof(POOL_CACHE_BLOCK_HEADER),
+			   work_buffer + sizeof(POOL_CACHE_BLOCK_HEADER),
+			   block_size - sizeof(POOL_CACHE_BLOCK_HEADER));
+		bh->num_items = index;
+		bh->free_bytes = (dci - work_buffer) - sizeof(POOL_CACHE_BLOCK_HEADER) -
+			sizeof(POOL_CACHE_ITEM_POINTER) * index;
+	}
+	pool_update_fsmm(blockid, bh->free_bytes);
+
+	free(work_buffer);
+	pool_debug("pool_pack_cache_block: block:%d items:%d free:%d", blockid, index, bh->free_bytes);
+	return 0;
+}
+
+/*
+ * Pack fragmented blocks of the shmem cache. Space of deleted items
+ * in the middle of a block cannot be used until the block is packed,
+ * so it is done periodically by the worker child. A block is packed
+ * if deleted items take 1/POOL_COMPACTION_FRACTION of it or more, and
+ * the FSMM is refreshed accordingly. The partition lock is released
+ * after every POOL_COMPACTION_BATCH blocks so that clients do not
+ * wait long.
+ * Returns number of packed blocks.
+ */
+int pool_compact_shmem_cache(void)
+{
+	int maxblock = pool_get_memqcache_blocks();
+	size_t threshold = pool_config->memqcache_cache_block_size / POOL_COMPACTION_FRACTION;
+	int num_packed = 0;
+	int partition;
+	POOL_CACHE_BLOCKID blockid;
+	int n;
+#ifdef HAVE_SIGPROCMASK
+	sigset_t oldmask;
+#else
+	int	oldmask;
+#endif
+
+	if (!pool_is_shmem_cache())
+		return 0;
+
+	for (partition=0;partition<memqcache_num_partitions;partition++)
+	{
+		blockid = partition;
+
+		while (blockid < maxblock)
+		{
+			/* Do not exit while holding the lock */
+			POOL_SETMASK2(&BlockSig, &oldmask);
+			pool_shmem_lock_partition(partition);
+
+			for (n=0;n<POOL_COMPACTION_BATCH && blockid<maxblock;n++)
+			{
+				char *p = block_address(blockid);
+				POOL_CACHE_BLOCK_HEADER *bh = (POOL_CACHE_BLOCK_HEADER *)p;
+
+				if ((bh->flags & POOL_BLOCK_USED) && pool_deleted_bytes(p) >= threshold &&
+					pool_pack_cache_block(blockid) == 0)
+				{
+					/* Item ids have changed. Restart the clock hand in the block */
+					if (cache_partitions[partition].clock_hand == blockid)
+						cache_partitions[partition].clock_item = 0;
+					num_packed++;
+				}
+				blockid += memqcache_num_partitions;
+			}
+
+			pool_shmem_unlock_partition(partition);
+			POOL_SETMASK(&oldmask);
+		}
+	}
+
+	if (num_packed > 0)
+	{
+		__sync_add_and_fetch(&stats->num_compacted_blocks, num_packed);
+		pool_debug("pool_compact_shmem_cache: %d blocks packed", num_packed);
+	}
+	return num_packed;
+}
+
+/*
+ * Get block id in the partition which has enough space. If there's
+ * none, make room according to the eviction policy. See
+ * pool_evict_items for "admission" and "rejected".
  */
-static POOL_CACHE_BLOCKID pool_get_block(size_t free_space)
+static POOL_CACHE_BLOCKID pool_get_block(size_t free_space, int partition, POOL_QUERY_HASH **admission, bool *rejected)
 {
 	int encode_value;
 	unsigned char *p = pool_fsmm_address();
@@ -1885,7 +3456,7 @@ static POOL_CACHE_BLOCKID pool_get_block(size_t free_space)
 
 	encode_value = free_space/POOL_FSMM_RATIO;
 
-	for (i=0;i<maxblock;i++)
+	for (i=partition;i<maxblock;i+=memqcache_num_partitions)
 	{
 		if (p[i] >= encode_value)
 		{
@@ -1902,9 +3473,12 @@ static POOL_CACHE_BLOCKID pool_get_block(size_t free_space)
 	}
 
 	/*
-	 * No enough space found. Reuse victim block
+	 * No enough space found. Reuse victim block or evict items.
 	 */
-	return pool_reuse_block();
+	if (eviction_policy == POOL_EVICT_BLOCK)
+		return pool_reuse_block(partition);
+
+	return pool_evict_items(partition, free_space, admission, rejected);
 }
 
 /*
@@ -1941,12 +3515,13 @@ static void pool_update_fsmm(POOL_CACHE_BLOCKID blockid, size_t free_space)
 }
 
 /*
- * Add item data to shared memory cache.
+ * Add item data to shared memory cache. The data is taken from data,
+ * or from the chunks of buffer if data is NULL.
  * On successful registration, returns cache id.
  * The cache id is overwritten by the subsequent call to this function.
  * On error returns NULL.
  */
-static POOL_CACHEID *pool_add_item_shmem_cache(POOL_QUERY_HASH *query_hash, char *data, int size)
+static POOL_CACHEID *pool_add_item_shmem_cache(POOL_QUERY_HASH *query_hash, POOL_QUERY_KEY *key, char *data, POOL_INTERNAL_BUFFER *buffer, int size, bool *rejected)
 {
 	static POOL_CACHEID cacheid;
 	POOL_CACHE_BLOCKID blockid;
@@ -1959,15 +3534,10 @@ static POOL_CACHEID *pool_add_item_shmem_cache(POOL_QUERY_HASH *query_hash, char
 
 	int request_size;
 	char *p;
-	int i;
-	char *src;
-	char *dst;
-	int num_deleted;
-	char *dcip;
-	char *dci;
-	bool need_pack;
-	char *work_buffer;
-	int index;
+	int partition;
+	POOL_QUERY_HASH *admission;
+
+	*rejected = false;
 
 	if (query_hash == NULL)
 	{
@@ -1975,7 +3545,7 @@ static POOL_CACHEID *pool_add_item_shmem_cache(POOL_QUERY_HASH *query_hash, char
 		return NULL;
 	}
 
-	if (data == NULL)
+	if (data == NULL && buffer == NULL)
 	{
 		pool_error("pool_add_item_shmem_cache: data NULL");
 		return NULL;
@@ -1988,10 +3558,23 @@ static POOL_CACHEID *pool_add_item_shmem_cache(POOL_QUERY_HASH *query_hash, char
 	}
 
 	/* Add overhead */
-	request_size = size + sizeof(POOL_CACHE_ITEM_POINTER) + sizeof(POOL_CACHE_ITEM_HEADER);
+	request_size = size + key->length + sizeof(POOL_CACHE_ITEM_POINTER) + sizeof(POOL_CACHE_ITEM_HEADER);
+
+	if (request_size > POOL_MAX_FREE_SPACE)
+	{
+		pool_debug("pool_add_item_shmem_cache: item size %d exceeds block size", request_size);
+		return NULL;
+	}
+
+	/*
+	 * With the tinylfu policy the new item has to be used at least as
+	 * often as the first item evicted for it.
+	 */
+	admission = eviction_policy == POOL_EVICT_TINYLFU ? query_hash : NULL;
 
-	/* Get cache block which has enough space */
-	blockid = pool_get_block(request_size);
+	/* Get cache block which has enough space in the partition */
+	partition = query_hash_partition(query_hash);
+	blockid = pool_get_block(request_size, partition, &admission, rejected);
 
 	if (blockid == -1)
 	{
@@ -2008,122 +3591,31 @@ static POOL_CACHEID *pool_add_item_shmem_cache(POOL_QUERY_HASH *query_hash, char
 	/*
 	 * Make sure that we have at least one free hash element.
 	 */
-	while (!is_free_hash_element())
-	{
-		/* If not, reuse next victim block */
-		blockid = pool_reuse_block();
-		pool_init_cache_block(blockid);
-	}
-
-	/* Get block address on shmem */
-	p = block_address(blockid);
-	bh = (POOL_CACHE_BLOCK_HEADER *)p;
-
-	/*
-	 * Create contiguous free space. We assume that item bodies are
-	 * ordered from bottom to top of the block, and corresponding item
-	 * pointers are ordered from the youngest to the oldest in the
-	 * beginning of the block.
-	 */
-
-	/*
-	 * Optimization. If there's no deleted items, we don't need to
-	 * pack it to create contiguous free space.
-	 */
-	need_pack = false;
-	for (i=0;i<bh->num_items;i++)
-	{
-		cip = item_pointer(p, i);
-
-		if (POOL_ITEM_DELETED & cip->flags)		/* Deleted item? */
-		{
-			need_pack = true;
-			pool_debug("pool_add_item_shmem_cache: start creating contiguous space");
-			break;
-		}
-	}
-
-	/*
-	 * We disable packing for now.
-	 * Revisit and remove following code fragment later.
-	 */
-	need_pack = false;
-
-	if (need_pack)
+	while (!is_free_hash_element(partition))
 	{
-		/*
-		 * Pack and create contiguous free space.
-		 */
-		dcip = calloc(1, pool_config->memqcache_cache_block_size);
-		if (!dcip)
-		{
-			pool_error("pool_add_item_shmem_cache: calloc failed");
-			return NULL;
-		}
-
-		work_buffer = dcip;
-		dci = dcip + pool_config->memqcache_cache_block_size;
-		num_deleted = 0;
-		index = 0;
-
-		for (i=0;i<bh->num_items;i++)
-		{
-			int total_length;
-			POOL_CACHEID cid;
-
-			cip = item_pointer(p, i);
-
-			if (POOL_ITEM_DELETED & cip->flags)		/* Deleted item? */
-			{
-				num_deleted++;
-				continue;
-			}
-
-			/* Copy item body */
-			src = p + cip->offset;
-			total_length = item_header(p, i)->total_length;
-			dst = dci - total_length;
-			cip->offset = dst - work_buffer;
-			memcpy(dst, src, total_length);
-
-			dci -= total_length;
-
-			/* Copy item pointer */
-			src = (char *)cip;
-			dst = (char *)item_pointer(dcip, index);
-			memcpy(dst, src, sizeof(POOL_CACHE_ITEM_POINTER));
-
-			/* Update hash index */
-			cid.blockid = blockid;
-			cid.itemid = index;
-			pool_hash_insert(&cip->query_hash, &cid, true);
-			pool_debug("pool_add_item_shmem_cache: item cid updated. old:%d %d new:%d %d",
-					   blockid, i, blockid, index);
-
-			index++;
-		}
-	
-		/* All items deleted? */
-		if (num_deleted > 0 && num_deleted == bh->num_items)
+		if (eviction_policy == POOL_EVICT_BLOCK)
 		{
-			pool_debug("pool_add_item_shmem_cache: all items deleted num_deleted:%d", num_deleted);
-			bh->flags = 0;
+			/* If not, reuse next victim block */
+			blockid = pool_reuse_block(partition);
 			pool_init_cache_block(blockid);
-			pool_update_fsmm(blockid, POOL_MAX_FREE_SPACE);
 		}
 		else
 		{
-			/* Update number of items */
-			bh->num_items -= num_deleted;
-
-			/* Copy back the packed block except block header */
-			memcpy(p+sizeof(POOL_CACHE_BLOCK_HEADER),
-				   work_buffer+sizeof(POOL_CACHE_BLOCK_HEADER),
-				   pool_config->memqcache_cache_block_size-sizeof(POOL_CACHE_BLOCK_HEADER));
+			/* Evict an item. This does not take space from blockid */
+			if (pool_evict_items(partition, 0, &admission, rejected) == -1)
+				return NULL;
 		}
-		free(work_buffer);
 	}
 
+	/* Get block address on shmem */
+	p = block_address(blockid);
+	bh = (POOL_CACHE_BLOCK_HEADER *)p;
+
+	/*
+	 * Space of deleted items in the middle of the block is not
+	 * reused here. Blocks are packed by pool_evict_items.
+	 */
+
 	/*
 	 * Make sure that we have enough free space
 	 */
@@ -2141,7 +3633,8 @@ static POOL_CACHEID *pool_add_item_shmem_cache(POOL_QUERY_HASH *query_hash, char
 
 	/* Fill in cache item header */
 	ci.header.timestamp = time(NULL);
-	ci.header.total_length = sizeof(POOL_CACHE_ITEM_HEADER) + size;
+	ci.header.key_length = key->length;
+	ci.header.total_length = sizeof(POOL_CACHE_ITEM_HEADER) + key->length + size;
 
 	/* Calculate item body address */
 	if (bh->num_items == 0)
@@ -2163,8 +3656,15 @@ static POOL_CACHEID *pool_add_item_shmem_cache(POOL_QUERY_HASH *query_hash, char
 	memcpy(item, &ci, sizeof(POOL_CACHE_ITEM_HEADER));
 	bh->free_bytes -= sizeof(POOL_CACHE_ITEM_HEADER);
 
+	/* Copy query key */
+	pool_copy_query_key(key, item + sizeof(POOL_CACHE_ITEM_HEADER));
+	bh->free_bytes -= key->length;
+
 	/* Copy item body */
-	memcpy(item + sizeof(POOL_CACHE_ITEM_HEADER), data, size);
+	if (data)
+		memcpy(item + sizeof(POOL_CACHE_ITEM_HEADER) + key->length, data, size);
+	else
+		pool_copy_buffer(buffer, item + sizeof(POOL_CACHE_ITEM_HEADER) + key->length);
 	bh->free_bytes -= size;
 
 	/* Copy cache item pointer */
@@ -2173,6 +3673,7 @@ static POOL_CACHEID *pool_add_item_shmem_cache(POOL_QUERY_HASH *query_hash, char
 	cip_body.offset = item - p;
 	cip_body.flags = POOL_ITEM_USED;
 	memcpy(item_pointer(p, bh->num_items), &cip_body, sizeof(POOL_CACHE_ITEM_POINTER));
+	*item_refcount(blockid, bh->num_items) = 0;
 	bh->free_bytes -= sizeof(POOL_CACHE_ITEM_POINTER);
 
 	/* Update FSMM */
@@ -2187,7 +3688,7 @@ static POOL_CACHEID *pool_add_item_shmem_cache(POOL_QUERY_HASH *query_hash, char
 	bh->num_items++;
 
 	/* Update hash table */
-	if (pool_hash_insert(query_hash, &cacheid, false) < 0)
+	if (pool_hash_insert(query_hash, &cacheid) < 0)
 	{
 		pool_error("pool_add_item_shmem_cache: pool_hash_insert failed");
 
@@ -2212,7 +3713,7 @@ static POOL_CACHEID *pool_add_item_shmem_cache(POOL_QUERY_HASH *query_hash, char
  * On error or data not found case returns NULL.
  * Detail is set to *sts. (0: success, 1: not found, -1: error)
  */
-static char *pool_get_item_shmem_cache(POOL_QUERY_HASH *query_hash, int *size, int *sts)
+static char *pool_get_item_shmem_cache(POOL_QUERY_HASH *query_hash, POOL_QUERY_KEY *key, int *size, int *sts, bool *stale)
 {
 	POOL_CACHEID *cacheid;
 	POOL_CACHE_ITEM_HEADER *cih;
@@ -2250,8 +3751,20 @@ static char *pool_get_item_shmem_cache(POOL_QUERY_HASH *query_hash, int *size, i
 
 	cih = pool_cache_item_header(cacheid);
 
-	*size = cih->total_length - sizeof(POOL_CACHE_ITEM_HEADER);
-	return (char *)cih + sizeof(POOL_CACHE_ITEM_HEADER);
+	/* Make sure that this is not a hash collision */
+	if (!pool_query_key_equal(key, (char *)cih + sizeof(POOL_CACHE_ITEM_HEADER), cih->key_length))
+	{
+		pool_debug("pool_get_item_shmem_cache: hash collision");
+		*sts = 1;
+		return NULL;
+	}
+
+	/* Tell the clock hand that this item is used */
+	pool_count_item_hit(cacheid->blockid, cacheid->itemid);
+
+	*stale = pool_cache_expired(cih->timestamp, false);
+	*size = cih->total_length - sizeof(POOL_CACHE_ITEM_HEADER) - cih->key_length;
+	return (char *)cih + sizeof(POOL_CACHE_ITEM_HEADER) + cih->key_length;
 }
 
 /*
@@ -2264,7 +3777,6 @@ static POOL_CACHEID *pool_find_item_on_shmem_cache(POOL_QUERY_HASH *query_hash)
 	static POOL_CACHEID cacheid;
 	POOL_CACHEID *c;
 	POOL_CACHE_ITEM_HEADER *cih;
-	time_t now;
 
 	c = pool_hash_search(query_hash);
 	if (!c)
@@ -2274,18 +3786,14 @@ static POOL_CACHEID *pool_find_item_on_shmem_cache(POOL_QUERY_HASH *query_hash)
 
 	cih = item_header(block_address(c->blockid), c->itemid);
 
-	/* Check cache expiration */
-	if (pool_config->memqcache_expire > 0)
+	/* Check cache expiration. Stale items are still returned. */
+	if (pool_cache_expired(cih->timestamp, true))
 	{
-		now = time(NULL);
-		if (now > (cih->timestamp + pool_config->memqcache_expire))
-		{
-			pool_debug("pool_find_item_on_shmem_cache: cache expired");
-			pool_debug("pool_find_item_on_shmem_cache: now: %ld timestamp: %ld",
-					   now, cih->timestamp + pool_config->memqcache_expire);
-			pool_delete_item_shmem_cache(c);
-			return NULL;
-		}
+		pool_debug("pool_find_item_on_shmem_cache: cache expired");
+		pool_debug("pool_find_item_on_shmem_cache: now: %ld timestamp: %ld",
+				   time(NULL), cih->timestamp + pool_config->memqcache_expire);
+		pool_delete_item_shmem_cache(c);
+		return NULL;
 	}
 
 	cacheid.blockid = c->blockid;
@@ -2360,34 +3868,37 @@ static int pool_delete_item_shmem_cache(POOL_CACHEID *cacheid)
 	/* Delete item pointer */
 	cip->flags |= POOL_ITEM_DELETED;
 
-	/*
-	 * We do NOT count down bh->num_items here. The deleted space will be recycled
-	 * by pool_add_item_shmem_cache(). However, if this is the last item, we can
-	 * recycle whole block.
-	 *
-	 * 2012/4/1: Now we do not pack data in
-	 * pool_add_item_shmem_cache() for performance reason. Also we
-	 * count down num_items if it is the last one.
-	 */
-	if ((bh->num_items -1) == 0)
-	{
-		pool_debug("pool_delete_item_shmem_cache: no item remains. So initialize block");
-		bh->flags = 0;
-		pool_init_cache_block(cacheid->blockid);
-	}
-
 	/* Remove hash index */
-	pool_hash_delete(&key);
+	pool_hash_delete(&key, cacheid);
 
 	/*
-	 * If the deleted item is last one in the block, we add it to the free space.
+	 * We do NOT count down bh->num_items here unless the item is the
+	 * last one. Space of deleted items in the middle of the block is
+	 * recycled by pool_compact_shmem_cache() or pool_evict_items().
+	 * If the deleted item is the last one, we add it and deleted
+	 * items just before it to the free space.
 	 */
 	if (cacheid->itemid == (bh->num_items -1))
 	{
-		bh->free_bytes += size;
+		char *p = block_address(cacheid->blockid);
+
+		do
+		{
+			bh->free_bytes += item_header(p, bh->num_items-1)->total_length +
+				sizeof(POOL_CACHE_ITEM_POINTER);
+			bh->num_items--;
+		} while (bh->num_items > 0 &&
+				 (item_pointer(p, bh->num_items-1)->flags & POOL_ITEM_DELETED));
+
 		pool_debug("pool_delete_item_shmem_cache: after deleting %d bytes, free_bytes is %d",
 				   size, bh->free_bytes);
-		bh->num_items--;
+
+		if (bh->num_items == 0)
+		{
+			pool_debug("pool_delete_item_shmem_cache: no item remains. So initialize block");
+			bh->flags = 0;
+			pool_init_cache_block(cacheid->blockid);
+		}
 	}
 
 	/* Update FSMM */
@@ -2482,30 +3993,104 @@ static void pool_wipe_out_cache_block(POOL_CACHE_BLOCKID blockid)
 #endif
 
 /*
- * Acquire lock: XXX giant lock
+ * Acquire locks of all partitions. Used for operations on the whole
+ * cache. Locks are always acquired in partition order.
  */
 void pool_shmem_lock(void)
 {
+	int i;
+
 	if (pool_is_shmem_cache())
 	{
-		pool_semaphore_lock(SHM_CACHE_SEM);
+		for (i=0;i<memqcache_num_partitions;i++)
+		{
+			pool_semaphore_lock(SHM_CACHE_PARTITION_SEM(i));
+			cache_partitions[i].version++;
+		}
+		pool_memory_barrier();
 	}
 }
 
 /*
- * Release lock
+ * Release locks of all partitions
  */
 void pool_shmem_unlock(void)
+{
+	int i;
+
+	if (pool_is_shmem_cache())
+	{
+		pool_memory_barrier();
+		for (i=memqcache_num_partitions-1;i>=0;i--)
+		{
+			cache_partitions[i].version++;
+			pool_semaphore_unlock(SHM_CACHE_PARTITION_SEM(i));
+		}
+	}
+}
+
+/*
+ * Acquire lock of a partition. Never acquire another partition lock
+ * while holding one. The version of the partition becomes odd so that
+ * lock-free readers retry.
+ */
+void pool_shmem_lock_partition(int partition)
+{
+	if (pool_is_shmem_cache())
+	{
+		pool_semaphore_lock(SHM_CACHE_PARTITION_SEM(partition));
+		cache_partitions[partition].version++;
+		pool_memory_barrier();
+	}
+}
+
+/*
+ * Release lock of a partition
+ */
+void pool_shmem_unlock_partition(int partition)
 {
 	if (pool_is_shmem_cache())
 	{
-		pool_semaphore_unlock(SHM_CACHE_SEM);
+		pool_memory_barrier();
+		cache_partitions[partition].version++;
+		pool_semaphore_unlock(SHM_CACHE_PARTITION_SEM(partition));
 	}
 }
 
 /*
  * Returns cache block address specified by block id 
  */
+/*
+ * Maximum number of items in a block, which is the number of hit
+ * counters per block.
+ */
+static size_t max_items_per_block(void)
+{
+	return (pool_config->memqcache_cache_block_size - sizeof(POOL_CACHE_BLOCK_HEADER)) /
+		sizeof(POOL_CACHE_ITEM_POINTER);
+}
+
+/*
+ * Return the hit counter of the item
+ */
+static unsigned char *item_refcount(POOL_CACHE_BLOCKID blockid, int itemid)
+{
+	return item_refcounts + (size_t)blockid * max_items_per_block() + itemid;
+}
+
+/*
+ * Count up the hit counter of the item. May be called without the
+ * partition lock.
+ */
+static void pool_count_item_hit(POOL_CACHE_BLOCKID blockid, int itemid)
+{
+	unsigned char *refcount = item_refcount(blockid, itemid);
+	unsigned char c = *refcount;
+
+	if (c < POOL_ITEM_MAX_REFCOUNT)
+		__sync_bool_compare_and_swap(refcount, c, c + 1);
+}
+
 static char *block_address(int blockid)
 {
 	char *p;
@@ -2673,6 +4258,8 @@ POOL_TEMP_QUERY_CACHE *pool_create_temp_query_cache(char *query)
 		p->num_oids = 0;
 		p->is_exceeded = false;
 		p->is_discarded = false;
+		p->is_suspended = false;
+		p->num_rows = 0;
 	}
 	return p;
 }
@@ -2703,6 +4290,7 @@ static void pool_add_temp_query_cache(POOL_TEMP_QUERY_CACHE *temp_cache, char ki
 	POOL_INTERNAL_BUFFER *buffer;
 	size_t buflen;
 	int send_len;
+	char tag[64];
 
 	if (temp_cache == NULL)
 	{
@@ -2719,6 +4307,13 @@ static void pool_add_temp_query_cache(POOL_TEMP_QUERY_CACHE *temp_cache, char ki
 		return;
 	}
 
+	/* The rest of the rows come with the following Executes */
+	if (kind == 's')
+	{
+		temp_cache->is_suspended = true;
+		return;
+	}
+
 	/*
 	 * We only store T(Table Description), D(Data row), C(Command Complete),
 	 * 1(ParseComplete), 2(BindComplete)
@@ -2737,13 +4332,34 @@ static void pool_add_temp_query_cache(POOL_TEMP_QUERY_CACHE *temp_cache, char ki
 		pool_debug("pool_add_temp_query_cache: data size exceeds memqcache_maxcache. current:%zd requested:%zd memq_maxcache:%d",
 				 buflen, data_len+sizeof(int)+1, pool_config->memqcache_maxcache);
 		temp_cache->is_exceeded = true;
+
+		/* The result is never cached. Free the captured data now. */
+		pool_reset_buffer(buffer);
 		return;
 	}
 
-	pool_add_buffer(buffer, &kind, 1);
+	/*
+	 * CommandComplete of a portal fetched by several Executes has the
+	 * number of rows of the last Execute. Make it the total.
+	 */
+	if (kind == 'C' && temp_cache->is_suspended && strncmp(data, "SELECT ", 7) == 0)
+	{
+		snprintf(tag, sizeof(tag), "SELECT %d", temp_cache->num_rows);
+		data = tag;
+		data_len = strlen(tag) + 1;
+	}
+	else if (kind == 'D')
+		temp_cache->num_rows++;
+
 	send_len = htonl(data_len + sizeof(int));
-	pool_add_buffer(buffer, (char *)&send_len, sizeof(int));
-	pool_add_buffer(buffer, data, data_len);
+	if (pool_add_buffer(buffer, &kind, 1) < 0 ||
+		pool_add_buffer(buffer, (char *)&send_len, sizeof(int)) < 0 ||
+		pool_add_buffer(buffer, data, data_len) < 0)
+	{
+		/* Give up caching rather than keeping a partial message */
+		temp_cache->is_exceeded = true;
+		pool_reset_buffer(buffer);
+	}
 
 	return;
 }
@@ -2768,10 +4384,11 @@ static void pool_add_oids_temp_query_cache(POOL_TEMP_QUERY_CACHE *temp_cache, in
  * Usage:
  * 1) Create buffer using pool_create_buffer().
  * 2) Add data to buffer using pool_add_buffer().
- * 3) Extract (copied) data from buffer using pool_get_buffer().
+ * 3) Extract (copied) data from buffer using pool_get_buffer(), or
+ *	  copy it to your own memory using pool_copy_buffer().
  * 4) Optionally you can:
  *		Obtain buffer length by using pool_get_buffer_length().
- *		Obtain buffer pointer by using pool_get_buffer_pointer().
+ *		Free the data but keep the buffer by using pool_reset_buffer().
  * 5) Discard buffer using pool_discard_buffer().
  */
 
@@ -2789,6 +4406,25 @@ static POOL_INTERNAL_BUFFER *pool_create_buffer(void)
 	return p;
 }
 
+/*
+ * Free data in internal buffer
+ */
+static void pool_reset_buffer(POOL_INTERNAL_BUFFER *buffer)
+{
+	POOL_BUFFER_CHUNK *chunk;
+	POOL_BUFFER_CHUNK *next;
+
+	if (!buffer)
+		return;
+
+	for (chunk = buffer->head; chunk; chunk = next)
+	{
+		next = chunk->next;
+		free(chunk);
+	}
+	memset(buffer, 0, sizeof(*buffer));
+}
+
 /*
  * Discard internal buffer
  */
@@ -2796,46 +4432,85 @@ static void pool_discard_buffer(POOL_INTERNAL_BUFFER *buffer)
 {
 	if (buffer)
 	{
-		if (buffer->buf)
-			free(buffer->buf);
+		pool_reset_buffer(buffer);
 		free(buffer);
 	}
 }
 
 /*
- * Add data to internal buffer
+ * Add data to internal buffer.
+ * Returns 0 on success, -1 on error.
  */
-static void pool_add_buffer(POOL_INTERNAL_BUFFER *buffer, void *data, size_t len)
+static int pool_add_buffer(POOL_INTERNAL_BUFFER *buffer, void *data, size_t len)
 {
 #define POOL_ALLOCATE_UNIT 8192
+	POOL_BUFFER_CHUNK *chunk;
+	size_t chunk_size;
+	size_t n;
 
 	/* Sanity check */
 	if (!buffer || !data || len == 0)
-		return;
+		return 0;
 
-	/* Check if we need to increase the buffer size */
-	if ((buffer->buflen + len) > buffer->bufsize)
+	while (len > 0)
 	{
-		size_t allocate_size = ((buffer->buflen + len)/POOL_ALLOCATE_UNIT +1)*POOL_ALLOCATE_UNIT;
-		pool_debug("pool_add_buffer: realloc old size:%zd new size:%zd",
-				   buffer->bufsize, allocate_size);
-		buffer->bufsize = allocate_size;
-		buffer->buf = (char *)realloc(buffer->buf, buffer->bufsize);
-		if (!buffer->buf)
+		chunk = buffer->tail;
+
+		/* Check if we need a new chunk */
+		if (chunk == NULL || chunk->len == chunk->size)
 		{
-			pool_error("pool_add_buffer: realloc failed(request size:%zd",
-					   buffer->bufsize);
-			return;
+			/*
+			 * Make the new chunk as large as the data so far so that a
+			 * large result fits in a few chunks. The data already in
+			 * the buffer is never copied.
+			 */
+			chunk_size = Max(Max(buffer->buflen, len), POOL_ALLOCATE_UNIT);
+			chunk = malloc(offsetof(POOL_BUFFER_CHUNK, data) + chunk_size);
+			if (!chunk)
+			{
+				pool_error("pool_add_buffer: malloc failed(request size:%zd)",
+						   chunk_size);
+				return -1;
+			}
+			chunk->next = NULL;
+			chunk->size = chunk_size;
+			chunk->len = 0;
+
+			if (buffer->tail)
+				buffer->tail->next = chunk;
+			else
+				buffer->head = chunk;
+			buffer->tail = chunk;
+
+			pool_debug("pool_add_buffer: new chunk size:%zd total:%zd",
+					   chunk_size, buffer->buflen);
 		}
+
+		/* Add data to the last chunk */
+		n = Min(len, chunk->size - chunk->len);
+		memcpy(chunk->data + chunk->len, data, n);
+		chunk->len += n;
+		buffer->buflen += n;
+		data = (char *)data + n;
+		len -= n;
 	}
-	/* Add data to buffer */
-	memcpy(buffer->buf+buffer->buflen, data, len);
-	buffer->buflen += len;
 
-	pool_debug("pool_add_buffer: len:%zd, total:%zd bufsize:%zd",
-			   len, buffer->buflen, buffer->bufsize);
+	return 0;
+}
 
-	return;
+/*
+ * Copy data in internal buffer to dest, which must have room for
+ * pool_get_buffer_length() bytes.
+ */
+static void pool_copy_buffer(POOL_INTERNAL_BUFFER *buffer, char *dest)
+{
+	POOL_BUFFER_CHUNK *chunk;
+
+	for (chunk = buffer->head; chunk; chunk = chunk->next)
+	{
+		memcpy(dest, chunk->data, chunk->len);
+		dest += chunk->len;
+	}
 }
 
 /*
@@ -2847,8 +4522,7 @@ static void *pool_get_buffer(POOL_INTERNAL_BUFFER *buffer, size_t *len)
 {
 	void *p;
 
-	if (buffer->bufsize == 0 || buffer->buflen == 0 ||
-		buffer->buf == NULL)
+	if (buffer->buflen == 0)
 	{
 		*len = 0;
 		return NULL;
@@ -2861,7 +4535,7 @@ static void *pool_get_buffer(POOL_INTERNAL_BUFFER *buffer, size_t *len)
 		*len = 0;
 		return NULL;
 	}
-	memcpy(p, buffer->buf, buffer->buflen);
+	pool_copy_buffer(buffer, p);
 	*len = buffer->buflen;
 	return p;
 }
@@ -2877,17 +4551,6 @@ static size_t pool_get_buffer_length(POOL_INTERNAL_BUFFER *buffer)
 	return buffer->buflen;
 }
 
-/*
- * Get internal buffer pointer.
- */
-static char *pool_get_buffer_pointer(POOL_INTERNAL_BUFFER *buffer)
-{
-	if (buffer == NULL)
-		return NULL;
-
-	return buffer->buf;
-}
-
 /*
  * Get query cache buffer struct of current query context
  */
@@ -2909,23 +4572,6 @@ POOL_TEMP_QUERY_CACHE *pool_get_current_cache(void)
 	return p;
 }
 
-/*
- * Get query cache buffer of current query context
- */
-static char *pool_get_current_cache_buffer(size_t *len)
-{
-	char *p = NULL;
-	*len = 0;
-	POOL_TEMP_QUERY_CACHE *cache;
-
-	cache = pool_get_current_cache();
-	if (cache)
-	{
-		p = pool_get_buffer(cache->buffer, len);
-	}
-	return p;
-}
-
 /*
  * Mark this temporary query cache buffer discarded if the SELECT
  * uses the table oid specified by oids.
@@ -2981,7 +4627,6 @@ static void pool_check_and_discard_cache_buffer(int num_oids, int *oids)
 void pool_handle_query_cache(POOL_CONNECTION_POOL *backend, char *query, Node *node, char state)
 {
 	POOL_SESSION_CONTEXT *session_context;
-	char *cache_buffer;
 	size_t len;
 	int num_oids;
 	int *oids;
@@ -3017,19 +4662,17 @@ void pool_handle_query_cache(POOL_CONNECTION_POOL *backend, char *query, Node *n
 				 * immediately register to cache storage.
 				 */
 				/* Register to memcached or shmem */
+				POOL_TEMP_QUERY_CACHE *cache = pool_get_current_cache();
+
 				POOL_SETMASK2(&BlockSig, &oldmask);
-				pool_shmem_lock();
 
-				cache_buffer =  pool_get_current_cache_buffer(&len);
-				if (cache_buffer)
+				if (cache && pool_get_buffer_length(cache->buffer) > 0)
 				{
-					if (pool_commit_cache(backend, query, cache_buffer, len, num_oids, oids) != 0)
+					if (pool_commit_cache(backend, query, cache->buffer, num_oids, oids) != 0)
 					{
 						pool_error("ReadyForQuery: pool_commit_cache failed");
 					}
-					free(cache_buffer);
 				}
-				pool_shmem_unlock();
 				POOL_SETMASK(&oldmask);
 			}
 
@@ -3096,13 +4739,12 @@ void pool_handle_query_cache(POOL_CONNECTION_POOL *backend, char *query, Node *n
 		int num_caches;
 
 		POOL_SETMASK2(&BlockSig, &oldmask);
-		pool_shmem_lock();
 
 		/* Invalidate query cache */
 		if (pool_config->memqcache_auto_cache_invalidation)
 		{
 			num_oids = pool_get_dml_table_oid(&oids);
-			pool_invalidate_query_cache(num_oids, oids, true, 0);
+			pool_invalidate_query_cache(num_oids, oids, 0);
 		}
 
 		/*
@@ -3123,18 +4765,14 @@ void pool_handle_query_cache(POOL_CONNECTION_POOL *backend, char *query, Node *n
 
 			num_oids = cache->num_oids;
 			oids = pool_get_buffer(cache->oids, &len);
-			cache_buffer = pool_get_buffer(cache->buffer, &len);
-						
-			if (pool_commit_cache(backend, cache->query, cache_buffer, len, num_oids, oids) != 0)
+
+			if (pool_commit_cache(backend, cache->query, cache->buffer, num_oids, oids) != 0)
 			{
 				pool_error("ReadyForQuery: pool_commit_cache failed");
 			}
 			if (oids)
 				free(oids);
-			if (cache_buffer)
-				free(cache_buffer);
 		}
-		pool_shmem_unlock();
 		POOL_SETMASK(&oldmask);
 
 		/* Count up number of SELECT stats */
@@ -3161,23 +4799,20 @@ void pool_handle_query_cache(POOL_CONNECTION_POOL *backend, char *query, Node *n
 		}
 		/*
 		 * If the query is DROP DATABASE, discard both of caches in shmem/memcached and
-		 * oidmap in memqcache_oiddir.
+		 * oid maps of the database.
 		 */
 		else if (is_drop_database(node) && session_context->query_context->dboid != 0)
 		{
 			int dboid = session_context->query_context->dboid;
-			num_oids = pool_get_dropdb_table_oids(&oids, dboid);
 
-			if (num_oids > 0 && pool_config->memqcache_auto_cache_invalidation)
+			if (pool_config->memqcache_auto_cache_invalidation)
 			{
-				pool_shmem_lock();
-				pool_invalidate_query_cache(num_oids, oids, true, dboid);
-				pool_discard_oid_maps_by_db(dboid);
-				pool_shmem_unlock();
+				POOL_SETMASK2(&BlockSig, &oldmask);
+				pool_invalidate_query_cache_by_db(dboid);
+				POOL_SETMASK(&oldmask);
 				pool_reset_memqcache_buffer();
 
-				free(oids);
-				pool_debug("ReadyForQuery: deleted all cache files for the DROPped DB");
+				pool_debug("ReadyForQuery: deleted all caches for the DROPped DB");
 			}
 		}
 		else
@@ -3197,9 +4832,7 @@ void pool_handle_query_cache(POOL_CONNECTION_POOL *backend, char *query, Node *n
 				if (state == 'I')
 				{
 					POOL_SETMASK2(&BlockSig, &oldmask);
-					pool_shmem_lock();
-					pool_invalidate_query_cache(num_oids, oids, true, 0);
-					pool_shmem_unlock();
+					pool_invalidate_query_cache(num_oids, oids, 0);
 					POOL_SETMASK(&oldmask);
 					pool_reset_memqcache_buffer();
 				}
@@ -3221,7 +4854,6 @@ void pool_handle_query_cache(POOL_CONNECTION_POOL *backend, char *query, Node *n
 /*
  * Create and initialize query cache stats
  */
-static POOL_QUERY_CACHE_STATS *stats;
 int pool_init_memqcache_stats(void)
 {
 	stats = pool_shared_memory_create(sizeof(POOL_QUERY_CACHE_STATS));
@@ -3295,192 +4927,347 @@ long long int pool_stats_count_up_num_selects(long long int num)
 }
 
 /*
- * Count up number of successful SELECTs in temporary area and returns
- * the number.
+ * Count up number of successful SELECTs in temporary area and returns
+ * the number.
+ */
+long long int pool_tmp_stats_count_up_num_selects(void)
+{
+	POOL_SESSION_CONTEXT *session_context;
+
+	session_context = pool_get_session_context();
+	session_context->num_selects++;
+	return 	session_context->num_selects;
+}
+
+/*
+ * Return number of successful SELECTs in temporary area.
+ */
+long long int pool_tmp_stats_get_num_selects(void)
+{
+	POOL_SESSION_CONTEXT *session_context;
+
+	session_context = pool_get_session_context();
+	return session_context->num_selects;
+}
+
+/*
+ * Reset number of successful SELECTs in temporary area.
+ */
+void pool_tmp_stats_reset_num_selects(void)
+{
+	POOL_SESSION_CONTEXT *session_context;
+
+	session_context = pool_get_session_context();
+	session_context->num_selects = 0;
+}
+
+/*
+ * Count up number of SELECTs extracted from cache returns the number.
+ * This is called for every cache hit, so the counter is incremented
+ * atomically rather than under QUERY_CACHE_STATS_SEM.
+ */
+long long int pool_stats_count_up_num_cache_hits(void)
+{
+	return __sync_add_and_fetch(&stats->num_cache_hits, 1);
+}
+
+/*
+ * On shared memory hash table implementation. See POOL_HASH_BUCKET
+ * for the layout. The query hash is already a good hash, so the first
+ * 16 hex digits of it are used as the hash value: the lowest 8 bits
+ * choose the partition, the next bits choose the home bucket in the
+ * region of the partition and the top 8 bits are the tag.
+ *
+ * Probing goes bucket by bucket from the home bucket and stops at a
+ * bucket which has an empty slot. Deleted slots are marked
+ * POOL_HASH_TAG_DELETED unless the bucket already has an empty slot,
+ * and are reused by insertion. When deleted slots pile up, the region
+ * is rebuilt.
+ */
+
+static volatile POOL_HASH_HEADER *hash_header;
+static volatile POOL_HASH_BUCKET *hash_buckets;
+
+#define POOL_HASH_ONES	0x0101010101010101ULL
+#define POOL_HASH_HIGHS	0x8080808080808080ULL
+
+static uint64_t hex_to_uint64(const char *hex);
+static uint64_t query_hash_value(POOL_QUERY_HASH *key);
+static unsigned char hash_tag(uint64_t value);
+static volatile POOL_HASH_BUCKET *hash_region(int partition);
+static bool bucket_has_tag(volatile POOL_HASH_BUCKET *bucket, unsigned char tag);
+static bool hash_slot_matches(volatile POOL_CACHEID *slot, POOL_QUERY_HASH *key);
+static volatile POOL_CACHEID *pool_hash_find(POOL_QUERY_HASH *key);
+static volatile POOL_HASH_BUCKET *pool_hash_find_cacheid(POOL_QUERY_HASH *key, POOL_CACHEID *cacheid, int *slot);
+static int pool_hash_put(POOL_QUERY_HASH *key, POOL_CACHEID *cacheid);
+static void pool_hash_clear_region(int partition);
+static void pool_hash_rebuild_region(int partition);
+
+/*
+ * Initialize hash table on shared memory "nelements" is max number of
+ * hash entries. Each partition can hold nelements / number of
+ * partitions entries, and the region of a partition has power of 2
+ * buckets so that the load factor is kept under 7/8.
+ * Should be called after pool_init_cache_partitions.
+ */
+#undef POOL_HASH_DEBUG
+
+int pool_hash_init(int nelements)
+{
+	size_t size;
+	long nbuckets;		/* number of buckets in a region */
+	int max_entries;
+	int i;
+
+	if (nelements <= 0)
+	{
+		pool_error("pool_hash_init: invalid nelements:%d", nelements);
+		return -1;
+	}
+
+	nbuckets = pool_hash_num_buckets(nelements, memqcache_num_partitions, &max_entries);
+
+	hash_header = pool_cache_shared_memory_create(sizeof(POOL_HASH_HEADER));
+	if (hash_header == NULL)
+	{
+		pool_error("pool_hash_init: failed to allocate shared memory cache for hash header. request size: %zd",
+				   sizeof(POOL_HASH_HEADER));
+		return -1;
+	}
+	hash_header->nhash = nbuckets * memqcache_num_partitions;
+	hash_header->mask = nbuckets - 1;
+	hash_header->max_entries = max_entries;
+
+	size = sizeof(POOL_HASH_BUCKET) * hash_header->nhash;
+	hash_buckets = pool_cache_shared_memory_create(size);
+	if (hash_buckets == NULL)
+	{
+		pool_error("pool_hash_init: failed to allocate shared memory cache for hash buckets. request size: %zd", size);
+		return -1;
+	}
+
+#ifdef POOL_HASH_DEBUG
+	pool_log("pool_hash_init: size:%zd nbuckets:%ld max_entries:%d", size, nbuckets, max_entries);
+#endif
+
+	if (persistent_cache_restored)
+		return 0;
+
+	for (i=0;i<memqcache_num_partitions;i++)
+		pool_hash_clear_region(i);
+
+	return 0;
+}
+
+/*
+ * Return number of buckets in the hash region of a partition, and set
+ * max number of entries of a partition to *max_entries.
+ */
+static long pool_hash_num_buckets(int nelements, int num_partitions, int *max_entries)
+{
+	long nbuckets = 1;
+
+	*max_entries = (nelements + num_partitions - 1) / num_partitions;
+
+	while (nbuckets * POOL_HASH_BUCKET_SLOTS * 7 / 8 < *max_entries)
+		nbuckets <<= 1;
+
+	return nbuckets;
+}
+
+/*
+ * Reset hash table on shared memory.
+ */
+static int
+pool_hash_reset(void)
+{
+	int i;
+
+	for (i=0;i<memqcache_num_partitions;i++)
+		pool_hash_clear_region(i);
+
+	return 0;
+}
+
+/*
+ * Make all buckets of the region of the partition empty.
+ */
+static void pool_hash_clear_region(int partition)
+{
+	volatile POOL_HASH_BUCKET *region = hash_region(partition);
+	long nbuckets = (long)hash_header->mask + 1;
+	long i;
+
+	memset((void *)region, 0, sizeof(POOL_HASH_BUCKET) * nbuckets);
+
+	/* Padding tag must not look like an empty slot */
+	for (i=0;i<nbuckets;i++)
+		region[i].tags[POOL_HASH_BUCKET_SLOTS] = POOL_HASH_TAG_DELETED;
+
+	cache_partitions[partition].num_entries = 0;
+	cache_partitions[partition].num_deleted = 0;
+}
+
+/*
+ * Convert 16 hex digits to 64 bit value.
+ */
+static uint64_t hex_to_uint64(const char *hex)
+{
+	uint64_t value = 0;
+	int i;
+
+	for (i=0;i<16;i++)
+	{
+		unsigned char c = hex[i];
+
+		value = (value << 4) | (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+	}
+	return value;
+}
+
+/*
+ * Calculate hash value from the first 16 hex digits of the query hash.
  */
-long long int pool_tmp_stats_count_up_num_selects(void)
+static uint64_t query_hash_value(POOL_QUERY_HASH *key)
 {
-	POOL_SESSION_CONTEXT *session_context;
-
-	session_context = pool_get_session_context();
-	session_context->num_selects++;
-	return 	session_context->num_selects;
+	return hex_to_uint64(key->query_hash);
 }
 
 /*
- * Return number of successful SELECTs in temporary area.
+ * Tag of used slot for the hash value.
  */
-long long int pool_tmp_stats_get_num_selects(void)
+static unsigned char hash_tag(uint64_t value)
 {
-	POOL_SESSION_CONTEXT *session_context;
+	unsigned char tag = value >> 56;
 
-	session_context = pool_get_session_context();
-	return session_context->num_selects;
+	return tag < POOL_HASH_TAG_MIN ? tag + POOL_HASH_TAG_MIN : tag;
 }
 
 /*
- * Reset number of successful SELECTs in temporary area.
+ * Returns the first bucket of the region of the partition.
  */
-void pool_tmp_stats_reset_num_selects(void)
+static volatile POOL_HASH_BUCKET *hash_region(int partition)
 {
-	POOL_SESSION_CONTEXT *session_context;
-
-	session_context = pool_get_session_context();
-	session_context->num_selects = 0;
+	return &hash_buckets[((long)hash_header->mask + 1) * partition];
 }
 
 /*
- * Count up number of SELECTs extracted from cache returns the number.
- * QUERY_CACHE_STATS_SEM lock is acquired in this function.
+ * Returns true if any slot of the bucket has the tag. All the tags
+ * of the bucket are compared at once as a 64 bit word: bytes equal to
+ * the tag become 0 by xor, and the test for zero bytes is exact as a
+ * whole (though not per byte, so callers check each slot).
  */
-long long int pool_stats_count_up_num_cache_hits(void)
+static bool bucket_has_tag(volatile POOL_HASH_BUCKET *bucket, unsigned char tag)
 {
-#ifdef HAVE_SIGPROCMASK
-	sigset_t oldmask;
-#else
-	int	oldmask;
-#endif
+	uint64_t word;
 
-	POOL_SETMASK2(&BlockSig, &oldmask);
-	pool_semaphore_lock(QUERY_CACHE_STATS_SEM);
-	stats->num_cache_hits++;
-	pool_semaphore_unlock(QUERY_CACHE_STATS_SEM);
-	POOL_SETMASK(&oldmask);
-	return stats->num_cache_hits;
+	memcpy(&word, (const void *)bucket->tags, sizeof(word));
+	word ^= POOL_HASH_ONES * tag;
+	return ((word - POOL_HASH_ONES) & ~word & POOL_HASH_HIGHS) != 0;
 }
 
 /*
- * On shared memory hash table implementation.  We use sub part of md5
- * hash key as hash function.  The experiment has shown that has_any()
- * of PostgreSQL is a little bit better than the method using part of
- * md5 hash value, but it seems adding some cpu cycles to call
- * hash_any() is not worth the trouble.
+ * Returns true if the slot points to the cache item of the query
+ * hash. The cache id is validated first since this may be called
+ * without the partition lock.
  */
+static bool hash_slot_matches(volatile POOL_CACHEID *slot, POOL_QUERY_HASH *key)
+{
+	POOL_CACHEID cacheid = *slot;
+	POOL_CACHE_BLOCK_HEADER *bh;
+	POOL_CACHE_ITEM_POINTER *cip;
 
-static volatile POOL_HASH_HEADER *hash_header;
-static volatile POOL_HASH_ELEMENT *hash_elements;
-static volatile POOL_HASH_ELEMENT hash_free_body;
-static volatile POOL_HASH_ELEMENT *hash_free;
+	if (cacheid.blockid >= pool_get_memqcache_blocks())
+		return false;
+
+	bh = (POOL_CACHE_BLOCK_HEADER *)block_address(cacheid.blockid);
+	if (cacheid.itemid >= bh->num_items ||
+		sizeof(POOL_CACHE_BLOCK_HEADER) + sizeof(POOL_CACHE_ITEM_POINTER) * (cacheid.itemid + 1) >
+		pool_config->memqcache_cache_block_size)
+		return false;
+
+	cip = item_pointer((char *)bh, cacheid.itemid);
+	if (cip->flags & POOL_ITEM_DELETED)
+		return false;
+
+	return memcmp(cip->query_hash.query_hash, key->query_hash, POOL_MD5_HASHKEYLEN) == 0;
+}
 
 /*
- * Initialize hash table on shared memory "nelements" is max number of
- * hash keys. The actual number of hash key is rounded up to power of
- * 2.
+ * Returns the slot holding the cache id of the query hash, or NULL.
+ * Probing is bounded by the region size so that a reader without the
+ * partition lock (pool_read_item_optimistic) always finishes.
  */
-#undef POOL_HASH_DEBUG
-
-int pool_hash_init(int nelements)
+static volatile POOL_CACHEID *pool_hash_find(POOL_QUERY_HASH *key)
 {
-	size_t size;
-	int nelements2;		/* number of rounded up hash keys */
-	int shift;
-	uint32 mask;
-	POOL_HASH_HEADER hh;
+	uint64_t value = query_hash_value(key);
+	unsigned char tag = hash_tag(value);
+	volatile POOL_HASH_BUCKET *region = hash_region(value & (memqcache_num_partitions - 1));
+	uint32 mask = hash_header->mask;
+	uint32 b = (value >> 8) & mask;
+	uint32 n;
 	int i;
 
-	if (nelements <= 0)
-	{
-		pool_error("pool_hash_init: invalid nelements:%d", nelements);
-		return -1;
-	}
-
-	/* Round up to power of 2 */
-	shift = 32;
-	nelements2 = 1;
-	do
-	{
-		nelements2 <<= 1;
-		shift--;
-	} while (nelements2 < nelements);
-
-	mask = ~0;
-	mask >>= shift;
-	size = (char *)&hh.elements - (char *)&hh + sizeof(POOL_HEADER_ELEMENT)*nelements2;
-	hash_header = pool_shared_memory_create(size);
-	if (hash_header == NULL)
+	for (n=0;n<=mask;n++)
 	{
-		pool_error("pool_hash_init: failed to allocate shared memory cache for hash header. request size: %zd", size);
-		return -1;
-	}
-	hash_header->nhash = nelements2;
-    hash_header->mask = mask;
-
-#ifdef POOL_HASH_DEBUG
-	pool_log("pool_hash_init: size:%zd nelements2:%d", size, nelements2);
-#endif
+		volatile POOL_HASH_BUCKET *bucket = &region[b];
 
-	size = sizeof(POOL_HASH_ELEMENT)*nelements2;
-	hash_elements = pool_shared_memory_create(size);
-	if (hash_elements == NULL)
-	{
-		pool_error("pool_hash_init: failed to allocate shared memory cache for free list. request size: %zd", size);
-		return -1;
-	}
+		if (bucket_has_tag(bucket, tag))
+		{
+			for (i=0;i<POOL_HASH_BUCKET_SLOTS;i++)
+			{
+				if (bucket->tags[i] == tag && hash_slot_matches(&bucket->cacheids[i], key))
+					return &bucket->cacheids[i];
+			}
+		}
 
-#ifdef POOL_HASH_DEBUG
-	pool_log("pool_hash_init: size:%zd nelements2:%d", size, nelements2);
-#endif
+		if (bucket_has_tag(bucket, POOL_HASH_TAG_EMPTY))
+			break;
 
-	for (i=0;i<nelements2-1;i++)
-	{
-		hash_elements[i].next = (POOL_HASH_ELEMENT *)&hash_elements[i+1];
+		b = (b + 1) & mask;
 	}
-	hash_elements[nelements2-1].next = NULL;
-	hash_free = hash_elements;
-
-	return 0;
+	return NULL;
 }
 
 /*
- * Reset hash table on shared memory "nelements" is max number of
- * hash keys. The actual number of hash key is rounded up to power of
- * 2.
+ * Look for the slot of the query hash which has the cache id. Unlike
+ * pool_hash_find, this does not look into the cache item, which may
+ * be in the middle of being moved or deleted.
  */
-static int
-pool_hash_reset(int nelements)
+static volatile POOL_HASH_BUCKET *pool_hash_find_cacheid(POOL_QUERY_HASH *key, POOL_CACHEID *cacheid, int *slot)
 {
-	size_t size;
-	int nelements2;		/* number of rounded up hash keys */
-	int shift;
-	uint32 mask;
-	POOL_HASH_HEADER hh;
+	uint64_t value = query_hash_value(key);
+	unsigned char tag = hash_tag(value);
+	volatile POOL_HASH_BUCKET *region = hash_region(value & (memqcache_num_partitions - 1));
+	uint32 mask = hash_header->mask;
+	uint32 b = (value >> 8) & mask;
+	uint32 n;
 	int i;
 
-	if (nelements <= 0)
-	{
-		pool_error("pool_hash_clear: invalid nelements:%d", nelements);
-		return -1;
-	}
-
-	/* Round up to power of 2 */
-	shift = 32;
-	nelements2 = 1;
-	do
+	for (n=0;n<=mask;n++)
 	{
-		nelements2 <<= 1;
-		shift--;
-	} while (nelements2 < nelements);
-
-	mask = ~0;
-	mask >>= shift;
+		volatile POOL_HASH_BUCKET *bucket = &region[b];
 
-	size = (char *)&hh.elements - (char *)&hh + sizeof(POOL_HEADER_ELEMENT)*nelements2;
-	memset((void *)hash_header, 0, size);
-
-	hash_header->nhash = nelements2;
-    	hash_header->mask = mask;
+		if (bucket_has_tag(bucket, tag))
+		{
+			for (i=0;i<POOL_HASH_BUCKET_SLOTS;i++)
+			{
+				if (bucket->tags[i] == tag &&
+					bucket->cacheids[i].blockid == cacheid->blockid &&
+					bucket->cacheids[i].itemid == cacheid->itemid)
+				{
+					*slot = i;
+					return bucket;
+				}
+			}
+		}
 
-	size = sizeof(POOL_HASH_ELEMENT)*nelements2;
-	memset((void *)hash_elements, 0, size);
+		if (bucket_has_tag(bucket, POOL_HASH_TAG_EMPTY))
+			break;
 
-	for (i=0;i<nelements2-1;i++)
-	{
-		hash_elements[i].next = (POOL_HASH_ELEMENT *)&hash_elements[i+1];
+		b = (b + 1) & mask;
 	}
-	hash_elements[nelements2-1].next = NULL;
-	hash_free = hash_elements;
-
-	return 0;
+	return NULL;
 }
 
 /*
@@ -3489,247 +5276,443 @@ pool_hash_reset(int nelements)
  */
 POOL_CACHEID *pool_hash_search(POOL_QUERY_HASH *key)
 {
-	volatile POOL_HASH_ELEMENT *element;
+	return (POOL_CACHEID *)pool_hash_find(key);
+}
 
-	uint32 hash_key = create_hash_key(key);
+/*
+ * Look up and copy an item without the partition lock, seqlock
+ * style: remember the partition version, copy the item, then check
+ * that the version has not changed. Anything read before the check
+ * may be inconsistent, so pointers and sizes are validated before use
+ * and chain walks are bounded.
+ * 0: fetch success, 1: not found, -1: retry with the partition lock
+ */
+static int pool_read_item_optimistic(POOL_QUERY_HASH *query_hash, POOL_QUERY_KEY *key, int partition, char **buf, size_t *len, bool *stale)
+{
+	volatile unsigned int *version = &cache_partitions[partition].version;
+	size_t block_size = pool_config->memqcache_cache_block_size;
+	int maxblock = pool_get_memqcache_blocks();
+	char *p = NULL;
+	size_t psize = 0;
+	int retry;
 
-	if (hash_key >= hash_header->nhash)
+	for (retry = 0; retry < POOL_CACHE_READ_RETRIES; retry++)
 	{
-		pool_error("pool_hash_search: invalid hash key: %uld nhash: %ld",
-				   hash_key, hash_header->nhash);
-		return NULL;
-	}
+		volatile POOL_CACHEID *slot;
+		POOL_CACHEID cacheid;
+		POOL_CACHE_BLOCK_HEADER *bh;
+		POOL_CACHE_ITEM_POINTER *cip;
+		POOL_CACHE_ITEM_HEADER *cih;
+		unsigned int v;
+		unsigned int offset;
+		unsigned int total_length;
+		unsigned int key_length;
+		time_t timestamp;
+		size_t size;
+
+		v = *version;
+		pool_memory_barrier();
+		if (v & 1)
+			continue;		/* writer in progress */
+
+		slot = pool_hash_find(query_hash);
+		if (slot == NULL)
+		{
+			pool_memory_barrier();
+			if (*version != v)
+				continue;
+			free(p);
+			return 1;
+		}
+		cacheid = *slot;
 
-	{
-		char md5[POOL_MD5_HASHKEYLEN+1];
-		memcpy(md5, key->query_hash, POOL_MD5_HASHKEYLEN);
-		md5[POOL_MD5_HASHKEYLEN] = '\0';
-#ifdef POOL_HASH_DEBUG
-		pool_log("pool_hash_search: hash_key:%d md5:%s", hash_key, md5);
-#endif
-	}
+		/* Validate cache id and item before copying */
+		if (cacheid.blockid >= maxblock)
+			continue;
+		bh = (POOL_CACHE_BLOCK_HEADER *)block_address(cacheid.blockid);
+		if (cacheid.itemid >= bh->num_items ||
+			sizeof(POOL_CACHE_BLOCK_HEADER) +
+			sizeof(POOL_CACHE_ITEM_POINTER) * (cacheid.itemid + 1) > block_size)
+			continue;
+		cip = item_pointer((char *)bh, cacheid.itemid);
+		offset = cip->offset;
+		if (offset > block_size - sizeof(POOL_CACHE_ITEM_HEADER))
+			continue;
+		cih = (POOL_CACHE_ITEM_HEADER *)((char *)bh + offset);
+		total_length = cih->total_length;
+		key_length = cih->key_length;
+		timestamp = cih->timestamp;
+		if (total_length < sizeof(POOL_CACHE_ITEM_HEADER) ||
+			total_length > block_size - offset ||
+			key_length > total_length - sizeof(POOL_CACHE_ITEM_HEADER))
+			continue;
 
-	element = hash_header->elements[hash_key].element;
-	while (element)
-	{
+		/* Make sure that this is not a hash collision */
+		if (!pool_query_key_equal(key, (char *)cih + sizeof(POOL_CACHE_ITEM_HEADER), key_length))
 		{
-			char md5[POOL_MD5_HASHKEYLEN+1];
-			memcpy(md5, key->query_hash, POOL_MD5_HASHKEYLEN);
-			md5[POOL_MD5_HASHKEYLEN] = '\0';
-#ifdef POOL_HASH_DEBUG
-			pool_log("pool_hash_search: element md5:%s", md5);
-#endif
+			pool_memory_barrier();
+			if (*version != v)
+				continue;
+			pool_debug("pool_read_item_optimistic: hash collision");
+			free(p);
+			return 1;
+		}
+
+		/* Expired items are deleted under the lock */
+		if (pool_cache_expired(timestamp, true))
+		{
+			free(p);
+			return -1;
 		}
 
-		if (memcmp((const void *)element->hashkey.query_hash,
-				   (const void *)key->query_hash, sizeof(key->query_hash)) == 0)
+		size = total_length - sizeof(POOL_CACHE_ITEM_HEADER) - key_length;
+		if (size > psize || p == NULL)
 		{
-			return (POOL_CACHEID *)&element->cacheid;
+			free(p);
+			p = malloc(size > 0 ? size : 1);
+			if (!p)
+			{
+				pool_error("pool_read_item_optimistic: malloc failed");
+				return -1;
+			}
+			psize = size;
 		}
-		element = element->next;
+		memcpy(p, (char *)cih + sizeof(POOL_CACHE_ITEM_HEADER) + key_length, size);
+
+		pool_memory_barrier();
+		if (*version != v)
+			continue;
+
+		/*
+		 * The item may have been replaced since the version check, so
+		 * the hit may be counted for another item. The counters are
+		 * apart from item data, so that only affects eviction order.
+		 * cacheid has been validated to be in the counter array.
+		 */
+		pool_count_item_hit(cacheid.blockid, cacheid.itemid);
+
+		*buf = p;
+		*len = size;
+		*stale = pool_cache_expired(timestamp, false);
+		return 0;
 	}
-	return NULL;
+
+	pool_debug("pool_read_item_optimistic: gave up after %d retries", retry);
+	free(p);
+	return -1;
 }
 
 /*
- * Insert MD5 key and associated cache id into shmem hash table.  If
- * "update" is true, replace cacheid associated with the MD5 key,
- * rather than throw an error.
+ * Insert MD5 key and associated cache id into shmem hash table.
+ * Caller must make sure that the partition has a free entry.
  */
-static int pool_hash_insert(POOL_QUERY_HASH *key, POOL_CACHEID *cacheid, bool update)
+static int pool_hash_insert(POOL_QUERY_HASH *key, POOL_CACHEID *cacheid)
 {
-	POOL_HASH_ELEMENT *element;
-	POOL_HASH_ELEMENT *new_element;
+	int partition = query_hash_partition(key);
+	POOL_CACHE_PARTITION *part = &cache_partitions[partition];
+	long nslots = ((long)hash_header->mask + 1) * POOL_HASH_BUCKET_SLOTS;
 
-	uint32 hash_key = create_hash_key(key);
+#ifdef POOL_HASH_DEBUG
+	pool_log("pool_hash_insert: key:%.*s block:%d item:%d",
+			 POOL_MD5_HASHKEYLEN, key->query_hash, cacheid->blockid, cacheid->itemid);
+#endif
 
-	if (hash_key >= hash_header->nhash)
+	if (pool_hash_find(key))
 	{
-		pool_error("pool_hash_insert: invalid hash key: %uld nhash: %ld",
-				   hash_key, hash_header->nhash);
+		pool_error("pool_hash_insert: the key:==%.*s== already exists",
+				   POOL_MD5_HASHKEYLEN, key->query_hash);
 		return -1;
 	}
 
+	if (part->num_entries >= hash_header->max_entries)
 	{
-		char md5[POOL_MD5_HASHKEYLEN+1];
-		memcpy(md5, key->query_hash, POOL_MD5_HASHKEYLEN);
-		md5[POOL_MD5_HASHKEYLEN] = '\0';
-#ifdef POOL_HASH_DEBUG
-		pool_log("pool_hash_insert: hash_key:%d md5:%s block:%d item:%d", hash_key, md5, cacheid->blockid, cacheid->itemid);
-#endif
+		pool_error("pool_hash_insert: no free hash entry in partition %d", partition);
+		return -1;
 	}
 
-	/*
-	 * Look for hash key.
-	 */
-	element = hash_header->elements[hash_key].element;
+	/* Too many deleted slots make probing long */
+	if (part->num_deleted > 0 &&
+		part->num_entries + part->num_deleted >= nslots * 7 / 8)
+		pool_hash_rebuild_region(partition);
+
+	return pool_hash_put(key, cacheid);
+}
+
+/*
+ * Put the cache id into the first unused slot of the probe sequence
+ * of the query hash.
+ */
+static int pool_hash_put(POOL_QUERY_HASH *key, POOL_CACHEID *cacheid)
+{
+	uint64_t value = query_hash_value(key);
+	int partition = value & (memqcache_num_partitions - 1);
+	volatile POOL_HASH_BUCKET *region = hash_region(partition);
+	uint32 mask = hash_header->mask;
+	uint32 b = (value >> 8) & mask;
+	uint32 n;
+	int i;
 
-	while (element)
+	for (n=0;n<=mask;n++)
 	{
-		if (memcmp((const void *)element->hashkey.query_hash,
-				   (const void *)key->query_hash, sizeof(key->query_hash)) == 0)
-		{
-			/* Hash key found. If "update" is false, just throw an error. */
-			char md5[POOL_MD5_HASHKEYLEN+1];
+		volatile POOL_HASH_BUCKET *bucket = &region[b];
 
-			if (!update)
-			{
-				memcpy(md5, key->query_hash, POOL_MD5_HASHKEYLEN);
-				md5[POOL_MD5_HASHKEYLEN] = '\0';
-				pool_error("pool_hash_insert: the key:==%s== already exists", md5);
-				return -1;
-			}
-			else
+		for (i=0;i<POOL_HASH_BUCKET_SLOTS;i++)
+		{
+			if (bucket->tags[i] < POOL_HASH_TAG_MIN)
 			{
-				/* Update cache id */
-				memcpy((void *)&element->cacheid, cacheid, sizeof(POOL_CACHEID));
+				if (bucket->tags[i] == POOL_HASH_TAG_DELETED)
+					cache_partitions[partition].num_deleted--;
+				bucket->cacheids[i] = *cacheid;
+				bucket->tags[i] = hash_tag(value);
+				cache_partitions[partition].num_entries++;
 				return 0;
 			}
 		}
-		element = element->next;
+		b = (b + 1) & mask;
 	}
 
-	/*
-	 * Ok, same key did not exist. Just insert new hash key.
-	 */
-	new_element = (POOL_HASH_ELEMENT *)get_new_hash_element();
-	if (!new_element)
+	pool_error("pool_hash_put: no free slot in partition %d", partition);
+	return -1;
+}
+
+/*
+ * Replace cache id of the query hash. Used when a cache item is
+ * moved in the block.
+ */
+static int pool_hash_update(POOL_QUERY_HASH *key, POOL_CACHEID *old, POOL_CACHEID *new)
+{
+	volatile POOL_HASH_BUCKET *bucket;
+	int slot;
+
+	bucket = pool_hash_find_cacheid(key, old, &slot);
+	if (bucket == NULL)
 	{
-		pool_error("pool_hash_insert: could not get new element");
+		pool_error("pool_hash_update: the key:==%.*s== not found",
+				   POOL_MD5_HASHKEYLEN, key->query_hash);
 		return -1;
 	}
-
-	element = hash_header->elements[hash_key].element;
-
-	hash_header->elements[hash_key].element = new_element;
-	new_element->next = element;
-
-	memcpy((void *)new_element->hashkey.query_hash, key->query_hash, POOL_MD5_HASHKEYLEN);
-	memcpy((void *)&new_element->cacheid, cacheid, sizeof(POOL_CACHEID));
-
+	bucket->cacheids[slot] = *new;
 	return 0;
 }
 
 /*
- * Delete MD5 key and associated cache id into shmem hash table.
+ * Delete MD5 key and associated cache id from shmem hash table.
  */
-int pool_hash_delete(POOL_QUERY_HASH *key)
+int pool_hash_delete(POOL_QUERY_HASH *key, POOL_CACHEID *cacheid)
 {
-	POOL_HASH_ELEMENT *element;
-	POOL_HASH_ELEMENT **delete_point;
-	bool found;
-
-	uint32 hash_key = create_hash_key(key);
+	volatile POOL_HASH_BUCKET *bucket;
+	int partition = query_hash_partition(key);
+	int slot;
 
-	if (hash_key >= hash_header->nhash)
+	bucket = pool_hash_find_cacheid(key, cacheid, &slot);
+	if (bucket == NULL)
 	{
-		pool_error("pool_hash_delete: invalid hash key: %uld nhash: %ld",
-				   hash_key, hash_header->nhash);
+		pool_error("pool_hash_delete: the key:==%.*s== not found",
+				   POOL_MD5_HASHKEYLEN, key->query_hash);
 		return -1;
 	}
 
 	/*
-	 * Look for delete location
+	 * Probing never goes past a bucket which has an empty slot, so
+	 * the slot can be made empty in such a bucket.
 	 */
-	found = false;
-	delete_point = (POOL_HASH_ELEMENT **)&(hash_header->elements[hash_key].element);
-	element = hash_header->elements[hash_key].element;
+	if (bucket_has_tag(bucket, POOL_HASH_TAG_EMPTY))
+		bucket->tags[slot] = POOL_HASH_TAG_EMPTY;
+	else
+	{
+		bucket->tags[slot] = POOL_HASH_TAG_DELETED;
+		cache_partitions[partition].num_deleted++;
+	}
+	cache_partitions[partition].num_entries--;
+
+	return 0;
+}
+
+/*
+ * Rebuild the region of the partition to get rid of deleted slots.
+ * Query hashes are taken from item pointers of the cache blocks. If
+ * there's no memory to do it, just leave the region as it is.
+ */
+static void pool_hash_rebuild_region(int partition)
+{
+	volatile POOL_HASH_BUCKET *region = hash_region(partition);
+	long nbuckets = (long)hash_header->mask + 1;
+	POOL_HASH_BUCKET *copy;
+	long i;
+	int j;
 
-	while (element)
+	copy = malloc(sizeof(POOL_HASH_BUCKET) * nbuckets);
+	if (copy == NULL)
 	{
-		if (memcmp(element->hashkey.query_hash, key->query_hash, sizeof(key->query_hash)) == 0)
-		{
-			found = true;
-			break;
-		}
-		delete_point = &element->next;
-		element = element->next;
+		pool_debug("pool_hash_rebuild_region: malloc failed");
+		return;
 	}
+	memcpy(copy, (void *)region, sizeof(POOL_HASH_BUCKET) * nbuckets);
 
-	if (!found)
+	pool_debug("pool_hash_rebuild_region: partition:%d entries:%d deleted:%d",
+			   partition, cache_partitions[partition].num_entries,
+			   cache_partitions[partition].num_deleted);
+
+	pool_hash_clear_region(partition);
+
+	for (i=0;i<nbuckets;i++)
 	{
-		char md5[POOL_MD5_HASHKEYLEN+1];
+		for (j=0;j<POOL_HASH_BUCKET_SLOTS;j++)
+		{
+			POOL_CACHEID *cacheid = &copy[i].cacheids[j];
+			POOL_CACHE_ITEM_POINTER *cip;
 
-		memcpy(md5, key->query_hash, POOL_MD5_HASHKEYLEN);
-		md5[POOL_MD5_HASHKEYLEN] = '\0';
-		pool_error("pool_hash_delete: the key:==%s== not found", md5);
-		return -1;
-	}
+			if (copy[i].tags[j] < POOL_HASH_TAG_MIN)
+				continue;
 
-	/*
-	 * Put back the element to free list
-	 */
-	*delete_point = element->next;
-	put_back_hash_element(element);
+			cip = item_pointer(block_address(cacheid->blockid), cacheid->itemid);
+			pool_hash_put(&cip->query_hash, cacheid);
+		}
+	}
 
-	return 0;
+	free(copy);
 }
 
 /* 
- * Calculate 32bit binary hash key(i.e. location in hash header) from MD5
- * string. We use top most 8 characters of MD5 string for calculation.
-*/
+ * Calculate 32bit binary hash key from MD5 string. Only the low bits
+ * are used (to choose the partition).
+ */
 static uint32 create_hash_key(POOL_QUERY_HASH *key)
 {
-#define POOL_HASH_NCHARS 8
-
-	char md5[POOL_HASH_NCHARS+1];
-	uint32 mask;
+	return (uint32)query_hash_value(key);
+}
 
-	memcpy(md5, key->query_hash, POOL_HASH_NCHARS);
-	md5[POOL_HASH_NCHARS] = '\0';
-	mask = strtoul(md5, NULL, 16);
-	mask &= hash_header->mask;
-	return mask;
+/*
+ * Return true if there's a free hash entry in the partition.
+ */
+static bool is_free_hash_element(int partition)
+{
+	return cache_partitions[partition].num_entries < hash_header->max_entries;
 }
 
 /*
- * Get new free hash element from free list.
+ * Access frequency sketch of the tinylfu policy. Each partition has
+ * POOL_SKETCH_DEPTH rows of counters. Row indexes are made from the
+ * last 16 hex digits of the query hash, which are not used by the
+ * hash table. Counters are updated without lock, so the counts are
+ * approximate.
+ */
+static unsigned char *sketch;
+static uint32 sketch_mask;		/* number of counters in a row - 1 */
+
+/*
+ * Allocate the sketch on shmem if the tinylfu policy is used. Each
+ * row has as many counters as hash entries of a partition (rounded up
+ * to a power of 2). Should be called after pool_hash_init.
  */
-static volatile POOL_HASH_ELEMENT *get_new_hash_element(void)
+int pool_init_cache_sketch(void)
 {
-	volatile POOL_HASH_ELEMENT *elm;
+	size_t size;
+	uint32 width;
+
+	if (eviction_policy != POOL_EVICT_TINYLFU)
+		return 0;
+
+	width = pool_sketch_width(hash_header->max_entries);
+	sketch_mask = width - 1;
 
-	if (!hash_free->next)
+	size = (size_t)width * POOL_SKETCH_DEPTH * memqcache_num_partitions;
+	sketch = pool_cache_shared_memory_create(size);
+	if (sketch == NULL)
 	{
-		/* No free element */
-		return NULL;
+		pool_error("pool_init_cache_sketch: failed to allocate shared memory for sketch. request size: %zd", size);
+		return -1;
 	}
+	if (!persistent_cache_restored)
+		memset(sketch, 0, size);
+	return 0;
+}
 
-#ifdef POOL_HASH_DEBUG
-	pool_log("get_new_hash_element: hash_free->next:%p hash_free->next->next:%p",
-			 hash_free->next, hash_free->next->next);
-#endif
+/*
+ * Return number of counters in a row of the sketch.
+ */
+static uint32 pool_sketch_width(int max_entries)
+{
+	uint32 width = 64;
+
+	while (width < max_entries)
+		width <<= 1;
+	return width;
+}
 
-	elm = hash_free->next;
-	hash_free->next = elm->next;
+/*
+ * Returns the first counter of the rows of the partition and row
+ * hash values of the query hash.
+ */
+static unsigned char *pool_sketch_rows(POOL_QUERY_HASH *key, uint32 *h1, uint32 *h2)
+{
+	uint64_t value = hex_to_uint64(key->query_hash + 16);
+	int partition = query_hash_partition(key);
 
-	return elm;
+	*h1 = (uint32)value;
+	*h2 = (uint32)(value >> 32) | 1;
+	return sketch + ((size_t)sketch_mask + 1) * POOL_SKETCH_DEPTH * partition;
 }
 
 /*
- * Put back hash element to free list.
+ * Count an access to the query hash. When the partition has counted
+ * POOL_SKETCH_SAMPLE_FACTOR times its max entries, all counters of
+ * the partition are halved so that old accesses fade away.
  */
-static void put_back_hash_element(volatile POOL_HASH_ELEMENT *element)
+static void pool_sketch_increment(POOL_QUERY_HASH *key)
 {
-	POOL_HASH_ELEMENT *elm;
+	unsigned char *rows;
+	uint32 h1, h2;
+	int partition;
+	int i;
 
-#ifdef POOL_HASH_DEBUG
-	pool_log("put_back_hash_element: hash_free->next:%p hash_free->next->next:%p",
-			 hash_free->next, hash_free->next->next);
-#endif
+	if (sketch == NULL)
+		return;
+
+	rows = pool_sketch_rows(key, &h1, &h2);
+	for (i=0;i<POOL_SKETCH_DEPTH;i++)
+	{
+		unsigned char *counter = &rows[((size_t)sketch_mask + 1) * i + ((h1 + i * h2) & sketch_mask)];
 
-	elm = hash_free->next;
-	hash_free->next = (POOL_HASH_ELEMENT *)element;
-	element->next = elm;
+		if (*counter < POOL_SKETCH_MAX)
+			(*counter)++;
+	}
+
+	partition = query_hash_partition(key);
+	if (__sync_add_and_fetch(&cache_partitions[partition].sketch_samples, 1) ==
+		POOL_SKETCH_SAMPLE_FACTOR * hash_header->max_entries)
+	{
+		size_t n = ((size_t)sketch_mask + 1) * POOL_SKETCH_DEPTH;
+		size_t j;
+
+		cache_partitions[partition].sketch_samples = 0;
+		for (j=0;j<n;j++)
+			rows[j] >>= 1;
+	}
 }
 
 /*
- * Return true if there's a free hash element.
+ * Estimate number of accesses to the query hash.
  */
-static bool is_free_hash_element(void)
+static int pool_sketch_estimate(POOL_QUERY_HASH *key)
 {
-	return hash_free->next != NULL;
+	unsigned char *rows;
+	uint32 h1, h2;
+	int min = POOL_SKETCH_MAX;
+	int i;
+
+	if (sketch == NULL)
+		return 0;
+
+	rows = pool_sketch_rows(key, &h1, &h2);
+	for (i=0;i<POOL_SKETCH_DEPTH;i++)
+	{
+		int count = rows[((size_t)sketch_mask + 1) * i + ((h1 + i * h2) & sketch_mask)];
+
+		if (count < min)
+			min = count;
+	}
+	return min;
 }
 
 /*
@@ -3742,7 +5725,6 @@ static bool is_free_hash_element(void)
 POOL_SHMEM_STATS *pool_get_shmem_storage_stats(void)
 {
 	static POOL_SHMEM_STATS mystats;
-	POOL_HASH_ELEMENT *element;
 	int nblocks;
 	int i;
 
@@ -3756,23 +5738,34 @@ POOL_SHMEM_STATS *pool_get_shmem_storage_stats(void)
 	 */
 	mystats.cache_stats.num_selects = stats->num_selects;
 	mystats.cache_stats.num_cache_hits = stats->num_cache_hits;
+	mystats.cache_stats.num_evicted_items = stats->num_evicted_items;
+	mystats.cache_stats.num_reused_blocks = stats->num_reused_blocks;
+	mystats.cache_stats.num_rejected_items = stats->num_rejected_items;
+	mystats.cache_stats.num_compacted_blocks = stats->num_compacted_blocks;
+	mystats.cache_stats.num_compressed_items = stats->num_compressed_items;
+	mystats.cache_stats.compress_raw_bytes = stats->compress_raw_bytes;
+	mystats.cache_stats.compress_stored_bytes = stats->compress_stored_bytes;
+	mystats.cache_stats.compress_usec = stats->compress_usec;
+	mystats.cache_stats.decompress_usec = stats->decompress_usec;
+	mystats.cache_stats.num_coalesced_misses = stats->num_coalesced_misses;
+	mystats.cache_stats.num_coalesce_timeouts = stats->num_coalesce_timeouts;
+	mystats.cache_stats.num_stale_hits = stats->num_stale_hits;
+	mystats.cache_stats.num_stale_refreshes = stats->num_stale_refreshes;
+
+	/* oid map is used by memcached too. Counters are read without lock */
+	mystats.num_oidmap_entries = oid_map->num_entries;
+	mystats.used_oidmap_entries = oid_map->used_entries;
+	mystats.num_oidmap_overflows = oid_map->num_overflows;
 
 	if (strcmp(pool_config-> memqcache_method, "shmem"))
 		return &mystats;
 
 	/* number of total hash entries */
-	mystats.num_hash_entries = hash_header->nhash;
+	mystats.num_hash_entries = hash_header->max_entries * memqcache_num_partitions;
 
 	/* number of used hash entries */
-	for (i=0;i<hash_header->nhash;i++)
-	{
-		element = hash_header->elements[i].element;
-		while (element)
-		{
-			mystats.used_hash_entries++;
-			element = element->next;
-		}
-	}
+	for (i=0;i<memqcache_num_partitions;i++)
+		mystats.used_hash_entries += cache_partitions[i].num_entries;
 
 	nblocks = pool_get_memqcache_blocks();
 
@@ -32,7 +32,7 @@
 #define NO_QUERY_CACHE "/*NO QUERY CACHE*/"
 #define NO_QUERY_CACHE_COMMENT_SZ (sizeof(NO_QUERY_CACHE)-1)
 
-#define POOL_MD5_HASHKEYLEN		32		/* MD5 hash key length */
+#define POOL_MD5_HASHKEYLEN		32		/* hash key length in hex digits */
 
 /*
  * On memory query cache on shmem is divided into fixed length "cache
@@ -68,6 +68,43 @@ typedef struct {
 	char query_hash[POOL_MD5_HASHKEYLEN];
 } POOL_QUERY_HASH;
 
+/*
+ * Cached data is a series of backend messages. If it is compressed
+ * (memqcache_compress_threshold), it starts with
+ * POOL_CACHE_COMPRESSED, which is not a message kind, followed by the
+ * uncompressed length (int32) and the messages compressed by LZ4.
+ */
+#define POOL_CACHE_COMPRESSED	'\0'
+#define POOL_CACHE_COMPRESSED_HEADER_SIZE	(1 + sizeof(int32))
+
+/*
+ * A child which missed the cache and is running the query
+ * (memqcache_miss_wait_timeout). Other children missing the same
+ * query wait for it to cache the result instead of running the query
+ * too. Indexed by process table id.
+ */
+typedef struct {
+	volatile unsigned int generation;	/* odd while running the query */
+	POOL_QUERY_HASH query_hash;	/* query being run */
+	struct timeval start;	/* when the query started */
+} POOL_CACHE_FLIGHT;
+
+#define POOL_CACHE_FLIGHT_POLL_USEC	1000	/* interval to check the running query */
+
+/*
+ * A query result is cached for the combination of user, database and
+ * query string. They are hashed into POOL_QUERY_HASH to find the
+ * cache, and stored with the cached data so that a hash collision
+ * cannot return the result of another query.
+ */
+#define POOL_QUERY_KEY_PARTS 3
+
+typedef struct {
+	const char *parts[POOL_QUERY_KEY_PARTS];	/* user, database and query */
+	size_t lens[POOL_QUERY_KEY_PARTS];	/* length of each part including '\0' */
+	size_t length;				/* total length of the key */
+} POOL_QUERY_KEY;
+
 #define POOL_ITEM_USED	0x0001		/* is this item used? */
 #define POOL_ITEM_HAS_NEXT	0x0002		/* is this item has "next" item? */
 #define POOL_ITEM_DELETED	0x0004		/* is this item deleted? */
@@ -79,6 +116,13 @@ typedef struct {
 	unsigned char flags;		/* flags. see above */
 } POOL_CACHE_ITEM_POINTER;
 
+/*
+ * Number of hits of an item since the clock hand passed. Kept in an
+ * array apart from the cache blocks (see item_refcount()) and
+ * saturates at this.
+ */
+#define POOL_ITEM_MAX_REFCOUNT 3
+
 /*
  * Each block holds several "cache item", which consists of variable
  * length of Data(header plus RowDescription packet and DataRow
@@ -97,6 +141,7 @@ typedef struct {
  */
 typedef struct {
 	unsigned int total_length;	/* total length in bytes including myself */
+	unsigned int key_length;	/* length of query key following the header */
 	time_t timestamp;	/* cache creation time */
 } POOL_CACHE_ITEM_HEADER;
 
@@ -120,22 +165,22 @@ extern void memcached_disconnect(void);
 extern void memqcache_register(char kind, POOL_CONNECTION *frontend, char *data, int data_len);
 
 /*
- * Cache key
+ * Internal buffer structure. Data is kept in a list of chunks so that
+ * adding data never moves the data already in the buffer.
  */
-typedef union
+typedef struct POOL_BUFFER_CHUNK
 {
-	POOL_CACHEID		cacheid;		/* cache key (shmem configuration) */
-	char hashkey[POOL_MD5_HASHKEYLEN];	/* cache key (memcached configuration) */
-} POOL_CACHEKEY;
+	struct POOL_BUFFER_CHUNK *next;
+	size_t size;		/* allocated size of data */
+	size_t len;		/* used length of data */
+	char data[1];	/* VARIABLE LENGTH ARRAY */
+} POOL_BUFFER_CHUNK;
 
-/*
- * Internal buffer structure
- */
 typedef struct
 {
-	size_t bufsize;		/* buffer size */
-	size_t buflen;		/* used length */
-	char *buf;	/* buffer */
+	size_t buflen;		/* total used length */
+	POOL_BUFFER_CHUNK *head;	/* first chunk */
+	POOL_BUFFER_CHUNK *tail;	/* last chunk. data is added here */
 } POOL_INTERNAL_BUFFER;
 
 /*
@@ -145,12 +190,25 @@ typedef struct
 {
 	bool is_exceeded;		/* true if data size exceeds memqcache_maxcache */
 	bool is_discarded;	/* true if this cache entry is discarded */
+	bool is_suspended;	/* true if the portal was suspended by Execute with row limit */
+	int num_rows;		/* number of DataRows */
 	char *query;		/* SELECT query */
 	POOL_INTERNAL_BUFFER *buffer;
 	int num_oids;
 	POOL_INTERNAL_BUFFER *oids;
 } POOL_TEMP_QUERY_CACHE;
 
+/*
+ * Query cache being sent to a portal suspended by Execute with row
+ * limit. The rest is sent by the following Executes.
+ */
+typedef struct
+{
+	char *data;		/* uncompressed cache data. NULL if none */
+	size_t len;
+	size_t pos;		/* offset of the next message to send */
+} POOL_CACHE_REPLAY;
+
 /*
  * Temporary query cache buffer array
  */
@@ -170,6 +228,19 @@ typedef struct
 	time_t		start_time;		/* start time when the statistics begins */
 	long long int num_selects;	/* number of successful SELECTs */
 	long long int num_cache_hits;		/* number of SELECTs extracted from cache */
+	long long int num_evicted_items;	/* number of caches evicted to make room */
+	long long int num_reused_blocks;	/* number of blocks reused by "block" policy */
+	long long int num_rejected_items;	/* number of caches not admitted by "tinylfu" policy */
+	long long int num_compacted_blocks;	/* number of blocks packed by the worker child */
+	long long int num_compressed_items;	/* number of caches stored compressed */
+	long long int compress_raw_bytes;	/* size of compressed caches before compression */
+	long long int compress_stored_bytes;	/* size of compressed caches after compression */
+	long long int compress_usec;	/* time spent for compression */
+	long long int decompress_usec;	/* time spent for decompression */
+	long long int num_coalesced_misses;	/* number of misses served by the result another child cached */
+	long long int num_coalesce_timeouts;	/* number of misses which gave up waiting for another child */
+	long long int num_stale_hits;	/* number of hits on caches in memqcache_expire_grace */
+	long long int num_stale_refreshes;	/* number of stale caches refreshed by running the query */
 } POOL_QUERY_CACHE_STATS;
 
 /*
@@ -183,6 +254,9 @@ typedef struct
 	long used_cache_entries_size;	/* total size of used cache entries */
 	long free_cache_entries_size;	/* total size of free(usable) cache entries */
 	long fragment_cache_entries_size;	/* total size of fragment(unusable) cache entries */
+	int num_oidmap_entries;		/* number of total oid map entries */
+	int used_oidmap_entries;	/* number of used oid map entries */
+	long long int num_oidmap_overflows;	/* number of tables invalidated to make room */
 	POOL_QUERY_CACHE_STATS cache_stats;
 } POOL_SHMEM_STATS;
 
@@ -191,56 +265,188 @@ typedef struct
  *--------------------------------------------------------------------------------
  */
 
-/* Hash element */
-typedef struct POOL_HASH_ELEMENT
-{
-	struct POOL_HASH_ELEMENT *next;		/* link to next entry */
-	POOL_QUERY_HASH		hashkey;		/* MD5 hash key */
-	POOL_CACHEID		cacheid;		/* logical location of this cache element */
-} POOL_HASH_ELEMENT;
+/*
+ * The hash table is an open addressing table of buckets. A bucket
+ * fills a cache line and holds a one byte tag and a cache id per
+ * slot. The tag is made from bits of the query hash not used to
+ * choose the bucket, and the full query hash is compared (it is kept
+ * in the item pointer) only when the tag matches.
+ */
+#define POOL_HASH_BUCKET_SLOTS 7
 
-typedef uint32 POOL_HASH_KEY;
+#define POOL_HASH_TAG_EMPTY		0	/* slot has never been used */
+#define POOL_HASH_TAG_DELETED	1	/* slot was used. probing goes on */
+#define POOL_HASH_TAG_MIN		2	/* smallest tag of used slots */
 
-/* Hash header element */
 typedef struct
 {
-	POOL_HASH_KEY hashkey;		/* hash key */
-	POOL_HASH_ELEMENT *element;	/* hash element */
-} POOL_HEADER_ELEMENT;
+	unsigned char tags[POOL_HASH_BUCKET_SLOTS + 1];	/* the last one is padding */
+	POOL_CACHEID cacheids[POOL_HASH_BUCKET_SLOTS];	/* logical location of caches */
+} POOL_HASH_BUCKET;
 
-/* Hash header */
+/*
+ * Hash header. Buckets are divided into regions of the same size,
+ * one per partition, and probing wraps around within the region.
+ */
 typedef struct
 {
-	long nhash;			/* number of hash keys (power of 2) */
-	uint32 mask;		/* mask for hash function */
-	POOL_HEADER_ELEMENT elements[1];	/* actual hash elements follows */
+	long nhash;			/* number of buckets */
+	uint32 mask;		/* mask for bucket number in a region (power of 2 - 1) */
+	int max_entries;	/* max number of entries in a partition */
 } POOL_HASH_HEADER;
 
+/*
+ * Partition of the shmem cache. A query hash belongs to the partition
+ * selected by the low bits of its hash key, and block i belongs to
+ * partition i % number of partitions. Everything belonging to a
+ * partition is protected by SHM_CACHE_PARTITION_SEM(partition).
+ *
+ * "version" is a sequence counter for lock-free readers. It is
+ * incremented when the partition lock is acquired and again before
+ * it is released, so it is odd while the partition may be modified.
+ */
+typedef struct
+{
+	int num_entries;			/* number of hash entries of this partition */
+	int num_deleted;			/* number of deleted hash slots in the region */
+	POOL_CACHE_BLOCKID clock_hand;	/* next victim block */
+	POOL_CACHE_ITEMID clock_item;	/* next victim item in clock_hand block */
+	volatile int sketch_samples;	/* number of accesses counted in the sketch */
+	volatile unsigned int version;	/* sequence counter. see above */
+} POOL_CACHE_PARTITION;
+
+/*
+ * Header of memqcache_persistent_file, which holds the cache blocks,
+ * FSMM, partitions, hash table, sketch and oid map so that the shmem
+ * cache survives restarts. Each of them starts at a page boundary
+ * after the header.
+ *
+ * The contents are restored only if the magic, version, size and
+ * fingerprint of the configuration match, and the previous pgpool-II
+ * shut down cleanly. "generation" is incremented at every startup and
+ * copied to "shutdown_generation" at clean shutdown, so they differ
+ * after a crash.
+ */
+#define POOL_PERSISTENT_CACHE_MAGIC		"PGPOOLQC"
+#define POOL_PERSISTENT_CACHE_VERSION	1
+#define POOL_PERSISTENT_CACHE_ALIGN(size)	(((size) + 4095) & ~((size_t)4095))
+
+typedef struct
+{
+	char magic[8];				/* POOL_PERSISTENT_CACHE_MAGIC */
+	int version;				/* POOL_PERSISTENT_CACHE_VERSION */
+	size_t size;				/* size of the file */
+	char fingerprint[32+1];		/* murmur3 hash of the configuration */
+	unsigned int generation;	/* incremented at startup */
+	unsigned int shutdown_generation;	/* generation at clean shutdown */
+} POOL_PERSISTENT_CACHE_HEADER;
+
+/*
+ * Eviction policies of the shmem cache (memqcache_eviction_policy).
+ */
+#define POOL_EVICT_BLOCK	0	/* reuse the whole victim block */
+#define POOL_EVICT_CLOCK	1	/* evict items not hit since the clock hand passed */
+#define POOL_EVICT_TINYLFU	2	/* clock plus access frequency based admission */
+
+/*
+ * Frequency sketch of the tinylfu policy: a count-min sketch of
+ * POOL_SKETCH_DEPTH rows of byte counters per partition.
+ */
+#define POOL_SKETCH_DEPTH	4
+#define POOL_SKETCH_MAX		15	/* counters saturate at this */
+#define POOL_SKETCH_SAMPLE_FACTOR 10	/* counters are halved every (this * max entries) accesses */
+
+/*
+ * Online compaction of the shmem cache. A block is packed if deleted
+ * items take 1/POOL_COMPACTION_FRACTION of it or more. The partition
+ * lock is released after every POOL_COMPACTION_BATCH blocks.
+ */
+#define POOL_COMPACTION_FRACTION	8
+#define POOL_COMPACTION_BATCH	16
+
+/*
+ * Number of optimistic read attempts before a reader falls back to
+ * taking the partition lock.
+ */
+#define POOL_CACHE_READ_RETRIES 8
+
+/* Full memory barrier between lock-free readers and writers */
+#define pool_memory_barrier()	__sync_synchronize()
+
+/*--------------------------------------------------------------------------------
+ * Table oid map on shared memory
+ *--------------------------------------------------------------------------------
+ */
+
+#define POOL_OID_MAP_NONE (-1)	/* end of list */
+
+/* Oid map entry: a cache entry which uses a table */
+typedef struct
+{
+	int next;					/* next entry of the table or free list */
+	POOL_QUERY_HASH query_hash;	/* key of the cache entry */
+} POOL_OID_MAP_ENTRY;
+
+/* Oid map table: a table used by cache entries */
+typedef struct
+{
+	int dboid;					/* database oid */
+	int table_oid;				/* table oid. 0 if unused */
+	int next;					/* next table in hash bucket or free list */
+	int head;					/* first entry of this table */
+	int num_entries;			/* number of entries of this table */
+} POOL_OID_MAP_TABLE;
+
+/*
+ * Oid map header. Hash buckets, tables and entries follow in this
+ * order. Protected by OID_MAP_SEM.
+ */
+typedef struct
+{
+	int num_buckets;			/* number of hash buckets (power of 2) */
+	int num_tables;				/* number of tables */
+	int num_entries;			/* number of entries */
+	int free_table;				/* free list of tables */
+	int free_entry;				/* free list of entries */
+	int used_entries;			/* number of used entries */
+	int victim;					/* next table to be examined on overflow */
+	long long int num_overflows;	/* number of tables invalidated to make room */
+} POOL_OID_MAP_HEADER;
+
 extern int pool_hash_init(int nelements);
 extern POOL_CACHEID *pool_hash_search(POOL_QUERY_HASH *key);
-extern int pool_hash_delete(POOL_QUERY_HASH *key);
+extern int pool_hash_delete(POOL_QUERY_HASH *key, POOL_CACHEID *cacheid);
 extern uint32 hash_any(unsigned char *k, int keylen);
 
 extern POOL_STATUS pool_fetch_from_memory_cache(POOL_CONNECTION *frontend,
 												POOL_CONNECTION_POOL *backend,
 												char *contents, bool *foundp);
+extern POOL_STATUS pool_fetch_portal_from_memory_cache(POOL_CONNECTION *frontend,
+													   POOL_CONNECTION_POOL *backend,
+													   char *contents, POOL_CACHE_REPLAY *replay,
+													   int max_rows, bool *foundp);
 
 extern bool pool_is_likely_select(char *query);
 extern bool pool_is_table_in_black_list(const char *table_name);
 extern bool pool_is_table_in_white_list(const char *table_name);
 extern bool pool_is_allow_to_cache(Node *node, char *query);
+extern char *pool_query_cache_key_text(char *query, Node *node);
 extern int pool_extract_table_oids(Node *node, int **oidsp);
 extern void pool_add_dml_table_oid(int oid);
+extern size_t pool_oid_map_size(void);
+extern int pool_init_oid_maps(void);
 extern void pool_discard_oid_maps(void);
+extern void pool_flush_memcached(void);
 extern int pool_get_database_oid_from_dbname(char *dbname);
-extern void pool_discard_oid_maps_by_db(int dboid);
 extern bool pool_is_shmem_cache(void);
 extern size_t pool_shared_memory_cache_size(void);
+extern int pool_init_persistent_cache(void);
 extern int pool_init_memory_cache(size_t size);
 extern void pool_clear_memory_cache(void);
 extern size_t pool_shared_memory_fsmm_size(void);
 extern int pool_init_fsmm(size_t size);
-extern void pool_allocate_fsmm_clock_hand(void);
+extern void pool_init_cache_partitions(void);
+extern int pool_init_cache_sketch(void);
 
 extern POOL_QUERY_CACHE_ARRAY *pool_create_query_cache_array(void);
 extern void pool_discard_query_cache_array(POOL_QUERY_CACHE_ARRAY *cache_array);
@@ -262,7 +468,13 @@ extern POOL_TEMP_QUERY_CACHE *pool_get_current_cache(void);
 extern POOL_TEMP_QUERY_CACHE *pool_get_current_cache(void);
 extern void pool_discard_temp_query_cache(POOL_TEMP_QUERY_CACHE *temp_cache);
 
+extern int pool_compact_shmem_cache(void);
+extern int pool_init_cache_flights(void);
+extern void pool_end_cache_flight(void);
+
 extern void pool_shmem_lock(void);
 extern void pool_shmem_unlock(void);
+extern void pool_shmem_lock_partition(int partition);
+extern void pool_shmem_unlock_partition(int partition);
 
 #endif /* POOL_MEMQCACHE_H */
@@ -101,7 +101,7 @@ void pool_incremnet_local_session_id(void)
 int pool_coninfo_size(void)
 {
 	int size;
-	size = pool_config->num_init_children *
+	size = pool_config->max_children *
 		pool_config->max_pool *
 		MAX_NUM_BACKENDS *
 		sizeof(ConnectionInfo);
@@ -115,7 +115,7 @@ int pool_coninfo_size(void)
 int pool_coninfo_num(void)
 {
 	int nelm;
-	nelm = pool_config->num_init_children *
+	nelm = pool_config->max_children *
 		pool_config->max_pool *
 		MAX_NUM_BACKENDS;
 
@@ -128,7 +128,7 @@ int pool_coninfo_num(void)
  */
 ConnectionInfo *pool_coninfo(int child, int connection_pool, int backend)
 {
-	if (child < 0 || child >= pool_config->num_init_children)
+	if (child < 0 || child >= pool_config->max_children)
 	{
 		pool_error("pool_coninfo: invalid child number: %d", child);
 		return NULL;
@@ -160,7 +160,7 @@ ConnectionInfo *pool_coninfo_pid(int pid, int connection_pool, int backend)
 	int child = -1;
 	int		i;
 
-	for (i = 0; i < pool_config->num_init_children; i++)
+	for (i = 0; i < pool_config->max_children; i++)
 	{
 		if (process_info[i].pid == pid)
 		{
@@ -175,7 +175,7 @@ ConnectionInfo *pool_coninfo_pid(int pid, int connection_pool, int backend)
 		return NULL;
 	}
 
-	if (child < 0 || child >= pool_config->num_init_children)
+	if (child < 0 || child >= pool_config->max_children)
 	{
 		pool_error("pool_coninfo_pid: invalid child number: %d", child);
 		return NULL;
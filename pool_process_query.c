@@ -80,6 +80,8 @@ static bool has_lock_target(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *bac
 static POOL_STATUS insert_oid_into_insert_lock(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend, char* table);
 static POOL_STATUS read_packets_and_process(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend, int reset_request, int *state, short *num_fields, bool *cont);
 static bool is_all_slaves_command_complete(unsigned char *kind_list, int num_backends, int master);
+static bool can_splice_data_rows(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
+static POOL_STATUS SpliceDataRows(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
 
 /* timeout sec for pool_check_fd */
 static int timeoutsec;
@@ -988,7 +990,8 @@ void pool_send_frontend_exits(POOL_CONNECTION_POOL *backend)
 		 * send a terminate message to backend if there's an existing
 		 * connection
 		 */
-		if (VALID_BACKEND(i) && CONNECTION_SLOT(backend, i))
+		if (VALID_BACKEND(i) && CONNECTION_SLOT(backend, i) &&
+			CONNECTION(backend, i)->fd >= 0)
 		{
 			pool_write(CONNECTION(backend, i), "X", 1);
 
@@ -1090,6 +1093,9 @@ POOL_STATUS SimpleForwardToFrontend(char kind, POOL_CONNECTION *frontend,
 	}
 #endif
 
+	if (kind == 'D' && can_splice_data_rows(frontend, backend))
+		return SpliceDataRows(frontend, backend);
+
 	status = pool_read(MASTER(backend), &len, sizeof(len));
 	if (status < 0)
 	{
@@ -1192,6 +1198,106 @@ POOL_STATUS SimpleForwardToFrontend(char kind, POOL_CONNECTION *frontend,
 	return POOL_CONTINUE;
 }
 
+/*
+ * Return true if DataRow messages can be moved from the backend to
+ * the frontend without looking into them.  Only one backend must be
+ * involved and nobody must need the contents of rows.
+ */
+static bool can_splice_data_rows(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
+{
+	int i;
+
+	if (!pool_config->use_splice || MAJOR(backend) != PROTO_MAJOR_V3 || PARALLEL_MODE)
+		return false;
+
+	if (!pool_can_splice(MASTER(backend), frontend))
+		return false;
+
+	/* query cache needs the rows */
+	if (pool_config->enable_query_cache && SYSDB_STATUS == CON_UP)
+		return false;
+
+	if (pool_config->memory_cache_enabled && pool_is_cache_safe() && !pool_is_cache_exceeded())
+		return false;
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (VALID_BACKEND(i) && !IS_MASTER_NODE_ID(i))
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Forward a DataRow message whose kind has already been read, and
+ * following DataRow messages which have already arrived, using
+ * splice(2).  The headers of the following messages are inspected
+ * with pool_peek() to find out how many bytes belong to the run of
+ * DataRows.
+ */
+static POOL_STATUS SpliceDataRows(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
+{
+	POOL_CONNECTION *cp = MASTER(backend);
+	char kind = 'D';
+	char buf[8192];
+	int len;
+	int status;
+
+	status = pool_read(cp, &len, sizeof(len));
+	if (status < 0)
+	{
+		pool_error("SpliceDataRows: error while reading message length");
+		return POOL_END;
+	}
+
+	pool_write(frontend, &kind, 1);
+	pool_write(frontend, &len, sizeof(len));
+	len = ntohl(len) - 4;
+
+	if (pool_splice(cp, frontend, len) < 0)
+	{
+		pool_error("SpliceDataRows: pool_splice failed");
+		return POOL_END;
+	}
+
+	/*
+	 * Move following DataRows as a whole.  Anything else is left to
+	 * the caller.
+	 */
+	for (;;)
+	{
+		int n, po, total;
+
+		n = pool_peek(cp, buf, sizeof(buf));
+		if (n < 5)
+			break;
+
+		po = 0;
+		while (po + 5 <= n && buf[po] == 'D')
+		{
+			memcpy(&len, buf + po + 1, sizeof(len));
+			len = ntohl(len);
+			if (len < 4)
+				break;		/* broken message. let the caller complain */
+			po += 1 + len;
+		}
+		total = po;
+
+		if (total == 0)
+			break;
+
+		pool_debug("SpliceDataRows: splicing %d bytes of DataRows", total);
+
+		if (pool_splice(cp, frontend, total) < 0)
+		{
+			pool_error("SpliceDataRows: pool_splice failed");
+			return POOL_END;
+		}
+	}
+
+	return POOL_CONTINUE;
+}
+
 POOL_STATUS SimpleForwardToBackend(char kind, POOL_CONNECTION *frontend,
 								   POOL_CONNECTION_POOL *backend,
 								   int len, char *contents)
@@ -4816,6 +4922,20 @@ static POOL_STATUS read_packets_and_process(POOL_CONNECTION *frontend, POOL_CONN
 	int idle_count = 0;	/* for other than in recovery */
 	int idle_count_in_recovery = 0;	/* for in recovery */
 
+	/*
+	 * In transaction pooling mode, release backend connections while
+	 * waiting for the next transaction from frontend.
+	 */
+	if (!reset_request && pool_can_release_backend(backend))
+		pool_release_backend(backend);
+
+	/*
+	 * If the child serves multiple sessions, let do_child() park this
+	 * session while the frontend is idle.
+	 */
+	if (!reset_request && pool_can_park_session(backend))
+		return POOL_IDLE;
+
 SELECT_RETRY:
 	FD_ZERO(&readmask);
 	FD_ZERO(&writemask);
@@ -4845,7 +4965,7 @@ SELECT_RETRY:
 
 	for (i=0;i<NUM_BACKENDS;i++)
 	{
-		if (VALID_BACKEND(i))
+		if (VALID_BACKEND(i) && !pool_is_backend_released())
 		{
 			num_fds = Max(CONNECTION(backend, i)->fd + 1, num_fds);
 			FD_SET(CONNECTION(backend, i)->fd, &readmask);
@@ -4926,7 +5046,7 @@ SELECT_RETRY:
 
 	for (i = 0; i < NUM_BACKENDS; i++)
 	{
-		if (VALID_BACKEND(i))
+		if (VALID_BACKEND(i) && !pool_is_backend_released())
 		{
 			/*
 			 * make sure that connection slot exists
@@ -4999,12 +5119,39 @@ SELECT_RETRY:
 			return POOL_END;
 		else if (FD_ISSET(frontend->fd, &readmask))
 		{
+			/*
+			 * Frontend started a new transaction. Get backend
+			 * connections back unless it is going to terminate.
+			 */
+			if (pool_is_backend_released())
+			{
+				char kind;
+
+				if (pool_read(frontend, &kind, sizeof(kind)) < 0)
+					return POOL_END;
+				pool_unread(frontend, &kind, sizeof(kind));
+				if (kind == 'X')
+					return POOL_END;
+
+				if (pool_reacquire_backend(backend) < 0)
+				{
+					pool_send_error_message(frontend, MAJOR(backend),
+											"08006", "failed to reconnect to backend",
+											"","",  __FILE__, __LINE__);
+					return POOL_END_WITH_FRONTEND_ERROR;
+				}
+			}
+
 			status = ProcessFrontendResponse(frontend, backend);
 			if (status != POOL_CONTINUE)
 				return status;
 		}
 	}
 
+	/* backend connections are released while frontend is idle */
+	if (pool_is_backend_released())
+		goto SELECT_RETRY;
+
 	if (FD_ISSET(MASTER(backend)->fd, &exceptmask))
 		return POOL_ERROR;
 	else if (FD_ISSET(MASTER(backend)->fd, &readmask))
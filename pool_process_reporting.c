@@ -25,6 +25,8 @@
 #include "pool_stream.h"
 #include "pool_config.h"
 #include "pool_memqcache.h"
+#include "pool_manager.h"
+#include "pool_admission.h"
 #include "version.h"
 
 #include <stdlib.h>
@@ -232,6 +234,36 @@ POOL_REPORT_CONFIG* get_config(int *nrows)
 	strncpy(status[i].desc, "# of children initially pre-forked", POOLCONFIG_MAXDESCLEN);
 	i++;
 
+	strncpy(status[i].name, "max_children", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->max_children);
+	strncpy(status[i].desc, "max # of children", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "min_spare_children", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->min_spare_children);
+	strncpy(status[i].desc, "min # of idle children", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "max_spare_children", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->max_spare_children);
+	strncpy(status[i].desc, "max # of idle children", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "accept_method", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%s", pool_config->accept_method);
+	strncpy(status[i].desc, "how children wait for connection requests", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "admission_queue_length", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->admission_queue_length);
+	strncpy(status[i].desc, "max # of clients waiting for a child", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "admission_wait_timeout", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->admission_wait_timeout);
+	strncpy(status[i].desc, "max seconds a client waits in admission queue", POOLCONFIG_MAXDESCLEN);
+	i++;
+
 	strncpy(status[i].name, "max_pool", POOLCONFIG_MAXNAMELEN);
 	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->max_pool);
 	strncpy(status[i].desc, "max # of connection pool per child", POOLCONFIG_MAXDESCLEN);
@@ -333,6 +365,26 @@ POOL_REPORT_CONFIG* get_config(int *nrows)
 	strncpy(status[i].desc, "if true, cache connection pool", POOLCONFIG_MAXDESCLEN);
 	i++;
 
+	strncpy(status[i].name, "transaction_pooling", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->transaction_pooling);
+	strncpy(status[i].desc, "if true, release backend connections at the end of each transaction", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "max_sessions_per_child", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->max_sessions_per_child);
+	strncpy(status[i].desc, "max number of frontend sessions served by a child", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "shared_connection_pool", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->shared_connection_pool);
+	strncpy(status[i].desc, "if true, share idle backend connections among children", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "use_splice", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->use_splice);
+	strncpy(status[i].desc, "if true, forward DataRow messages with splice(2)", POOLCONFIG_MAXDESCLEN);
+	i++;
+
 	strncpy(status[i].name, "reset_query_list", POOLCONFIG_MAXNAMELEN);
 	*(status[i].value) = '\0';
 	for (j=0;j<pool_config->num_reset_queries;j++)
@@ -771,7 +823,7 @@ POOL_REPORT_CONFIG* get_config(int *nrows)
 
 	strncpy(status[i].name, "memqcache_memcached_host", POOLCONFIG_MAXNAMELEN);
 	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%s", pool_config->memqcache_memcached_host);
-	strncpy(status[i].desc, "Memcached host name. Mandatory if memqcache_method=memcached", POOLCONFIG_MAXDESCLEN);
+	strncpy(status[i].desc, "Memcached host[:port] list. Mandatory if memqcache_method=memcached", POOLCONFIG_MAXDESCLEN);
 	i++;
 
 	strncpy(status[i].name, "memqcache_memcached_port", POOLCONFIG_MAXNAMELEN);
@@ -789,6 +841,51 @@ POOL_REPORT_CONFIG* get_config(int *nrows)
 	strncpy(status[i].desc, "Total number of cache entries", POOLCONFIG_MAXDESCLEN);
 	i++;
 
+	strncpy(status[i].name, "memqcache_max_num_oidmap", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->memqcache_max_num_oidmap);
+	strncpy(status[i].desc, "Total number of table oid map entries", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "memqcache_partitions", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->memqcache_partitions);
+	strncpy(status[i].desc, "Number of lock partitions of the shmem cache", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "memqcache_eviction_policy", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%s", pool_config->memqcache_eviction_policy);
+	strncpy(status[i].desc, "Eviction policy of the shmem cache", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "memqcache_compaction_interval", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->memqcache_compaction_interval);
+	strncpy(status[i].desc, "Interval to pack fragmented cache blocks", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "memqcache_compress_threshold", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->memqcache_compress_threshold);
+	strncpy(status[i].desc, "Compress cached results of this size or larger", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "memqcache_miss_wait_timeout", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->memqcache_miss_wait_timeout);
+	strncpy(status[i].desc, "Wait for another child running the same query on cache miss", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "memqcache_expire_grace", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->memqcache_expire_grace);
+	strncpy(status[i].desc, "Keep serving an expired cache while one child refreshes it", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "memqcache_persistent_file", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%s", pool_config->memqcache_persistent_file);
+	strncpy(status[i].desc, "File to keep shmem query cache across restarts", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "memqcache_parse_tree_key", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->memqcache_parse_tree_key);
+	strncpy(status[i].desc, "Make query cache keys from the parse tree of SELECT", POOLCONFIG_MAXDESCLEN);
+	i++;
+
 	strncpy(status[i].name, "memqcache_expire", POOLCONFIG_MAXNAMELEN);
 	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->memqcache_expire);
 	strncpy(status[i].desc, "Memory cache entry life time specified in seconds. 60 by default", POOLCONFIG_MAXDESCLEN);
@@ -811,7 +908,7 @@ POOL_REPORT_CONFIG* get_config(int *nrows)
 
 	strncpy(status[i].name, "memqcache_cache_oiddir", POOLCONFIG_MAXNAMELEN);
 	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%s", pool_config->memqcache_oiddir);
-	strncpy(status[i].desc, "Tempory work directory to record table oids", POOLCONFIG_MAXDESCLEN);
+	strncpy(status[i].desc, "Not used. Table oids are recorded on shared memory", POOLCONFIG_MAXDESCLEN);
 	i++;
 
 	strncpy(status[i].name, "memqcache_stats_start_time", POOLCONFIG_MAXNAMELEN);
@@ -1168,12 +1265,17 @@ POOL_REPORT_POOLS* get_pools(int *nrows)
     int lines = 0;
 
     POOL_REPORT_POOLS* pools = malloc(
-		pool_config->num_init_children * pool_config->max_pool * NUM_BACKENDS * sizeof(POOL_REPORT_POOLS)
+		pool_config->max_children * pool_config->max_pool * NUM_BACKENDS * sizeof(POOL_REPORT_POOLS)
 		);
 
-	for (child = 0; child < pool_config->num_init_children; child++)
+	for (child = 0; child < pool_config->max_children; child++)
 	{
 		proc_id = process_info[child].pid;
+
+		/* skip slots not used by dynamic scaling of children */
+		if (proc_id == 0)
+			continue;
+
 		pi = pool_get_process_info(proc_id);
 
 		for (pool = 0; pool < pool_config->max_pool; pool++)
@@ -1361,39 +1463,46 @@ void pools_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
 POOL_REPORT_PROCESSES* get_processes(int *nrows)
 {
 	int child;
+	int n = 0;
     int pool;
     int poolBE;
     ProcessInfo *pi = NULL;
     int proc_id;
 
-    POOL_REPORT_PROCESSES* processes = malloc(pool_config->num_init_children * sizeof(POOL_REPORT_PROCESSES));
+    POOL_REPORT_PROCESSES* processes = malloc(pool_config->max_children * sizeof(POOL_REPORT_PROCESSES));
 
-	for (child = 0; child < pool_config->num_init_children; child++)
+	for (child = 0; child < pool_config->max_children; child++)
     {
 		proc_id = process_info[child].pid;
+
+		/* skip slots not used by dynamic scaling of children */
+		if (proc_id == 0)
+			continue;
+
 	    pi = pool_get_process_info(proc_id);
 
-        snprintf(processes[child].pool_pid, POOLCONFIG_MAXCOUNTLEN, "%d", proc_id);
-	    strftime(processes[child].start_time, POOLCONFIG_MAXDATELEN, "%Y-%m-%d %H:%M:%S", localtime(&pi->start_time));
-	    strncpy(processes[child].database, "", POOLCONFIG_MAXIDENTLEN);
-	    strncpy(processes[child].username, "", POOLCONFIG_MAXIDENTLEN);
-        strncpy(processes[child].create_time, "", POOLCONFIG_MAXDATELEN);
-        strncpy(processes[child].pool_counter, "", POOLCONFIG_MAXCOUNTLEN);
+        snprintf(processes[n].pool_pid, POOLCONFIG_MAXCOUNTLEN, "%d", proc_id);
+	    strftime(processes[n].start_time, POOLCONFIG_MAXDATELEN, "%Y-%m-%d %H:%M:%S", localtime(&pi->start_time));
+	    strncpy(processes[n].database, "", POOLCONFIG_MAXIDENTLEN);
+	    strncpy(processes[n].username, "", POOLCONFIG_MAXIDENTLEN);
+        strncpy(processes[n].create_time, "", POOLCONFIG_MAXDATELEN);
+        strncpy(processes[n].pool_counter, "", POOLCONFIG_MAXCOUNTLEN);
 
         for (pool = 0; pool < pool_config->max_pool; pool++)
         {
             poolBE = pool*MAX_NUM_BACKENDS;
             if (pi->connection_info[poolBE].connected && strlen(pi->connection_info[poolBE].database) > 0 && strlen(pi->connection_info[poolBE].user) > 0)
             {
-	            strncpy(processes[child].database, pi->connection_info[poolBE].database, POOLCONFIG_MAXIDENTLEN);
-	            strncpy(processes[child].username, pi->connection_info[poolBE].user, POOLCONFIG_MAXIDENTLEN);
-	            strftime(processes[child].create_time, POOLCONFIG_MAXDATELEN, "%Y-%m-%d %H:%M:%S", localtime(&pi->connection_info[poolBE].create_time));
-                snprintf(processes[child].pool_counter, POOLCONFIG_MAXCOUNTLEN, "%d", pi->connection_info[poolBE].counter);
+	            strncpy(processes[n].database, pi->connection_info[poolBE].database, POOLCONFIG_MAXIDENTLEN);
+	            strncpy(processes[n].username, pi->connection_info[poolBE].user, POOLCONFIG_MAXIDENTLEN);
+	            strftime(processes[n].create_time, POOLCONFIG_MAXDATELEN, "%Y-%m-%d %H:%M:%S", localtime(&pi->connection_info[poolBE].create_time));
+                snprintf(processes[n].pool_counter, POOLCONFIG_MAXCOUNTLEN, "%d", pi->connection_info[poolBE].counter);
             }
         }
+		n++;
     }
 
-	*nrows = child;
+	*nrows = n;
 
 	return processes;
 }
@@ -1565,14 +1674,14 @@ void version_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
  */
 void cache_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
 {
-	static char *field_names[] = {"num_cache_hits", "num_selects", "cache_hit_ratio", "num_hash_entries", "used_hash_entries", "num_cache_entries", "used_cache_entries_size", "free_cache_entries_size", "fragment_cache_entries_size"};
+	static char *field_names[] = {"num_cache_hits", "num_selects", "cache_hit_ratio", "num_hash_entries", "used_hash_entries", "num_cache_entries", "used_cache_entries_size", "free_cache_entries_size", "fragment_cache_entries_size", "num_oidmap_entries", "used_oidmap_entries", "num_oidmap_overflows", "eviction_policy", "num_evicted_items", "num_reused_blocks", "num_rejected_items", "num_compacted_blocks", "num_compressed_items", "compression_ratio", "compress_usec", "decompress_usec", "num_coalesced_misses", "num_coalesce_timeouts", "num_stale_hits", "num_stale_refreshes"};
 	short num_fields = sizeof(field_names)/sizeof(char *);
 	int i;
 	short s;
 	int len;
 	int size;
 	int hsize;
-	static unsigned char nullmap[2] = {0xff, 0xff};
+	static unsigned char nullmap[4] = {0xff, 0xff, 0xff, 0xff};
 	int nbytes = (num_fields + 7)/8;
 	volatile POOL_SHMEM_STATS *mystats;
 #ifdef HAVE_SIGPROCMASK
@@ -1627,6 +1736,30 @@ void cache_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
 	snprintf(strp[i++].string, POOL_CACHE_STATS_MAX_STRING_LEN+1, "%ld", mystats->used_cache_entries_size);
 	snprintf(strp[i++].string, POOL_CACHE_STATS_MAX_STRING_LEN+1, "%ld", mystats->free_cache_entries_size);
 	snprintf(strp[i++].string, POOL_CACHE_STATS_MAX_STRING_LEN+1, "%ld", mystats->fragment_cache_entries_size);
+	snprintf(strp[i++].string, POOL_CACHE_STATS_MAX_STRING_LEN+1, "%d", mystats->num_oidmap_entries);
+	snprintf(strp[i++].string, POOL_CACHE_STATS_MAX_STRING_LEN+1, "%d", mystats->used_oidmap_entries);
+	snprintf(strp[i++].string, POOL_CACHE_STATS_MAX_STRING_LEN+1, "%lld", mystats->num_oidmap_overflows);
+	snprintf(strp[i++].string, POOL_CACHE_STATS_MAX_STRING_LEN+1, "%s", pool_config->memqcache_eviction_policy);
+	snprintf(strp[i++].string, POOL_CACHE_STATS_MAX_STRING_LEN+1, "%lld", mystats->cache_stats.num_evicted_items);
+	snprintf(strp[i++].string, POOL_CACHE_STATS_MAX_STRING_LEN+1, "%lld", mystats->cache_stats.num_reused_blocks);
+	snprintf(strp[i++].string, POOL_CACHE_STATS_MAX_STRING_LEN+1, "%lld", mystats->cache_stats.num_rejected_items);
+	snprintf(strp[i++].string, POOL_CACHE_STATS_MAX_STRING_LEN+1, "%lld", mystats->cache_stats.num_compacted_blocks);
+	snprintf(strp[i++].string, POOL_CACHE_STATS_MAX_STRING_LEN+1, "%lld", mystats->cache_stats.num_compressed_items);
+	if (mystats->cache_stats.compress_stored_bytes == 0)
+	{
+		ratio = 0.0;
+	}
+	else
+	{
+		ratio = (double)mystats->cache_stats.compress_raw_bytes/mystats->cache_stats.compress_stored_bytes;
+	}
+	snprintf(strp[i++].string, POOL_CACHE_STATS_MAX_STRING_LEN+1, "%.2f", ratio);
+	snprintf(strp[i++].string, POOL_CACHE_STATS_MAX_STRING_LEN+1, "%lld", mystats->cache_stats.compress_usec);
+	snprintf(strp[i++].string, POOL_CACHE_STATS_MAX_STRING_LEN+1, "%lld", mystats->cache_stats.decompress_usec);
+	snprintf(strp[i++].string, POOL_CACHE_STATS_MAX_STRING_LEN+1, "%lld", mystats->cache_stats.num_coalesced_misses);
+	snprintf(strp[i++].string, POOL_CACHE_STATS_MAX_STRING_LEN+1, "%lld", mystats->cache_stats.num_coalesce_timeouts);
+	snprintf(strp[i++].string, POOL_CACHE_STATS_MAX_STRING_LEN+1, "%lld", mystats->cache_stats.num_stale_hits);
+	snprintf(strp[i++].string, POOL_CACHE_STATS_MAX_STRING_LEN+1, "%lld", mystats->cache_stats.num_stale_refreshes);
 
 	/*
 	 * Calculate total data length
@@ -1679,3 +1812,225 @@ void cache_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
 
 	free(strp);
 }
+
+/*
+ * Show statistics of the pool manager (shared_connection_pool)
+ */
+void pool_manager_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
+{
+	static char *field_names[] = {"num_idle_connections", "num_hits", "num_misses", "hit_ratio", "num_puts", "num_discards"};
+	short num_fields = sizeof(field_names)/sizeof(char *);
+	int i;
+	short s;
+	int len;
+	int size;
+	int hsize;
+	static unsigned char nullmap[2] = {0xff, 0xff};
+	int nbytes = (num_fields + 7)/8;
+	POOL_MANAGER_STATS mystats;
+	double ratio;
+
+#define POOL_MANAGER_STATS_MAX_STRING_LEN 32
+	struct {
+		int len;		/* length of string excluding null terminate */
+		char string[POOL_MANAGER_STATS_MAX_STRING_LEN+1];
+	} strp[6];
+
+	/* all zero if the pool manager is not running */
+	if (pool_manager_stats)
+		memcpy(&mystats, pool_manager_stats, sizeof(mystats));
+	else
+		memset(&mystats, 0, sizeof(mystats));
+
+	/*
+	 * Convert to string
+	 */
+	i = 0;
+	snprintf(strp[i++].string, POOL_MANAGER_STATS_MAX_STRING_LEN+1, "%d", mystats.num_idle_connections);
+	snprintf(strp[i++].string, POOL_MANAGER_STATS_MAX_STRING_LEN+1, "%lld", mystats.num_hits);
+	snprintf(strp[i++].string, POOL_MANAGER_STATS_MAX_STRING_LEN+1, "%lld", mystats.num_misses);
+	if ((mystats.num_hits + mystats.num_misses) == 0)
+	{
+		ratio = 0.0;
+	}
+	else
+	{
+		ratio = (double)mystats.num_hits/(mystats.num_hits + mystats.num_misses);
+	}
+	snprintf(strp[i++].string, POOL_MANAGER_STATS_MAX_STRING_LEN+1, "%.2f", ratio);
+	snprintf(strp[i++].string, POOL_MANAGER_STATS_MAX_STRING_LEN+1, "%lld", mystats.num_puts);
+	snprintf(strp[i++].string, POOL_MANAGER_STATS_MAX_STRING_LEN+1, "%lld", mystats.num_discards);
+
+	/*
+	 * Calculate total data length
+	 */
+	len = 2;	/* number of fields (int16) */
+	for (i=0;i<num_fields;i++)
+	{
+		strp[i].len = strlen(strp[i].string);
+		len += 4 /* length of string (int32) */
+			+ strp[i].len;
+	}
+
+	/* Send row description */
+	send_row_description(frontend, backend, num_fields, field_names);
+
+	/* Send each field */
+	if (MAJOR(backend) == PROTO_MAJOR_V2)
+	{
+		pool_write(frontend, "D", 1);
+		pool_write(frontend, nullmap, nbytes);
+
+		for (i=0;i<num_fields;i++)
+		{
+			size = strp[i].len + 1;
+			hsize = htonl(size+4);
+			pool_write(frontend, &hsize, sizeof(hsize));
+			pool_write(frontend, strp[i].string, size);
+		}
+	}
+	else
+	{
+		/* Kind */
+		pool_write(frontend, "D", 1);
+		/* Packet length */
+		len = htonl(len+sizeof(int32));
+		pool_write(frontend, &len, sizeof(len));
+		/* Number of fields */
+		s = htons(num_fields);
+		pool_write(frontend, &s, sizeof(s));
+
+		for (i=0;i<num_fields;i++)
+		{
+			hsize = htonl(strp[i].len);
+			pool_write(frontend, &hsize, sizeof(hsize));
+			pool_write(frontend, strp[i].string, strp[i].len);
+		}
+	}
+
+	send_complete_and_ready(frontend, backend, 1);
+}
+
+/*
+ * Send a data row consisting of strings
+ */
+static void send_string_row(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend,
+							short num_fields, char **values)
+{
+	static unsigned char nullmap[2] = {0xff, 0xff};
+	int nbytes = (num_fields + 7)/8;
+	int len;
+	int size;
+	int hsize;
+	short s;
+	int i;
+
+	if (MAJOR(backend) == PROTO_MAJOR_V2)
+	{
+		pool_write(frontend, "D", 1);
+		pool_write(frontend, nullmap, nbytes);
+
+		for (i=0;i<num_fields;i++)
+		{
+			size = strlen(values[i]) + 1;
+			hsize = htonl(size+4);
+			pool_write(frontend, &hsize, sizeof(hsize));
+			pool_write(frontend, values[i], size);
+		}
+	}
+	else
+	{
+		len = 2;	/* number of fields (int16) */
+		for (i=0;i<num_fields;i++)
+			len += 4 + strlen(values[i]);	/* int32 + data */
+
+		pool_write(frontend, "D", 1);
+		len = htonl(len+sizeof(int32));
+		pool_write(frontend, &len, sizeof(len));
+		s = htons(num_fields);
+		pool_write(frontend, &s, sizeof(s));
+
+		for (i=0;i<num_fields;i++)
+		{
+			hsize = htonl(strlen(values[i]));
+			pool_write(frontend, &hsize, sizeof(hsize));
+			pool_write(frontend, values[i], strlen(values[i]));
+		}
+	}
+}
+
+void pool_admission_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
+{
+	static char *field_names[] = {"queue_length", "peak_queue_length", "num_admitted",
+								  "num_timeouts", "num_rejected", "avg_wait_ms", "max_wait_ms"};
+	short num_fields = sizeof(field_names)/sizeof(char *);
+	POOL_ADMISSION_STATS mystats;
+	char strings[7][32];
+	char *values[7];
+	double avg;
+	int i;
+
+	/* all zero if the admission queue is not used */
+	if (pool_admission_stats)
+		memcpy(&mystats, pool_admission_stats, sizeof(mystats));
+	else
+		memset(&mystats, 0, sizeof(mystats));
+
+	if (mystats.num_admitted == 0)
+		avg = 0.0;
+	else
+		avg = (double)mystats.total_wait_usec / mystats.num_admitted / 1000;
+
+	i = 0;
+	snprintf(strings[i++], sizeof(strings[0]), "%d", mystats.queue_length);
+	snprintf(strings[i++], sizeof(strings[0]), "%d", mystats.peak_queue_length);
+	snprintf(strings[i++], sizeof(strings[0]), "%lld", mystats.num_admitted);
+	snprintf(strings[i++], sizeof(strings[0]), "%lld", mystats.num_timeouts);
+	snprintf(strings[i++], sizeof(strings[0]), "%lld", mystats.num_rejected);
+	snprintf(strings[i++], sizeof(strings[0]), "%.3f", avg);
+	snprintf(strings[i++], sizeof(strings[0]), "%.3f", mystats.max_wait_usec / 1000.0);
+
+	for (i=0;i<num_fields;i++)
+		values[i] = strings[i];
+
+	send_row_description(frontend, backend, num_fields, field_names);
+	send_string_row(frontend, backend, num_fields, values);
+	send_complete_and_ready(frontend, backend, 1);
+}
+
+/*
+ * Histogram of the time admitted clients waited in the admission queue
+ */
+void pool_admission_wait_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
+{
+	static char *field_names[] = {"wait_time", "num_clients"};
+	short num_fields = sizeof(field_names)/sizeof(char *);
+	long long int histogram[POOL_ADMISSION_WAIT_BUCKETS];
+	char wait_time[32];
+	char num_clients[32];
+	char *values[2];
+	int i;
+
+	if (pool_admission_stats)
+		memcpy(histogram, pool_admission_stats->wait_histogram, sizeof(histogram));
+	else
+		memset(histogram, 0, sizeof(histogram));
+
+	send_row_description(frontend, backend, num_fields, field_names);
+
+	values[0] = wait_time;
+	values[1] = num_clients;
+
+	for (i=0;i<POOL_ADMISSION_WAIT_BUCKETS;i++)
+	{
+		if (i < POOL_ADMISSION_WAIT_BUCKETS - 1)
+			snprintf(wait_time, sizeof(wait_time), "< %d ms", pool_admission_wait_bounds[i]);
+		else
+			snprintf(wait_time, sizeof(wait_time), ">= %d ms", pool_admission_wait_bounds[i-1]);
+		snprintf(num_clients, sizeof(num_clients), "%lld", histogram[i]);
+
+		send_string_row(frontend, backend, num_fields, values);
+	}
+
+	send_complete_and_ready(frontend, backend, POOL_ADMISSION_WAIT_BUCKETS);
+}
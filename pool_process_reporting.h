@@ -40,5 +40,8 @@ extern void processes_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL
 extern void nodes_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
 extern void version_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
 extern void cache_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
+extern void pool_manager_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
+extern void pool_admission_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
+extern void pool_admission_wait_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
 
 #endif
@@ -109,6 +109,9 @@ POOL_STATUS SimpleQuery(POOL_CONNECTION *frontend,
  	static char *sq_nodes = "pool_nodes";
  	static char *sq_version = "pool_version";
  	static char *sq_cache = "pool_cache";
+ 	static char *sq_manager = "pool_manager";
+ 	static char *sq_admission = "pool_admission";
+ 	static char *sq_admission_wait = "pool_admission_wait";
 	int commit;
 	List *parse_tree_list;
 	Node *node = NULL;
@@ -165,6 +168,7 @@ POOL_STATUS SimpleQuery(POOL_CONNECTION *frontend,
 	 * query cache. 
 	 */
 	if (pool_config->memory_cache_enabled && is_likely_select &&
+		!pool_config->memqcache_parse_tree_key &&
 		!pool_is_writing_transaction() &&
 		TSTATE(backend, MASTER_SLAVE ? PRIMARY_NODE_ID : REAL_MASTER_NODE_ID) != 'E')
 	{
@@ -264,6 +268,41 @@ POOL_STATUS SimpleQuery(POOL_CONNECTION *frontend,
 			}
 		}
 
+		/*
+		 * With memqcache_parse_tree_key, the cache key is made from the
+		 * parse tree. So the cache is looked up here instead of before
+		 * parsing.
+		 */
+		if (pool_config->memory_cache_enabled && is_likely_select &&
+			pool_config->memqcache_parse_tree_key &&
+			!query_context->is_parse_error &&
+			list_length(parse_tree_list) == 1 &&
+			!pool_is_writing_transaction() &&
+			TSTATE(backend, MASTER_SLAVE ? PRIMARY_NODE_ID : REAL_MASTER_NODE_ID) != 'E')
+		{
+			bool foundp;
+
+			query_context->cache_key_query = pool_query_cache_key_text(contents, node);
+			status = pool_fetch_from_memory_cache(frontend, backend, query_context->cache_key_query, &foundp);
+
+			if (status != POOL_CONTINUE || foundp)
+			{
+				pool_query_context_destroy(query_context);
+				pool_memory_context_switch_to(old_context);
+			}
+
+			if (status != POOL_CONTINUE)
+				return status;
+
+			if (foundp)
+			{
+				pool_ps_idle_display(backend);
+				pool_set_skip_reading_from_backends();
+				pool_stats_count_up_num_cache_hits();
+				return POOL_CONTINUE;
+			}
+		}
+
 		/*
 		 * Start query context
 		 */
@@ -289,6 +328,10 @@ POOL_STATUS SimpleQuery(POOL_CONNECTION *frontend,
 		if (parse_tree_list && list_length(parse_tree_list) > 1)
 		{
 			query_context->is_multi_statement = true;
+
+			/* the later statements may create session state too */
+			if (pool_config->transaction_pooling)
+				query_context->has_session_state = has_session_state_query(parse_tree_list);
 		}
 		else
 		{
@@ -356,6 +399,24 @@ POOL_STATUS SimpleQuery(POOL_CONNECTION *frontend,
                 pool_debug("cache reporting");
                 cache_reporting(frontend, backend);
             }
+			else if (!strcmp(sq_manager, vnode->name))
+            {
+				is_valid_show_command = true;
+                pool_debug("pool manager reporting");
+                pool_manager_reporting(frontend, backend);
+            }
+			else if (!strcmp(sq_admission, vnode->name))
+            {
+				is_valid_show_command = true;
+                pool_debug("admission queue reporting");
+                pool_admission_reporting(frontend, backend);
+            }
+			else if (!strcmp(sq_admission_wait, vnode->name))
+            {
+				is_valid_show_command = true;
+                pool_debug("admission queue wait time reporting");
+                pool_admission_wait_reporting(frontend, backend);
+            }
 
 			if (is_valid_show_command)
 			{
@@ -393,6 +454,10 @@ POOL_STATUS SimpleQuery(POOL_CONNECTION *frontend,
 			else
 			{
 				pool_unset_cache_safe();
+
+				/* Children waiting for the result need not wait any more */
+				if (pool_config->memory_cache_enabled)
+					pool_end_cache_flight();
 			}
 
 			/* If table is to be cached and the query is DML, save the table oid */
@@ -566,7 +631,7 @@ POOL_STATUS SimpleQuery(POOL_CONNECTION *frontend,
 			 * not need to wait for the master node's response, and
 			 * could execute the query concurrently.
 			 */
-			if (pool_config->num_init_children == 1)
+			if (pool_config->max_children == 1)
 			{
 				/* Send query to all DB nodes at once */
 				status = pool_send_and_wait(query_context, 0, 0);
@@ -655,6 +720,8 @@ POOL_STATUS Execute(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend,
 	POOL_SESSION_CONTEXT *session_context;
 	POOL_QUERY_CONTEXT *query_context;
 	POOL_SENT_MESSAGE *bind_msg;
+	int max_rows;
+	bool executed;
 
 	/* Get session context */
 	session_context = pool_get_session_context();
@@ -664,7 +731,10 @@ POOL_STATUS Execute(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend,
 		return POOL_END;
 	}
 
-	pool_debug("Execute: portal name <%s>", contents);
+	memcpy(&max_rows, contents + strlen(contents) + 1, sizeof(max_rows));
+	max_rows = ntohl(max_rows);
+
+	pool_debug("Execute: portal name <%s> max rows %d", contents, max_rows);
 
 	bind_msg = pool_get_sent_message('B', contents);
 	if (!bind_msg)
@@ -696,28 +766,59 @@ POOL_STATUS Execute(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend,
 
 	pool_debug("Execute: query string = <%s>", query);
 
+	/*
+	 * Send the rest of the portal suspended while sending the query
+	 * cache.
+	 */
+	if (bind_msg->cache_replay.data)
+	{
+		bool foundp;
+		POOL_STATUS status;
+
+		status = pool_fetch_portal_from_memory_cache(frontend, backend, query,
+													 &bind_msg->cache_replay, max_rows, &foundp);
+		if (status != POOL_CONTINUE)
+			return status;
+
+		pool_ps_idle_display(backend);
+		pool_set_skip_reading_from_backends();
+		pool_unset_query_in_progress();
+		return POOL_CONTINUE;
+	}
+
+	/*
+	 * The following Executes of a portal suspended by the backend go
+	 * to the backend. The rows are added to the temp cache.
+	 */
+	executed = bind_msg->is_executed;
+	bind_msg->is_executed = true;
+
 	/*
 	 * Fetch memory cache if possible
 	 */
-	if (pool_config->memory_cache_enabled && pool_is_likely_select(query) &&
+	if (pool_config->memory_cache_enabled && !executed && pool_is_likely_select(query) &&
 		!pool_is_writing_transaction() &&
 		(TSTATE(backend, MASTER_SLAVE ? PRIMARY_NODE_ID : REAL_MASTER_NODE_ID) != 'E'))
 	{
 		bool foundp;
 		POOL_STATUS status;
 		char *search_query = NULL;
+		char *key_query;
 		int len;
 		char *tmp;
 #define STR_ALLOC_SIZE 1024
 
-		len = strlen(query)+1;
+		/* The cache key may be made from the parse tree */
+		key_query = query_context->cache_key_query ? query_context->cache_key_query : query;
+
+		len = strlen(key_query)+1;
 		search_query = (char *)malloc(len);
 		if (search_query == NULL)
 		{
 			pool_error("Execute: malloc failed");
 			return POOL_END;
 		}
-		strcpy(search_query, query);
+		strcpy(search_query, key_query);
 
 		/*
 		 * Add bind message's info to query to search.
@@ -788,8 +889,16 @@ POOL_STATUS Execute(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend,
 			}
 		}
 
+		/*
+		 * Rows of a suspended portal which was not fetched to the end
+		 * are left in the temp cache. Do not cache this result with them.
+		 */
+		if (query_context->temp_cache && query_context->temp_cache->is_suspended)
+			query_context->temp_cache->is_exceeded = true;
+
 		/* If the query is SELECT from table to cache, try to fetch cached result. */
-		status = pool_fetch_from_memory_cache(frontend, backend, search_query, &foundp);
+		status = pool_fetch_portal_from_memory_cache(frontend, backend, search_query,
+													 &bind_msg->cache_replay, max_rows, &foundp);
 
 		if (status != POOL_CONTINUE)
 			return status;
@@ -1733,6 +1842,17 @@ POOL_STATUS ReadyForQuery(POOL_CONNECTION *frontend,
 
 			if (node)
 			{
+				/*
+				 * In transaction pooling mode, remember that the
+				 * backend connections cannot be released any more if
+				 * the query created state which lives beyond the
+				 * transaction.
+				 */
+				if (pool_config->transaction_pooling &&
+					(is_session_state_query(node) ||
+					 session_context->query_context->has_session_state))
+					pool_set_session_pinned();
+
 				/*
 				 * If the query was BEGIN/START TRANSACTION, clear the
 				 * history that we had a writing command in the transaction
@@ -1839,6 +1959,10 @@ POOL_STATUS ReadyForQuery(POOL_CONNECTION *frontend,
 					{
 						state = 'I';	/* XXX I don't think query cache works with PROTO2 protocol */
 					}
+					/* The cache key may be made from the parse tree */
+					if (pool_config->memqcache_parse_tree_key && session_context->query_context &&
+						session_context->query_context->cache_key_query)
+						query = session_context->query_context->cache_key_query;
 					pool_handle_query_cache(backend, query, node, state);
 				}
 			}
@@ -1865,6 +1989,10 @@ POOL_STATUS ReadyForQuery(POOL_CONNECTION *frontend,
 		pool_unset_query_in_progress();
 	}
 
+	/* Let children waiting for the result of the query fetch it from cache */
+	if (pool_config->memory_cache_enabled)
+		pool_end_cache_flight();
+
 	if (!pool_is_doing_extended_query_message())
 	{
 		if (!(node && IsA(node, PrepareStmt)))
@@ -2594,6 +2722,17 @@ POOL_STATUS ProcessFrontendResponse(POOL_CONNECTION *frontend,
 
 	pool_unset_doing_extended_query_message();
 
+	/*
+	 * Remember if extended query messages are waiting for Sync.
+	 * Backend connections cannot be released in transaction pooling
+	 * mode until Sync is sent.
+	 */
+	if (fkind == 'S' || fkind == 'Q')
+		pool_unset_sync_pending();
+	else if (fkind == 'P' || fkind == 'B' || fkind == 'D' ||
+			 fkind == 'E' || fkind == 'C')
+		pool_set_sync_pending();
+
 	/*
 	 * Allocate buffer and copy the packet contents.  Because inside
 	 * these protocol modules, pool_read2 maybe called and modify its
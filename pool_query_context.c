@@ -27,6 +27,7 @@
 #include "pool_query_context.h"
 #include "pool_select_walker.h"
 #include "parser/nodes.h"
+#include "parser/pg_class.h"
 
 #include <string.h>
 #include <netinet/in.h>
@@ -102,7 +103,11 @@ void pool_start_query(POOL_QUERY_CONTEXT *query_context, char *query, int len, N
 		query_context->is_cache_safe = false;
 		query_context->num_original_params = -1;
 		if (pool_config->memory_cache_enabled)
-			query_context->temp_cache = pool_create_temp_query_cache(query);
+		{
+			if (!query_context->cache_key_query)
+				query_context->cache_key_query = pool_query_cache_key_text(query_context->original_query, node);
+			query_context->temp_cache = pool_create_temp_query_cache(query_context->cache_key_query);
+		}
 		pool_set_query_in_progress();
 		session_context->query_context = query_context;
 	}
@@ -1500,6 +1505,81 @@ bool is_2pc_transaction_query(Node *node)
 	return false;
 }
 
+/*
+ * Return true if the query creates state which lives beyond the
+ * transaction, i.e. SET (other than SET LOCAL and SET TRANSACTION),
+ * LISTEN, PREPARE, LOAD, DECLARE ... WITH HOLD and creating temporary
+ * tables (including CREATE TABLE AS and SELECT INTO), sequences and
+ * views.
+ */
+bool is_session_state_query(Node *node)
+{
+	switch (nodeTag(node))
+	{
+		case T_VariableSetStmt:
+			{
+				VariableSetStmt *stmt = (VariableSetStmt *)node;
+
+				if (stmt->is_local)
+					return false;
+				if (stmt->kind == VAR_SET_MULTI && !strcmp(stmt->name, "TRANSACTION"))
+					return false;
+				return true;
+			}
+
+		case T_ListenStmt:
+		case T_PrepareStmt:
+		case T_LoadStmt:
+			return true;
+
+		case T_DeclareCursorStmt:
+			return (((DeclareCursorStmt *)node)->options & CURSOR_OPT_HOLD) != 0;
+
+		case T_CreateStmt:
+			return ((CreateStmt *)node)->relation->relpersistence == RELPERSISTENCE_TEMP;
+
+		case T_CreateTableAsStmt:
+			return ((CreateTableAsStmt *)node)->into->rel->relpersistence == RELPERSISTENCE_TEMP;
+
+		case T_CreateSeqStmt:
+			return ((CreateSeqStmt *)node)->sequence->relpersistence == RELPERSISTENCE_TEMP;
+
+		case T_ViewStmt:
+			return ((ViewStmt *)node)->view->relpersistence == RELPERSISTENCE_TEMP;
+
+		case T_SelectStmt:
+			{
+				SelectStmt *stmt = (SelectStmt *)node;
+
+				/* SELECT INTO of set operations is in the leftmost SELECT */
+				while (stmt->op != SETOP_NONE && stmt->larg)
+					stmt = stmt->larg;
+
+				return stmt->intoClause &&
+					stmt->intoClause->rel->relpersistence == RELPERSISTENCE_TEMP;
+			}
+
+		default:
+			return false;
+	}
+}
+
+/*
+ * Return true if any of the statements in parse_tree_list creates
+ * session state. See is_session_state_query().
+ */
+bool has_session_state_query(List *parse_tree_list)
+{
+	ListCell *cell;
+
+	foreach(cell, parse_tree_list)
+	{
+		if (is_session_state_query((Node *)lfirst(cell)))
+			return true;
+	}
+	return false;
+}
+
 /*
  * Set query state, if a current state is before it than the specified state.
  */
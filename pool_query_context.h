@@ -63,7 +63,10 @@ typedef struct {
 	bool is_cache_safe;	/* true if SELECT is safe to cache */
 	POOL_TEMP_QUERY_CACHE *temp_cache;	/* temporary cache */
 	bool is_multi_statement;	/* true if multi statement query */
+	bool has_session_state;	/* true if one of multi statements creates
+							 * session state. see is_session_state_query() */
 	int dboid;	/* DB oid which is used at DROP DATABASE */
+	char *cache_key_query;	/* text to make query cache key from. see pool_query_cache_key_text() */
 	char *query_w_hex;	/* original_query with bind message hex which used for committing cache of extended query */
 	bool is_parse_error;		/* if true, we could not parse the original
 								 * query and parsed node is actually a dummy query.
@@ -94,6 +97,8 @@ extern bool is_serializable(TransactionStmt *node);
 extern bool pool_need_to_treat_as_if_default_transaction(POOL_QUERY_CONTEXT *query_context);
 extern bool is_savepoint_query(Node *node);
 extern bool is_2pc_transaction_query(Node *node);
+extern bool is_session_state_query(Node *node);
+extern bool has_session_state_query(List *parse_tree_list);
 extern void pool_set_query_state(POOL_QUERY_CONTEXT *query_context, POOL_QUERY_STATE state);
 extern int statecmp(POOL_QUERY_STATE s1, POOL_QUERY_STATE s2);
 extern bool pool_is_cache_safe(void);
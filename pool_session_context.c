@@ -112,6 +112,10 @@ void pool_init_session_context(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *
 	 */
 	session_context->mismatch_ntuples = false;
 
+	/* Backend connections can be released in transaction pooling mode */
+	session_context->session_pinned = false;
+	session_context->sync_pending = false;
+
 	if (pool_config->memory_cache_enabled)
 	{
 		session_context->query_cache_array = pool_create_query_cache_array();
@@ -143,6 +147,50 @@ void pool_session_context_destroy(void)
 	session_context = NULL;
 }
 
+/*
+ * Detach the session context so that the process can serve another
+ * session.  The returned copy must be given back to
+ * pool_session_context_attach() when the session is resumed.
+ */
+POOL_SESSION_CONTEXT *pool_session_context_detach(void)
+{
+	POOL_SESSION_CONTEXT *context;
+
+	if (!session_context)
+	{
+		pool_error("pool_session_context_detach: session context is not initialized");
+		return NULL;
+	}
+
+	context = malloc(sizeof(*context));
+	if (context == NULL)
+	{
+		pool_error("pool_session_context_detach: malloc failed: %s", strerror(errno));
+		return NULL;
+	}
+	memcpy(context, session_context, sizeof(*context));
+
+	memset(&session_context_d, 0, sizeof(session_context_d));
+	session_context = NULL;
+
+	return context;
+}
+
+/*
+ * Make the session context detached by pool_session_context_detach()
+ * the current session context again.  backend is the connection pool
+ * the session is now using, which may differ from the one used when
+ * the session was detached.
+ */
+void pool_session_context_attach(POOL_SESSION_CONTEXT *context, POOL_CONNECTION_POOL *backend)
+{
+	session_context = &session_context_d;
+	memcpy(session_context, context, sizeof(*session_context));
+	free(context);
+
+	session_context->backend = backend;
+}
+
 /*
  * Return session context
  */
@@ -445,6 +493,9 @@ void pool_sent_message_destroy(POOL_SENT_MESSAGE *message)
 		if (message->name)
 			pool_memory_free(session_context->memory_context, message->name);
 
+		if (message->cache_replay.data)
+			free(message->cache_replay.data);
+
 		if (message->query_context)
 		{
 			if (session_context->query_context != message->query_context)
@@ -523,6 +574,10 @@ POOL_SENT_MESSAGE *pool_create_sent_message(char kind, int len, char *contents,
 	msg->num_tsparams = num_tsparams;
 	msg->name = pool_memory_strdup(session_context->memory_context, name);
 	msg->query_context = query_context;
+	msg->is_executed = false;
+	msg->cache_replay.data = NULL;
+	msg->cache_replay.len = 0;
+	msg->cache_replay.pos = 0;
 
 	return msg;
 }
@@ -830,6 +885,107 @@ bool pool_is_command_success(void)
 	return session_context->command_success;
 }
 
+/*
+ * The session has created state which lives beyond the transaction.
+ * Backend connections are not released in transaction pooling mode
+ * any more.
+ */
+void pool_set_session_pinned(void)
+{
+	if (!session_context)
+	{
+		pool_error("pool_set_session_pinned: session context is not initialized");
+		return;
+	}
+	pool_debug("pool_set_session_pinned: done");
+	session_context->session_pinned = true;
+}
+
+/*
+ * Does the session have state which lives beyond the transaction?
+ * Named prepared statements and portals are such state as well.
+ */
+bool pool_is_session_pinned(void)
+{
+	POOL_SENT_MESSAGE_LIST *msglist;
+	int i;
+
+	if (!session_context)
+	{
+		pool_error("pool_is_session_pinned: session context is not initialized");
+		return false;
+	}
+
+	if (session_context->session_pinned)
+		return true;
+
+	msglist = &session_context->message_list;
+
+	for (i = 0; i < msglist->size; i++)
+	{
+		if (*msglist->sent_messages[i]->name != '\0')
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Frontend has sent extended query messages not followed by Sync yet.
+ */
+void pool_set_sync_pending(void)
+{
+	if (!session_context)
+	{
+		pool_error("pool_set_sync_pending: session context is not initialized");
+		return;
+	}
+	session_context->sync_pending = true;
+}
+
+/*
+ * Extended query messages have been followed by Sync.
+ */
+void pool_unset_sync_pending(void)
+{
+	if (!session_context)
+	{
+		pool_error("pool_unset_sync_pending: session context is not initialized");
+		return;
+	}
+	session_context->sync_pending = false;
+}
+
+/*
+ * Are we waiting for Sync from frontend?
+ */
+bool pool_is_sync_pending(void)
+{
+	if (!session_context)
+	{
+		pool_error("pool_is_sync_pending: session context is not initialized");
+		return false;
+	}
+	return session_context->sync_pending;
+}
+
+/*
+ * Forget the unnamed prepared statement and portal.  Called when the
+ * backend connections they were created on are released.
+ */
+void pool_remove_unnamed_sent_messages(void)
+{
+	if (!session_context)
+	{
+		pool_error("pool_remove_unnamed_sent_messages: session context is not initialized");
+		return;
+	}
+
+	while (pool_remove_sent_message('B', ""))
+		;
+	while (pool_remove_sent_message('P', ""))
+		;
+}
+
 /*
  * Copy send map
  */
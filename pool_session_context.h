@@ -63,6 +63,8 @@ typedef struct {
 							 * parameters are stored.
 							 * This is meaningful only when is_cache_safe is true.
 							 */
+	bool is_executed;		/* true if the portal has been executed. Bind only */
+	POOL_CACHE_REPLAY cache_replay;	/* query cache being sent to the portal. Bind only */
 } POOL_SENT_MESSAGE;
 
 /*
@@ -153,10 +155,23 @@ typedef struct {
 	 */
 	POOL_QUERY_CACHE_ARRAY *query_cache_array;	/* pending SELECT results */
 	long long int num_selects;	/* number of successful SELECTs in this transaction */
+
+	/*
+	 * Transaction pooling management area.
+	 * If session_pinned is true, the session has created state which
+	 * lives beyond the transaction (SET, LISTEN, temporary tables
+	 * etc.) and the backend connections must be kept until the
+	 * session ends.  If sync_pending is true, frontend has sent
+	 * extended query messages which are not followed by Sync yet.
+	 */
+	bool session_pinned;
+	bool sync_pending;
 } POOL_SESSION_CONTEXT;
 
 extern void pool_init_session_context(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
 extern void pool_session_context_destroy(void);
+extern POOL_SESSION_CONTEXT *pool_session_context_detach(void);
+extern void pool_session_context_attach(POOL_SESSION_CONTEXT *context, POOL_CONNECTION_POOL *backend);
 extern POOL_SESSION_CONTEXT *pool_get_session_context(void);
 extern int pool_get_local_session_id(void);
 extern bool pool_is_query_in_progress(void);
@@ -192,6 +207,12 @@ extern POOL_TRANSACTION_ISOLATION pool_get_transaction_isolation(void);
 extern void pool_unset_command_success(void);
 extern void pool_set_command_success(void);
 extern bool pool_is_command_success(void);
+extern void pool_set_session_pinned(void);
+extern bool pool_is_session_pinned(void);
+extern void pool_set_sync_pending(void);
+extern void pool_unset_sync_pending(void);
+extern bool pool_is_sync_pending(void);
+extern void pool_remove_unnamed_sent_messages(void);
 extern void pool_copy_prep_where(bool *src, bool *dest);
 extern bool can_query_context_destroy(POOL_QUERY_CONTEXT *qc);
 
@@ -125,10 +125,13 @@ void pool_ssl_close(POOL_CONNECTION *cp) {
 	if (cp->ssl) { 
 		SSL_shutdown(cp->ssl); 
 		SSL_free(cp->ssl); 
+		cp->ssl = NULL;
 	} 
 
-	if (cp->ssl_ctx) 
+	if (cp->ssl_ctx) {
 		SSL_CTX_free(cp->ssl_ctx);
+		cp->ssl_ctx = NULL;
+	}
 }
 
 int pool_ssl_read(POOL_CONNECTION *cp, void *buf, int size) {
@@ -22,6 +22,11 @@
 *
 */
 
+/* for splice(2) */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "config.h"
 
 #ifdef HAVE_SYS_SELECT_H
@@ -33,6 +38,8 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #ifdef HAVE_FCNTL_H
 #include <fcntl.h>
@@ -44,8 +51,13 @@
 
 static int mystrlen(char *str, int upper, int *flag);
 static int mystrlinelen(char *str, int upper, int *flag);
+static int pool_flush_iov(POOL_CONNECTION *cp);
 static int save_pending_data(POOL_CONNECTION *cp, void *data, int len);
 static int consume_pending_data(POOL_CONNECTION *cp, void *data, int len);
+static void skip_pending_data(POOL_CONNECTION *cp, int len);
+static int reserve_pending_buffer(POOL_CONNECTION *cp, int len);
+static void replace_pending_buffer(POOL_CONNECTION *cp, char *p, int size);
+static int pool_read_socket(POOL_CONNECTION *cp, void *buf, int len, const char *caller);
 
 /*
 * open read/write file descriptors.
@@ -85,10 +97,10 @@ POOL_CONNECTION *pool_open(int fd)
 	cp->bufsz = READBUFSZ;
 	cp->po = 0;
 	cp->len = 0;
+	cp->vpo = -1;
+	cp->hp_old = NULL;
 	cp->sbuf = NULL;
 	cp->sbufsz = 0;
-	cp->buf2 = NULL;
-	cp->bufsz2 = 0;
 
 	cp->fd = fd;
 	return cp;
@@ -108,10 +120,10 @@ void pool_close(POOL_CONNECTION *cp)
 
 	free(cp->wbuf);
 	free(cp->hp);
+	if (cp->hp_old)
+		free(cp->hp_old);
 	if (cp->sbuf)
 		free(cp->sbuf);
-	if (cp->buf2)
-		free(cp->buf2);
 	pool_discard_params(&cp->params);
 
 	pool_ssl_close(cp);
@@ -125,8 +137,6 @@ void pool_close(POOL_CONNECTION *cp)
 */
 int pool_read(POOL_CONNECTION *cp, void *buf, int len)
 {
-	static char readbuf[READBUFSZ];
-
 	int consume_size;
 	int readlen;
 
@@ -136,90 +146,30 @@ int pool_read(POOL_CONNECTION *cp, void *buf, int len)
 
 	while (len > 0)
 	{
-		if (pool_check_fd(cp))
-		{
-			if (!IS_MASTER_NODE_ID(cp->db_node_id) && (getpid() != mypid))
-			{
-				pool_log("pool_read: data is not ready in DB node: %d. abort this session",
-						 cp->db_node_id);
-				exit(1);
-			}
-			else
-			{
-				pool_error("pool_read: pool_check_fd failed (%s)", strerror(errno));
-			    return -1;
-			}
-		}
-
-		if (cp->ssl_active > 0) {
-		  readlen = pool_ssl_read(cp, readbuf, READBUFSZ);
-		} else {
-		  readlen = read(cp->fd, readbuf, READBUFSZ);
-		}
-
-		if (readlen == -1)
-		{
-			if (errno == EINTR || errno == EAGAIN)
-			{
-				pool_debug("pool_read: retrying due to %s", strerror(errno));
-				continue;
-			}
-
-			pool_error("pool_read: read failed (%s)", strerror(errno));
-
-			if (cp->isbackend)
-			{
-				/* if fail_over_on_backend_error is true, then trigger failover */
-				if (pool_config->fail_over_on_backend_error)
-				{
-					notice_backend_error(cp->db_node_id);
-					child_exit(1);
-					pool_log("pool_read: do not failover because I am the main process");
-					return -1;
-				}
-				else
-				{
-					pool_log("pool_read: do not failover because fail_over_on_backend_error is off");
-					return -1;
-				}
-			}
-			else
-			{
-			    return -1;
-			}
-		}
-		else if (readlen == 0)
+		/*
+		 * The pending buffer is empty here. Read small requests into it
+		 * so that following data is buffered as well. Large requests,
+		 * and requests which do not fit because data returned by
+		 * pool_read2 occupies the buffer, are read in place.
+		 */
+		if (cp->vpo < 0)
+			cp->po = 0;
+
+		if (len >= READBUFSZ || cp->bufsz - cp->po < READBUFSZ)
 		{
-			if (cp->isbackend)
-			{
-				pool_error("pool_read: EOF encountered with backend");
+			readlen = pool_read_socket(cp, buf, len, "pool_read");
+			if (readlen < 0)
 				return -1;
-
-#ifdef NOT_USED
-			    /* fatal error, notice to parent and exit */
-			    notice_backend_error(IS_MASTER_NODE_ID(cp->db_node_id));
-				child_exit(1);
-#endif
-			}
-			else
-			{
-				/*
-				 * if backend offers authentication method, frontend could close connection
-				 */
-				return -1;
-			}
 		}
-
-		if (len < readlen)
+		else
 		{
-			/* overrun. we need to save remaining data to pending buffer */
-			if (save_pending_data(cp, readbuf+len, readlen-len))
+			readlen = pool_read_socket(cp, cp->hp + cp->po, cp->bufsz - cp->po, "pool_read");
+			if (readlen < 0)
 				return -1;
-			memmove(buf, readbuf, len);
-			break;
+			cp->len = readlen;
+			readlen = consume_pending_data(cp, buf, len);
 		}
 
-		memmove(buf, readbuf, readlen);
 		buf += readlen;
 		len -= readlen;
 	}
@@ -230,49 +180,68 @@ int pool_read(POOL_CONNECTION *cp, void *buf, int len)
 /*
 * read exactly len bytes from cp
 * returns buffer address on success otherwise NULL.
+* The data is returned in place in the pending data buffer and stays
+* valid until the next call to pool_read2 for cp.
 */
 char *pool_read2(POOL_CONNECTION *cp, int len)
 {
 	char *buf;
-	int req_size;
-	int alloc_size;
-	int consume_size;
 	int readlen;
 
-	req_size = cp->len + len;
+	/* data returned last time is no longer referenced */
+	if (cp->hp_old)
+	{
+		free(cp->hp_old);
+		cp->hp_old = NULL;
+	}
+	cp->vpo = -1;
 
-	if (req_size > cp->bufsz2)
+	if (cp->len < len)
 	{
-		alloc_size = ((req_size+1)/READBUFSZ+1)*READBUFSZ;
-		cp->buf2 = realloc(cp->buf2, alloc_size);
-		if (cp->buf2 == NULL)
+		if (reserve_pending_buffer(cp, len - cp->len))
+			return NULL;
+
+		while (cp->len < len)
 		{
-			pool_error("pool_read2: failed to realloc");
-			exit(1);
+			readlen = pool_read_socket(cp, cp->hp + cp->po + cp->len,
+									   cp->bufsz - cp->po - cp->len, "pool_read2");
+			if (readlen < 0)
+				return NULL;
+			cp->len += readlen;
 		}
-		cp->bufsz2 = alloc_size;
 	}
 
-	buf = cp->buf2;
+	buf = cp->hp + cp->po;
+	cp->vpo = cp->po;
+	skip_pending_data(cp, len);
 
-	consume_size = consume_pending_data(cp, buf, len);
-	len -= consume_size;
-	buf += consume_size;
+	return buf;
+}
 
-	while (len > 0)
+/*
+ * Read available data from the socket of cp into buf, at most len
+ * bytes. Waits for data and handles errors the same way for all the
+ * read functions. caller is the name of the caller for messages.
+ * returns the number of bytes read otherwise -1.
+ */
+static int pool_read_socket(POOL_CONNECTION *cp, void *buf, int len, const char *caller)
+{
+	int readlen;
+
+	for (;;)
 	{
 		if (pool_check_fd(cp))
 		{
-			if (!IS_MASTER_NODE_ID(cp->db_node_id))
+			if (!IS_MASTER_NODE_ID(cp->db_node_id) && (getpid() != mypid))
 			{
-				pool_log("pool_read2: data is not ready in DB node:%d. abort this session",
-						 cp->db_node_id);
+				pool_log("%s: data is not ready in DB node: %d. abort this session",
+						 caller, cp->db_node_id);
 				exit(1);
 			}
 			else
 			{
-				pool_error("pool_read2: pool_check_fd failed (%s)", strerror(errno));
-			    return NULL;
+				pool_error("%s: pool_check_fd failed (%s)", caller, strerror(errno));
+			    return -1;
 			}
 		}
 
@@ -286,11 +255,11 @@ char *pool_read2(POOL_CONNECTION *cp, int len)
 		{
 			if (errno == EINTR || errno == EAGAIN)
 			{
-				pool_debug("pool_read2: retrying due to %s", strerror(errno));
+				pool_debug("%s: retrying due to %s", caller, strerror(errno));
 				continue;
 			}
 
-			pool_error("pool_read2: read failed (%s)", strerror(errno));
+			pool_error("%s: read failed (%s)", caller, strerror(errno));
 
 			if (cp->isbackend)
 			{
@@ -299,26 +268,26 @@ char *pool_read2(POOL_CONNECTION *cp, int len)
 				{
 					notice_backend_error(cp->db_node_id);
 					child_exit(1);
-					pool_log("pool_read2: do not failover because I am the main process");
-					return NULL;
+					pool_log("%s: do not failover because I am the main process", caller);
+					return -1;
 				}
 				else
 				{
-					pool_log("pool_read2: do not failover because fail_over_on_backend_error is off");
-					return NULL;
+					pool_log("%s: do not failover because fail_over_on_backend_error is off", caller);
+					return -1;
 				}
 			}
 			else
 			{
-			    return NULL;
+			    return -1;
 			}
 		}
 		else if (readlen == 0)
 		{
 			if (cp->isbackend)
 			{
-				pool_error("pool_read2: EOF encountered with backend");
-				return NULL;
+				pool_error("%s: EOF encountered with backend", caller);
+				return -1;
 
 #ifdef NOT_USED
 			    /* fatal error, notice to parent and exit */
@@ -331,15 +300,12 @@ char *pool_read2(POOL_CONNECTION *cp, int len)
 				/*
 				 * if backend offers authentication method, frontend could close connection
 				 */
-				return NULL;
+				return -1;
 			}
 		}
 
-		buf += readlen;
-		len -= readlen;
+		return readlen;
 	}
-
-	return cp->buf2;
 }
 
 /*
@@ -357,6 +323,17 @@ int pool_write(POOL_CONNECTION *cp, void *buf, int len)
 	if (cp->no_forward)
 		return 0;
 
+	/*
+	 * Large data would fill up the write buffer anyway. Write it
+	 * together with the buffered data without copying.
+	 */
+	if (len >= WRITEBUFSZ && cp->ssl_active <= 0)
+	{
+		if (pool_write_ref(cp, buf, len) < 0)
+			return -1;
+		return pool_flush_it(cp);
+	}
+
 	while (len > 0)
 	{
 		int remainder = WRITEBUFSZ - cp->wbufpo;
@@ -387,6 +364,36 @@ int pool_write(POOL_CONNECTION *cp, void *buf, int len)
 	return 0;
 }
 
+/*
+ * Queue data to be written after the data in the write buffer
+ * without copying it. The caller must keep buf unchanged until the
+ * next flush. Small data, and data written over SSL, is copied by
+ * pool_write().
+ */
+int pool_write_ref(POOL_CONNECTION *cp, void *buf, int len)
+{
+	POOL_WRITE_REF *ref;
+
+	if (len < WRITE_REF_MIN || cp->ssl_active > 0)
+		return pool_write(cp, buf, len);
+
+	if (cp->no_forward)
+		return 0;
+
+	if (cp->nwrefs >= MAX_WRITE_REFS)
+	{
+		if (pool_flush_it(cp) == -1)
+			return -1;
+	}
+
+	ref = &cp->wrefs[cp->nwrefs++];
+	ref->wbufpo = cp->wbufpo;
+	ref->buf = buf;
+	ref->len = len;
+
+	return 0;
+}
+
 /*
  * flush write buffer
  */
@@ -395,6 +402,10 @@ int pool_flush_it(POOL_CONNECTION *cp)
 	int sts;
 	int wlen;
 	int offset;
+
+	if (cp->nwrefs > 0)
+		return pool_flush_iov(cp);
+
 	wlen = cp->wbufpo;
 
 	if (wlen == 0)
@@ -499,6 +510,78 @@ int pool_flush_it(POOL_CONNECTION *cp)
 	return 0;
 }
 
+/*
+ * Write the write buffer interleaved with the referenced data by
+ * writev(). Used by pool_flush_it() if there is referenced data.
+ */
+static int pool_flush_iov(POOL_CONNECTION *cp)
+{
+	struct iovec iov[MAX_WRITE_REFS * 2 + 1];
+	int niov = 0;
+	int offset = 0;
+	int i;
+	int sts;
+
+	for (i=0;i<cp->nwrefs;i++)
+	{
+		POOL_WRITE_REF *ref = &cp->wrefs[i];
+
+		if (ref->wbufpo > offset)
+		{
+			iov[niov].iov_base = cp->wbuf + offset;
+			iov[niov++].iov_len = ref->wbufpo - offset;
+			offset = ref->wbufpo;
+		}
+		iov[niov].iov_base = ref->buf;
+		iov[niov++].iov_len = ref->len;
+	}
+	if (cp->wbufpo > offset)
+	{
+		iov[niov].iov_base = cp->wbuf + offset;
+		iov[niov++].iov_len = cp->wbufpo - offset;
+	}
+
+	cp->wbufpo = 0;
+	cp->nwrefs = 0;
+
+	i = 0;
+	while (i < niov)
+	{
+		errno = 0;
+		sts = writev(cp->fd, iov + i, niov - i);
+
+		if (sts > 0)
+		{
+			/* skip written data. partially written entry is adjusted */
+			while (i < niov && (size_t) sts >= iov[i].iov_len)
+				sts -= iov[i++].iov_len;
+			if (sts > 0)
+			{
+				iov[i].iov_base = (char *)iov[i].iov_base + sts;
+				iov[i].iov_len -= sts;
+			}
+		}
+
+		else if (errno == EAGAIN || errno == EINTR)
+		{
+			continue;
+		}
+
+		else
+		{
+			if (cp->isbackend)
+				pool_error("pool_flush_iov: writev failed to backend (%d). reason: %s",
+						   cp->db_node_id, strerror(errno));
+			else
+				pool_debug("pool_flush_iov: writev failed to frontend. reason: %s",
+						   strerror(errno));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
 /*
 * flush write buffer and degenerate/failover if error occurs
 */
@@ -543,11 +626,153 @@ int pool_flush(POOL_CONNECTION *cp)
 */
 int pool_write_and_flush(POOL_CONNECTION *cp, void *buf, int len)
 {
-	if (pool_write(cp, buf, len))
+	/* buf is flushed right away. no need to copy it */
+	if (pool_write_ref(cp, buf, len))
 		return -1;
 	return pool_flush(cp);
 }
 
+/*
+ * Return true if pool_splice() can be used to forward data from
+ * "from" to "to".  splice(2) is Linux specific and cannot see the
+ * plain text of SSL connections.
+ */
+bool pool_can_splice(POOL_CONNECTION *from, POOL_CONNECTION *to)
+{
+#ifdef SPLICE_F_MOVE
+	return from->ssl_active <= 0 && to->ssl_active <= 0 && !to->no_forward;
+#else
+	return false;
+#endif
+}
+
+/*
+ * Move len bytes from "from" to "to".  Pending data in the read buffer
+ * of "from" is copied to the write buffer of "to" first, and the rest
+ * is moved from socket to socket through a pipe with splice(2) without
+ * being copied into user space.  The caller must check
+ * pool_can_splice() beforehand.
+ * returns 0 on success otherwise -1.
+ */
+int pool_splice(POOL_CONNECTION *from, POOL_CONNECTION *to, int len)
+{
+#ifdef SPLICE_F_MOVE
+	static int pipefd[2] = {-1, -1};
+	int consume_size;
+
+	consume_size = Min(len, from->len);
+	if (consume_size > 0)
+	{
+		if (pool_write(to, from->hp + from->po, consume_size) < 0)
+			return -1;
+		skip_pending_data(from, consume_size);
+		len -= consume_size;
+	}
+
+	if (len <= 0)
+		return 0;
+
+	/* buffered data must go first */
+	if (pool_flush_it(to) < 0)
+		return -1;
+
+	if (pipefd[0] < 0 && pipe(pipefd) < 0)
+	{
+		pool_error("pool_splice: pipe() failed. reason: %s", strerror(errno));
+		pipefd[0] = pipefd[1] = -1;
+		return -1;
+	}
+
+	while (len > 0)
+	{
+		ssize_t readlen;
+
+		readlen = splice(from->fd, NULL, pipefd[1], NULL, Min(len, POOL_SPLICE_CHUNK_SIZE),
+						 SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (readlen < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+
+		if (readlen <= 0)
+		{
+			if (readlen == 0)
+				pool_error("pool_splice: EOF encountered");
+			else
+				pool_error("pool_splice: splice() failed (%s)", strerror(errno));
+
+			if (from->isbackend && pool_config->fail_over_on_backend_error && readlen < 0)
+			{
+				notice_backend_error(from->db_node_id);
+				child_exit(1);
+			}
+			return -1;
+		}
+		len -= readlen;
+
+		while (readlen > 0)
+		{
+			ssize_t writelen;
+
+			writelen = splice(pipefd[0], NULL, to->fd, NULL, readlen,
+							  SPLICE_F_MOVE | (len > 0 ? SPLICE_F_MORE : 0));
+			if (writelen < 0)
+			{
+				if (errno == EINTR || errno == EAGAIN)
+					continue;
+
+				pool_debug("pool_splice: splice() failed to write (%s)", strerror(errno));
+
+				/* discard data left in the pipe */
+				close(pipefd[0]);
+				close(pipefd[1]);
+				pipefd[0] = pipefd[1] = -1;
+				return -1;
+			}
+			readlen -= writelen;
+		}
+	}
+	return 0;
+#else
+	pool_error("pool_splice: splice is not supported on this platform");
+	return -1;
+#endif
+}
+
+/*
+ * Look at data already arrived without consuming it.  If the read
+ * buffer has data, it is returned.  Otherwise data arrived at the
+ * socket of cp is looked at.  Returns the number of bytes copied to
+ * buf, which may be 0 if nothing has arrived, or -1 on error.
+ */
+int pool_peek(POOL_CONNECTION *cp, void *buf, int len)
+{
+	int readlen;
+
+	if (cp->len > 0)
+	{
+		readlen = Min(len, cp->len);
+		memcpy(buf, cp->hp + cp->po, readlen);
+		return readlen;
+	}
+
+	if (cp->ssl_active > 0)
+		return -1;
+
+	for (;;)
+	{
+		readlen = recv(cp->fd, buf, len, MSG_PEEK | MSG_DONTWAIT);
+		if (readlen >= 0)
+			return readlen;
+
+		if (errno == EINTR)
+			continue;
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+
+		pool_debug("pool_peek: recv failed (%s)", strerror(errno));
+		return -1;
+	}
+}
+
 /*
  * read a string until EOF or NULL is encountered.
  * if line is not 0, read until new line is encountered.
@@ -777,31 +1002,8 @@ static int mystrlinelen(char *str, int upper, int *flag)
  */
 static int save_pending_data(POOL_CONNECTION *cp, void *data, int len)
 {
-	int reqlen;
-	size_t realloc_size;
-	char *p;
-
-	/* to be safe */
-	if (cp->len == 0)
-		cp->po = 0;
-
-	reqlen = cp->po + cp->len + len;
-
-	/* pending buffer is enough? */
-	if (reqlen > cp->bufsz)
-	{
-		/* too small, enlarge it */
-		realloc_size = (reqlen/READBUFSZ+1)*READBUFSZ;
-		p = realloc(cp->hp, realloc_size);
-		if (p == NULL)
-		{
-			pool_error("save_pending_data: realloc failed");
-			return -1;
-		}
-
-		cp->bufsz = realloc_size;
-		cp->hp = p;
-	}
+	if (reserve_pending_buffer(cp, len))
+		return -1;
 
 	memmove(cp->hp + cp->po + cp->len, data, len);
 	cp->len += len;
@@ -821,41 +1023,131 @@ static int consume_pending_data(POOL_CONNECTION *cp, void *data, int len)
 
 	consume_size = Min(len, cp->len);
 	memmove(data, cp->hp + cp->po, consume_size);
-	cp->len -= consume_size;
-
-	if (cp->len <= 0)
-		cp->po = 0;
-	else
-		cp->po += consume_size;
+	skip_pending_data(cp, consume_size);
 
 	return consume_size;
 }
 
 /*
- * pool_unread: Put back data to input buffer
+ * discard len bytes of pending data
  */
-int pool_unread(POOL_CONNECTION *cp, void *data, int len)
+static void skip_pending_data(POOL_CONNECTION *cp, int len)
 {
-	void *p = cp->hp;
-	int n = cp->len + len;
-	int realloc_size;
+	cp->len -= len;
+	cp->po += len;
+
+	/* rewind if nothing is pending nor referenced */
+	if (cp->len <= 0 && cp->vpo < 0)
+		cp->po = 0;
+}
 
-	if (cp->bufsz < n)
+/*
+ * Make room for at least len bytes after the pending data. Pending
+ * data is moved to the head of the buffer, or to a larger buffer if
+ * needed. If data returned by pool_read2 is in the buffer, a new
+ * buffer is always used and the old one is kept until the next
+ * pool_read2 call.
+ */
+static int reserve_pending_buffer(POOL_CONNECTION *cp, int len)
+{
+	int size;
+	char *p;
+
+	if (cp->len <= 0 && cp->vpo < 0)
+		cp->po = 0;
+
+	if (cp->bufsz - cp->po - cp->len >= len)
+		return 0;
+
+	len = Max(len, READBUFSZ);
+	size = cp->bufsz;
+	if (cp->len + len > size)
+		size = ((cp->len + len)/READBUFSZ+1)*READBUFSZ;
+
+	if (cp->vpo >= 0)
 	{
-		realloc_size = (n/READBUFSZ+1)*READBUFSZ;
-		p = realloc(cp->hp, realloc_size);
+		p = malloc(size);
 		if (p == NULL)
 		{
-			pool_error("pool_unread: realloc failed");
+			pool_error("reserve_pending_buffer: malloc failed");
+			return -1;
+		}
+		memcpy(p, cp->hp + cp->po, cp->len);
+		replace_pending_buffer(cp, p, size);
+		return 0;
+	}
+
+	if (cp->po > 0)
+	{
+		memmove(cp->hp, cp->hp + cp->po, cp->len);
+		cp->po = 0;
+	}
+
+	if (size > cp->bufsz)
+	{
+		p = realloc(cp->hp, size);
+		if (p == NULL)
+		{
+			pool_error("reserve_pending_buffer: realloc failed");
 			return -1;
 		}
 		cp->hp = p;
+		cp->bufsz = size;
 	}
-	if (cp->len != 0)
-		memmove(p + len, cp->hp + cp->po, cp->len);
-	memmove(p, data, len);
-	cp->len = n;
+
+	return 0;
+}
+
+/*
+ * Switch the pending data buffer to p whose pending data starts at
+ * the head. The old buffer is freed unless pool_read2 data is in it.
+ */
+static void replace_pending_buffer(POOL_CONNECTION *cp, char *p, int size)
+{
+	if (cp->vpo >= 0)
+	{
+		if (cp->hp_old)
+			free(cp->hp_old);
+		cp->hp_old = cp->hp;
+	}
+	else
+		free(cp->hp);
+
+	cp->hp = p;
+	cp->bufsz = size;
 	cp->po = 0;
+	cp->vpo = -1;
+}
+
+/*
+ * pool_unread: Put back data to input buffer
+ */
+int pool_unread(POOL_CONNECTION *cp, void *data, int len)
+{
+	int size;
+	char *p;
+
+	/* room before the pending data? */
+	if (cp->vpo < 0 && cp->po >= len)
+	{
+		cp->po -= len;
+		memmove(cp->hp + cp->po, data, len);
+		cp->len += len;
+		return 0;
+	}
+
+	size = ((len + cp->len)/READBUFSZ+1)*READBUFSZ;
+	p = malloc(size);
+	if (p == NULL)
+	{
+		pool_error("pool_unread: malloc failed");
+		return -1;
+	}
+	memcpy(p, data, len);
+	if (cp->len > 0)
+		memcpy(p + len, cp->hp + cp->po, cp->len);
+	cp->len += len;
+	replace_pending_buffer(cp, p, size);
 	return 0;
 }
 
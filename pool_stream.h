@@ -29,6 +29,15 @@
 #define READBUFSZ 1024
 #define WRITEBUFSZ 8192
 
+/*
+ * Data at least this large is referenced by pool_write_ref() instead
+ * of being copied into the write buffer.
+ */
+#define WRITE_REF_MIN 1024
+
+/* max bytes moved at once by pool_splice(). default pipe capacity */
+#define POOL_SPLICE_CHUNK_SIZE 65536
+
 /*
  * Return true if read buffer is empty. Argument is POOL_CONNECTION.
  */
@@ -49,7 +58,11 @@ extern char *pool_read2(POOL_CONNECTION *cp, int len);
 extern int pool_write(POOL_CONNECTION *cp, void *buf, int len);
 extern int pool_flush(POOL_CONNECTION *cp);
 extern int pool_flush_it(POOL_CONNECTION *cp);
+extern int pool_write_ref(POOL_CONNECTION *cp, void *buf, int len);
 extern int pool_write_and_flush(POOL_CONNECTION *cp, void *buf, int len);
+extern bool pool_can_splice(POOL_CONNECTION *from, POOL_CONNECTION *to);
+extern int pool_splice(POOL_CONNECTION *from, POOL_CONNECTION *to, int len);
+extern int pool_peek(POOL_CONNECTION *cp, void *buf, int len);
 extern char *pool_read_string(POOL_CONNECTION *cp, int *len, int line);
 extern int pool_unread(POOL_CONNECTION *cp, void *data, int len);
 extern int pool_push(POOL_CONNECTION *cp, void *data, int len);
@@ -56,6 +56,7 @@
 #include "pool_ip.h"
 #include "md5.h"
 #include "pool_stream.h"
+#include "pool_memqcache.h"
 
 extern int myargc;
 extern char **myargv;
@@ -91,6 +92,9 @@ static void reload_config(void);
 */
 void do_worker_child(void)
 {
+	time_t next_sr_check = 0;
+	time_t next_compaction = 0;
+
 	pool_debug("I am %d", getpid());
 
 	/* Identify myself via ps */
@@ -116,29 +120,52 @@ void do_worker_child(void)
 
 	for (;;)
 	{
+		time_t now;
+		time_t next;
+
 		CHECK_REQUEST;
 
-		if (pool_config->sr_check_period <= 0)
+		now = time(NULL);
+
+		if (now >= next_sr_check)
 		{
-			sleep(30);
+			/*
+			 * If streaming replication mode, do time lag checking
+			 */
+			if (pool_config->sr_check_period > 0 && MASTER_SLAVE && !strcmp(pool_config->master_slave_sub_mode, MODE_STREAMREP))
+			{
+				/* Check and establish persistent connections to the backend */
+				establish_persistent_connection();
+
+				/* Do replication time lag checking */
+				check_replication_time_lag();
+
+				/* Discard persistent connections */
+				discard_persistent_connection();
+			}
+			now = time(NULL);
+			next_sr_check = now + (pool_config->sr_check_period > 0 ? pool_config->sr_check_period : 30);
 		}
 
 		/*
-		 * If streaming replication mode, do time lag checking
+		 * Pack fragmented blocks of the shmem query cache
 		 */
-
-		if (pool_config->sr_check_period > 0 && MASTER_SLAVE && !strcmp(pool_config->master_slave_sub_mode, MODE_STREAMREP))
+		if (pool_config->memory_cache_enabled &&
+			pool_config->memqcache_compaction_interval > 0 && pool_is_shmem_cache())
 		{
-			/* Check and establish persistent connections to the backend */
-			establish_persistent_connection();
-
-			/* Do replication time lag checking */
-			check_replication_time_lag();
-
-			/* Discard persistent connections */
-			discard_persistent_connection();
+			if (now >= next_compaction)
+			{
+				pool_compact_shmem_cache();
+				now = time(NULL);
+				next_compaction = now + pool_config->memqcache_compaction_interval;
+			}
+			next = next_compaction < next_sr_check ? next_compaction : next_sr_check;
 		}
-		sleep(pool_config->sr_check_period);
+		else
+			next = next_sr_check;
+
+		if (next > now)
+			sleep(next - now);
 	}
 	exit(0);
 }
@@ -0,0 +1,55 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# Connection rate benchmark: compare accept_method = select and epoll.
+#
+# Runs pgbench with -C (new connection for each transaction) against
+# pgpool-II with a large num_init_children so that the cost of waking
+# up idle children on each connection request becomes visible.
+#
+# usage: connect_rate.sh [num_init_children [clients [seconds]]]
+#
+# Requires the same environment as the regression test suite:
+# PGPOOL_SETUP (path to pgpool_setup), PGBIN (PostgreSQL bin
+# directory) and optionally PGBENCH_PATH.
+#-------------------------------------------------------------------
+dir=`pwd`
+NUM_INIT_CHILDREN=${1:-512}
+CLIENTS=${2:-32}
+SECONDS_TO_RUN=${3:-30}
+PGBENCH=${PGBENCH_PATH:-$PGBIN/pgbench}
+TESTLIBS=$dir/../regression/libs.sh
+TESTDIR=testdir
+
+source $TESTLIBS
+
+for method in select epoll
+do
+	rm -fr $TESTDIR
+	mkdir $TESTDIR
+	cd $TESTDIR
+
+	echo -n "creating test environment..."
+	$PGPOOL_SETUP -m s -n 1 >/dev/null 2>&1 || exit 1
+	echo "done."
+
+	source ./bashrc.ports
+	export PGPORT=$PGPOOL_PORT
+
+	echo "num_init_children = $NUM_INIT_CHILDREN" >> etc/pgpool.conf
+	echo "accept_method = '$method'" >> etc/pgpool.conf
+	echo "max_pool = 1" >> etc/pgpool.conf
+	# the backend needs enough slots for all pooled connections
+	echo "max_connections = `expr $NUM_INIT_CHILDREN + 10`" >> data0/postgresql.conf
+
+	./startall
+	wait_for_pgpool_startup
+
+	$PGBENCH -i -s 1 test >/dev/null 2>&1
+	echo "accept_method = $method, num_init_children = $NUM_INIT_CHILDREN, clients = $CLIENTS"
+	$PGBENCH -C -S -n -c $CLIENTS -j $CLIENTS -T $SECONDS_TO_RUN test | grep -E "^tps|latency"
+
+	./shutdownall
+	cd $dir
+done
+
+exit 0
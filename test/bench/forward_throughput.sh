@@ -0,0 +1,54 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# Forwarding throughput benchmark: small and large messages.
+#
+# Runs pgbench with custom scripts through pgpool-II. "small" returns
+# many narrow rows, so that per message overhead dominates. "large"
+# returns a few wide rows, so that copying of the message payload in
+# the write path dominates.
+#
+# usage: forward_throughput.sh [clients [seconds]]
+#
+# Requires the same environment as the regression test suite:
+# PGPOOL_SETUP (path to pgpool_setup), PGBIN (PostgreSQL bin
+# directory) and optionally PGBENCH_PATH.
+#-------------------------------------------------------------------
+dir=`pwd`
+CLIENTS=${1:-8}
+SECONDS_TO_RUN=${2:-30}
+PGBENCH=${PGBENCH_PATH:-$PGBIN/pgbench}
+TESTLIBS=$dir/../regression/libs.sh
+TESTDIR=testdir
+
+source $TESTLIBS
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 1 >/dev/null 2>&1 || exit 1
+echo "done."
+
+source ./bashrc.ports
+export PGPORT=$PGPOOL_PORT
+
+echo "num_init_children = $CLIENTS" >> etc/pgpool.conf
+echo "max_pool = 1" >> etc/pgpool.conf
+
+echo "SELECT i FROM generate_series(1, 10000) AS i;" > small.sql
+echo "SELECT repeat('x', 1024 * 1024) FROM generate_series(1, 10);" > large.sql
+
+./startall
+wait_for_pgpool_startup
+
+for size in small large
+do
+	echo "messages = $size, clients = $CLIENTS"
+	$PGBENCH -n -f $size.sql -c $CLIENTS -j $CLIENTS -T $SECONDS_TO_RUN test | grep -E "^tps|latency"
+done
+
+./shutdownall
+cd $dir
+
+exit 0
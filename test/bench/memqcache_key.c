@@ -0,0 +1,115 @@
+/* -*-pgsql-c-*- */
+/*
+ * Micro benchmark of query cache key derivation.
+ *
+ * Compares the former key derivation of the on memory query cache
+ * (concatenate user name, query string and database name into a
+ * malloc'ed buffer and take MD5 of it) with the current one (feed the
+ * three strings to streaming MurmurHash3), for increasing query
+ * lengths. Prints nanoseconds per key and throughput in MB/s.
+ *
+ * Built and run by memqcache_key.sh.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "pool.h"
+#include "md5.h"
+#include "murmurhash3.h"
+
+static const char *user = "postgres";
+static const char *database = "test";
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void md5_key(const char *query, char *buf)
+{
+	int len;
+	char *p;
+
+	len = strlen(user) + strlen(query) + strlen(database) + 1;
+	p = malloc(len);
+	if (p == NULL)
+	{
+		fprintf(stderr, "malloc failed\n");
+		exit(1);
+	}
+	strcpy(p, user);
+	strcat(p, query);
+	strcat(p, database);
+	pool_md5_hash(p, strlen(p), buf);
+	free(p);
+}
+
+static void murmur3_key(const char *query, char *buf)
+{
+	MURMUR3_CTX ctx;
+
+	murmur3_init(&ctx, 0);
+	murmur3_update(&ctx, user, strlen(user) + 1);
+	murmur3_update(&ctx, database, strlen(database) + 1);
+	murmur3_update(&ctx, query, strlen(query) + 1);
+	murmur3_final(&ctx, buf);
+}
+
+static double run(void (*fn)(const char *, char *), const char *query, long loops)
+{
+	char buf[33];
+	double start;
+	long i;
+
+	start = now();
+	for (i=0;i<loops;i++)
+		fn(query, buf);
+	return now() - start;
+}
+
+int main(int argc, char **argv)
+{
+	long total = 256L * 1024 * 1024;	/* bytes hashed per measurement */
+	size_t len;
+
+	if (argc > 1)
+		total = atol(argv[1]) * 1024L * 1024;
+
+	printf("%8s %12s %12s %12s %12s\n", "length", "md5 ns", "md5 MB/s", "murmur3 ns", "murmur3 MB/s");
+
+	for (len = 64; len <= 64 * 1024; len *= 4)
+	{
+		char *query;
+		long loops;
+		double t_md5, t_mm3;
+		size_t i;
+
+		query = malloc(len + 1);
+		if (query == NULL)
+		{
+			fprintf(stderr, "malloc failed\n");
+			exit(1);
+		}
+		for (i=0;i<len;i++)
+			query[i] = "SELECT * FROM t WHERE c = 1 "[i % 28];
+		query[len] = '\0';
+
+		loops = total / len;
+		if (loops < 100)
+			loops = 100;
+
+		t_md5 = run(md5_key, query, loops);
+		t_mm3 = run(murmur3_key, query, loops);
+
+		printf("%8lu %12.1f %12.1f %12.1f %12.1f\n", (unsigned long)len,
+			   t_md5 * 1e9 / loops, len * loops / t_md5 / (1024 * 1024),
+			   t_mm3 * 1e9 / loops, len * loops / t_mm3 / (1024 * 1024));
+		free(query);
+	}
+	return 0;
+}
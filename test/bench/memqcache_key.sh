@@ -0,0 +1,23 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# Key derivation benchmark of the on memory query cache.
+#
+# Builds memqcache_key.c against the pgpool-II source tree and runs
+# it. The tree must have been configured so that config.h exists.
+# PGINCLUDE is the directory of libpq-fe.h (defaults to
+# pg_config --includedir).
+#
+# usage: memqcache_key.sh [megabytes per measurement]
+#-------------------------------------------------------------------
+dir=`pwd`
+TOPDIR=$dir/../..
+CC=${CC:-cc}
+PGINCLUDE=${PGINCLUDE:-`pg_config --includedir 2>/dev/null`}
+
+$CC -O2 -DHAVE_CONFIG_H -I$TOPDIR -I$TOPDIR/parser -I$PGINCLUDE -o memqcache_key memqcache_key.c \
+	$TOPDIR/md5.c $TOPDIR/murmurhash3.c || exit 1
+
+./memqcache_key $1
+rc=$?
+rm -f memqcache_key
+exit $rc
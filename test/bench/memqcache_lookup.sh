@@ -0,0 +1,72 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# Concurrent lookup benchmark of the shared memory query cache.
+#
+# Runs pgbench -S through pgpool-II with memory_cache_enabled and the
+# shmem cache, with memqcache_partitions = 1 (single lock) and
+# memqcache_partitions = 16, for increasing numbers of clients. After
+# the first pass almost all SELECTs are served from the cache, so the
+# result shows how cache lookups scale with concurrency.
+#
+# usage: memqcache_lookup.sh [seconds [scale]]
+#
+# Requires the same environment as the regression test suite:
+# PGPOOL_SETUP (path to pgpool_setup), PGBIN (PostgreSQL bin
+# directory) and optionally PGBENCH_PATH.
+#-------------------------------------------------------------------
+dir=`pwd`
+SECONDS_TO_RUN=${1:-30}
+SCALE=${2:-1}
+CLIENTS_LIST="1 4 16 64"
+PGBENCH=${PGBENCH_PATH:-$PGBIN/pgbench}
+TESTLIBS=$dir/../regression/libs.sh
+TESTDIR=testdir
+
+source $TESTLIBS
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 1 >/dev/null 2>&1 || exit 1
+echo "done."
+
+source ./bashrc.ports
+export PGPORT=$PGPOOL_PORT
+
+echo "num_init_children = 64" >> etc/pgpool.conf
+echo "max_pool = 1" >> etc/pgpool.conf
+echo "memory_cache_enabled = on" >> etc/pgpool.conf
+echo "memqcache_method = 'shmem'" >> etc/pgpool.conf
+echo "memqcache_total_size = 268435456" >> etc/pgpool.conf
+echo "memqcache_max_num_cache = 1000000" >> etc/pgpool.conf
+cp etc/pgpool.conf etc/pgpool.conf.base
+
+./startall
+wait_for_pgpool_startup
+$PGBENCH -i -s $SCALE test >/dev/null 2>&1 || { ./shutdownall; exit 1; }
+./shutdownall
+
+for partitions in 1 16
+do
+	cp etc/pgpool.conf.base etc/pgpool.conf
+	echo "memqcache_partitions = $partitions" >> etc/pgpool.conf
+	./startall
+	wait_for_pgpool_startup
+
+	# warm up the cache
+	$PGBENCH -n -S -c 4 -j 4 -T 10 test >/dev/null 2>&1
+
+	for clients in $CLIENTS_LIST
+	do
+		echo "memqcache_partitions = $partitions, clients = $clients"
+		$PGBENCH -n -S -c $clients -j $clients -T $SECONDS_TO_RUN test | grep -E "^tps|latency"
+	done
+
+	./shutdownall
+done
+
+cd $dir
+
+exit 0
@@ -0,0 +1,103 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for transaction pooling.
+#
+# With transaction_pooling = on, backend connections are released
+# when the session becomes idle outside of a transaction. So each
+# transaction runs on a different backend process, unless the session
+# created state which lives beyond the transaction.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+
+for mode in s r
+do
+	rm -fr $TESTDIR
+	mkdir $TESTDIR
+	cd $TESTDIR
+
+# create test environment
+	echo -n "creating test environment..."
+	$PGPOOL_SETUP -m $mode -n 2 || exit 1
+	echo "done."
+
+	source ./bashrc.ports
+
+	echo "transaction_pooling = on" >> etc/pgpool.conf
+
+	./startall
+
+	export PGPORT=$PGPOOL_PORT
+
+	wait_for_pgpool_startup
+
+	# backend pid must change between transactions
+	$PSQL -A -t test > result1 <<EOF2
+SELECT pg_backend_pid();
+SELECT pg_backend_pid();
+EOF2
+	if [ `sort -u result1 | wc -l` != 2 ];then
+		echo "backend connection was not released between transactions"
+		./shutdownall
+		exit 1
+	fi
+
+	# but not inside an explicit transaction
+	$PSQL -A -t test > result2 <<EOF2
+BEGIN;
+SELECT pg_backend_pid();
+SELECT pg_backend_pid();
+END;
+EOF2
+	if [ `grep -v -E "BEGIN|COMMIT" result2 | sort -u | wc -l` != 1 ];then
+		echo "backend connection was released inside a transaction"
+		./shutdownall
+		exit 1
+	fi
+
+	# SET pins the session to the backend connection
+	$PSQL -A -t test > result3 <<EOF2
+SET application_name TO 'pinned';
+SELECT pg_backend_pid();
+SELECT current_setting('application_name');
+SELECT pg_backend_pid();
+EOF2
+	if [ `grep -v -E "SET|pinned" result3 | sort -u | wc -l` != 1 ];then
+		echo "backend connection was released after SET"
+		./shutdownall
+		exit 1
+	fi
+	if ! grep -q pinned result3;then
+		echo "session state was lost after SET"
+		./shutdownall
+		exit 1
+	fi
+
+	# temporary objects pin the session, also in a multi statement
+	# query (psql sends "\;" separated statements at once)
+	for q in "SELECT 1 AS i INTO TEMP t1" \
+			 "CREATE TEMP TABLE t1 AS SELECT 1 AS i" \
+			 "CREATE TEMP SEQUENCE t1" \
+			 "CREATE TEMP VIEW t1 AS SELECT 1 AS i" \
+			 "SELECT 1\\; CREATE TEMP TABLE t1(i int)"
+	do
+		$PSQL -A -t test > result4 2>&1 <<EOF2
+$q;
+SELECT * FROM t1;
+SELECT * FROM t1;
+EOF2
+		if grep -q ERROR result4;then
+			cat result4
+			echo "temporary object was lost: $q"
+			./shutdownall
+			exit 1
+		fi
+	done
+
+	./shutdownall
+
+	cd ..
+done
+
+exit 0
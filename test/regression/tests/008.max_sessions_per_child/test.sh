@@ -0,0 +1,73 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for max_sessions_per_child.
+#
+# With only one child process, a second client must be served while
+# the first client is idle, and both sessions must keep their state.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+
+for mode in s r
+do
+	rm -fr $TESTDIR
+	mkdir $TESTDIR
+	cd $TESTDIR
+
+# create test environment
+	echo -n "creating test environment..."
+	$PGPOOL_SETUP -m $mode -n 2 || exit 1
+	echo "done."
+
+	source ./bashrc.ports
+
+	echo "num_init_children = 1" >> etc/pgpool.conf
+	echo "max_sessions_per_child = 4" >> etc/pgpool.conf
+	echo "transaction_pooling = on" >> etc/pgpool.conf
+
+	./startall
+
+	export PGPORT=$PGPOOL_PORT
+
+	wait_for_pgpool_startup
+
+	# first session stays idle for a while between its queries
+	(echo "SET application_name TO 'first';"
+	 sleep 10
+	 echo "SELECT current_setting('application_name');") | $PSQL -A -t test > result1 &
+
+	sleep 2
+
+	# second session must not wait for the first one to disconnect
+	timeout 5 $PSQL -A -t test > result2 <<EOF2
+SELECT 'second';
+SELECT 'second again';
+EOF2
+	if [ $? != 0 ];then
+		echo "second session was not served while the first one was idle"
+		wait
+		./shutdownall
+		exit 1
+	fi
+
+	wait
+
+	if ! grep -q "second again" result2;then
+		echo "second session failed"
+		./shutdownall
+		exit 1
+	fi
+
+	if ! grep -q first result1;then
+		echo "session state of the first session was lost"
+		./shutdownall
+		exit 1
+	fi
+
+	./shutdownall
+
+	cd ..
+done
+
+exit 0
@@ -0,0 +1,60 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for shared_connection_pool.
+#
+# Backend connections released by a child must be reused by the
+# following sessions through the pool manager.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+
+for mode in s r
+do
+	rm -fr $TESTDIR
+	mkdir $TESTDIR
+	cd $TESTDIR
+
+# create test environment
+	echo -n "creating test environment..."
+	$PGPOOL_SETUP -m $mode -n 2 || exit 1
+	echo "done."
+
+	source ./bashrc.ports
+
+	echo "num_init_children = 4" >> etc/pgpool.conf
+	echo "shared_connection_pool = on" >> etc/pgpool.conf
+
+	./startall
+
+	export PGPORT=$PGPOOL_PORT
+
+	wait_for_pgpool_startup
+
+	for i in 1 2 3 4 5 6 7 8
+	do
+		$PSQL -A -t -c "SELECT 1" test > /dev/null
+		if [ $? != 0 ];then
+			echo "session $i failed"
+			./shutdownall
+			exit 1
+		fi
+	done
+
+	# wait for the last session to be handed over
+	sleep 1
+
+	hits=`$PSQL -A -t -c "SHOW pool_manager" test | cut -d '|' -f 2`
+	echo "num_hits: $hits"
+	if [ -z "$hits" -o "$hits" = "0" ];then
+		echo "backend connections were not shared"
+		./shutdownall
+		exit 1
+	fi
+
+	./shutdownall
+
+	cd ..
+done
+
+exit 0
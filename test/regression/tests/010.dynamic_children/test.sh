@@ -0,0 +1,68 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for min_spare_children/max_spare_children.
+#
+# Children must be forked while clients are connected and retired
+# down to num_init_children after they disconnect.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+
+# count pgpool children waiting for or serving clients
+function count_children
+{
+	$PSQL -A -t -c "SHOW pool_processes" test | wc -l
+}
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+# create test environment
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 2 || exit 1
+echo "done."
+
+source ./bashrc.ports
+
+echo "num_init_children = 2" >> etc/pgpool.conf
+echo "max_children = 8" >> etc/pgpool.conf
+echo "min_spare_children = 1" >> etc/pgpool.conf
+echo "max_spare_children = 2" >> etc/pgpool.conf
+
+./startall
+
+export PGPORT=$PGPOOL_PORT
+
+wait_for_pgpool_startup
+
+# keep 5 sessions open
+for i in 1 2 3 4 5
+do
+	$PSQL -c "SELECT pg_sleep(10)" test > /dev/null &
+	sleep 1
+done
+
+n=`count_children`
+echo "number of children while busy: $n"
+if [ $n -le 5 ];then
+	echo "children were not forked"
+	./shutdownall
+	exit 1
+fi
+
+wait
+sleep 10
+
+n=`count_children`
+echo "number of children after sessions end: $n"
+if [ $n -ne 2 ];then
+	echo "children were not retired"
+	./shutdownall
+	exit 1
+fi
+
+./shutdownall
+
+exit 0
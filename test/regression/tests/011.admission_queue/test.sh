@@ -0,0 +1,76 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for admission_queue_length and admission_wait_timeout.
+#
+# Clients must wait in the admission queue while all children are
+# busy, and must be rejected after admission_wait_timeout.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+# create test environment
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 2 || exit 1
+echo "done."
+
+source ./bashrc.ports
+
+echo "num_init_children = 2" >> etc/pgpool.conf
+echo "admission_queue_length = 10" >> etc/pgpool.conf
+echo "admission_wait_timeout = 5" >> etc/pgpool.conf
+
+./startall
+
+export PGPORT=$PGPOOL_PORT
+
+wait_for_pgpool_startup
+
+# occupy one child. the queued clients are served by the other one
+$PSQL -c "SELECT pg_sleep(20)" test > /dev/null &
+sleep 1
+
+pids=""
+for i in 1 2 3
+do
+	$PSQL -c "SELECT pg_sleep(1)" test > /dev/null &
+	pids="$pids $!"
+done
+for pid in $pids
+do
+	wait $pid
+	if [ $? != 0 ];then
+		echo "queued client failed"
+		./shutdownall
+		exit 1
+	fi
+done
+
+# occupy both children. the next client must time out
+$PSQL -c "SELECT pg_sleep(10)" test > /dev/null &
+sleep 1
+
+$PSQL -c "SELECT 1" test > result 2>&1
+if ! grep "too many clients" result > /dev/null;then
+	echo "client did not time out"
+	./shutdownall
+	exit 1
+fi
+
+wait
+
+$PSQL -c "SHOW pool_admission" test
+timeouts=`$PSQL -A -t -c "SHOW pool_admission" test | cut -d '|' -f 4`
+if [ "$timeouts" != "1" ];then
+	echo "num_timeouts is $timeouts"
+	./shutdownall
+	exit 1
+fi
+
+./shutdownall
+
+exit 0
@@ -0,0 +1,55 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for use_splice.
+#
+# A large result set forwarded with splice(2) must be identical to
+# the one forwarded as usual.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+QUERY="SELECT i, repeat(md5(i::text), i % 100) FROM generate_series(1, 100000) AS i"
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+# create test environment
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 2 || exit 1
+echo "done."
+
+source ./bashrc.ports
+
+echo "load_balance_mode = off" >> etc/pgpool.conf
+echo "use_splice = off" >> etc/pgpool.conf
+
+./startall
+
+export PGPORT=$PGPOOL_PORT
+
+wait_for_pgpool_startup
+
+$PSQL -A -t -c "$QUERY" test > expected
+if [ $? != 0 ];then
+	echo "query failed"
+	./shutdownall
+	exit 1
+fi
+
+echo "use_splice = on" >> etc/pgpool.conf
+./pgpool_reload
+sleep 1
+
+$PSQL -A -t -c "$QUERY" test > result
+if [ $? != 0 ];then
+	echo "query failed with use_splice"
+	./shutdownall
+	exit 1
+fi
+
+./shutdownall
+
+cmp expected result || exit 1
+
+exit 0
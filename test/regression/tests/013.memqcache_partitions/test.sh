@@ -0,0 +1,64 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for memqcache_partitions.
+#
+# Concurrent clients hit the partitioned shmem cache. Then a table is
+# updated and the cached result must be invalidated.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+PGBENCH=${PGBENCH_PATH:-$PGBIN/pgbench}
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+# create test environment
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 2 || exit 1
+echo "done."
+
+source ./bashrc.ports
+
+echo "memory_cache_enabled = on" >> etc/pgpool.conf
+echo "memqcache_method = 'shmem'" >> etc/pgpool.conf
+echo "memqcache_partitions = 4" >> etc/pgpool.conf
+
+./startall
+
+export PGPORT=$PGPOOL_PORT
+
+wait_for_pgpool_startup
+
+$PGBENCH -i test || { ./shutdownall; exit 1; }
+
+$PGBENCH -n -S -c 8 -j 8 -t 500 test
+if [ $? != 0 ];then
+	echo "pgbench failed"
+	./shutdownall
+	exit 1
+fi
+
+# cache must have been hit
+hits=`$PSQL -A -t -c "show pool_cache" test | awk -F'|' '{print $1}'`
+echo "cache hits: $hits"
+if [ -z "$hits" -o "$hits" = "0" ];then
+	./shutdownall
+	exit 1
+fi
+
+# cached result must be invalidated by UPDATE
+$PSQL -A -t -c "SELECT abalance FROM pgbench_accounts WHERE aid = 1" test
+$PSQL -A -t -c "SELECT abalance FROM pgbench_accounts WHERE aid = 1" test
+$PSQL -A -t -c "UPDATE pgbench_accounts SET abalance = 12345 WHERE aid = 1" test
+result=`$PSQL -A -t -c "SELECT abalance FROM pgbench_accounts WHERE aid = 1" test`
+
+./shutdownall
+
+if [ "$result" != "12345" ];then
+	echo "stale result: $result"
+	exit 1
+fi
+
+exit 0
@@ -0,0 +1,81 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for the oid map on shared memory.
+#
+# Caches of many queries are registered to a small oid map so that it
+# overflows. Cached results must still be invalidated by UPDATE.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+# create test environment
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 2 || exit 1
+echo "done."
+
+source ./bashrc.ports
+
+echo "memory_cache_enabled = on" >> etc/pgpool.conf
+echo "memqcache_method = 'shmem'" >> etc/pgpool.conf
+echo "memqcache_max_num_oidmap = 16" >> etc/pgpool.conf
+
+./startall
+
+export PGPORT=$PGPOOL_PORT
+
+wait_for_pgpool_startup
+
+$PSQL test <<EOF2
+CREATE TABLE t1(i int);
+CREATE TABLE t2(i int);
+CREATE TABLE t3(i int);
+INSERT INTO t1 SELECT generate_series(1, 100);
+INSERT INTO t2 SELECT generate_series(1, 100);
+INSERT INTO t3 SELECT generate_series(1, 100);
+EOF2
+
+# register caches twice as many as the oid map can hold
+for i in `seq 1 32`
+do
+	t=t$((i % 3 + 1))
+	$PSQL -A -t -c "SELECT count(*) FROM $t WHERE i <= $i" test >/dev/null
+	$PSQL -A -t -c "SELECT count(*) FROM t1, $t WHERE t1.i = $t.i AND t1.i <= $i" test >/dev/null
+done
+
+overflows=`$PSQL -A -t -c "show pool_cache" test | awk -F'|' '{print $12}'`
+echo "oid map overflows: $overflows"
+if [ -z "$overflows" -o "$overflows" = "0" ];then
+	./shutdownall
+	exit 1
+fi
+
+$PSQL -A -t -c "DELETE FROM t1 WHERE i > 50" test
+$PSQL -A -t -c "DELETE FROM t2 WHERE i > 50" test
+$PSQL -A -t -c "DELETE FROM t3 WHERE i > 50" test
+
+# no stale result may be returned
+r=0
+for i in `seq 1 32`
+do
+	t=t$((i % 3 + 1))
+	expected=$(( i < 50 ? i : 50 ))
+	result=`$PSQL -A -t -c "SELECT count(*) FROM $t WHERE i <= $i" test`
+	if [ "$result" != "$expected" ];then
+		echo "stale result for $t, $i: $result"
+		r=1
+	fi
+	result=`$PSQL -A -t -c "SELECT count(*) FROM t1, $t WHERE t1.i = $t.i AND t1.i <= $i" test`
+	if [ "$result" != "$expected" ];then
+		echo "stale result for t1 and $t, $i: $result"
+		r=1
+	fi
+done
+
+./shutdownall
+
+exit $r
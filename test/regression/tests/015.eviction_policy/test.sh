@@ -0,0 +1,82 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for memqcache_eviction_policy.
+#
+# A small shmem cache is filled by a few frequently used queries and
+# many queries run only once. Items must be evicted one by one with
+# 'clock' and 'tinylfu', and 'tinylfu' must reject some of the one-off
+# queries. Results must be correct in any case.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+# create test environment
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 2 || exit 1
+echo "done."
+
+source ./bashrc.ports
+
+echo "memory_cache_enabled = on" >> etc/pgpool.conf
+echo "memqcache_method = 'shmem'" >> etc/pgpool.conf
+echo "memqcache_max_num_cache = 64" >> etc/pgpool.conf
+echo "memqcache_partitions = 1" >> etc/pgpool.conf
+
+export PGPORT=$PGPOOL_PORT
+
+# 16 frequently used queries and 100 one-off queries, 5 times
+rm -f queries.sql
+for r in 1 2 3 4 5
+do
+	for i in `seq 1 16`
+	do
+		echo "SELECT i FROM t1 WHERE i = $i;" >> queries.sql
+	done
+	for i in `seq 1 100`
+	do
+		echo "SELECT i FROM t1 WHERE i = $((r * 1000 + i));" >> queries.sql
+	done
+done
+
+r=0
+for policy in clock tinylfu
+do
+	echo "memqcache_eviction_policy = '$policy'" >> etc/pgpool.conf
+
+	./startall
+	wait_for_pgpool_startup
+
+	if [ $policy = clock ];then
+		$PSQL -c "CREATE TABLE t1(i int); INSERT INTO t1 SELECT generate_series(1, 10000)" test
+	fi
+
+	$PSQL -A -t -f queries.sql test > result.txt
+	if [ "`sort -n result.txt | uniq | wc -l`" != 516 ];then
+		echo "$policy: wrong result"
+		r=1
+	fi
+
+	stats=`$PSQL -A -t -c "show pool_cache" test`
+	echo "$policy: $stats"
+	evicted=`echo "$stats" | awk -F'|' '{print $14}'`
+	reused=`echo "$stats" | awk -F'|' '{print $15}'`
+	rejected=`echo "$stats" | awk -F'|' '{print $16}'`
+
+	if [ -z "$evicted" -o "$evicted" = "0" -o "$reused" != "0" ];then
+		echo "$policy: items are not evicted one by one"
+		r=1
+	fi
+	if [ $policy = tinylfu -a \( -z "$rejected" -o "$rejected" = "0" \) ];then
+		echo "$policy: no item was rejected"
+		r=1
+	fi
+
+	./shutdownall
+done
+
+exit $r
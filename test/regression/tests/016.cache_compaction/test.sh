@@ -0,0 +1,85 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for memqcache_compaction_interval.
+#
+# Caches of two tables are stored in turn, then caches of one table
+# are invalidated. The worker process must pack the fragmented blocks
+# and the caches of the other table must remain.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+# create test environment
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 2 || exit 1
+echo "done."
+
+source ./bashrc.ports
+
+echo "memory_cache_enabled = on" >> etc/pgpool.conf
+echo "memqcache_method = 'shmem'" >> etc/pgpool.conf
+echo "memqcache_cache_block_size = 8192" >> etc/pgpool.conf
+echo "memqcache_maxcache = 4096" >> etc/pgpool.conf
+echo "memqcache_compaction_interval = 1" >> etc/pgpool.conf
+
+export PGPORT=$PGPOOL_PORT
+
+./startall
+wait_for_pgpool_startup
+
+$PSQL test <<EOF2
+CREATE TABLE t1(i int);
+CREATE TABLE t2(i int);
+INSERT INTO t1 SELECT generate_series(1, 100);
+INSERT INTO t2 SELECT generate_series(1, 100);
+EOF2
+
+rm -f queries.sql
+for i in `seq 1 100`
+do
+	echo "SELECT i FROM t1 WHERE i = $i;" >> queries.sql
+	echo "SELECT i FROM t2 WHERE i = $i;" >> queries.sql
+done
+
+$PSQL -A -t -f queries.sql test > /dev/null
+
+# invalidate caches of t1
+$PSQL -c "UPDATE t1 SET i = i + 1000" test
+
+sleep 3
+
+stats=`$PSQL -A -t -c "show pool_cache" test`
+echo "$stats"
+fragment=`echo "$stats" | awk -F'|' '{print $9}'`
+compacted=`echo "$stats" | awk -F'|' '{print $17}'`
+
+r=0
+if [ "$fragment" != "0" ];then
+	echo "fragment remains: $fragment"
+	r=1
+fi
+if [ -z "$compacted" -o "$compacted" = "0" ];then
+	echo "no block was packed"
+	r=1
+fi
+
+# caches of t2 must be hit and correct
+$PSQL -A -t -f queries.sql test > result.txt
+if [ "`grep -c . result.txt`" != 100 ];then
+	echo "wrong result"
+	r=1
+fi
+hits=`$PSQL -A -t -c "show pool_cache" test | awk -F'|' '{print $1}'`
+if [ "$hits" != 100 ];then
+	echo "number of cache hits is $hits, expected 100"
+	r=1
+fi
+
+./shutdownall
+
+exit $r
@@ -0,0 +1,70 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for memqcache_compress_threshold.
+#
+# Large SELECT results must be cached compressed, and results
+# fetched from the cache must be same as the original ones.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+# create test environment
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 2 || exit 1
+echo "done."
+
+source ./bashrc.ports
+
+echo "memory_cache_enabled = on" >> etc/pgpool.conf
+echo "memqcache_method = 'shmem'" >> etc/pgpool.conf
+echo "memqcache_compress_threshold = 100" >> etc/pgpool.conf
+
+export PGPORT=$PGPOOL_PORT
+
+./startall
+wait_for_pgpool_startup
+
+$PSQL test <<EOF2
+CREATE TABLE t1(i int, t text);
+INSERT INTO t1 SELECT i, repeat('pgpool', i % 20) FROM generate_series(1, 2000) i;
+EOF2
+
+rm -f queries.sql
+for i in `seq 1 10`
+do
+	echo "SELECT * FROM t1 WHERE i % 10 = $i - 1;" >> queries.sql
+done
+# too small to be compressed
+echo "SELECT 1;" >> queries.sql
+
+$PSQL -A -t -f queries.sql test > result1.txt
+$PSQL -A -t -f queries.sql test > result2.txt
+
+r=0
+if ! cmp result1.txt result2.txt;then
+	echo "results from cache differ"
+	r=1
+fi
+
+stats=`$PSQL -A -t -c "show pool_cache" test`
+echo "$stats"
+hits=`echo "$stats" | awk -F'|' '{print $1}'`
+compressed=`echo "$stats" | awk -F'|' '{print $18}'`
+
+if [ "$hits" != 11 ];then
+	echo "number of cache hits is $hits, expected 11"
+	r=1
+fi
+if [ "$compressed" != 10 ];then
+	echo "number of compressed items is $compressed, expected 10"
+	r=1
+fi
+
+./shutdownall
+
+exit $r
@@ -0,0 +1,71 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for memqcache_miss_wait_timeout.
+#
+# Clients running the same slow SELECT at the same time must wait for
+# the first one to cache the result instead of running it too.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+# create test environment
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 2 || exit 1
+echo "done."
+
+source ./bashrc.ports
+
+echo "memory_cache_enabled = on" >> etc/pgpool.conf
+echo "memqcache_method = 'shmem'" >> etc/pgpool.conf
+echo "memqcache_miss_wait_timeout = 10000" >> etc/pgpool.conf
+
+export PGPORT=$PGPOOL_PORT
+
+./startall
+wait_for_pgpool_startup
+
+$PSQL test <<EOF2
+CREATE TABLE t1(i int);
+INSERT INTO t1 SELECT generate_series(1, 3000);
+EOF2
+
+# slow enough for all clients to miss the cache
+for i in 1 2 3 4 5
+do
+	$PSQL -A -t -c "SELECT count(*) FROM t1 a, t1 b WHERE a.i <> b.i" test > result$i.txt &
+done
+wait
+
+r=0
+for i in 2 3 4 5
+do
+	if ! cmp result1.txt result$i.txt;then
+		echo "result of client $i differs"
+		r=1
+	fi
+done
+
+stats=`$PSQL -A -t -c "show pool_cache" test`
+echo "$stats"
+hits=`echo "$stats" | awk -F'|' '{print $1}'`
+selects=`echo "$stats" | awk -F'|' '{print $2}'`
+coalesced=`echo "$stats" | awk -F'|' '{print $22}'`
+
+# the query must have been run only once
+if [ "$selects" != 1 ];then
+	echo "the query was run $selects times"
+	r=1
+fi
+if [ "$coalesced" = 0 -o "$hits" != 4 ];then
+	echo "misses were not coalesced: hits $hits coalesced $coalesced"
+	r=1
+fi
+
+./shutdownall
+
+exit $r
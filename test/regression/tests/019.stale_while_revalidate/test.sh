@@ -0,0 +1,96 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for memqcache_expire_grace.
+#
+# After memqcache_expire, clients must keep getting the expired cache
+# while one client runs the SELECT again to refresh it.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+# create test environment
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 2 || exit 1
+echo "done."
+
+source ./bashrc.ports
+
+echo "memory_cache_enabled = on" >> etc/pgpool.conf
+echo "memqcache_method = 'shmem'" >> etc/pgpool.conf
+echo "memqcache_expire = 2" >> etc/pgpool.conf
+echo "memqcache_expire_grace = 60" >> etc/pgpool.conf
+
+export PGPORT=$PGPOOL_PORT
+
+./startall
+wait_for_pgpool_startup
+
+$PSQL test <<EOF2
+CREATE TABLE t1(i int);
+INSERT INTO t1 SELECT generate_series(1, 3000);
+EOF2
+
+# slow enough for other clients to arrive during the refresh
+SQL="SELECT count(*) FROM t1 a, t1 b WHERE a.i <> b.i"
+
+$PSQL -A -t -c "$SQL" test > old.txt
+
+# update the primary directly so that the cache is not invalidated
+$PSQL -p 11000 -c "INSERT INTO t1 VALUES(0)" test
+sleep 3
+
+for i in 1 2 3 4 5
+do
+	$PSQL -A -t -c "$SQL" test > result$i.txt &
+done
+wait
+
+r=0
+stale=0
+fresh=0
+for i in 1 2 3 4 5
+do
+	if cmp -s old.txt result$i.txt;then
+		stale=`expr $stale + 1`
+	else
+		fresh=`expr $fresh + 1`
+	fi
+done
+echo "stale results: $stale fresh results: $fresh"
+if [ $stale = 0 -o $fresh != 1 ];then
+	echo "expired cache was not served while refreshing"
+	r=1
+fi
+
+# the refreshed cache is served
+$PSQL -A -t -c "$SQL" test > new.txt
+if cmp -s old.txt new.txt;then
+	echo "cache was not refreshed"
+	r=1
+fi
+
+stats=`$PSQL -A -t -c "show pool_cache" test`
+echo "$stats"
+stale_hits=`echo "$stats" | awk -F'|' '{print $24}'`
+refreshes=`echo "$stats" | awk -F'|' '{print $25}'`
+if [ "$stale_hits" != $stale -o "$refreshes" != 1 ];then
+	echo "unexpected stats: stale hits $stale_hits refreshes $refreshes"
+	r=1
+fi
+
+# invalidation still removes the cache immediately
+$PSQL -c "INSERT INTO t1 VALUES(0)" test
+$PSQL -A -t -c "$SQL" test > invalidated.txt
+if cmp -s new.txt invalidated.txt;then
+	echo "cache was not invalidated"
+	r=1
+fi
+
+./shutdownall
+
+exit $r
@@ -0,0 +1,81 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for memqcache_persistent_file.
+#
+# The shmem query cache must survive a restart of pgpool-II, and the
+# restored cache must still be invalidated by updates.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+# create test environment
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 2 || exit 1
+echo "done."
+
+source ./bashrc.ports
+
+echo "memory_cache_enabled = on" >> etc/pgpool.conf
+echo "memqcache_method = 'shmem'" >> etc/pgpool.conf
+echo "memqcache_persistent_file = '`pwd`/query_cache'" >> etc/pgpool.conf
+
+export PGPORT=$PGPOOL_PORT
+
+./startall
+wait_for_pgpool_startup
+
+$PSQL test <<EOF2
+CREATE TABLE t1(i int);
+INSERT INTO t1 SELECT generate_series(1, 100);
+EOF2
+
+for i in 1 2 3 4 5
+do
+	$PSQL -A -t -c "SELECT * FROM t1 WHERE i = $i" test
+done > before.txt
+
+./shutdownall
+./startall
+wait_for_pgpool_startup
+
+r=0
+if ! grep "restored query cache" log/pgpool.log;then
+	echo "query cache was not restored"
+	r=1
+fi
+
+for i in 1 2 3 4 5
+do
+	$PSQL -A -t -c "SELECT * FROM t1 WHERE i = $i" test
+done > after.txt
+
+if ! cmp before.txt after.txt;then
+	echo "results differ after restart"
+	r=1
+fi
+
+stats=`$PSQL -A -t -c "show pool_cache" test`
+echo "$stats"
+hits=`echo "$stats" | awk -F'|' '{print $1}'`
+selects=`echo "$stats" | awk -F'|' '{print $2}'`
+if [ "$hits" != 5 -o "$selects" != 0 ];then
+	echo "restored cache was not used: hits $hits selects $selects"
+	r=1
+fi
+
+# the restored cache is invalidated
+$PSQL -c "DELETE FROM t1 WHERE i = 1" test
+result=`$PSQL -A -t -c "SELECT * FROM t1 WHERE i = 1" test`
+if [ "$result" != "" ];then
+	echo "restored cache was not invalidated"
+	r=1
+fi
+
+./shutdownall
+
+exit $r
@@ -0,0 +1,92 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for query cache on several memcached servers.
+#
+# Requires memcached in PATH and pgpool-II configured with
+# --with-memcached.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+MEMCACHED=${MEMCACHED:-memcached}
+MCPORT1=11511
+MCPORT2=11512
+
+if ! which $MEMCACHED > /dev/null 2>&1;then
+	echo "memcached is not installed. skipped."
+	exit 0
+fi
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+# create test environment
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 2 || exit 1
+echo "done."
+
+source ./bashrc.ports
+
+$MEMCACHED -l 127.0.0.1 -p $MCPORT1 -U 0 -P `pwd`/memcached1.pid -d
+$MEMCACHED -l 127.0.0.1 -p $MCPORT2 -U 0 -P `pwd`/memcached2.pid -d
+sleep 1
+
+echo "memory_cache_enabled = on" >> etc/pgpool.conf
+echo "memqcache_method = 'memcached'" >> etc/pgpool.conf
+echo "memqcache_memcached_host = '127.0.0.1:$MCPORT1, 127.0.0.1:$MCPORT2'" >> etc/pgpool.conf
+
+export PGPORT=$PGPOOL_PORT
+
+./startall
+wait_for_pgpool_startup
+
+# number of items on a memcached server
+function mc_items
+{
+	(echo stats; sleep 0.5) | nc 127.0.0.1 $1 | awk '/curr_items/ {print $3}' | tr -d '\r'
+}
+
+$PSQL test <<EOF2
+CREATE TABLE t1(i int);
+INSERT INTO t1 SELECT generate_series(1, 100);
+EOF2
+
+for i in `seq 1 50`
+do
+	$PSQL -A -t -c "SELECT * FROM t1 WHERE i = $i" test > /dev/null
+done
+
+r=0
+items1=`mc_items $MCPORT1`
+items2=`mc_items $MCPORT2`
+echo "items on servers: $items1 $items2"
+if [ "$items1" = 0 -o "$items2" = 0 -o `expr $items1 + $items2` != 50 ];then
+	echo "cache is not sharded over the servers"
+	r=1
+fi
+
+# served from cache
+$PSQL -A -t -c "SELECT * FROM t1 WHERE i = 1" test > result1.txt
+stats=`$PSQL -A -t -c "show pool_cache" test`
+echo "$stats"
+hits=`echo "$stats" | awk -F'|' '{print $1}'`
+if [ "$hits" != 1 ];then
+	echo "cache was not hit"
+	r=1
+fi
+
+# one update deletes the cache entries on all the servers
+$PSQL -c "UPDATE t1 SET i = i" test
+items1=`mc_items $MCPORT1`
+items2=`mc_items $MCPORT2`
+echo "items after update: $items1 $items2"
+if [ "$items1" != 0 -o "$items2" != 0 ];then
+	echo "cache was not invalidated"
+	r=1
+fi
+
+./shutdownall
+kill `cat memcached1.pid` `cat memcached2.pid`
+
+exit $r
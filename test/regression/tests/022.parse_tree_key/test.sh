@@ -0,0 +1,69 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for memqcache_parse_tree_key.
+#
+# SELECTs differing only in white spaces, case and comments must share
+# the cache, while different constants must not.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+# create test environment
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 2 || exit 1
+echo "done."
+
+source ./bashrc.ports
+
+echo "memory_cache_enabled = on" >> etc/pgpool.conf
+echo "memqcache_method = 'shmem'" >> etc/pgpool.conf
+echo "memqcache_parse_tree_key = on" >> etc/pgpool.conf
+
+export PGPORT=$PGPOOL_PORT
+
+./startall
+wait_for_pgpool_startup
+
+$PSQL test <<EOF2
+CREATE TABLE t1(id int, v text);
+INSERT INTO t1 VALUES(1, 'a'), (2, 'b');
+EOF2
+
+$PSQL -A -t -c "SELECT * FROM t1 WHERE id=1" test > result1.txt
+$PSQL -A -t -c "select *  from T1
+ where id = 1 -- comment" test > result2.txt
+$PSQL -A -t -c "SELECT /* comment */ * FROM t1 WHERE id = 2" test > result3.txt
+
+r=0
+if ! cmp -s result1.txt result2.txt;then
+	echo "unexpected result"
+	r=1
+fi
+if cmp -s result1.txt result3.txt;then
+	echo "different constants shared the cache"
+	r=1
+fi
+
+hits=`$PSQL -A -t -c "show pool_cache" test | awk -F'|' '{print $1}'`
+echo "cache hits: $hits"
+if [ "$hits" != 1 ];then
+	echo "equivalent queries did not share the cache"
+	r=1
+fi
+
+# invalidation removes the shared cache
+$PSQL -c "UPDATE t1 SET v = 'c' WHERE id = 1" test
+$PSQL -A -t -c "SELECT  *  FROM t1 WHERE id = 1" test > result4.txt
+if cmp -s result1.txt result4.txt;then
+	echo "cache was not invalidated"
+	r=1
+fi
+
+./shutdownall
+
+exit $r
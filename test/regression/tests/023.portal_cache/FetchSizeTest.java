@@ -0,0 +1,25 @@
+import java.sql.*;
+
+/*
+ * Run a SELECT with the given fetch size, which makes the driver use
+ * Execute with a row limit, and print the rows.
+ */
+public class FetchSizeTest {
+    public static void main(String[] args) throws Exception
+    {
+	String url = "jdbc:postgresql://localhost:" + args[0] + "/test";
+	int fetchsize = Integer.parseInt(args[1]);
+	Connection connection = DriverManager.getConnection(url, System.getProperty("user.name"), "");
+
+	connection.setAutoCommit(false);
+	PreparedStatement pstmt = connection.prepareStatement("SELECT * FROM t1 ORDER BY i");
+	pstmt.setFetchSize(fetchsize);
+	ResultSet rs = pstmt.executeQuery();
+	while (rs.next())
+	    System.out.println(rs.getInt(1) + " " + rs.getString(2));
+	rs.close();
+	pstmt.close();
+	connection.commit();
+	connection.close();
+    }
+}
@@ -0,0 +1,67 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for query cache of portals fetched by Execute with row
+# limit (JDBC setFetchSize).
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+export CLASSPATH=.:$JDBC_DRIVER
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+# create test environment
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 2 || exit 1
+echo "done."
+
+source ./bashrc.ports
+
+echo "memory_cache_enabled = on" >> etc/pgpool.conf
+echo "memqcache_method = 'shmem'" >> etc/pgpool.conf
+
+export PGPORT=$PGPOOL_PORT
+
+cp ../FetchSizeTest.java .
+javac FetchSizeTest.java || exit 1
+
+./startall
+wait_for_pgpool_startup
+
+$PSQL test <<EOF2
+CREATE TABLE t1(i int, v text);
+INSERT INTO t1 SELECT i, 'row' || i FROM generate_series(1, 100) i;
+EOF2
+
+# The result is assembled from the suspended portal and cached at commit.
+java FetchSizeTest $PGPOOL_PORT 7 > result1.txt || exit 1
+
+# update the primary directly so that the cache is not invalidated
+$PSQL -p 11000 -c "UPDATE t1 SET v = 'updated'" test
+
+# served from cache in batches of another size and at once
+java FetchSizeTest $PGPOOL_PORT 30 > result2.txt || exit 1
+java FetchSizeTest $PGPOOL_PORT 0 > result3.txt || exit 1
+
+r=0
+if [ `wc -l < result1.txt` != 100 ];then
+	echo "unexpected number of rows"
+	r=1
+fi
+if ! cmp -s result1.txt result2.txt || ! cmp -s result1.txt result3.txt;then
+	echo "result was not served from cache"
+	r=1
+fi
+
+hits=`$PSQL -A -t -c "show pool_cache" test | awk -F'|' '{print $1}'`
+echo "cache hits: $hits"
+if [ "$hits" != 2 ];then
+	echo "unexpected cache hits"
+	r=1
+fi
+
+./shutdownall
+
+exit $r
@@ -0,0 +1,73 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for caching large results.
+#
+# A result spanning many capture chunks must be cached and returned
+# intact, in and out of transactions. A result larger than
+# memqcache_maxcache must not be cached.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+# create test environment
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 2 || exit 1
+echo "done."
+
+source ./bashrc.ports
+
+echo "memory_cache_enabled = on" >> etc/pgpool.conf
+echo "memqcache_method = 'shmem'" >> etc/pgpool.conf
+echo "memqcache_maxcache = 900000" >> etc/pgpool.conf
+echo "memqcache_cache_block_size = 1048576" >> etc/pgpool.conf
+echo "memqcache_total_size = 16777216" >> etc/pgpool.conf
+
+export PGPORT=$PGPOOL_PORT
+
+./startall
+wait_for_pgpool_startup
+
+$PSQL -c "CREATE TABLE t1(i int, v text); INSERT INTO t1 SELECT i, md5(i::text) FROM generate_series(1, 20000) i" test
+
+# about 770kB
+SMALL="SELECT * FROM t1 WHERE i <= 15000 ORDER BY i"
+# about 1MB, exceeds memqcache_maxcache
+LARGE="SELECT * FROM t1 ORDER BY i"
+
+r=0
+$PSQL -A -t -c "$SMALL" test > small1.txt
+$PSQL -A -t -c "$LARGE" test > large1.txt
+$PSQL -q -A -t test > tx1.txt <<EOF2
+BEGIN;
+SELECT * FROM t1 WHERE i > 5000 ORDER BY i;
+COMMIT;
+EOF2
+
+# update the primary directly so that the cache is not invalidated
+$PSQL -p 11000 -c "UPDATE t1 SET v = 'updated'" test
+
+$PSQL -A -t -c "$SMALL" test > small2.txt
+$PSQL -A -t -c "$LARGE" test > large2.txt
+$PSQL -A -t -c "SELECT * FROM t1 WHERE i > 5000 ORDER BY i" test > tx2.txt
+
+if [ `wc -l < small1.txt` != 15000 ] || ! cmp -s small1.txt small2.txt;then
+	echo "large result was not cached correctly"
+	r=1
+fi
+if ! cmp -s tx1.txt tx2.txt;then
+	echo "large result in transaction was not cached correctly"
+	r=1
+fi
+if [ `grep -c updated large2.txt` != 20000 ];then
+	echo "result exceeding memqcache_maxcache was cached"
+	r=1
+fi
+
+./shutdownall
+
+exit $r
@@ -0,0 +1,62 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for cancel requests with transaction pooling.
+#
+# The frontend keeps the pid and cancel key it got at session start
+# while transaction_pooling replaces the backend connections between
+# transactions. A query in a later transaction must still be canceled.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+# create test environment
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 2 || exit 1
+echo "done."
+
+source ./bashrc.ports
+
+echo "transaction_pooling = on" >> etc/pgpool.conf
+
+export PGPORT=$PGPOOL_PORT
+
+./startall
+wait_for_pgpool_startup
+
+# the second transaction runs on a new backend connection
+start=`date +%s`
+$PSQL -A -t test > result 2>&1 <<EOF2 &
+SELECT pg_backend_pid();
+SELECT pg_sleep(30);
+EOF2
+PSQL_PID=$!
+sleep 3
+# psql sends a cancel request on SIGINT
+kill -INT $PSQL_PID
+wait $PSQL_PID
+end=`date +%s`
+
+cat result
+
+r=0
+if ! grep -q "canceling statement due to user request" result;then
+	echo "query was not canceled"
+	r=1
+fi
+if [ $((end - start)) -ge 30 ];then
+	echo "query ran to completion"
+	r=1
+fi
+if grep -q "invalid cancel key" log/pgpool.log;then
+	echo "cancel key was not found"
+	r=1
+fi
+
+./shutdownall
+
+exit $r